@@ -1,6 +1,10 @@
 #!/bin/bash
 #
 #  Runs every PNG file found under the current directory through the filter
+#
+#  Arguments after the directory are passed to avc-vision, so when tuning
+#  add "-C CACHE_DIR" to only filter images whose results could have
+#  changed since the last run.
 
 declare topDir="${1:-.}";
 shift;
@@ -0,0 +1,218 @@
+#include "avcvision.h"
+#include "filter.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+
+#include <string.h>
+
+using namespace cv;
+using namespace vision;
+using namespace std;
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+/** What an avc_detector handle points to. */
+struct avc_detector {
+    Filter filter;
+    // BGR frame converted from other pixel formats (reused each frame)
+    Mat converted;
+    string error;
+};
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+namespace {
+
+    /** Wraps (or converts) the caller's pixels as a BGR image. */
+    bool wrapPixels(avc_detector* detector, const uint8_t* pixels,
+		    int width, int height, size_t stride, int format, Mat& bgr) {
+	switch (format) {
+
+	case AVC_PIXELS_BGR24:
+	    if (stride < (size_t) width * 3) {
+		detector->error = "stride is less than width * 3";
+		return false;
+	    }
+	    bgr = Mat(height, width, CV_8UC3, (void*) pixels, stride);
+	    return true;
+
+	case AVC_PIXELS_YUYV:
+	    if ((stride < (size_t) width * 2) || (width % 2 != 0)) {
+		detector->error = "YUYV needs an even width and stride of at least width * 2";
+		return false;
+	    }
+	    cvtColor(Mat(height, width, CV_8UC2, (void*) pixels, stride),
+		     detector->converted, COLOR_YUV2BGR_YUYV);
+	    bgr = detector->converted;
+	    return true;
+	}
+
+	detector->error = "unknown pixel format";
+	return false;
+    }
+
+    /** Copy what the filter found into a result. */
+    void fillResult(const Filter& filter, Size frameSize, avc_result& result) {
+	const FileData& fileData = filter.getFileData();
+	result.frame_count = fileData.frameCount;
+	result.found = fileData.found;
+	result.box_width = fileData.boxWidth;
+	result.box_height = fileData.boxHeight;
+	result.x_mid = fileData.xMid;
+	result.y_bot = fileData.yBot;
+	result.range_feet = fileData.rangeFeet;
+	result.bearing_degrees = fileData.bearingDegrees;
+
+	Rect crop = Filter::getCropWindow(frameSize);
+	result.crop_x = crop.x;
+	result.crop_y = crop.y;
+
+	const vector<Candidate>& candidates = filter.getCandidates();
+	int n = min((int) candidates.size(), AVC_MAX_CANDIDATES);
+	result.winner = (filter.getWinner() < n) ? filter.getWinner() : -1;
+	result.candidate_count = n;
+	result.candidates_seen = candidates.size();
+	for (int i = 0; i < n; i++) {
+	    const Candidate& c = candidates[i];
+	    avc_candidate& dst = result.candidates[i];
+	    dst.x = c.bbox.x;
+	    dst.y = c.bbox.y;
+	    dst.width = c.bbox.width;
+	    dst.height = c.bbox.height;
+	    dst.color = c.color;
+	    dst.score = c.score;
+	}
+    }
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+int avc_version(void) {
+    return AVC_VISION_API_VERSION;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+void avc_config_init(avc_config* config) {
+    memset(config, 0, sizeof(*config));
+    config->size = sizeof(*config);
+    config->detector = AVC_DETECTOR_CONTOUR;
+    config->red_enabled = 1;
+    config->yellow_enabled = 1;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+avc_detector* avc_detector_create(const avc_config* callerConfig) {
+    // Fields the caller doesn't know about keep their defaults
+    avc_config config;
+    avc_config_init(&config);
+    if (callerConfig != 0) {
+	if (callerConfig->size < sizeof(uint32_t)) {
+	    cerr << "avc_detector_create: config size not set (use avc_config_init())\n";
+	    return 0;
+	}
+	memcpy(&config, callerConfig, min((size_t) callerConfig->size, sizeof(config)));
+    }
+
+    if ((config.detector < AVC_DETECTOR_CONTOUR) || (config.detector > AVC_DETECTOR_STREAM)) {
+	cerr << "avc_detector_create: unknown detector " << config.detector << "\n";
+	return 0;
+    }
+
+    try {
+	avc_detector* detector = new avc_detector();
+	Filter& filter = detector->filter;
+	if ((config.values_file != 0) && !filter.loadConfig(config.values_file)) {
+	    cerr << "avc_detector_create: unable to read color ranges from "
+		 << config.values_file << "\n";
+	    delete detector;
+	    return 0;
+	}
+	if ((config.range_file != 0) && !filter.loadRange(config.range_file)) {
+	    cerr << "avc_detector_create: unable to read camera model from "
+		 << config.range_file << "\n";
+	    delete detector;
+	    return 0;
+	}
+	if (config.red_ranges != 0) {
+	    filter.setColorRanges(Found::Red, config.red_ranges);
+	}
+	if (config.yellow_ranges != 0) {
+	    filter.setColorRanges(Found::Yellow, config.yellow_ranges);
+	}
+	filter.setDetector((Detector) config.detector);
+	filter.setRedEnabled(config.red_enabled != 0);
+	filter.setYellowEnabled(config.yellow_enabled != 0);
+	filter.setSearchAllColors(config.search_all_colors != 0);
+	filter.setBlur(config.blur != 0);
+	return detector;
+    } catch (const std::exception& e) {
+	cerr << "avc_detector_create: " << e.what() << "\n";
+	return 0;
+    }
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+void avc_detector_destroy(avc_detector* detector) {
+    delete detector;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+int avc_detector_process(avc_detector* detector, const uint8_t* pixels,
+			 int width, int height, size_t stride, int format,
+			 avc_result* result) {
+    if (detector == 0) {
+	return -1;
+    }
+    detector->error.clear();
+
+    if ((pixels == 0) || (result == 0) || (result->size < sizeof(uint32_t))) {
+	detector->error = "pixels and result (with its size set) are required";
+	return -1;
+    }
+
+    // Crop window must fit in the frame (see Filter::getCropWindow())
+    Rect crop = Filter::getCropWindow(Size(width, height));
+    if ((crop.width <= 0) || (crop.height <= 0)) {
+	detector->error = "frame is too small";
+	return -1;
+    }
+
+    try {
+	Mat bgr;
+	if (!wrapPixels(detector, pixels, width, height, stride, format, bgr)) {
+	    return -1;
+	}
+	detector->filter.filter(bgr);
+
+	// Only write as much as the caller's structure holds
+	avc_result filled;
+	memset(&filled, 0, sizeof(filled));
+	filled.size = result->size;
+	fillResult(detector->filter, bgr.size(), filled);
+	memcpy(result, &filled, min((size_t) result->size, sizeof(filled)));
+	return filled.found;
+    } catch (const std::exception& e) {
+	detector->error = e.what();
+	return -1;
+    }
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+const char* avc_detector_error(const avc_detector* detector) {
+    return (detector == 0) ? "no detector" : detector->error.c_str();
+}
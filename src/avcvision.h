@@ -0,0 +1,218 @@
+#ifndef AVC_VISION_H
+#define AVC_VISION_H
+
+/**
+ * C interface to the stanchion filter (libavcvision).
+ *
+ * <p>Lets programs run the detector in process on frames they already
+ * have (no cv::Mat or C++ types in the interface), rather than reading
+ * results another process publishes to /dev/shm. Build with "make lib"
+ * and link against libavcvision.a or libavcvision.so.</p>
+ *
+ * <p>The interface is stable: functions are only added and structures
+ * only have fields appended. Callers record the size of the structures
+ * they were built against (avc_config_init() and AVC_RESULT_INIT do
+ * that) so an older caller works with a newer library.</p>
+ *
+ * <pre>
+ *   avc_config config;
+ *   avc_config_init(&config);
+ *   avc_detector* detector = avc_detector_create(&config);
+ *
+ *   avc_result result = AVC_RESULT_INIT;
+ *   if (avc_detector_process(detector, pixels, 320, 240, 320 * 3,
+ *                            AVC_PIXELS_BGR24, &result) > 0) {
+ *       ... result.x_mid, result.y_bot ...
+ *   }
+ *   avc_detector_destroy(detector);
+ * </pre>
+ *
+ * <p>A detector keeps working buffers from frame to frame, so use one
+ * per thread (different detectors may be used on different threads at
+ * the same time).</p>
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Only the functions below are exported from libavcvision.so */
+#define AVC_API __attribute__((visibility("default")))
+
+/* Version of this interface (see avc_version()) */
+#define AVC_VISION_API_VERSION 3
+
+/* Maximum number of candidates returned for a frame */
+#define AVC_MAX_CANDIDATES 16
+
+/* What was found (same values as vision::Found) */
+#define AVC_FOUND_NONE 0
+#define AVC_FOUND_RED 1
+#define AVC_FOUND_YELLOW 2
+
+/* Layout of the pixels passed to avc_detector_process() */
+typedef enum {
+    /* 3 bytes per pixel: blue, green, red */
+    AVC_PIXELS_BGR24 = 0,
+    /* 2 bytes per pixel: Y0 U Y1 V (what most USB cameras send) */
+    AVC_PIXELS_YUYV = 1
+} avc_pixel_format;
+
+/* How stanchions are found (same values as vision::Detector) */
+typedef enum {
+    /* Threshold, erode, dilate, trace contours and fit polygons */
+    AVC_DETECTOR_CONTOUR = 0,
+    /* Column and row occupancy of the color mask (faster) */
+    AVC_DETECTOR_PROFILE = 1,
+    /* Same results as AVC_DETECTOR_CONTOUR, made a few rows at a time
+       (since version 3) */
+    AVC_DETECTOR_STREAM = 2
+} avc_detector_type;
+
+/**
+ * Settings for a new detector (call avc_config_init() first, then
+ * change what you need).
+ */
+typedef struct {
+    /* sizeof(avc_config) the caller was built with */
+    uint32_t size;
+
+    /* Values file to read color ranges from (NULL for the installed
+       /etc/avc.conf.d/values.txt) */
+    const char* values_file;
+
+    /* Color ranges (min0, max0, min1, max1, min2, max2) to use instead
+       of the ones in the values file (NULL to keep those) */
+    const int* red_ranges;
+    const int* yellow_ranges;
+
+    /* avc_detector_type */
+    int detector;
+
+    /* Non-zero to look for each color */
+    int red_enabled;
+    int yellow_enabled;
+
+    /* Non-zero to keep looking for red after yellow is found (so the
+       candidates include everything in the frame) */
+    int search_all_colors;
+
+    /* Non-zero to smooth frames with a 3x3 box blur (cleaner masks in
+       low light). Since version 2. */
+    int blur;
+
+    /* Camera model for range and bearing estimates (NULL for the
+       installed /etc/avc.conf.d/range.txt if there is one, otherwise
+       the model fitted to the webcam-test images). Since version 3. */
+    const char* range_file;
+} avc_config;
+
+/**
+ * One candidate stanchion found in a frame. Boxes are in the same
+ * cropped image coordinates as the result (add crop_x and crop_y of the
+ * result for frame coordinates).
+ */
+typedef struct {
+    int32_t x, y;
+    int32_t width, height;
+    /* AVC_FOUND_RED or AVC_FOUND_YELLOW */
+    int32_t color;
+    /* Ranking score (larger is better) */
+    int32_t score;
+} avc_candidate;
+
+/**
+ * Everything found in a frame.
+ */
+typedef struct {
+    /* sizeof(avc_result) the caller was built with (set before the
+       first call, see AVC_RESULT_INIT) */
+    uint32_t size;
+
+    /* Frames processed by the detector (including this one) */
+    int32_t frame_count;
+
+    /* AVC_FOUND_NONE, AVC_FOUND_RED or AVC_FOUND_YELLOW (color of the
+       winning candidate) */
+    int32_t found;
+
+    /* Box of the winning candidate (same meaning as FileData: width,
+       height, middle of the box and its bottom) */
+    int32_t box_width, box_height;
+    int32_t x_mid, y_bot;
+
+    /* Where the part of the frame the filter looks at starts */
+    int32_t crop_x, crop_y;
+
+    /* Index of winning candidate (-1 if none) */
+    int32_t winner;
+
+    /* Number of candidates in array and number actually seen (more
+       than AVC_MAX_CANDIDATES may have been seen) */
+    int32_t candidate_count;
+    int32_t candidates_seen;
+
+    avc_candidate candidates[AVC_MAX_CANDIDATES];
+
+    /* Estimated feet to the bottom of the winning box along the ground
+       (-1 if nothing was found) and its bearing in degrees (positive is
+       to the right). Since version 3. */
+    float range_feet;
+    float bearing_degrees;
+} avc_result;
+
+/* Initializer for an avc_result declared by the caller */
+#define AVC_RESULT_INIT { (uint32_t) sizeof(avc_result) }
+
+/* Opaque detector */
+typedef struct avc_detector avc_detector;
+
+/** Version of the library (AVC_VISION_API_VERSION it was built with). */
+AVC_API int avc_version(void);
+
+/** Fill in default settings (and the size of the structure). */
+AVC_API void avc_config_init(avc_config* config);
+
+/**
+ * Create a detector.
+ *
+ * @param config Settings (NULL for defaults).
+ *
+ * @return New detector or NULL if the settings are bad (the reason is
+ * written to stderr).
+ */
+AVC_API avc_detector* avc_detector_create(const avc_config* config);
+
+/** Release a detector (NULL is ignored). */
+AVC_API void avc_detector_destroy(avc_detector* detector);
+
+/**
+ * Look for a stanchion in a frame. The pixels are only read during the
+ * call (BGR frames are not copied).
+ *
+ * @param detector Detector from avc_detector_create().
+ * @param pixels First byte of the top row.
+ * @param width Width of frame in pixels.
+ * @param height Height of frame in rows.
+ * @param stride Bytes from the start of one row to the next.
+ * @param format avc_pixel_format of the pixels.
+ * @param result Where to store what was found (size must be set).
+ *
+ * @return AVC_FOUND_NONE, AVC_FOUND_RED or AVC_FOUND_YELLOW, or -1 on
+ * error (see avc_detector_error()).
+ */
+AVC_API int avc_detector_process(avc_detector* detector, const uint8_t* pixels,
+                                 int width, int height, size_t stride, int format,
+                                 avc_result* result);
+
+/** Why the last call to avc_detector_process() failed ("" if it didn't). */
+AVC_API const char* avc_detector_error(const avc_detector* detector);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
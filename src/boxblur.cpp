@@ -0,0 +1,146 @@
+#include "boxblur.hpp"
+
+#include <algorithm>
+
+using namespace cv;
+using namespace vision;
+using namespace std;
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+namespace {
+
+    /** Index of row (or column) i of n with edges reflected (-1 is 1). */
+    inline int reflect(int i, int n) {
+	if (n == 1) {
+	    return 0;
+	}
+	if (i < 0) {
+	    return -i;
+	}
+	return (i >= n) ? (2 * n - 2 - i) : i;
+    }
+
+    /** Rounded sum / 9 (exact for sums of nine 8 bit values). */
+    inline uchar divideBy9(unsigned sum) {
+	return (sum * 7282 + 32768) >> 16;
+    }
+
+    /**
+     * Row y of a region (-1 and rows are the ones just outside it) read
+     * from the whole image, reflected at its edges.
+     */
+    inline const uchar* rowAt(const Mat& bgr, const smooth::BlurScratch& scratch, int y) {
+	int row = reflect(scratch.top + y, scratch.wholeRows) - scratch.top;
+	return bgr.data + row * (ptrdiff_t) bgr.step;
+    }
+
+    /**
+     * Column sums of rows a, b and c, or (Slide) move sums already
+     * made down from row a to row c (b isn't read). sums has an extra
+     * column at each end for the left and right neighbours.
+     */
+    template <bool Slide>
+    void sumColumns(uint16_t* sums, const uchar* a, const uchar* b, const uchar* c,
+		    int n, int left, int right) {
+	uint16_t* inside = sums + 3;
+	for (int i = 0; i < n; i++) {
+	    if (Slide) {
+		inside[i] += c[i] - a[i];
+	    } else {
+		inside[i] = a[i] + b[i] + c[i];
+	    }
+	}
+	for (int k = 0; k < 3; k++) {
+	    int l = left * 3 + k;
+	    int r = right * 3 + k;
+	    if (Slide) {
+		sums[k] += c[l] - a[l];
+		inside[n + k] += c[r] - a[r];
+	    } else {
+		sums[k] = a[l] + b[l] + c[l];
+		inside[n + k] = a[r] + b[r] + c[r];
+	    }
+	}
+    }
+
+    /** Horizontal pass: blurred row from the column sums. */
+    void blurRow(const uint16_t* sums, int cols, uchar* dst) {
+	int n = cols * 3;
+	for (int i = 0; i < n; i++) {
+	    dst[i] = divideBy9(sums[i] + sums[i + 3] + sums[i + 6]);
+	}
+    }
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+void smooth::blurToHsv(const Mat& bgr, Mat& hsv, BlurScratch& scratch) {
+    int rows = bgr.rows;
+    hsv.create(rows, bgr.cols, CV_8UC3);
+    startBlur(bgr, scratch);
+
+    for (int y0 = 0; y0 < rows; y0 += STRIP_ROWS) {
+	Mat dst = hsv.rowRange(y0, min(rows, y0 + STRIP_ROWS));
+	blurRows(bgr, dst.rows, scratch, dst);
+    }
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+void smooth::startBlur(const Mat& bgr, BlurScratch& scratch) {
+    CV_Assert(bgr.type() == CV_8UC3);
+    int rows = bgr.rows;
+    int n = bgr.cols * 3;
+    scratch.next = 0;
+    scratch.sums.resize(n + 6);
+    if ((rows == 0) || (n == 0)) {
+	return;
+    }
+
+    // Neighbours come from the whole image when bgr is a region of one
+    Size whole;
+    Point offset;
+    bgr.locateROI(whole, offset);
+    scratch.top = offset.y;
+    scratch.wholeRows = whole.height;
+    scratch.left = reflect(offset.x - 1, whole.width) - offset.x;
+    scratch.right = reflect(offset.x + bgr.cols, whole.width) - offset.x;
+
+    // Window for row 0 is rows -1, 0 and 1
+    sumColumns<false>(&scratch.sums[0], rowAt(bgr, scratch, -1), rowAt(bgr, scratch, 0),
+		      rowAt(bgr, scratch, 1), n, scratch.left, scratch.right);
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+void smooth::blurRows(const Mat& bgr, int count, BlurScratch& scratch, Mat& hsv) {
+    int rows = bgr.rows;
+    int cols = bgr.cols;
+    int n = cols * 3;
+    count = min(count, rows - scratch.next);
+    if ((count <= 0) || (cols == 0)) {
+	return;
+    }
+
+    scratch.strip.create(max(STRIP_ROWS, count), cols, CV_8UC3);
+    uint16_t* sums = &scratch.sums[0];
+
+    for (int s = 0; s < count; s++) {
+	int y = scratch.next++;
+	blurRow(sums, cols, scratch.strip.ptr(s));
+
+	// Slide window down a row
+	if (y + 1 < rows) {
+	    sumColumns<true>(sums, rowAt(bgr, scratch, y - 1), 0, rowAt(bgr, scratch, y + 2),
+			     n, scratch.left, scratch.right);
+	}
+    }
+
+    // Rows of hsv are already allocated, so this converts in place
+    cvtColor(scratch.strip.rowRange(0, count), hsv, COLOR_BGR2HSV);
+}
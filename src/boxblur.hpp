@@ -0,0 +1,90 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+
+#include <vector>
+
+#include <stdint.h>
+
+namespace vision {
+
+    /**
+     * 3x3 box blur fused with the HSV conversion, so smoothing costs a
+     * small part of what a separate cv::blur() pass over the whole
+     * image did.
+     *
+     * <p>Sums of each column over the three rows around the current row
+     * are kept from row to row (add the row entering the window,
+     * subtract the one leaving it), so each output row only needs the
+     * horizontal sum of three neighbouring column sums. Blurred rows
+     * are written to a small strip that stays in cache and each strip
+     * is converted to HSV straight away: no blurred copy of the image is
+     * ever made.</p>
+     */
+    namespace smooth {
+
+	// Rows blurred before converting them to HSV (a 320 pixel wide
+	// strip fits in L1 cache)
+	const int STRIP_ROWS = 16;
+
+	/** Working storage reused from frame to frame. */
+	struct BlurScratch {
+	    // Column sums of the three rows around the current row, with
+	    // the columns just left and right of the image at each end
+	    std::vector<uint16_t> sums;
+	    // Blurred BGR rows waiting to be converted
+	    cv::Mat strip;
+	    // Next row blurRows() blurs
+	    int next;
+	    // Where the image sits in the one it is a region of (see
+	    // cv::Mat::locateROI()) and the columns (relative to the
+	    // region) read for its left and right neighbours
+	    int top;
+	    int wholeRows;
+	    int left;
+	    int right;
+
+	    BlurScratch() :
+		sums(),
+		strip(),
+		next(0),
+		top(0),
+		wholeRows(0),
+		left(0),
+		right(0)
+	    {
+	    }
+	};
+
+	/**
+	 * Blurs an image (3x3 box, same as cv::blur() with its default
+	 * border) and converts it to HSV.
+	 *
+	 * @param bgr 8 bit 3 channel BGR image (may be a region of a
+	 * larger image: like cv::blur(), the pixels around the region are
+	 * used and only the edges of the whole image are reflected).
+	 * @param hsv Where to store the HSV image (same as
+	 * cvtColor(blurred, hsv, COLOR_BGR2HSV)).
+	 * @param scratch Working storage.
+	 */
+	void blurToHsv(const cv::Mat& bgr, cv::Mat& hsv, BlurScratch& scratch);
+
+	/**
+	 * Start blurring an image a few rows at a time (for callers that
+	 * consume rows as they are made, see blurRows()).
+	 */
+	void startBlur(const cv::Mat& bgr, BlurScratch& scratch);
+
+	/**
+	 * Blur the next rows of the image passed to startBlur() and
+	 * convert them to HSV.
+	 *
+	 * @param bgr Image passed to startBlur().
+	 * @param count Number of rows to blur.
+	 * @param scratch Working storage passed to startBlur().
+	 * @param hsv Where to store the rows (count rows as wide as bgr,
+	 * already allocated).
+	 */
+	void blurRows(const cv::Mat& bgr, int count, BlurScratch& scratch, cv::Mat& hsv);
+    }
+}
@@ -0,0 +1,291 @@
+#include "datasetpack.hpp"
+
+#include <iostream>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace cv;
+using namespace vision;
+using namespace std;
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+namespace {
+    size_t alignUp(size_t n, size_t alignment) {
+	return ((n + alignment - 1) / alignment) * alignment;
+    }
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+int32_t vision::expectedFromPath(const string& path) {
+    size_t start = 0;
+    int32_t expected = DATASET_PACK_UNKNOWN;
+
+    // Last directory named after a color wins
+    for (size_t end = path.find('/'); end != string::npos; end = path.find('/', start)) {
+	string dir = path.substr(start, end - start);
+	if (dir == "red") {
+	    expected = Found::Red;
+	} else if (dir == "yellow") {
+	    expected = Found::Yellow;
+	}
+	start = end + 1;
+    }
+    return expected;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+PackWriter::PackWriter() :
+    _path(),
+    _out(),
+    _offset(0),
+    _entries(),
+    _strings()
+{
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+PackWriter::~PackWriter() {
+    close();
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+bool PackWriter::open(const string& path) {
+    close();
+    _path = path;
+    _out.open(path.c_str(), ios::binary | ios::trunc);
+    if (!_out) {
+	cerr << "Unable to create " << path << ": " << strerror(errno) << "\n";
+	return false;
+    }
+
+    // Zero header until close() (readers reject a pack that isn't finished)
+    PackHeader header;
+    memset(&header, 0, sizeof(header));
+    _out.write((const char*) &header, sizeof(header));
+    _offset = sizeof(header);
+    _entries.clear();
+    _strings.clear();
+    return bool(_out);
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+bool PackWriter::pad(size_t alignment) {
+    static const char zeros[DATASET_PACK_ALIGN] = { 0 };
+    size_t n = alignUp(_offset, alignment) - _offset;
+    _out.write(zeros, n);
+    _offset += n;
+    return bool(_out);
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+uint32_t PackWriter::addString(const string& s) {
+    uint32_t offset = _strings.size();
+    _strings.append(s.c_str(), s.size() + 1);
+    return offset;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+bool PackWriter::add(const Mat& image, const string& path,
+		     const string& label, int32_t expected) {
+    if (!_out.is_open() || image.empty() || (image.depth() != CV_8U)) {
+	return false;
+    }
+
+    size_t rowBytes = image.cols * image.elemSize();
+    size_t step = alignUp(rowBytes, DATASET_PACK_ROW_ALIGN);
+
+    if (!pad(DATASET_PACK_ALIGN)) {
+	return false;
+    }
+
+    PackEntry entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.dataOffset = _offset;
+    entry.rows = image.rows;
+    entry.cols = image.cols;
+    entry.type = image.type();
+    entry.step = step;
+    entry.expected = expected;
+    entry.pathOffset = addString(path);
+    entry.labelOffset = addString(label);
+
+    // Rows padded out to step so each one starts aligned
+    vector<char> row(step, 0);
+    for (int y = 0; y < image.rows; y++) {
+	memcpy(&row[0], image.ptr(y), rowBytes);
+	_out.write(&row[0], step);
+    }
+    _offset += step * image.rows;
+
+    if (!_out) {
+	cerr << "Failed writing " << _path << ": " << strerror(errno) << "\n";
+	return false;
+    }
+    _entries.push_back(entry);
+    return true;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+bool PackWriter::close() {
+    if (!_out.is_open()) {
+	return false;
+    }
+
+    PackHeader header;
+    memset(&header, 0, sizeof(header));
+    header.count = _entries.size();
+    header.entrySize = sizeof(PackEntry);
+
+    pad(sizeof(uint64_t));
+    header.indexOffset = _offset;
+    if (!_entries.empty()) {
+	_out.write((const char*) &_entries[0], _entries.size() * sizeof(PackEntry));
+    }
+    _offset += _entries.size() * sizeof(PackEntry);
+
+    header.stringsOffset = _offset;
+    header.stringsSize = _strings.size();
+    _out.write(_strings.data(), _strings.size());
+    _offset += _strings.size();
+
+    // Header last so a partially written pack is never mistaken for a good one
+    header.magic = DATASET_PACK_MAGIC;
+    header.version = DATASET_PACK_VERSION;
+    _out.seekp(0);
+    _out.write((const char*) &header, sizeof(header));
+
+    bool ok = bool(_out);
+    _out.close();
+    if (!ok) {
+	cerr << "Failed writing " << _path << ": " << strerror(errno) << "\n";
+    }
+    return ok;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+DatasetPack::DatasetPack() :
+    _map(0),
+    _mapSize(0),
+    _index(0),
+    _strings(0),
+    _count(0)
+{
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+DatasetPack::~DatasetPack() {
+    close();
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+bool DatasetPack::open(const string& path, bool prefault) {
+    close();
+
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat info;
+    if ((fd < 0) || (fstat(fd, &info) != 0)) {
+	cerr << "Unable to open " << path << ": " << strerror(errno) << "\n";
+	if (fd >= 0) {
+	    ::close(fd);
+	}
+	return false;
+    }
+
+    size_t size = info.st_size;
+    if (size < sizeof(PackHeader)) {
+	cerr << path << " is not a dataset pack\n";
+	::close(fd);
+	return false;
+    }
+
+    // Private writable mapping: images are handed out as plain Mats
+    // and a stray write must neither fault nor change the file
+    int flags = MAP_PRIVATE | (prefault ? MAP_POPULATE : 0);
+    void* addr = mmap(0, size, PROT_READ | PROT_WRITE, flags, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED) {
+	cerr << "Unable to map " << path << ": " << strerror(errno) << "\n";
+	return false;
+    }
+    _map = (uint8_t*) addr;
+    _mapSize = size;
+
+    const PackHeader* header = (const PackHeader*) _map;
+    bool valid = (header->magic == DATASET_PACK_MAGIC)
+	&& (header->version == DATASET_PACK_VERSION)
+	&& (header->entrySize == sizeof(PackEntry))
+	&& (header->indexOffset + header->count * sizeof(PackEntry) <= size)
+	&& (header->stringsOffset + header->stringsSize <= size)
+	&& ((header->stringsSize == 0) || (_map[size - 1] == 0));
+
+    _index = (const PackEntry*) (_map + header->indexOffset);
+    _strings = (const char*) (_map + header->stringsOffset);
+    _count = header->count;
+
+    for (size_t i = 0; valid && (i < _count); i++) {
+	const PackEntry& entry = _index[i];
+	valid = (entry.dataOffset + (uint64_t) entry.step * entry.rows <= header->indexOffset)
+	    && (entry.pathOffset < header->stringsSize)
+	    && (entry.labelOffset < header->stringsSize);
+    }
+
+    if (!valid) {
+	cerr << path << " is not a dataset pack (or was not finished)\n";
+	close();
+	return false;
+    }
+
+    madvise(_map, _mapSize, MADV_SEQUENTIAL);
+    return true;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+void DatasetPack::close() {
+    if (_map != 0) {
+	munmap(_map, _mapSize);
+    }
+    _map = 0;
+    _mapSize = 0;
+    _index = 0;
+    _strings = 0;
+    _count = 0;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+Mat DatasetPack::image(size_t index) const {
+    const PackEntry& entry = _index[index];
+    return Mat(entry.rows, entry.cols, entry.type, _map + entry.dataOffset, entry.step);
+}
@@ -0,0 +1,162 @@
+#pragma once
+
+#include "filedata.hpp"
+
+#include <opencv2/opencv.hpp>
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace vision {
+
+    // Identifies a dataset pack file ("AVCK")
+    const uint32_t DATASET_PACK_MAGIC = 0x4B435641;
+    const uint32_t DATASET_PACK_VERSION = 1;
+
+    // Pixel buffers start on a page boundary and rows are padded to a
+    // multiple of DATASET_PACK_ROW_ALIGN bytes
+    const size_t DATASET_PACK_ALIGN = 4096;
+    const size_t DATASET_PACK_ROW_ALIGN = 64;
+
+    // Expected result when the pack doesn't know what is in an image
+    const int32_t DATASET_PACK_UNKNOWN = -1;
+
+    /**
+     * Header at the start of a pack file. The pixel buffers follow and
+     * the index (count PackEntry records) and string table come last.
+     */
+    struct PackHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t count;
+	uint32_t entrySize;
+	uint64_t indexOffset;
+	uint64_t stringsOffset;
+	uint64_t stringsSize;
+	char pad[24];
+    };
+
+    /**
+     * Where to find one image in a pack file and what it should contain.
+     */
+    struct PackEntry {
+	// Offset of the first row of pixels in the file
+	uint64_t dataOffset;
+	uint32_t rows;
+	uint32_t cols;
+	// OpenCV type (CV_8UC3 for BGR frames) and bytes per row
+	uint32_t type;
+	uint32_t step;
+	// Found value we expect the filter to report (or DATASET_PACK_UNKNOWN)
+	int32_t expected;
+	// Offsets of NUL terminated path and label in the string table
+	uint32_t pathOffset;
+	uint32_t labelOffset;
+	uint32_t reserved;
+    };
+
+    /**
+     * Writes decoded images to a pack file (see DatasetPack).
+     */
+    class PackWriter {
+    public:
+	PackWriter();
+
+	/** Finishes the pack if close() wasn't called. */
+	~PackWriter();
+
+	/** Create (or replace) pack file. */
+	bool open(const std::string& path);
+
+	/**
+	 * Append an image.
+	 *
+	 * @param image Decoded image (any 8 bit type).
+	 * @param path Where the image came from.
+	 * @param label What the image shows (like "red/north").
+	 * @param expected What the filter should find (Found value or
+	 * DATASET_PACK_UNKNOWN).
+	 */
+	bool add(const cv::Mat& image, const std::string& path,
+		 const std::string& label, int32_t expected);
+
+	/** Write the index and header. */
+	bool close();
+
+	/** Number of images added so far. */
+	size_t size() const { return _entries.size(); }
+
+    private:
+	bool pad(size_t alignment);
+	uint32_t addString(const std::string& s);
+
+	std::string _path;
+	std::ofstream _out;
+	uint64_t _offset;
+	std::vector<PackEntry> _entries;
+	std::string _strings;
+    };
+
+    /**
+     * Read only view of a memory mapped pack file of pre-decoded images,
+     * so repeated evaluation runs feed images to the filter without
+     * decoding or copying them.
+     */
+    class DatasetPack {
+    public:
+	DatasetPack();
+
+	~DatasetPack();
+
+	/**
+	 * Map a pack file.
+	 *
+	 * @param path Pack written by PackWriter (avc-vision-pack).
+	 * @param prefault Ask the kernel to read in the whole file now
+	 * rather than as each image is first touched.
+	 *
+	 * @return true if file is a pack we understand.
+	 */
+	bool open(const std::string& path, bool prefault = true);
+
+	/** Unmap the file (images previously returned become invalid). */
+	void close();
+
+	/** Number of images in the pack. */
+	size_t size() const { return _count; }
+
+	/**
+	 * Image at index, pointing straight at the mapped file (the mapping
+	 * is private, so anything written to it is never saved).
+	 */
+	cv::Mat image(size_t index) const;
+
+	/** File the image was packed from. */
+	const char* path(size_t index) const { return _strings + _index[index].pathOffset; }
+
+	/** What the image shows (like "red/north"). */
+	const char* label(size_t index) const { return _strings + _index[index].labelOffset; }
+
+	/** Found value expected (or DATASET_PACK_UNKNOWN). */
+	int32_t expected(size_t index) const { return _index[index].expected; }
+
+    private:
+	uint8_t* _map;
+	size_t _mapSize;
+	const PackEntry* _index;
+	const char* _strings;
+	size_t _count;
+    };
+
+    /**
+     * Expected result from where an image lives (a "red" or "yellow"
+     * directory, like webcam-test/red/north/2ftred.png).
+     *
+     * @return Found::Red, Found::Yellow or DATASET_PACK_UNKNOWN.
+     */
+    int32_t expectedFromPath(const std::string& path);
+}
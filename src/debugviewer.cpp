@@ -0,0 +1,385 @@
+#include "debugviewer.hpp"
+#include "latency.hpp"
+
+#include <iostream>
+#include <sstream>
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace cv;
+using namespace vision;
+using namespace std;
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+namespace {
+    // Paths of each view (indexed by DebugViewer::View)
+    const char* const VIEW_PATHS[] = { "/orig", "/mask", "/contours" };
+
+    // Client state once an index page or error is queued (the
+    // connection is closed once it has been sent)
+    const int CLOSE_WHEN_SENT = -1;
+
+    // How long the server waits for sockets before looking for a new
+    // snapshot (bounds how stale a snapshot gets before it's sent)
+    const int POLL_MSECS = 20;
+
+    const int JPEG_QUALITY = 70;
+
+    const char* const BOUNDARY = "avcframe";
+
+    const char* const INDEX_PAGE =
+	"<!DOCTYPE html>\n"
+	"<html><head><title>avc-vision</title></head>\n"
+	"<body style=\"background: #222\">\n"
+	"<img src=\"/orig\"> <img src=\"/mask\"> <img src=\"/contours\">\n"
+	"</body></html>\n";
+
+    string response(const char* status, const char* type, const string& body) {
+	ostringstream out;
+	out << "HTTP/1.0 " << status << "\r\n"
+	    << "Content-Type: " << type << "\r\n"
+	    << "Content-Length: " << body.size() << "\r\n"
+	    << "\r\n"
+	    << body;
+	return out.str();
+    }
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+DebugViewer::DebugViewer() :
+    _listenFd(-1),
+    _server(),
+    _serving(false),
+    _watched(false),
+    _ready(false),
+    _orig(),
+    _mask(),
+    _crop(),
+    _fileData(),
+    _shapes(),
+    _contours(),
+    _intervalNanos(0),
+    _nextNanos(0),
+    _snapshots(0),
+    _skipped(0),
+    _clients(),
+    _jpeg()
+{
+    memset(&_fileData, 0, sizeof(_fileData));
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+DebugViewer::~DebugViewer() {
+    stop();
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+bool DebugViewer::start(int port, double fps) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+	cerr << "Failed to create viewer socket: " << strerror(errno) << "\n";
+	return false;
+    }
+
+    // Restarting shouldn't have to wait for old connections to time out
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if ((bind(fd, (sockaddr*) &addr, sizeof(addr)) != 0) || (listen(fd, 4) != 0)) {
+	cerr << "Failed to listen on port " << port << ": " << strerror(errno) << "\n";
+	close(fd);
+	return false;
+    }
+
+    _listenFd = fd;
+    _intervalNanos = (fps > 0) ? (int64_t) (1e9 / fps) : 0;
+    _nextNanos = 0;
+    _serving.store(true);
+    _server = thread(&DebugViewer::serve, this);
+    cout << "Debug viewer on http://localhost:" << port << "/\n";
+    return true;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+void DebugViewer::stop() {
+    if (!_serving.exchange(false)) {
+	return;
+    }
+    if (_server.joinable()) {
+	_server.join();
+    }
+    for (Client& client : _clients) {
+	close(client.fd);
+    }
+    _clients.clear();
+    _watched.store(false);
+    close(_listenFd);
+    _listenFd = -1;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+void DebugViewer::snapshot(const Mat& orig, const Filter& filter, const FilterFrame& frame) {
+    int64_t now = monotonicNanos();
+    if (now < _nextNanos) {
+	return;
+    }
+    _nextNanos = now + _intervalNanos;
+
+    // Server still owns the last one
+    if (_ready.load(memory_order_acquire)) {
+	_skipped.store(_skipped.load(memory_order_relaxed) + 1, memory_order_relaxed);
+	return;
+    }
+
+    orig.copyTo(_orig);
+    filter.getMask(frame).copyTo(_mask);
+    _crop = Filter::getCropWindow(orig.size());
+    _fileData = frame.fileData;
+    _shapes = frame.shapes;
+    _contours = frame.contours;
+
+    _snapshots.store(_snapshots.load(memory_order_relaxed) + 1, memory_order_relaxed);
+    _ready.store(true, memory_order_release);
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+void DebugViewer::serve() {
+    vector<pollfd> fds;
+
+    while (_serving.load()) {
+	fds.clear();
+	pollfd incoming = { _listenFd, POLLIN, 0 };
+	fds.push_back(incoming);
+	for (const Client& client : _clients) {
+	    // Always watch for input (a read of 0 bytes means they left)
+	    short events = POLLIN;
+	    if (client.sent < client.pending.size()) {
+		events |= POLLOUT;
+	    }
+	    pollfd pfd = { client.fd, events, 0 };
+	    fds.push_back(pfd);
+	}
+
+	if (poll(fds.data(), fds.size(), POLL_MSECS) > 0) {
+	    for (size_t i = fds.size() - 1; i > 0; i--) {
+		Client& client = _clients[i - 1];
+		bool keep = true;
+		if (fds[i].revents & (POLLERR | POLLHUP)) {
+		    keep = false;
+		} else if (fds[i].revents & POLLIN) {
+		    readRequest(client);
+		    keep = (client.fd >= 0);
+		}
+		if (keep && (fds[i].revents & POLLOUT)) {
+		    keep = flush(client);
+		}
+		if (!keep) {
+		    if (client.fd >= 0) {
+			close(client.fd);
+		    }
+		    _clients.erase(_clients.begin() + (i - 1));
+		}
+	    }
+
+	    if (fds[0].revents & POLLIN) {
+		int fd = accept4(_listenFd, 0, 0, SOCK_CLOEXEC | SOCK_NONBLOCK);
+		if (fd >= 0) {
+		    Client client = { fd, VIEW_COUNT, "", "", 0 };
+		    _clients.push_back(client);
+		}
+	    }
+	}
+
+	bool watched = false;
+	for (const Client& client : _clients) {
+	    watched = watched || ((client.view >= 0) && (client.view < VIEW_COUNT));
+	}
+	_watched.store(watched, memory_order_relaxed);
+
+	if (_ready.load(memory_order_acquire)) {
+	    sendSnapshot();
+	    _ready.store(false, memory_order_release);
+	}
+    }
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+void DebugViewer::readRequest(Client& client) {
+    char buf[1024];
+    ssize_t n = read(client.fd, buf, sizeof(buf));
+    if (n == 0) {
+	// Viewer went away
+	close(client.fd);
+	client.fd = -1;
+	return;
+    }
+    if ((n < 0) || (client.view != VIEW_COUNT)) {
+	// Anything sent after the request is ignored
+	return;
+    }
+
+    client.request.append(buf, n);
+    if ((client.request.find("\r\n\r\n") == string::npos) && (client.request.size() < 4096)) {
+	return;
+    }
+
+    // "GET /path HTTP/1.1"
+    istringstream line(client.request);
+    string method, path;
+    line >> method >> path;
+
+    client.view = CLOSE_WHEN_SENT;
+    if (path == "/") {
+	client.pending = response("200 OK", "text/html", INDEX_PAGE);
+    } else {
+	for (int view = 0; view < VIEW_COUNT; view++) {
+	    if (path == VIEW_PATHS[view]) {
+		client.view = view;
+	    }
+	}
+	if (client.view == CLOSE_WHEN_SENT) {
+	    client.pending = response("404 Not Found", "text/plain", "No such view\n");
+	} else {
+	    ostringstream head;
+	    head << "HTTP/1.0 200 OK\r\n"
+		 << "Cache-Control: no-cache\r\n"
+		 << "Content-Type: multipart/x-mixed-replace; boundary=" << BOUNDARY << "\r\n"
+		 << "\r\n";
+	    client.pending = head.str();
+	}
+    }
+    client.request.clear();
+    client.sent = 0;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+bool DebugViewer::flush(Client& client) {
+    while (client.sent < client.pending.size()) {
+	ssize_t n = send(client.fd, client.pending.data() + client.sent,
+			 client.pending.size() - client.sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+	if (n < 0) {
+	    if (errno == EINTR) {
+		continue;
+	    }
+	    return (errno == EAGAIN) || (errno == EWOULDBLOCK);
+	}
+	client.sent += n;
+    }
+
+    client.pending.clear();
+    client.sent = 0;
+    return (client.view != CLOSE_WHEN_SENT);
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+void DebugViewer::sendSnapshot() {
+    vector<int> params;
+    params.push_back(CV_IMWRITE_JPEG_QUALITY);
+    params.push_back(JPEG_QUALITY);
+
+    Mat image;
+    for (int view = 0; view < VIEW_COUNT; view++) {
+	// Viewers still sending the last frame skip this one
+	bool wanted = false;
+	for (const Client& client : _clients) {
+	    wanted = wanted || ((client.view == view) && client.pending.empty());
+	}
+	if (!wanted) {
+	    continue;
+	}
+
+	render(view, image);
+	if (image.empty() || !imencode(".jpg", image, _jpeg, params)) {
+	    continue;
+	}
+
+	ostringstream head;
+	head << "--" << BOUNDARY << "\r\n"
+	     << "Content-Type: image/jpeg\r\n"
+	     << "Content-Length: " << _jpeg.size() << "\r\n"
+	     << "\r\n";
+	string part = head.str();
+	part.append((const char*) _jpeg.data(), _jpeg.size());
+	part.append("\r\n");
+
+	for (size_t i = 0; i < _clients.size(); ) {
+	    Client& client = _clients[i];
+	    if ((client.view == view) && client.pending.empty()) {
+		client.pending = part;
+		if (!flush(client)) {
+		    close(client.fd);
+		    _clients.erase(_clients.begin() + i);
+		    continue;
+		}
+	    }
+	    i++;
+	}
+    }
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+void DebugViewer::render(int view, Mat& image) const {
+    Scalar goodColor(255, 255, 0);
+    Scalar badColor(100, 200, 255);
+
+    if (view == MaskView) {
+	image = _mask;
+	return;
+    }
+
+    if (view == ContoursView) {
+	_orig(_crop).copyTo(image);
+	for (size_t i = 0; i < _shapes.size(); i++) {
+	    const Candidate& shape = _shapes[i];
+	    const Scalar& color = (shape.verdict == Verdict::Accepted) ? goodColor : badColor;
+	    if (i < _contours.size()) {
+		drawContours(image, _contours, i, color, 1);
+	    } else {
+		rectangle(image, shape.bbox, color, 1);
+	    }
+	}
+	return;
+    }
+
+    _orig.copyTo(image);
+    rectangle(image, _crop, Scalar(128, 128, 128), 1);
+    if (_fileData.found != Found::None) {
+	Rect box(_crop.x + _fileData.getX(), _crop.y + _fileData.getY(),
+		 _fileData.getWidth(), _fileData.getHeight());
+	Scalar color = (_fileData.found == Found::Yellow) ? Scalar(0, 255, 255) : Scalar(0, 0, 255);
+	rectangle(image, box, color, 2);
+    }
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+#include "filter.hpp"
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <stdint.h>
+
+namespace vision {
+
+    // Default snapshots per second sent to viewers
+    const double DEBUG_VIEWER_FPS = 5;
+
+    /**
+     * Streams what the filter sees as MJPEG over HTTP on localhost, for
+     * watching the detector on a robot without a display (use ssh -L
+     * to view from another machine).
+     *
+     * <p>http://localhost:PORT/ shows every view, each view is also a
+     * stream of its own: /orig (frame with the crop window and found
+     * box), /mask (final black and white mask) and /contours (cropped
+     * frame with every shape checked, colored by verdict).</p>
+     *
+     * <p>The processing loop only copies a snapshot of a frame when one
+     * is due (at the viewer's frame rate, with someone watching and the
+     * last snapshot already encoded), everything else happens on a
+     * background thread. Snapshots that come due while the previous one
+     * is still being encoded are skipped, as are frames for viewers
+     * that haven't read the last one yet, so a slow viewer never holds
+     * up the detector.</p>
+     */
+    class DebugViewer {
+    public:
+	DebugViewer();
+
+	/** Stops the server (if running). */
+	~DebugViewer();
+
+	/**
+	 * Starts the background thread serving the views.
+	 *
+	 * @param port TCP port to listen on (localhost only).
+	 * @param fps Snapshots per second to send viewers.
+	 *
+	 * @return true if listening.
+	 */
+	bool start(int port, double fps = DEBUG_VIEWER_FPS);
+
+	/** Stops the background thread and disconnects viewers. */
+	void stop();
+
+	/**
+	 * Offer a processed frame to the viewers (only call from one
+	 * thread). Returns right away unless a snapshot is due.
+	 *
+	 * @param orig Original image the filter processed.
+	 * @param filter Filter that processed it.
+	 * @param frame Results of processing it.
+	 */
+	void offer(const cv::Mat& orig, const Filter& filter, const FilterFrame& frame) {
+	    if (_watched.load(std::memory_order_relaxed)) {
+		snapshot(orig, filter, frame);
+	    }
+	}
+
+	/** Snapshots taken so far. */
+	uint64_t getSnapshots() const { return _snapshots.load(std::memory_order_relaxed); }
+
+	/** Snapshots skipped as the last one was still being encoded. */
+	uint64_t getSkipped() const { return _skipped.load(std::memory_order_relaxed); }
+
+    private:
+	enum View {
+	    OrigView,
+	    MaskView,
+	    ContoursView,
+	    VIEW_COUNT
+	};
+
+	// Connected viewer (or a request still being read)
+	struct Client {
+	    int fd;
+	    // View streamed (VIEW_COUNT until the request has been read,
+	    // -1 once a page that closes the connection is queued)
+	    int view;
+	    std::string request;
+	    // Data not yet sent and how much of it has been
+	    std::string pending;
+	    size_t sent;
+	};
+
+	void snapshot(const cv::Mat& orig, const Filter& filter, const FilterFrame& frame);
+	void serve();
+	void readRequest(Client& client);
+	bool flush(Client& client);
+	void sendSnapshot();
+	void render(int view, cv::Mat& image) const;
+
+	int _listenFd;
+	std::thread _server;
+	std::atomic<bool> _serving;
+
+	// Whether anybody is watching (so snapshots are worth taking)
+	std::atomic<bool> _watched;
+
+	// Set by the processing loop once the snapshot below is filled
+	// in, cleared by the server once it has been encoded (whoever
+	// doesn't own it leaves it alone)
+	std::atomic<bool> _ready;
+	cv::Mat _orig;
+	cv::Mat _mask;
+	cv::Rect _crop;
+	FileData _fileData;
+	std::vector<Candidate> _shapes;
+	std::vector<std::vector<cv::Point>> _contours;
+
+	// When the next snapshot is due (only used by the processing loop)
+	int64_t _intervalNanos;
+	int64_t _nextNanos;
+
+	std::atomic<uint64_t> _snapshots;
+	std::atomic<uint64_t> _skipped;
+
+	// Only used by the server thread
+	std::vector<Client> _clients;
+	std::vector<uchar> _jpeg;
+    };
+}
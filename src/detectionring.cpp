@@ -0,0 +1,233 @@
+#include "detectionring.hpp"
+
+#include <iostream>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace vision;
+using namespace std;
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+namespace {
+    size_t ringSize(uint32_t capacity) {
+	return sizeof(RingHeader) + capacity * sizeof(RingRecord);
+    }
+
+    void* mapSegment(int fd, size_t size, int prot) {
+	void* addr = mmap(0, size, prot, MAP_SHARED, fd, 0);
+	return (addr == MAP_FAILED) ? 0 : addr;
+    }
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+DetectionRingWriter::DetectionRingWriter() :
+    _header(0),
+    _records(0),
+    _mappedSize(0)
+{
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+DetectionRingWriter::~DetectionRingWriter() {
+    if (_header != 0) {
+	munmap(_header, _mappedSize);
+    }
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+bool DetectionRingWriter::open(int capacity, const string& name) {
+    if (capacity < 1) {
+	return false;
+    }
+
+    int fd = shm_open(name.c_str(), O_CREAT | O_RDWR, 0644);
+    if (fd < 0) {
+	cerr << "Failed to create shared memory " << name << ": " << strerror(errno) << "\n";
+	return false;
+    }
+
+    size_t size = ringSize(capacity);
+    void* addr = 0;
+    if (ftruncate(fd, size) == 0) {
+	addr = mapSegment(fd, size, PROT_READ | PROT_WRITE);
+    }
+    ::close(fd);
+
+    if (addr == 0) {
+	cerr << "Failed to map shared memory " << name << ": " << strerror(errno) << "\n";
+	return false;
+    }
+
+    _header = (RingHeader*) addr;
+    _records = (RingRecord*) (_header + 1);
+    _mappedSize = size;
+
+    // Keep going where a previous run left off if the layout matches
+    // (readers then don't have to notice we restarted)
+    bool compatible = (_header->magic == DETECTION_RING_MAGIC)
+	&& (_header->version == DETECTION_RING_VERSION)
+	&& (_header->capacity == (uint32_t) capacity)
+	&& (_header->recordSize == sizeof(RingRecord));
+
+    if (!compatible) {
+	// Clear magic first so readers don't attach to half initialized ring
+	_header->magic = 0;
+	atomic_thread_fence(memory_order_release);
+	memset(addr, 0, size);
+	_header->version = DETECTION_RING_VERSION;
+	_header->capacity = capacity;
+	_header->recordSize = sizeof(RingRecord);
+	_header->writeIndex.store(0, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	_header->magic = DETECTION_RING_MAGIC;
+    }
+
+    return true;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+void DetectionRingWriter::publish(const DetectionRecord& record) {
+    if (_header == 0) {
+	return;
+    }
+
+    uint64_t index = _header->writeIndex.load(memory_order_relaxed);
+    RingRecord& slot = _records[index % _header->capacity];
+
+    slot.lock.store(2 * index + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    slot.record = record;
+    slot.lock.store(2 * (index + 1), memory_order_release);
+
+    _header->writeIndex.store(index + 1, memory_order_release);
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+DetectionRingReader::DetectionRingReader() :
+    _header(0),
+    _records(0),
+    _mappedSize(0),
+    _readIndex(0),
+    _missed(0)
+{
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+DetectionRingReader::~DetectionRingReader() {
+    if (_header != 0) {
+	munmap(_header, _mappedSize);
+    }
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+bool DetectionRingReader::open(const string& name, bool fromStart) {
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0) {
+	return false;
+    }
+
+    struct stat info;
+    RingHeader* header = 0;
+    if ((fstat(fd, &info) == 0) && ((size_t) info.st_size >= sizeof(RingHeader))) {
+	header = (RingHeader*) mapSegment(fd, info.st_size, PROT_READ);
+    }
+    ::close(fd);
+
+    if (header == 0) {
+	return false;
+    }
+
+    bool compatible = (header->magic == DETECTION_RING_MAGIC)
+	&& (header->version == DETECTION_RING_VERSION)
+	&& (header->recordSize == sizeof(RingRecord))
+	&& (ringSize(header->capacity) <= (size_t) info.st_size);
+
+    if (!compatible) {
+	munmap(header, info.st_size);
+	return false;
+    }
+
+    _header = header;
+    _records = (RingRecord*) (_header + 1);
+    _mappedSize = info.st_size;
+    _missed = 0;
+
+    uint64_t writeIndex = _header->writeIndex.load(memory_order_acquire);
+    _readIndex = writeIndex;
+    if (fromStart) {
+	_readIndex = (writeIndex > _header->capacity) ? (writeIndex - _header->capacity) : 0;
+    }
+
+    return true;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+uint64_t DetectionRingReader::available() const {
+    if (_header == 0) {
+	return 0;
+    }
+    return _header->writeIndex.load(memory_order_acquire) - _readIndex;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+bool DetectionRingReader::next(DetectionRecord& record) {
+    if (_header == 0) {
+	return false;
+    }
+
+    uint64_t capacity = _header->capacity;
+
+    for (;;) {
+	uint64_t writeIndex = _header->writeIndex.load(memory_order_acquire);
+	if (_readIndex >= writeIndex) {
+	    return false;
+	}
+
+	// Skip records the writer has already lapped
+	if ((writeIndex - _readIndex) > capacity) {
+	    _missed += (writeIndex - capacity) - _readIndex;
+	    _readIndex = writeIndex - capacity;
+	}
+
+	const RingRecord& slot = _records[_readIndex % capacity];
+	uint64_t expected = 2 * (_readIndex + 1);
+
+	if (slot.lock.load(memory_order_acquire) == expected) {
+	    record = slot.record;
+	    atomic_thread_fence(memory_order_acquire);
+	    if (slot.lock.load(memory_order_relaxed) == expected) {
+		_readIndex++;
+		return true;
+	    }
+	}
+
+	// Writer overwrote the record while we were looking at it
+	_missed++;
+	_readIndex++;
+    }
+}
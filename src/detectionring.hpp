@@ -0,0 +1,167 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+
+#include <stdint.h>
+
+namespace vision {
+
+    // Identifies a detection ring shared memory segment ("AVCR")
+    const uint32_t DETECTION_RING_MAGIC = 0x52435641;
+    const uint32_t DETECTION_RING_VERSION = 1;
+
+    // Maximum number of candidates kept per frame record
+    const int DETECTION_RING_MAX_CANDIDATES = 16;
+
+    // Default shared memory name (shows up as /dev/shm/stanchions-ring)
+    const char* const DETECTION_RING_NAME = "/stanchions-ring";
+
+    /**
+     * One candidate stanchion found in a frame (box is in the same
+     * cropped image coordinates as FileData).
+     */
+    struct RingCandidate {
+	int32_t x, y;
+	int32_t width, height;
+	// Found::Red or Found::Yellow
+	int32_t color;
+	// Ranking score (larger is better)
+	int32_t score;
+    };
+
+    /**
+     * Everything found in a single frame.
+     */
+    struct DetectionRecord {
+	int32_t frameCount;
+	uint32_t cameraSeq;
+	// CLOCK_MONOTONIC_RAW nanoseconds (see FileData)
+	int64_t captureNanos;
+	int64_t publishNanos;
+
+	// Found::None, Found::Red or Found::Yellow (color of winner)
+	int32_t found;
+	// Index of winning candidate (-1 if none)
+	int32_t winner;
+	// Number of candidates in array and number actually seen (more
+	// than DETECTION_RING_MAX_CANDIDATES may have been seen)
+	int32_t candidateCount;
+	int32_t candidatesSeen;
+
+	RingCandidate candidates[DETECTION_RING_MAX_CANDIDATES];
+    };
+
+    /**
+     * Slot in the shared memory ring holding one record.
+     */
+    struct RingRecord {
+	// Sequence lock: odd while the producer is writing the record,
+	// 2 * (index + 1) once the record for ring index is complete
+	std::atomic<uint64_t> lock;
+	DetectionRecord record;
+    };
+
+    /**
+     * Header at the start of the shared memory segment, followed by
+     * capacity RingRecord entries.
+     */
+    struct RingHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t capacity;
+	uint32_t recordSize;
+	char pad0[48];
+
+	// Number of records ever published (record N lives at N % capacity)
+	std::atomic<uint64_t> writeIndex;
+	char pad1[56];
+    };
+
+    /**
+     * Producer side of a shared memory ring holding the last N frames
+     * of detection results.
+     *
+     * <p>Unlike the stanchions file (a single overwritten result), this
+     * keeps history so a consumer that reads slower than we produce
+     * doesn't lose frames. Only one process may write to a ring.</p>
+     */
+    class DetectionRingWriter {
+    public:
+	DetectionRingWriter();
+
+	/** Unmaps the ring (the shared memory is left for readers). */
+	~DetectionRingWriter();
+
+	/**
+	 * Creates (or recreates) the shared memory segment.
+	 *
+	 * @param capacity Number of frame records to keep.
+	 * @param name Shared memory name (see "man shm_open").
+	 *
+	 * @return true if ring is ready to use.
+	 */
+	bool open(int capacity, const std::string& name = DETECTION_RING_NAME);
+
+	/** Whether open() succeeded. */
+	bool isOpen() const { return _header != 0; }
+
+	/**
+	 * Publish the next record.
+	 *
+	 * @param record Results to copy into the ring.
+	 */
+	void publish(const DetectionRecord& record);
+
+    private:
+	RingHeader* _header;
+	RingRecord* _records;
+	size_t _mappedSize;
+    };
+
+    /**
+     * Consumer side of a detection ring. Each reader tracks its own
+     * position so any number of readers can consume at their own pace.
+     */
+    class DetectionRingReader {
+    public:
+	DetectionRingReader();
+	~DetectionRingReader();
+
+	/**
+	 * Maps an existing ring.
+	 *
+	 * @param name Shared memory name used by the writer.
+	 * @param fromStart Pass true to start with the oldest record still
+	 * in the ring, false to only see records published from now on.
+	 *
+	 * @return true if ring was found and is compatible.
+	 */
+	bool open(const std::string& name = DETECTION_RING_NAME, bool fromStart = false);
+
+	/** Whether open() succeeded. */
+	bool isOpen() const { return _header != 0; }
+
+	/** Number of records published that we haven't read yet. */
+	uint64_t available() const;
+
+	/**
+	 * Reads the next unread record (if any).
+	 *
+	 * @param record Where to copy the record.
+	 *
+	 * @return false if there are no new records.
+	 */
+	bool next(DetectionRecord& record);
+
+	/** Number of records overwritten before we got to read them. */
+	uint64_t getMissed() const { return _missed; }
+
+    private:
+	RingHeader* _header;
+	RingRecord* _records;
+	size_t _mappedSize;
+	uint64_t _readIndex;
+	uint64_t _missed;
+    };
+}
@@ -0,0 +1,348 @@
+#include "eventlog.hpp"
+#include "latency.hpp"
+#include "Timer.h"
+
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using namespace vision;
+using namespace std;
+
+static_assert(sizeof(EventRecord) == 64, "event records must stay 64 bytes");
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+namespace {
+    // How often the writer thread empties the queues
+    const float WRITE_INTERVAL_SECS = 0.01f;
+
+    // Most records written at once
+    const size_t WRITE_BATCH_RECORDS = 1024;
+
+    // Queue of the log this thread last used
+    thread_local const EventLog* cachedLog = 0;
+    thread_local SpscQueue<EventRecord>* cachedQueue = 0;
+    thread_local int cachedTid = 0;
+
+    int threadId() {
+	if (cachedTid == 0) {
+	    cachedTid = syscall(SYS_gettid);
+	}
+	return cachedTid;
+    }
+
+    /**
+     * Copy text into a fixed size field of a zeroed record (cut short
+     * without a terminator if it doesn't fit).
+     */
+    void copyText(char* dst, size_t size, const char* src, size_t length) {
+	memcpy(dst, src, min(length, size));
+    }
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+EventLog::EventLog() :
+    _fileName(),
+    _maxBytes(EVENT_LOG_MAX_BYTES),
+    _keepFiles(EVENT_LOG_KEEP_FILES),
+    _fd(-1),
+    _fileBytes(0),
+    _lock(),
+    _queues(),
+    _batch(),
+    _writer(),
+    _running(false),
+    _dropped(0),
+    _droppedLogged(0)
+{
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+EventLog::~EventLog() {
+    close();
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+bool EventLog::open(const string& fileName, size_t maxBytes, int keepFiles) {
+    close();
+    _fileName = fileName;
+    _maxBytes = maxBytes;
+    _keepFiles = keepFiles;
+    if (!startFile()) {
+	return false;
+    }
+
+    _batch.reserve(WRITE_BATCH_RECORDS);
+    _running.store(true);
+    _writer = thread(&EventLog::writeLoop, this);
+    return true;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+void EventLog::close() {
+    // Writer may have already stopped on its own (write failed)
+    _running.store(false);
+    if (_writer.joinable()) {
+	_writer.join();
+    }
+    if (_fd >= 0) {
+	::close(_fd);
+	_fd = -1;
+    }
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+bool EventLog::startFile() {
+    _fd = ::open(_fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (_fd < 0) {
+	cerr << "Failed to create event log " << _fileName << ": " << strerror(errno) << "\n";
+	return false;
+    }
+
+    timespec realtime;
+    clock_gettime(CLOCK_REALTIME, &realtime);
+    EventLogHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = EVENT_LOG_MAGIC;
+    header.version = EVENT_LOG_VERSION;
+    header.headerSize = sizeof(EventLogHeader);
+    header.recordSize = sizeof(EventRecord);
+    header.realtimeNanos = toNanos(realtime);
+    header.monotonicNanos = monotonicNanos();
+
+    _fileBytes = 0;
+    if (write(_fd, &header, sizeof(header)) != (ssize_t) sizeof(header)) {
+	cerr << "Failed to write event log " << _fileName << ": " << strerror(errno) << "\n";
+	::close(_fd);
+	_fd = -1;
+	return false;
+    }
+    _fileBytes = sizeof(header);
+    return true;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+bool EventLog::rotate() {
+    ::close(_fd);
+    _fd = -1;
+
+    // LOG.N-1 -> LOG.N, ..., LOG -> LOG.1 (the oldest falls off the end)
+    for (int i = _keepFiles - 1; i >= 0; i--) {
+	ostringstream from, to;
+	from << _fileName;
+	if (i > 0) {
+	    from << "." << i;
+	}
+	to << _fileName << "." << (i + 1);
+	rename(from.str().c_str(), to.str().c_str());
+    }
+    return startFile();
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+bool EventLog::writeRecords(const EventRecord* records, size_t count) {
+    size_t bytes = count * sizeof(EventRecord);
+    if ((_fileBytes + bytes > _maxBytes) && (_fileBytes > sizeof(EventLogHeader))) {
+	if (!rotate()) {
+	    return false;
+	}
+    }
+
+    const char* data = (const char*) records;
+    size_t written = 0;
+    while (written < bytes) {
+	ssize_t n = write(_fd, data + written, bytes - written);
+	if (n < 0) {
+	    if (errno == EINTR) {
+		continue;
+	    }
+	    cerr << "Failed to write event log " << _fileName << ": " << strerror(errno) << "\n";
+	    return false;
+	}
+	written += n;
+    }
+    _fileBytes += bytes;
+    return true;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+void EventLog::drainQueues() {
+    vector<Queue*> queues;
+    {
+	lock_guard<mutex> guard(_lock);
+	for (auto& entry : _queues) {
+	    queues.push_back(entry.second.get());
+	}
+    }
+
+    bool more = true;
+    while (more && (_fd >= 0)) {
+	more = false;
+	_batch.clear();
+
+	uint64_t dropped = _dropped.load(memory_order_relaxed);
+	if (dropped != _droppedLogged) {
+	    EventRecord record;
+	    memset(&record, 0, sizeof(record));
+	    record.type = DroppedEvent;
+	    record.tid = threadId();
+	    record.nanos = monotonicNanos();
+	    record.dropped.count = dropped - _droppedLogged;
+	    _batch.push_back(record);
+	    _droppedLogged = dropped;
+	}
+
+	EventRecord record;
+	for (Queue* queue : queues) {
+	    while ((_batch.size() < WRITE_BATCH_RECORDS) && queue->pop(record)) {
+		_batch.push_back(record);
+	    }
+	    more = more || (_batch.size() == WRITE_BATCH_RECORDS);
+	}
+
+	if (!_batch.empty() && !writeRecords(_batch.data(), _batch.size())) {
+	    // Nowhere to write, stop taking records
+	    _running.store(false);
+	    ::close(_fd);
+	    _fd = -1;
+	}
+    }
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+void EventLog::writeLoop() {
+    while (_running.load()) {
+	drainQueues();
+	avc::Timer::sleep(WRITE_INTERVAL_SECS);
+    }
+    // Whatever was logged before close()
+    drainQueues();
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+EventLog::Queue* EventLog::threadQueue() {
+    if (cachedLog != this) {
+	int tid = threadId();
+	lock_guard<mutex> guard(_lock);
+	unique_ptr<Queue>& queue = _queues[tid];
+	if (!queue) {
+	    queue.reset(new Queue(EVENT_LOG_THREAD_RECORDS));
+	}
+	cachedLog = this;
+	cachedQueue = queue.get();
+    }
+    return cachedQueue;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+void EventLog::append(EventRecord& record) {
+    record.tid = threadId();
+    record.nanos = monotonicNanos();
+    if (!threadQueue()->push(record)) {
+	_dropped.fetch_add(1, memory_order_relaxed);
+    }
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+void EventLog::frameResult(const FileData& fileData, int candidates) {
+    if (!isOpen()) {
+	return;
+    }
+    EventRecord record;
+    memset(&record, 0, sizeof(record));
+    record.type = FrameEvent;
+    record.frame = fileData.frameCount;
+    record.result.found = fileData.found;
+    record.result.boxWidth = fileData.boxWidth;
+    record.result.boxHeight = fileData.boxHeight;
+    record.result.xMid = fileData.xMid;
+    record.result.yBot = fileData.yBot;
+    record.result.rangeFeet = fileData.rangeFeet;
+    record.result.bearingDegrees = fileData.bearingDegrees;
+    record.result.cameraSeq = fileData.cameraSeq;
+    record.result.droppedFrames = fileData.droppedFrames;
+    record.result.latencyMicros = (fileData.publishNanos - fileData.captureNanos) / 1000;
+    record.result.candidates = candidates;
+    append(record);
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+void EventLog::timing(int frame, const char* stage, int64_t nanos) {
+    if (!isOpen()) {
+	return;
+    }
+    EventRecord record;
+    memset(&record, 0, sizeof(record));
+    record.type = TimingEvent;
+    record.frame = frame;
+    copyText(record.timing.stage, sizeof(record.timing.stage), stage, strlen(stage));
+    record.timing.nanos = nanos;
+    append(record);
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+void EventLog::stateChange(int frame, int from, int to, float fps) {
+    if (!isOpen()) {
+	return;
+    }
+    EventRecord record;
+    memset(&record, 0, sizeof(record));
+    record.type = StateEvent;
+    record.frame = frame;
+    record.state.from = from;
+    record.state.to = to;
+    record.state.fps = fps;
+    append(record);
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+void EventLog::error(int frame, const string& message) {
+    if (!isOpen()) {
+	return;
+    }
+    EventRecord record;
+    memset(&record, 0, sizeof(record));
+    record.type = ErrorEvent;
+    record.frame = frame;
+    copyText(record.message, sizeof(record.message), message.c_str(), message.size());
+    append(record);
+}
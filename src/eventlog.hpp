@@ -0,0 +1,212 @@
+#pragma once
+
+#include "filedata.hpp"
+#include "spscqueue.hpp"
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <stdint.h>
+
+namespace vision {
+
+    const uint32_t EVENT_LOG_MAGIC = 0x45435641;  // "AVCE"
+    const uint32_t EVENT_LOG_VERSION = 1;
+
+    // Start a new file once the current one reaches this size, keeping
+    // this many old ones (LOG.1 is the newest)
+    const size_t EVENT_LOG_MAX_BYTES = 16 << 20;
+    const int EVENT_LOG_KEEP_FILES = 4;
+
+    // Records each thread can have waiting to be written
+    const size_t EVENT_LOG_THREAD_RECORDS = 4096;
+
+    /** What an EventRecord holds. */
+    enum EventType : uint32_t {
+	// Results published for a frame
+	FrameEvent = 1,
+	// How long a stage took
+	TimingEvent = 2,
+	// What was found changed
+	StateEvent = 3,
+	// Something went wrong (text)
+	ErrorEvent = 4,
+	// Records lost because a thread's buffer was full
+	DroppedEvent = 5
+    };
+
+    /**
+     * Start of every event log file.
+     */
+    struct EventLogHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t headerSize;
+	uint32_t recordSize;
+	// CLOCK_REALTIME and CLOCK_MONOTONIC_RAW nanoseconds when the file
+	// was started (to turn record times into wall clock times)
+	int64_t realtimeNanos;
+	int64_t monotonicNanos;
+    };
+
+    /**
+     * One fixed size event (64 bytes), written to the file as is.
+     */
+    struct EventRecord {
+	// EventType
+	uint32_t type;
+	// Kernel thread id of the thread that logged it
+	int32_t tid;
+	// Frame it belongs to (0 if none)
+	int32_t frame;
+	uint32_t reserved;
+	// CLOCK_MONOTONIC_RAW nanoseconds when logged
+	int64_t nanos;
+
+	union {
+	    // FrameEvent
+	    struct {
+		int32_t found;
+		int16_t boxWidth, boxHeight;
+		int16_t xMid, yBot;
+		float rangeFeet;
+		float bearingDegrees;
+		uint32_t cameraSeq;
+		uint32_t droppedFrames;
+		// Capture to publish
+		int32_t latencyMicros;
+		int32_t candidates;
+	    } result;
+
+	    // TimingEvent
+	    struct {
+		// Stage name (not terminated if all 24 bytes are used)
+		char stage[24];
+		int64_t nanos;
+	    } timing;
+
+	    // StateEvent
+	    struct {
+		int32_t from;
+		int32_t to;
+		float fps;
+	    } state;
+
+	    // ErrorEvent (message not terminated if all 40 bytes are used)
+	    char message[40];
+
+	    // DroppedEvent
+	    struct {
+		uint64_t count;
+	    } dropped;
+	};
+    };
+
+    /**
+     * Compact binary log of what the streaming loop does (see
+     * avc-vision-eventlog to print it as text or CSV), so logging every
+     * frame costs a few stores rather than formatting and writing to
+     * the terminal.
+     *
+     * <p>Each thread that logs gets its own lock free queue of fixed
+     * size records (registered the first time it logs), a background
+     * thread drains them all to the file. Logging never blocks: when a
+     * thread's queue is full the record is dropped and counted, and a
+     * DroppedEvent is written in its place. Once the file reaches its
+     * size limit it is renamed to LOG.1 (older ones to LOG.2, ...) and
+     * a new one is started.</p>
+     */
+    class EventLog {
+    public:
+	EventLog();
+
+	/** Writes out anything still queued and closes the file. */
+	~EventLog();
+
+	/**
+	 * Create the log file and start the thread writing to it.
+	 *
+	 * @param fileName Where to write.
+	 * @param maxBytes Size at which to start a new file.
+	 * @param keepFiles Number of old files to keep.
+	 *
+	 * @return true if the file was created.
+	 */
+	bool open(const std::string& fileName, size_t maxBytes = EVENT_LOG_MAX_BYTES,
+		  int keepFiles = EVENT_LOG_KEEP_FILES);
+
+	/** Writes out anything still queued and closes the file. */
+	void close();
+
+	/** Whether the log is open (events are ignored otherwise). */
+	bool isOpen() const { return _running.load(std::memory_order_relaxed); }
+
+	/**
+	 * Log the results published for a frame.
+	 *
+	 * @param fileData Published results (time stamps filled in).
+	 * @param candidates Number of candidates found.
+	 */
+	void frameResult(const FileData& fileData, int candidates);
+
+	/**
+	 * Log how long a stage of a frame took.
+	 *
+	 * @param frame Frame number.
+	 * @param stage Name of stage (only the first 24 characters are kept).
+	 * @param nanos Time taken.
+	 */
+	void timing(int frame, const char* stage, int64_t nanos);
+
+	/**
+	 * Log a change in what is found.
+	 *
+	 * @param frame First frame with the new result.
+	 * @param from What was found before (-1 at start).
+	 * @param to What is found now.
+	 * @param fps Frames per second processed so far.
+	 */
+	void stateChange(int frame, int from, int to, float fps);
+
+	/** Log an error (only the first 40 characters are kept). */
+	void error(int frame, const std::string& message);
+
+	/** Records dropped because a thread's queue was full. */
+	uint64_t getDropped() const { return _dropped.load(std::memory_order_relaxed); }
+
+    private:
+	typedef SpscQueue<EventRecord> Queue;
+
+	Queue* threadQueue();
+	void append(EventRecord& record);
+	void writeLoop();
+	void drainQueues();
+	bool writeRecords(const EventRecord* records, size_t count);
+	bool startFile();
+	bool rotate();
+
+	std::string _fileName;
+	size_t _maxBytes;
+	int _keepFiles;
+	int _fd;
+	size_t _fileBytes;
+
+	// Queue of each thread that has logged (by kernel thread id, only
+	// added to)
+	std::mutex _lock;
+	std::map<int, std::unique_ptr<Queue>> _queues;
+
+	// Records being written (only used by the writer thread)
+	std::vector<EventRecord> _batch;
+
+	std::thread _writer;
+	std::atomic<bool> _running;
+	std::atomic<uint64_t> _dropped;
+	uint64_t _droppedLogged;
+    };
+}
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <stddef.h>
+#include <stdint.h>
+
 namespace vision {
 
 enum Found: int {
@@ -8,8 +11,13 @@ enum Found: int {
     Yellow,
 };
 
+// Current layout of FileData. Fields are only ever appended so readers
+// built against an older (shorter) layout keep working. Layout 1 was the
+// original seven int fields ending with safetyFrameCount.
+const int FILE_DATA_VERSION = 3;
+
 struct FileData {
-    int frameCount; 
+    int frameCount;
     Found found;
 
     int boxWidth, boxHeight;
@@ -17,10 +25,63 @@ struct FileData {
 
     int safetyFrameCount;
 
+    // ----- Layout version 2 -----
+
+    // FILE_DATA_VERSION and sizeof(FileData) of the writer (0 if the
+    // writer only filled in layout 1)
+    int version;
+    int size;
+
+    // Camera sequence number of frame and total frames dropped so far
+    uint32_t cameraSeq;
+    uint32_t droppedFrames;
+
+    // Keeps captureNanos 8 byte aligned whatever alignment the ABI gives
+    // int64_t (other processes read this layout)
+    int reserved2;
+
+    // CLOCK_MONOTONIC_RAW nanoseconds when the frame was captured and
+    // when these results were published
+    int64_t captureNanos;
+    int64_t publishNanos;
+
+    // Set to frameCount after all version 2 fields are written
+    int tailFrameCount;
+    int reserved;
+
+    // ----- Layout version 3 -----
+
+    // Estimated feet to the bottom of the box along the ground (-1 if
+    // unknown) and its bearing in degrees (positive is to the right),
+    // see range.txt
+    float rangeFeet;
+    float bearingDegrees;
+
+    // Set to frameCount after all version 3 fields are written
+    int rangeFrameCount;
+    int reserved3;
+
     int getX() const { return xMid - (boxWidth / 2); }
     int getY() const { return yBot - boxHeight; }
     int getWidth() const { return boxWidth; }
     int getHeight() const { return boxHeight; }
+
+    /** How old results were when published (in seconds). */
+    double getLatencySecs() const { return (publishNanos - captureNanos) * 1e-9; }
+
+    /** Mark structure as using the current layout. */
+    void stampLayout() {
+        version = FILE_DATA_VERSION;
+        size = sizeof(FileData);
+    }
 };
 
+// Layout shared with other processes must not depend on the compiler
+static_assert(offsetof(FileData, safetyFrameCount) == 24, "layout 1 changed");
+static_assert(offsetof(FileData, cameraSeq) == 36, "layout 2 changed");
+static_assert(offsetof(FileData, captureNanos) == 48, "layout 2 changed");
+static_assert(offsetof(FileData, tailFrameCount) == 64, "layout 2 changed");
+static_assert(offsetof(FileData, rangeFeet) == 72, "layout 3 changed");
+static_assert(sizeof(FileData) == 88, "layout 3 changed");
+
 }
@@ -1,16 +1,37 @@
 #include "filter.hpp"
+#include "datasetpack.hpp"
+#include "debugviewer.hpp"
+#include "eventlog.hpp"
+#include "framering.hpp"
+#include "framesource.hpp"
+#include "metrics.hpp"
+#include "pipeline.hpp"
+#include "profiledetector.hpp"
+#include "publisher.hpp"
+#include "resultcache.hpp"
+#include "startup.hpp"
+#include "trace.hpp"
 #include "Timer.h"
 
 #include <iostream>
 #include <iomanip>
 
+#include <atomic>
 #include <fstream>
+#include <functional>
+#include <future>
+#include <iterator>
+#include <memory>
+#include <thread>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 
+// Tools linking against the filter build with -DENABLE_MAIN=0
+#ifndef ENABLE_MAIN
 #define ENABLE_MAIN 1
+#endif
 
 using namespace cv;
 using namespace vision;
@@ -18,21 +39,178 @@ using namespace std;
 // ---------------------------------------------------------------------
 // ---------------------------------------------------------------------
 
+const char* const vision::FILTER_STAGE_NAMES[FILTER_STAGE_COUNT] = {
+    "convert",
+    "reduce",
+    "threshold",
+    "erode",
+    "dilate",
+    "contours",
+    "candidates"
+};
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+namespace {
+    /** Profiles and traces a filter stage for the life of the object. */
+    class StageScope {
+    public:
+	StageScope(StageProfiler* profiler, Tracer* tracer, FilterStage stage) :
+	    _profile(profiler, stage),
+	    _trace(tracer, FILTER_STAGE_NAMES[stage]) {
+	}
+
+    private:
+	StageProfiler::Scope _profile;
+	TraceScope _trace;
+    };
+
+    /** An image for writeImages() to write out. */
+    struct ImageJob {
+	string name;
+	const Mat* image;
+    };
+
+    /** File name extension for an image format. */
+    const char* imageExtension(ImageFormat format) {
+	return (format == BmpImages) ? ".bmp" : ".png";
+    }
+
+    /** imwrite() parameters for an image format. */
+    vector<int> imageParams(ImageFormat format) {
+	vector<int> params;
+	if ((format == FastPngImages) || (format == RawPngImages)) {
+	    params.push_back(CV_IMWRITE_PNG_COMPRESSION);
+	    params.push_back((format == FastPngImages) ? 1 : 0);
+	}
+	return params;
+    }
+
+    /**
+     * Encodes and writes images on as many threads as there are
+     * images (up to the number of CPUs).
+     */
+    void writeParallel(const vector<ImageJob>& jobs, const vector<int>& params) {
+	atomic<size_t> next(0);
+	auto work = [&]() {
+	    for (size_t i = next++; i < jobs.size(); i = next++) {
+		imwrite(jobs[i].name, *jobs[i].image, params);
+	    }
+	};
+
+	size_t cpus = max(1u, thread::hardware_concurrency());
+	size_t threads = min(jobs.size(), cpus);
+	vector<thread> helpers;
+	for (size_t i = 1; i < threads; i++) {
+	    helpers.push_back(thread(work));
+	}
+	work();
+	for (thread& helper : helpers) {
+	    helper.join();
+	}
+    }
+
+    /**
+     * Tiles images (scaled to the size of the first step after the
+     * original) into one BGR image, four to a row, with each labelled
+     * by name.
+     */
+    Mat contactSheet(const vector<string>& labels, const vector<const Mat*>& images) {
+	const int columns = 4;
+	const int labelHeight = 16;
+
+	Size tile(0, 0);
+	for (size_t i = 1; (i < images.size()) && (tile.area() == 0); i++) {
+	    tile = images[i]->size();
+	}
+	if (tile.area() == 0) {
+	    tile = images[0]->size();
+	}
+
+	int rows = (images.size() + columns - 1) / columns;
+	int cellHeight = tile.height + labelHeight;
+	Mat sheet(rows * cellHeight, columns * tile.width, CV_8UC3, Scalar::all(0));
+
+	for (size_t i = 0; i < images.size(); i++) {
+	    Rect cell((i % columns) * tile.width, (i / columns) * cellHeight,
+		      tile.width, cellHeight);
+	    putText(sheet, labels[i], Point(cell.x + 4, cell.y + labelHeight - 4),
+		    FONT_HERSHEY_PLAIN, 0.9, Scalar(255, 255, 255));
+
+	    Mat color;
+	    if (images[i]->channels() == 1) {
+		cvtColor(*images[i], color, COLOR_GRAY2BGR);
+	    } else {
+		color = *images[i];
+	    }
+	    Mat dst = sheet(Rect(cell.x, cell.y + labelHeight, tile.width, tile.height));
+	    if (color.size() == tile) {
+		color.copyTo(dst);
+	    } else {
+		resize(color, dst, tile, 0, 0, INTER_AREA);
+	    }
+	}
+	return sheet;
+    }
+
+    /**
+     * Trade the buffers of the color searched last for the spare set
+     * (see FilterFrame::otherBw), all swaps so storage is kept.
+     */
+    void swapSearched(FilterFrame& frame) {
+	swap(frame.bw, frame.otherBw);
+	swap(frame.eroded, frame.otherEroded);
+	swap(frame.dilated, frame.otherDilated);
+	frame.contours.swap(frame.otherContours);
+	frame.hierarchy.swap(frame.otherHierarchy);
+	frame.shapes.swap(frame.otherShapes);
+	swap(frame.lastSearched, frame.otherSearched);
+    }
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+FilterFrame::FilterFrame() :
+    lastSearched(Found::None),
+    otherSearched(Found::None),
+    winner(-1)
+{
+    memset(searched, 0, sizeof(searched));
+    memset(&fileData, 0, sizeof(fileData));
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
 Filter::Filter() :
-    _colorTransformed(),
-    _colorReduced(),
-    _grayScale(),
-    _bw(),
-    _dilated(),
     _dilationElem(),
-    _eroded(),
     _erosionElem(),
+    _frame(),
     _polyEpsilon(8),
     _redEnabled(true),
-    _yellowEnabled(true)
+    _yellowEnabled(true),
+    _searchAllColors(false),
+    _detector(ContourDetector),
+    _blur(false),
+    _convertKernel(0),
+    _reduceKernel(0),
+    _profiler(0),
+    _tracer(0),
+    _imageFormat(PngImages),
+    _contactSheet(false),
+    _range()
 {
-    memset(&_fileData, 0, sizeof(_fileData));
+    memset(_yelRanges, 0, sizeof(_yelRanges));
+    memset(_redRanges, 0, sizeof(_redRanges));
     loadConfig();
+    selectKernels();
+
+    // Installed camera model if there is one
+    if (!loadRange()) {
+	_range.setModel(RangeModel());
+    }
 
     // Initialize a erosion block for eroding black and with image
     int eDim = 5;
@@ -69,89 +247,244 @@ namespace {
 // ---------------------------------------------------------------------
 // ---------------------------------------------------------------------
 
-void Filter::loadConfig() {
-    std::ifstream values("/etc/avc.conf.d/values.txt");
+bool Filter::loadConfig(const string& fileName) {
+    std::ifstream values(fileName.c_str());
     readColorRanges(values, _redRanges);
     readColorRanges(values, _yelRanges);
+    bool ok = !values.fail();
     values.close();
+    return ok;
 }
 
 // ---------------------------------------------------------------------
 // ---------------------------------------------------------------------
 
-Found Filter::filter(const Mat& src) {
-    _fileData.frameCount++;
-    _fileData.found = Found::None;
-    _fileData.boxWidth = _fileData.boxHeight = 0;
-    _fileData.xMid = _fileData.yBot = 0;
+void Filter::selectKernels() {
+    bool streaming = (_detector == StreamDetector);
+    _convertKernel = kernels::selectConvert(_blur, streaming);
+    if (streaming) {
+	_reduceKernel = kernels::selectStream(_yellowEnabled, _redEnabled, _blur);
+    } else {
+	_reduceKernel = kernels::selectReduce(_yellowEnabled, _redEnabled,
+					      (_detector == ProfileDetector));
+    }
+}
 
-    // Crop the image (need to adjust this if we move/tilt camera)
-    _cropped = src(cv::Rect(50, 10, src.cols - 50, src.rows - 50));
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
 
-    // This could be a command line option
-    bool enableBlur = false;
+Found Filter::filter(const Mat& src) {
+    FileData& fileData = _frame.fileData;
+    fileData.frameCount++;
 
-    if (enableBlur) {
-	// Apply blur to smear colors together better (this adds a
-	// HUGE! impact to FPS)
-	blur(_cropped, _blurred, Size(3, 3));
+    convertColor(src, _frame);
 
-	// Convert to HSV color space
-	cvtColor(_blurred, _colorTransformed, cv::COLOR_BGR2HSV);
+    // Reducing every color in one pass beats reducing red separately
+    // when no yellow is found (generic path only reduces what it searches)
+    Found found;
+    if (_reduceKernel != 0) {
+	reduceColors(_frame);
+	found = searchColors(_frame, false);
     } else {
-	// Convert to HSV color space
-	cvtColor(_cropped, _colorTransformed, cv::COLOR_BGR2HSV);
+	found = searchColors(_frame, true);
     }
 
+    // Transfer final values and set safety frame count to match to signal done
+    fileData.safetyFrameCount = fileData.frameCount;
+
+    return found;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+void Filter::classify(const Mat& src, FilterFrame& frame) const {
+    convertColor(src, frame);
+
+    // Can't wait to see if yellow is found before building the red image
+    // (the search happens later on another thread)
+    reduceColors(frame);
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+void Filter::reduceColors(FilterFrame& frame) const {
+    if (_reduceKernel == 0) {
+	// Generic path (per color)
+	if (_yellowEnabled) {
+	    reduceColor(frame, Found::Yellow);
+	}
+	if (_redEnabled) {
+	    reduceColor(frame, Found::Red);
+	}
+	return;
+    }
+
+    StageScope scope(_profiler, _tracer, StageReduce);
+    _reduceKernel(frame, _yelRanges, _redRanges);
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+Found Filter::locate(FilterFrame& frame) const {
+    return searchColors(frame, false);
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+void Filter::prepare(FilterFrame& frame, Size frameSize) {
+    StageProfiler* profiler = _profiler;
+    Tracer* tracer = _tracer;
+    _profiler = 0;
+    _tracer = 0;
+
+    Mat blank(frameSize, CV_8UC3, Scalar::all(0));
+    classify(blank, frame);
+    locate(frame);
+
+    _profiler = profiler;
+    _tracer = tracer;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+Found Filter::searchColors(FilterFrame& frame, bool reduce) const {
+    FileData& fileData = frame.fileData;
+    fileData.found = Found::None;
+    fileData.boxWidth = fileData.boxHeight = 0;
+    fileData.xMid = fileData.yBot = 0;
+    fileData.rangeFeet = -1;
+    fileData.bearingDegrees = 0;
+    frame.candidates.clear();
+    frame.winner = -1;
+    frame.searched[Found::Yellow] = _yellowEnabled;
+    frame.searched[Found::Red] = false;
+
     // Try looking for yellow stanchion first
-    Found found = _yellowEnabled ? filterColorRange(_yelRanges, Found::Yellow) : Found::None;
+    int best = -1;
+    if (_yellowEnabled) {
+	if (reduce) {
+	    reduceColor(frame, Found::Yellow);
+	}
+	best = filterColorRange(frame, Found::Yellow);
+    }
+
+    // If yellow not found (or caller wants all candidates), then try red
+    if (_redEnabled && ((best < 0) || _searchAllColors)) {
+	frame.searched[Found::Red] = true;
+	if (reduce) {
+	    reduceColor(frame, Found::Red);
+	}
 
-    if ((found == Found::None) && _redEnabled) {
-        // If yellow not found, then try red
-        found = filterColorRange(_redRanges, Found::Red);
+	// Red only adds candidates once yellow has won, search it into
+	// the spare buffers so the masks and shapes stay yellow's
+	bool yellowWon = (best >= 0);
+	if (yellowWon) {
+	    swapSearched(frame);
+	}
+	int redBest = filterColorRange(frame, Found::Red);
+	if (yellowWon) {
+	    swapSearched(frame);
+	} else {
+	    best = redBest;
+	}
     }
 
-    // Transfer final values and set safety frame count to match to signal done
-    _fileData.found = found;
-    _fileData.safetyFrameCount = _fileData.frameCount;
+    frame.winner = best;
+    if (best >= 0) {
+	const Candidate& winner = frame.candidates[best];
+	int h = winner.bbox.height;
+	int w = winner.bbox.width;
+	fileData.boxWidth = w;
+	fileData.boxHeight = h;
+	fileData.xMid = winner.bbox.x + (w / 2);
+	fileData.yBot = winner.bbox.y + h;
+	fileData.found = winner.color;
+
+	// Only the bottom and top of the box are undistorted
+	Rect crop = getCropWindow(frame.frameSize);
+	bool bottomCut = (fileData.yBot >= frame.cropped.rows - RANGE_EDGE_ROWS);
+	_range.estimate(winner.bbox + crop.tl(), frame.frameSize, bottomCut,
+			fileData.rangeFeet, fileData.bearingDegrees);
+    }
 
-    return found;
+    return fileData.found;
 }
 
 // ---------------------------------------------------------------------
 // ---------------------------------------------------------------------
 
-void Filter::writeImages(const string& baseName, const Mat& orig, bool writeOrig) const {
-    Mat contoursImg, possibleImg, polygonImg, foundImg;
-    _cropped.copyTo(contoursImg);
-    _cropped.copyTo(possibleImg);
-    _cropped.copyTo(polygonImg);
-    _cropped.copyTo(foundImg);
+void Filter::convertColor(const Mat& src, FilterFrame& frame) const {
+    StageScope scope(_profiler, _tracer, StageConvert);
+
+    // Crop and convert to HSV color space (blurring first if enabled to
+    // smear colors together better, rows are blurred as they are
+    // converted so it costs little)
+    frame.frameSize = src.size();
+    _convertKernel(src, frame);
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+void Filter::writeImages(const FilterFrame& frame, const string& baseName,
+			 const Mat& orig, bool writeOrig) const {
+    const FileData& fileData = frame.fileData;
+    const vector<vector<Point>>& contours = frame.contours;
+
+    Mat blurredImg, contoursImg, possibleImg, polygonImg, foundImg;
+    if (_blur) {
+	// Blurred image is never kept, so make one to look at
+	blur(frame.cropped, blurredImg, Size(3, 3));
+    }
+    frame.cropped.copyTo(contoursImg);
+    frame.cropped.copyTo(possibleImg);
+    frame.cropped.copyTo(polygonImg);
+    frame.cropped.copyTo(foundImg);
 
     Scalar goodColor(255, 255, 0);
     Scalar badColor(100, 200, 255);
     Scalar labelColor(255, 128, 200);
 
-    int n = _contours.size();
+    // Shapes were checked (and polygons fitted) when the frame was filtered
+    int n = frame.shapes.size();
     for (int i = 0; i < n; i++) {
-	vector<Point> polygon;
-	Rect br;
-        approxPolyDP(Mat(_contours[i]), polygon, _polyEpsilon, true);
+	const Candidate& shape = frame.shapes[i];
+	const Rect& br = shape.bbox;
 	const Scalar* shapeColor = &badColor;
 
-	if (isPossibleStanchion(contoursImg, polygon, br)) {
+	// Shapes from the ProfileDetector have no contours, just boxes
+	bool hasContour = (i < (int) contours.size());
+
+	if (shape.verdict == Verdict::Accepted) {
 	    shapeColor = &goodColor;
-	    drawContours(possibleImg, _contours, i, *shapeColor, 1);
+	    if (hasContour) {
+		drawContours(possibleImg, contours, i, *shapeColor, 1);
+	    } else {
+		rectangle(possibleImg, br, *shapeColor, 1);
+	    }
 	}
 
-	drawContours(contoursImg, _contours, i, *shapeColor, 1);
-
-	const cv::Point* pts = (const cv::Point*) Mat(polygon).data;
-	int npts = Mat(polygon).rows;
-	polylines(polygonImg, &pts, &npts, 1, true, *shapeColor, 3);
+	if (hasContour) {
+	    drawContours(contoursImg, contours, i, *shapeColor, 1);
+	} else {
+	    rectangle(contoursImg, br, *shapeColor, 1);
+	}
 
+	// Label with number of polygon points (or why no polygon was fitted)
 	char buf[100];
-	snprintf(buf, sizeof(buf), "%d", polygon.size());
+	if (shape.polygon.empty()) {
+	    snprintf(buf, sizeof(buf), "%s", verdictName(shape.verdict));
+	} else {
+	    const cv::Point* pts = &shape.polygon[0];
+	    int npts = shape.polygon.size();
+	    polylines(polygonImg, &pts, &npts, 1, true, *shapeColor, 3);
+	    snprintf(buf, sizeof(buf), "%d", npts);
+	}
 	Point textPt(br.x + br.width / 2 - 8, br.y + (br.height / 2) - 5);
 	putText(polygonImg, buf, textPt, FONT_HERSHEY_PLAIN,
 		0.75, labelColor);
@@ -160,23 +493,23 @@ void Filter::writeImages(const string& baseName, const Mat& orig, bool writeOrig
     string foundExt;
     bool found = false;
 
-    if (_fileData.found == Found::Red) {
+    if (fileData.found == Found::Red) {
 	found = true;
-	foundExt = "-red.png";
-    } else if (_fileData.found == Found::Yellow) {
+	foundExt = "-red";
+    } else if (fileData.found == Found::Yellow) {
 	found = true;
-	foundExt = "-yellow.png";
+	foundExt = "-yellow";
     }
 
     if (found) {
-	int x = _fileData.getX();
-	int y = _fileData.getY();
-	int w = _fileData.getWidth();
-	int h = _fileData.getHeight();
-	int cx = _fileData.xMid;
+	int x = fileData.getX();
+	int y = fileData.getY();
+	int w = fileData.getWidth();
+	int h = fileData.getHeight();
+	int cx = fileData.xMid;
 	int cy = y + h / 2;
 	int rx = x + w;
-	int by = _fileData.yBot;
+	int by = fileData.yBot;
 	int iw = foundImg.cols;
 	int ih = foundImg.rows;
 
@@ -194,7 +527,7 @@ void Filter::writeImages(const string& baseName, const Mat& orig, bool writeOrig
 
 	char buf[1024];
 	snprintf(buf, sizeof(buf), "%s sz(%dx%d) tl(%d,%d), cp(%d,%d), br(%d,%d)",
-		 (_fileData.found == Found::Yellow ? "Yel" : "Red"),
+		 (fileData.found == Found::Yellow ? "Yel" : "Red"),
 		 w, h, x, y, cx, cy, rx, by);
 
 	putText(foundImg, buf, Point(4, textY), FONT_HERSHEY_PLAIN,
@@ -203,28 +536,28 @@ void Filter::writeImages(const string& baseName, const Mat& orig, bool writeOrig
 
     // NOTE: Keep two arrays in sync and ordered by steps done
     const string names[] = {
-	(writeOrig ? "-orig.png" : ""),
-	"-cropped.png",
-	"-blurred.png",
-	"-hsv.png",
-	"-hsv-reduced.png",
-	"-bw.png",
-	"-eroded.png",
-	"-dilated.png",
-	"-contours.png",
-	"-contours-possible.png",
-	"-polygons.png",
+	(writeOrig ? "-orig" : ""),
+	"-cropped",
+	"-blurred",
+	"-hsv",
+	"-hsv-reduced",
+	"-bw",
+	"-eroded",
+	"-dilated",
+	"-contours",
+	"-contours-possible",
+	"-polygons",
 	foundExt
     };
     const Mat* images[] = {
 	&orig,
-	&_cropped,
-	&_blurred,
-	&_colorTransformed,
-	&_colorReduced,
-	&_bw,
-	&_eroded,
-	&_dilated,
+	&frame.cropped,
+	&blurredImg,
+	&frame.colorTransformed,
+	&frame.colorReduced[frame.lastSearched],
+	&frame.bw,
+	&frame.eroded,
+	&frame.dilated,
 	&contoursImg,
 	&possibleImg,
 	&polygonImg,
@@ -232,15 +565,81 @@ void Filter::writeImages(const string& baseName, const Mat& orig, bool writeOrig
     };
 
     n = sizeof(names) / sizeof(names[0]);
+    string ext = imageExtension(_imageFormat);
+    vector<int> params = imageParams(_imageFormat);
+
+    if (_contactSheet) {
+	vector<string> labels;
+	vector<const Mat*> steps;
+	for (int i = 0; i < n; i++) {
+	    if ((names[i].size() != 0) && (images[i] != 0) && (images[i]->rows > 0)) {
+		ostringstream label;
+		label << setw(2) << setfill('0') << i << " " << names[i].substr(1);
+		labels.push_back(label.str());
+		steps.push_back(images[i]);
+	    }
+	}
+	if (!steps.empty()) {
+	    imwrite(baseName + "-steps" + ext, contactSheet(labels, steps), params);
+	}
+	return;
+    }
 
+    vector<ImageJob> jobs;
     for (int i = 0; i < n; i++) {
 	if ((names[i].size() != 0) && (images[i] != 0) && (images[i]->rows > 0)) {
 	    ostringstream fn;
-	    fn << baseName << "-step" << setw(2) << setfill('0') << i << names[i];
-	    imwrite(fn.str(), *images[i]);
+	    fn << baseName << "-step" << setw(2) << setfill('0') << i << names[i] << ext;
+	    ImageJob job = { fn.str(), images[i] };
+	    jobs.push_back(job);
 	}
     }
+    writeParallel(jobs, params);
+}
 
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+const char* vision::verdictName(Verdict verdict) {
+    switch (verdict) {
+    case Verdict::Accepted: return "ok";
+    case Verdict::TooSmall: return "small";
+    case Verdict::BadPosition: return "position";
+    case Verdict::OffCenter: return "center";
+    case Verdict::BadShape: return "shape";
+    }
+    return "?";
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+Verdict Filter::checkBounds(const cv::Mat& img, const cv::Rect& bounds) {
+    // The polygon's box (x, y, w, h) lies within the contour bounds, so
+    // each test below uses the most favorable box the polygon could have
+    // and only rejects if even that fails isPossibleStanchion().
+    int imgMid = img.rows / 2;
+    int bottom = bounds.y + bounds.height;
+    int right = bounds.x + bounds.width;
+
+    // Needs w > 15 and h > 40
+    if ((bounds.width <= 15) || (bounds.height <= 40)) {
+	return Verdict::TooSmall;
+    }
+
+    // Needs y < imgMid and y + (y + h) > imgMid where y + h <= bottom
+    // and y <= bottom - 41
+    if ((bounds.y >= imgMid) || ((2 * bottom - 41) <= imgMid)) {
+	return Verdict::BadPosition;
+    }
+
+    // Needs right edge (somewhere in [x + 16, right]) within 50 of center
+    int center = img.cols / 2;
+    if ((right <= center - 50) || ((bounds.x + 16) >= center + 50)) {
+	return Verdict::OffCenter;
+    }
+
+    return Verdict::Accepted;
 }
 
 // ---------------------------------------------------------------------
@@ -292,82 +691,246 @@ bool Filter::isPossibleStanchion(const cv::Mat& img,
 // ---------------------------------------------------------------------
 // ---------------------------------------------------------------------
 
-Found Filter::filterColorRange(const int* ranges, Found colorToFind) {
+void Filter::reduceColor(FilterFrame& frame, Found color) const {
+    StageScope scope(_profiler, _tracer, StageReduce);
+    const int* ranges = (color == Found::Red) ? _redRanges : _yelRanges;
+    Mat& colorReduced = frame.colorReduced[color];
+
+    if (_detector == ProfileDetector) {
+	// Count column occupancy as we go (red wraps around as below)
+	profile::reduce(frame.colorTransformed, ranges, (color == Found::Red),
+			colorReduced, frame.columnFill[color]);
+	return;
+    }
+
     Scalar lower(ranges[0], ranges[2], ranges[4]);
     Scalar upper(ranges[1], ranges[3], ranges[5]);
 
     // Filter each color channel for specified ranges
-    inRange(_colorTransformed, lower, upper, _colorReduced);
+    inRange(frame.colorTransformed, lower, upper, colorReduced);
 
     // NASTY HACK! Red Hue values wrap around 255 (we want Hue values from 0-10
     // and from something like 160-255).
-    if (colorToFind == Found::Red) {
+    if (color == Found::Red) {
 	Scalar lower(0, ranges[2], ranges[4]);
 	Scalar upper(10, ranges[3], ranges[5]);
-	inRange(_colorTransformed, lower, upper, _redLower);
-	bitwise_or(_redLower, _colorReduced, _colorReduced);
+	inRange(frame.colorTransformed, lower, upper, frame.redLower);
+	bitwise_or(frame.redLower, colorReduced, colorReduced);
+    }
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+int Filter::filterColorRange(FilterFrame& frame, Found colorToFind) const {
+    if (_detector == ProfileDetector) {
+	return findProfileCandidates(frame, colorToFind);
+    }
+    if (_detector == StreamDetector) {
+	return findStreamCandidates(frame, colorToFind);
     }
 
+    buildMask(frame, colorToFind);
+    return findCandidates(frame, colorToFind);
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+void Filter::buildMask(FilterFrame& frame, Found colorToFind) const {
+    frame.lastSearched = colorToFind;
+
     // Take it down to black and white
-    threshold(_colorReduced, _bw, 32, 255, THRESH_BINARY);
+    {
+	StageScope scope(_profiler, _tracer, StageThreshold);
+	threshold(frame.colorReduced[colorToFind], frame.bw, 32, 255, THRESH_BINARY);
+    }
 
     // Erode the image to clean up little bits of noise
-    erode(_bw, _eroded, _erosionElem);
+    {
+	StageScope scope(_profiler, _tracer, StageErode);
+	erode(frame.bw, frame.eroded, _erosionElem);
+    }
 
     // Dilate the image to try and fuse small holes
-    dilate(_eroded, _dilated, _dilationElem);
+    {
+	StageScope scope(_profiler, _tracer, StageDilate);
+	dilate(frame.eroded, frame.dilated, _dilationElem);
+    }
+}
 
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+int Filter::findCandidates(FilterFrame& frame, Found colorToFind) const {
     // Now go look for stanchion in black and white image
-    vector<Vec4i> hierarchy;
+    {
+	StageScope scope(_profiler, _tracer, StageContours);
+	frame.dilated.copyTo(frame.contourScratch);
+	findContours(frame.contourScratch, frame.contours, frame.hierarchy,
+		     CV_RETR_EXTERNAL, CV_CHAIN_APPROX_SIMPLE);
+    }
 
-    cv::Mat bwClone = _dilated.clone();
-    findContours(bwClone, _contours, hierarchy, CV_RETR_EXTERNAL, CV_CHAIN_APPROX_SIMPLE);
+    StageScope scope(_profiler, _tracer, StageCandidates);
 
-    int n = _contours.size();
+    int n = frame.contours.size();
     int maxH = 0;
+    int best = -1;
+
+    // Entries are reused from frame to frame so polygons keep their storage
+    frame.shapes.resize(n);
 
     for (int i = 0; i < n; i++) {
-        vector<Point> polygon;
-        Rect br;
-
-        approxPolyDP(Mat(_contours[i]), polygon, _polyEpsilon, true);
-
-        if (isPossibleStanchion(_cropped, polygon, br) && (br.height > maxH)) {
-	    int h = br.height;
-	    int w = br.width;
-            maxH = h;
-            _fileData.boxWidth = w;
-            _fileData.boxHeight = h;
-            _fileData.xMid = br.x + (w / 2);
-            _fileData.yBot = br.y + h;
-            _fileData.found = colorToFind;
+	Candidate& shape = frame.shapes[i];
+	shape.color = colorToFind;
+	shape.score = 0;
+	shape.polygon.clear();
+
+	// Only fit polygons to contours that could still pass
+	shape.bbox = boundingRect(frame.contours[i]);
+	shape.verdict = checkBounds(frame.cropped, shape.bbox);
+	if (shape.verdict != Verdict::Accepted) {
+	    continue;
+	}
+
+        approxPolyDP(Mat(frame.contours[i]), shape.polygon, _polyEpsilon, true);
+
+        if (!isPossibleStanchion(frame.cropped, shape.polygon, shape.bbox)) {
+	    shape.verdict = Verdict::BadShape;
+	    continue;
+	}
+
+	shape.score = shape.bbox.height;
+	frame.candidates.push_back(shape);
+
+	// Tallest candidate wins
+	if (shape.bbox.height > maxH) {
+	    maxH = shape.bbox.height;
+	    best = frame.candidates.size() - 1;
         }
     }
 
-    return _fileData.found;
+    return best;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+int Filter::findProfileCandidates(FilterFrame& frame, Found colorToFind) const {
+    frame.lastSearched = colorToFind;
+
+    // No contours in this mode (keeps writeImages() from drawing old ones)
+    frame.contours.clear();
+
+    // Runs of filled columns stand in for the contour search
+    vector<Rect> boxes;
+    {
+	StageScope scope(_profiler, _tracer, StageContours);
+	profile::findBoxes(frame.colorReduced[colorToFind], frame.columnFill[colorToFind], boxes);
+    }
+
+    StageScope scope(_profiler, _tracer, StageCandidates);
+    int n = boxes.size();
+    int maxH = 0;
+    int best = -1;
+
+    frame.shapes.resize(n);
+
+    for (int i = 0; i < n; i++) {
+	Candidate& shape = frame.shapes[i];
+	const Rect& br = boxes[i];
+	shape.color = colorToFind;
+	shape.score = 0;
+	shape.bbox = br;
+
+	// Box corners make a 4 point polygon with the same bounding box,
+	// so isPossibleStanchion() applies exactly the same box rules
+	shape.polygon.clear();
+	shape.polygon.push_back(br.tl());
+	shape.polygon.push_back(Point(br.x + br.width - 1, br.y));
+	shape.polygon.push_back(Point(br.x + br.width - 1, br.y + br.height - 1));
+	shape.polygon.push_back(Point(br.x, br.y + br.height - 1));
+
+	shape.verdict = checkBounds(frame.cropped, br);
+	if (shape.verdict != Verdict::Accepted) {
+	    continue;
+	}
+	if (!isPossibleStanchion(frame.cropped, shape.polygon, shape.bbox)) {
+	    shape.verdict = Verdict::BadShape;
+	    continue;
+	}
+
+	shape.score = br.height;
+	frame.candidates.push_back(shape);
+
+	if (br.height > maxH) {
+	    maxH = br.height;
+	    best = frame.candidates.size() - 1;
+	}
+    }
+
+    return best;
 }
 
 // ---------------------------------------------------------------------
 // ---------------------------------------------------------------------
 
-ostream& Filter::print(ostream& out) const {
+int Filter::findStreamCandidates(FilterFrame& frame, Found colorToFind) const {
+    frame.lastSearched = colorToFind;
+    const MorphLane& lane = frame.rowEngine.lanes[colorToFind];
+    frame.dilated = lane.getDilated();
+
+    // Contours are only worth tracing if a blob could pass
+    const vector<RowBlob>& blobs = lane.getBlobs();
+    bool worthTracing = false;
+    for (size_t i = 0; (i < blobs.size()) && !worthTracing; i++) {
+	worthTracing = (checkBounds(frame.cropped, blobs[i].bounds) == Verdict::Accepted);
+    }
+    if (worthTracing) {
+	return findCandidates(frame, colorToFind);
+    }
+
+    // Report the blobs as the shapes checked (nothing traced)
+    frame.contours.clear();
+    int n = blobs.size();
+    frame.shapes.resize(n);
+    for (int i = 0; i < n; i++) {
+	Candidate& shape = frame.shapes[i];
+	shape.bbox = blobs[i].bounds;
+	shape.color = colorToFind;
+	shape.score = 0;
+	shape.polygon.clear();
+	shape.verdict = checkBounds(frame.cropped, shape.bbox);
+    }
+    return -1;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+ostream& Filter::print(ostream& out, const FileData& fileData) {
 
     out << "Filter frames processed: "
-      << _fileData.frameCount
+      << fileData.frameCount
       << "  Found: ";
-    if (_fileData.found == Found::Red) {
+    if (fileData.found == Found::Red) {
         out << " Red Stanchion\n";
-    } else if (_fileData.found == Found::Yellow) {
+    } else if (fileData.found == Found::Yellow) {
         out << " Yellow Stanchion\n";
     } else {
         out << " Nothing";
         return out;
     }
 
-    out << "  Width: " << _fileData.boxWidth
-        << "  Height: " << _fileData.boxHeight
-        << "  X-Mid: " << _fileData.xMid
-        << "  Y-Bot: " << _fileData.yBot;
+    out << "  Width: " << fileData.boxWidth
+        << "  Height: " << fileData.boxHeight
+        << "  X-Mid: " << fileData.xMid
+        << "  Y-Bot: " << fileData.yBot;
+
+    if (fileData.rangeFeet >= 0) {
+	out << "  Range: " << fileData.rangeFeet << " ft"
+	    << "  Bearing: " << fileData.bearingDegrees << " deg";
+    }
 
     return out;
 }
@@ -375,13 +938,13 @@ ostream& Filter::print(ostream& out) const {
 // ---------------------------------------------------------------------
 // ---------------------------------------------------------------------
 
-ostream& Filter::printFrameRate(ostream& out, float secs) const {
-    float frames = getFileData().frameCount;
+ostream& Filter::printFrameRate(ostream& out, float secs, const FileData& fileData) {
+    float frames = fileData.frameCount;
     float fps = (secs > 0) ? (frames / secs) : 0;
 
     out << "Frame: " << frames << "  total time: "
-	<< secs << " secs (" << fps << " FPS), results:\n"
-	<< *this << "\n";
+	<< secs << " secs (" << fps << " FPS), results:\n";
+    print(out, fileData) << "\n";
 
     return out;
 }
@@ -396,6 +959,13 @@ namespace {
         isInterrupted = true; 
     }
 
+    // Set by SIGUSR1 to dump the trace buffer (-T TRACE_FILE)
+    volatile sig_atomic_t traceRequested = 0;
+
+    void requestTrace(int sig) {
+	traceRequested = 1;
+    }
+
     /**
      * Helper class to deal with command line argument options.
      */
@@ -413,23 +983,102 @@ namespace {
 	    outputDir("/dev/shm"),
 	    stanchionsFile("/dev/shm/stanchions"),
 	    changeDir(""),
-	    periodicWrite(0)
+	    periodicWrite(0),
+	    pipelined(false),
+	    pipelineCpus(),
+	    fifoPriority(0),
+	    ringRecords(0),
+	    metricsSocket(""),
+	    profileStages(false),
+	    traceFile(""),
+	    detector(ContourDetector),
+	    blur(false),
+	    frameSource("camera"),
+	    packFile(""),
+	    imageFormat(PngImages),
+	    contactSheet(false),
+	    viewerPort(0),
+	    viewerFps(DEBUG_VIEWER_FPS),
+	    eventLogFile(""),
+	    cacheDir("")
 	{
 
 	    int opt;
-	    while ((opt = getopt(argc, argv, "c:f:ho:p:rvy")) != -1) {
+	    while ((opt = getopt(argc, argv, "bc:C:d:D:f:F:g:hi:L:m:M:o:p:PrR:s:St:T:vV:y")) != -1) {
 		switch (opt) {
 
+		case 'b':
+		    blur = true;
+		    break;
+
 		case 'c':
 		    changeDir = optarg;
 		    changeDirEnabled = true;
 		    break;
 
+		case 'C':
+		    cacheDir = optarg;
+		    break;
+
+		case 'd':
+		    if (string(optarg) == "profile") {
+			detector = ProfileDetector;
+		    } else if (string(optarg) == "stream") {
+			detector = StreamDetector;
+		    } else if (string(optarg) != "contour") {
+			cerr << "Detector must be \"contour\", \"profile\" or \"stream\"";
+			ok = false;
+		    }
+		    break;
+
+		case 'D':
+		    packFile = optarg;
+		    break;
+
 		case 'f':
 		    readFromFile = true;
 		    inputFile = optarg;
 		    break;
 
+		case 'F':
+		    fifoPriority = atoi(optarg);
+		    if ((fifoPriority < 1) || (fifoPriority > 99)) {
+			cerr << "SCHED_FIFO priority must be in the range [1, 99]";
+			ok = false;
+		    }
+		    break;
+
+		case 'g':
+		    frameSource = string("synthetic:") + optarg;
+		    break;
+
+		case 'i':
+		    if (string(optarg) == "png") {
+			imageFormat = PngImages;
+		    } else if (string(optarg) == "fast") {
+			imageFormat = FastPngImages;
+		    } else if (string(optarg) == "raw") {
+			imageFormat = RawPngImages;
+		    } else if (string(optarg) == "bmp") {
+			imageFormat = BmpImages;
+		    } else {
+			cerr << "Image format must be \"png\", \"fast\", \"raw\" or \"bmp\"\n";
+			ok = false;
+		    }
+		    break;
+
+		case 'L':
+		    eventLogFile = optarg;
+		    break;
+
+		case 'm':
+		    frameSource = string("mjpeg:") + optarg;
+		    break;
+
+		case 'M':
+		    metricsSocket = optarg;
+		    break;
+
 		case 'o':
 		    outputDir = optarg;
 		    break;
@@ -442,15 +1091,48 @@ namespace {
 		    }
 		    break;
 
+		case 'P':
+		    profileStages = true;
+		    break;
+
+		case 's':
+		    frameSource = optarg;
+		    break;
+
+		case 'S':
+		    contactSheet = true;
+		    break;
+
 		case 'r':
 		    enableRed = true;
 		    enableYellow = false;
 		    break;
 
+		case 'R':
+		    ringRecords = atoi(optarg);
+		    if (ringRecords < 1) {
+			cerr << "Ring must hold at least 1 record";
+			ok = false;
+		    }
+		    break;
+
+		case 't':
+		    pipelined = true;
+		    parseCpuList(optarg);
+		    break;
+
+		case 'T':
+		    traceFile = optarg;
+		    break;
+
 		case 'v':
 		    verboseOut = true;
 		    break;
 
+		case 'V':
+		    parseViewer(optarg);
+		    break;
+
 		case 'y':
 		    enableRed = false;
 		    enableYellow = true;
@@ -463,7 +1145,10 @@ namespace {
 "Usage:\n"
 "\n"
 "  avc-vision [-h] [-v] [-r|-y] [-f FILE_TO_PROCESS] [-o OUTPUT_DIR]\n"
-"             [-c CHANGE_DIR]\n"
+"             [-c CHANGE_DIR] [-t CPUS] [-F PRIORITY] [-R RECORDS]\n"
+"             [-M SOCKET] [-P] [-T TRACE_FILE] [-d DETECTOR] [-m MJPEG]\n"
+"             [-D PACK_FILE] [-i IMAGE_FORMAT] [-S] [-g SYNTHETIC]\n"
+"             [-s SOURCE] [-b] [-V PORT[:FPS]] [-L LOG_FILE] [-C CACHE_DIR]\n"
 "\n"
 "Where:\n"
 "\n"
@@ -500,6 +1185,120 @@ namespace {
 "    the original image just processed each time it finds something\n"
 "    different. Files names will be: avc-vision-FRAME.png. NOTE: If\n"
 "    you include the -v option, then ALL frames are written.\n"
+"\n"
+"  -t CPUS\n"
+"    Runs the streaming mode as a pipeline with capture, classify (color\n"
+"    conversion and reduction), locate (morphology and contour search) and\n"
+"    publish each on their own thread. CPUS is a comma separated list of\n"
+"    the cores to pin each stage to (like \"0,1,2,3\"), use -1 for a\n"
+"    stage you don't want pinned or \"-\" to not pin any of them.\n"
+"\n"
+"  -F PRIORITY\n"
+"    Run pipeline stage threads with SCHED_FIFO real time PRIORITY\n"
+"    [1, 99] (requires appropriate privileges, only used with -t).\n"
+"\n"
+"  -R RECORDS\n"
+"    In addition to the stanchions file, publish every candidate found\n"
+"    for every enabled color (not just the winner) to a shared memory\n"
+"    ring (/dev/shm/stanchions-ring) holding the last RECORDS frames.\n"
+"\n"
+"  -M SOCKET\n"
+"    Serve live counters (frames, FPS, hit rates, stage latencies, ...)\n"
+"    in Prometheus text format on Unix socket SOCKET. For example:\n"
+"    curl --unix-socket SOCKET http://localhost/metrics\n"
+"\n"
+"  -P\n"
+"    Profile each stage of the filter with perf counters (cycles,\n"
+"    instructions, cache and branch misses, or software counters if\n"
+"    the hardware ones aren't available) and report per stage IPC and\n"
+"    miss rates on exit (not used with -t).\n"
+"\n"
+"  -T TRACE_FILE\n"
+"    Record when every stage of every frame starts and ends (on every\n"
+"    thread) in memory and write the timeline to TRACE_FILE in Chrome\n"
+"    trace event format on exit or when sent SIGUSR1 (open it with\n"
+"    chrome://tracing or https://ui.perfetto.dev).\n"
+"\n"
+"  -b\n"
+"    Smooth each frame with a 3x3 box blur as it is converted to HSV\n"
+"    (cleaner masks in low light for a small cost in frame rate).\n"
+"\n"
+"  -d DETECTOR\n"
+"    How to find stanchions in the color reduced image: \"contour\"\n"
+"    (erode, dilate and trace contours, the default) or \"profile\"\n"
+"    (column and row occupancy of the color mask, which is faster but\n"
+"    skips noise removal) or \"stream\" (same results as \"contour\",\n"
+"    but each frame goes through every step up to the dilated mask a\n"
+"    few rows at a time so it stays in cache, and contours are only\n"
+"    traced when a blob in the mask is big enough).\n"
+"\n"
+"  -m MJPEG\n"
+"    Process frames from a recorded MJPEG stream (back to back JPEG\n"
+"    frames, like \"ffmpeg -f mjpeg\" output or a saved multipart HTTP\n"
+"    stream), a JPEG image or a directory of JPEG images instead of the\n"
+"    camera (runs until the end of the input). Frames are decoded on a\n"
+"    separate thread, scaled down by libjpeg while decoding to 320 wide\n"
+"    (or the next size up) and only the part the filter uses is decoded.\n"
+"    Same as -s mjpeg:MJPEG.\n"
+"\n"
+"  -D PACK_FILE\n"
+"    Runs every image in a dataset pack (see avc-vision-pack) through\n"
+"    the filter straight from the memory mapped file, reports images\n"
+"    where the result differs from the one expected and exits with a\n"
+"    non-zero status if there were any.\n"
+"\n"
+"  -C CACHE_DIR\n"
+"    Keep the results of -f and -D runs in CACHE_DIR (created if needed),\n"
+"    keyed by a hash of each image and of the settings and program that\n"
+"    produced them. Images whose results can't have changed since are\n"
+"    not filtered again (and with -f their images aren't rewritten, so\n"
+"    -f results are also keyed by where the images go). A result where\n"
+"    yellow won is kept when only the red ranges change.\n"
+"\n"
+"  -i IMAGE_FORMAT\n"
+"    How images of each processing step are written: \"png\" (the\n"
+"    default), \"fast\" (PNG at the lowest compression level), \"raw\"\n"
+"    (uncompressed PNG) or \"bmp\" (uncompressed BMP). Step images are\n"
+"    encoded in parallel.\n"
+"\n"
+"  -S\n"
+"    Write a single contact sheet image (-steps.png) with every step\n"
+"    tiled and labelled instead of a separate image for each step.\n"
+"\n"
+"  -g SYNTHETIC\n"
+"    Process generated frames instead of the camera (repeatable load\n"
+"    at any resolution). SYNTHETIC is a comma separated list of\n"
+"    settings (see synthetic.hpp), like\n"
+"    \"size=1280x720,blobs=200,noise=20,light=30,frames=500,fps=30\".\n"
+"    Use \"-g default\" for 320x240 frames with a stanchion and nothing\n"
+"    else. Same as -s synthetic:SYNTHETIC.\n"
+"\n"
+"  -s SOURCE\n"
+"    Where frames come from when streaming (default \"camera\"):\n"
+"      camera[:N]                  OpenCV camera N at 320x240\n"
+"      v4l2:DEVICE[,WxH][,FORMAT]  V4L2 device read directly (FORMAT is\n"
+"                                  mjpeg, the default, or yuyv)\n"
+"      file:PATH, dir:PATH         An image or directory of images\n"
+"      video:PATH                  A video file\n"
+"      mjpeg:PATH                  See -m\n"
+"      pack:PATH                   Images in a dataset pack\n"
+"      synthetic:SPEC              See -g\n"
+"      shm:NAME                    Frames shared by another process\n"
+"                                  (see avc-vision-share)\n"
+"\n"
+"  -V PORT[:FPS]\n"
+"    Serve what the filter sees as MJPEG streams on http://localhost:PORT/\n"
+"    (the frame with the found box, the final mask and every shape\n"
+"    checked). Snapshots are taken at FPS (default 5) while someone is\n"
+"    watching and encoded on a separate thread, frames are skipped\n"
+"    rather than slowing the filter down. Use ssh -L to watch from\n"
+"    another machine.\n"
+"\n"
+"  -L LOG_FILE\n"
+"    Log every frame's results, stage timings, changes in what is found\n"
+"    and errors to a binary file (rotated at 16 MiB, four old files\n"
+"    kept) instead of printing changes to the terminal. Print it with\n"
+"    avc-vision-eventlog.\n"
 "\n";
 		}
 	    }
@@ -537,7 +1336,82 @@ namespace {
 	const bool isRedEnabled() const { return enableRed; }
 	const bool isYellowEnabled() const { return enableYellow; }
 
+	/** Whether streaming mode should run as a multi-threaded pipeline (-t CPUS). */
+	bool isPipelined() const { return pipelined; }
+
+	/** CPU to pin a pipeline stage to (-1 if not pinned). */
+	int getStageCpu(int stage) const {
+	    return (stage < (int) pipelineCpus.size()) ? pipelineCpus[stage] : -1;
+	}
+
+	/** SCHED_FIFO priority for pipeline stages (0 for normal scheduling). */
+	int getFifoPriority() const { return fifoPriority; }
+
+	/** Number of frames to keep in detection ring (0 if disabled). */
+	int getRingRecords() const { return ringRecords; }
+
+	/** Unix socket to serve metrics on (empty if disabled). */
+	const string& getMetricsSocket() const { return metricsSocket; }
+
+	/** Whether to collect perf counters for each filter stage (-P). */
+	bool isProfiling() const { return profileStages; }
+
+	/** Where frames come from (-s SOURCE, -m MJPEG or -g SYNTHETIC). */
+	const string& getFrameSource() const { return frameSource; }
+
+	/** How step images are written (-i IMAGE_FORMAT). */
+	ImageFormat getImageFormat() const { return imageFormat; }
+
+	/** Whether to tile step images into one contact sheet (-S). */
+	bool isContactSheet() const { return contactSheet; }
+
+	/** Dataset pack to evaluate (-D PACK_FILE, empty if none). */
+	const string& getPackFile() const { return packFile; }
+
+	/** Where to keep results of offline runs (-C CACHE_DIR, empty if not caching). */
+	const string& getCacheDir() const { return cacheDir; }
+
+	/** How to find stanchions (-d DETECTOR). */
+	Detector getDetector() const { return detector; }
+
+	/** Whether to blur frames before converting them to HSV (-b). */
+	bool isBlur() const { return blur; }
+
+	/** Where to write trace events (empty if not tracing). */
+	const string& getTraceFile() const { return traceFile; }
+
+	/** Port to serve the debug viewer on (-V PORT[:FPS], 0 if disabled). */
+	int getViewerPort() const { return viewerPort; }
+
+	/** Snapshots per second sent to debug viewers. */
+	double getViewerFps() const { return viewerFps; }
+
+	/** Where to write the binary event log (-L LOG_FILE, empty if not logging). */
+	const string& getEventLogFile() const { return eventLogFile; }
+
     private:
+	void parseViewer(const string& spec) {
+	    size_t colon = spec.find(':');
+	    viewerPort = atoi(spec.substr(0, colon).c_str());
+	    if (colon != string::npos) {
+		viewerFps = atof(spec.substr(colon + 1).c_str());
+	    }
+	    if ((viewerPort < 1) || (viewerPort > 65535) || (viewerFps <= 0)) {
+		cerr << "Viewer must be PORT (1 to 65535) optionally followed by :FPS (more than 0)";
+		ok = false;
+	    }
+	}
+
+	void parseCpuList(const string& list) {
+	    istringstream in(list);
+	    string cpu;
+	    while (getline(in, cpu, ',')) {
+		if (cpu != "-") {
+		    pipelineCpus.push_back(atoi(cpu.c_str()));
+		}
+	    }
+	}
+
 	bool ok;
 
 	bool verboseOut;
@@ -564,7 +1438,352 @@ namespace {
 
 	// Stanchions file
 	string stanchionsFile;
+
+	// Whether to run streaming mode as a pipeline (-t CPUS)
+	bool pipelined;
+	vector<int> pipelineCpus;
+	int fifoPriority;
+
+	// Number of frames to keep in shared memory ring (-R RECORDS)
+	int ringRecords;
+
+	// Where to serve metrics (-M SOCKET)
+	string metricsSocket;
+
+	// Collect perf counters for each filter stage (-P)
+	bool profileStages;
+
+	// Where to write trace of stage timings (-T TRACE_FILE)
+	string traceFile;
+
+	// How to find stanchions (-d DETECTOR)
+	Detector detector;
+
+	// Blur frames before converting them to HSV (-b)
+	bool blur;
+
+	// Where and how often to serve debug images (-V PORT[:FPS])
+	int viewerPort;
+	double viewerFps;
+
+	// Binary event log to write (-L LOG_FILE)
+	string eventLogFile;
+
+	// Where frames come from (see openFrameSource())
+	string frameSource;
+
+	// Pre-decoded images to evaluate (-D PACK_FILE)
+	string packFile;
+
+	// How step images are written (-i IMAGE_FORMAT, -S)
+	ImageFormat imageFormat;
+	bool contactSheet;
+
+	// Results of offline runs (-C CACHE_DIR)
+	string cacheDir;
     };
+
+    /** Writes trace (if tracing) and clears any SIGUSR1 request. */
+    void writeTrace(const Options& opts, Tracer* tracer) {
+	traceRequested = 0;
+	if (tracer != 0) {
+	    tracer->write(opts.getTraceFile());
+	}
+    }
+
+    /** Update metrics counters with results of a frame. */
+    void countResult(Metrics& metrics, Found found) {
+	metrics.add(FramesProcessed);
+	metrics.add((found == Found::Red) ? FoundRed :
+		    ((found == Found::Yellow) ? FoundYellow : FoundNone));
+    }
+
+    // Waits between attempts to open a camera that isn't there yet
+    // (doubling from the first up to the longest)
+    const float SOURCE_RETRY_FIRST_SECS = 0.05f;
+    const float SOURCE_RETRY_MAX_SECS = 2.0f;
+
+    /**
+     * Opens the frame source (noted as the "open_source" startup
+     * phase). Cameras, and processes sharing theirs, can take a while
+     * to show up after a reboot, so those are tried again after waits
+     * that start short and double: one that appears soon is picked up
+     * right away, one that stays missing is only tried every couple of
+     * seconds.
+     *
+     * @param filter Filter the frames are for (may be null if the
+     * source doesn't need it, see sourceNeedsFilter()).
+     *
+     * @return The source (null if it couldn't be opened or we were
+     * interrupted).
+     */
+    unique_ptr<FrameSource> openSource(const string& spec, const Filter* filter, int buffers,
+				       Metrics& metrics, EventLog& eventLog,
+				       StartupPhases& startup) {
+	int64_t start = monotonicNanos();
+	unique_ptr<FrameSource> source = openFrameSource(spec, filter, buffers);
+
+	bool retry = (spec.compare(0, 6, "camera") == 0)
+	    || (spec.compare(0, 4, "v4l2") == 0) || (spec.compare(0, 3, "shm") == 0);
+	int attempts = 1;
+	float waitSecs = SOURCE_RETRY_FIRST_SECS;
+	while (!source && retry) {
+	    cerr << "Failed to open " << spec << " on attempt " << attempts
+		 << ", trying again in "
+		 << waitSecs << " seconds.\n";
+	    eventLog.error(0, "failed to open " + spec);
+	    avc::Timer::sleep(waitSecs);
+	    if (isInterrupted) {
+		return nullptr;
+	    }
+	    source = openFrameSource(spec, filter, buffers);
+	    metrics.add(CameraReopens);
+	    attempts++;
+	    waitSecs = min(2 * waitSecs, SOURCE_RETRY_MAX_SECS);
+	}
+	if (source) {
+	    startup.add("open_source", start);
+	}
+	return source;
+    }
+
+    /**
+     * Buffers for one frame slot of the pipelined streaming mode.
+     */
+    struct PipelineSlot {
+	Frame frame;
+	FilterFrame work;
+	// Frame number used to tag trace events
+	int traceFrame;
+
+	PipelineSlot() : traceFrame(0) { }
+    };
+
+    // Frame slots in the pipelined streaming mode
+    const int PIPELINE_SLOTS = 4;
+
+    /**
+     * Runs the streaming mode with each stage of the filter on its own
+     * thread so frame N+1 can be classified while frame N is searched
+     * for contours. The metrics server is stopped before returning (it
+     * reads the pipeline's statistics).
+     */
+    void runPipelined(const Options& opts, Filter& filter, FrameSource& source,
+		      Publisher& publisher, Metrics& metrics, Tracer* tracer,
+		      DebugViewer& viewer, EventLog& eventLog, StartupPhases& startup) {
+	vector<PipelineSlot> frames(PIPELINE_SLOTS);
+
+	// Images of every slot ready before the first frame arrives
+	if (source.getFrameSize().area() > 0) {
+	    int64_t prepareStart = monotonicNanos();
+	    for (PipelineSlot& frame : frames) {
+		filter.prepare(frame.work, source.getFrameSize());
+	    }
+	    startup.add("prepare", prepareStart);
+	}
+	Pipeline pipeline(PIPELINE_SLOTS);
+	int prio = opts.getFifoPriority();
+
+	int captured = 0;
+	pipeline.addStage(StageConfig("capture", opts.getStageCpu(0), prio), [&](int slot) {
+	    PipelineSlot& frame = frames[slot];
+	    frame.traceFrame = ++captured;
+	    TraceScope scope(tracer, "capture", frame.traceFrame);
+	    // Slot is free again, so is the frame it last held
+	    source.release(frame.frame);
+	    return source.acquire(frame.frame);
+	});
+
+	pipeline.addStage(StageConfig("classify", opts.getStageCpu(1), prio), [&](int slot) {
+	    TraceScope scope(tracer, "classify", frames[slot].traceFrame);
+	    filter.classify(frames[slot].frame.image, frames[slot].work);
+	    return true;
+	});
+
+	pipeline.addStage(StageConfig("locate", opts.getStageCpu(2), prio), [&](int slot) {
+	    TraceScope scope(tracer, "locate", frames[slot].traceFrame);
+	    filter.locate(frames[slot].work);
+	    return true;
+	});
+
+	avc::Timer timer;
+	int frameCount = 0;
+	int foundLast = -1;
+	int lastSlot = -1;
+
+	pipeline.addStage(StageConfig("publish", opts.getStageCpu(3), prio), [&](int slot) {
+	    TraceScope scope(tracer, "publish", frames[slot].traceFrame);
+	    const Mat& origFrame = frames[slot].frame.image;
+	    FileData& fileData = frames[slot].work.fileData;
+	    fileData.frameCount = ++frameCount;
+	    fileData.safetyFrameCount = fileData.frameCount;
+	    lastSlot = slot;
+
+	    int found = fileData.found;
+	    if ((found != foundLast) || opts.verbose()) {
+		{
+		    TraceScope write(tracer, "write_image");
+		    opts.writeToChangeDir(origFrame, frameCount);
+		}
+		if (eventLog.isOpen()) {
+		    if (found != foundLast) {
+			eventLog.stateChange(frameCount, foundLast, found,
+					     frameCount / timer.secsElapsed());
+		    }
+		} else {
+		    Filter::printFrameRate(cout, timer.secsElapsed(), fileData);
+		    publisher.printLatency(cout) << "\n";
+		}
+		foundLast = found;
+	    } else {
+		TraceScope write(tracer, "write_image");
+		opts.writePeriodic(origFrame, frameCount);
+	    }
+
+	    const FilterFrame& work = frames[slot].work;
+	    publisher.publish(fileData, frames[slot].frame.stamp, work.candidates, work.winner);
+	    countResult(metrics, fileData.found);
+	    eventLog.frameResult(fileData, work.candidates.size());
+	    if (frameCount == 1) {
+		startup.add("first_result", frames[slot].frame.stamp.captureNanos);
+		startup.print(cout) << "\n";
+	    }
+	    viewer.offer(origFrame, filter, work);
+
+	    // Hang on to last slot when interrupted so we can dump it below
+	    return !isInterrupted;
+	});
+
+	for (int i = 0; i < pipeline.getStageCount(); i++) {
+	    const string& name = pipeline.getConfig(i).name;
+	    metrics.addStage(name, &pipeline.getStats(i).latency);
+	    metrics.addGauge("avc_queue_depth{stage=\"" + name + "\"}",
+			     "Frame slots waiting for each pipeline stage.",
+			     [&pipeline, i]() { return pipeline.getQueueDepth(i); });
+	}
+
+	timer.start();
+	metrics.markStart();
+	pipeline.start();
+
+	while (pipeline.isRunning() && !isInterrupted) {
+	    avc::Timer::sleep(0.1);
+	    if (traceRequested) {
+		writeTrace(opts, tracer);
+	    }
+	}
+	pipeline.stop();
+
+	// Stop serving before the stage histograms and queue depth gauges
+	// (owned by the pipeline) go away
+	metrics.stopServer();
+
+	float secs = timer.secsElapsed();
+	pipeline.printStats(cout, secs);
+
+	if (lastSlot >= 0) {
+	    const FilterFrame& last = frames[lastSlot].work;
+	    Filter::printFrameRate(cout, secs, last.fileData);
+	    publisher.printLatency(cout) << "\n";
+	    filter.writeImages(last, opts.getOutputDir() + "/avc-vision",
+			       frames[lastSlot].frame.image, true);
+	} else {
+	    cout << "***ERROR*** Failed to read/process any video frames from camera\n";
+	    eventLog.error(0, "no video frames read");
+	}
+
+	for (PipelineSlot& frame : frames) {
+	    source.release(frame.frame);
+	}
+    }
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+namespace {
+    const char* foundName(int found) {
+	return (found == Found::Red) ? "red"
+	    : ((found == Found::Yellow) ? "yellow"
+	       : ((found == Found::None) ? "none" : "unknown"));
+    }
+
+    /** Read a whole file (false if it couldn't be). */
+    bool readFile(const string& fileName, vector<uchar>& bytes) {
+	ifstream in(fileName.c_str(), ios::binary);
+	bytes.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+	return !in.bad() && !bytes.empty();
+    }
+
+    /**
+     * Runs every image in a dataset pack through the filter (images are
+     * used in place in the mapping, nothing is decoded or copied).
+     * Images with results in the cache (-C CACHE_DIR) still valid for
+     * the current settings aren't filtered again.
+     *
+     * @return Number of images where the result differed from the one
+     * expected (-1 if the pack couldn't be opened).
+     */
+    int evaluatePack(const Options& opts, Filter& filter) {
+	DatasetPack pack;
+	if (!pack.open(opts.getPackFile())) {
+	    return -1;
+	}
+
+	ResultCache cache;
+	if (!opts.getCacheDir().empty() && !cache.open(opts.getCacheDir(), filter)) {
+	    return -1;
+	}
+
+	int found = 0;
+	int checked = 0;
+	int images = 0;
+	vector<size_t> mismatches;
+	avc::Timer timer;
+
+	for (size_t i = 0; (i < pack.size()) && !isInterrupted; i++) {
+	    int result;
+	    CachedResult cached;
+	    uint64_t contentHash = cache.isOpen() ? hashImage(pack.image(i)) : 0;
+	    if (cache.lookup(contentHash, cached)) {
+		result = cached.fileData.found;
+	    } else {
+		result = filter.filter(pack.image(i));
+		cache.store(contentHash, filter.getFrame());
+	    }
+	    images++;
+	    found += (result != Found::None);
+
+	    int expected = pack.expected(i);
+	    bool known = (expected != DATASET_PACK_UNKNOWN);
+	    checked += known;
+	    if (known && (result != expected)) {
+		mismatches.push_back(i);
+	    }
+
+	    if (opts.verbose()) {
+		cout << pack.path(i) << ": " << foundName(result)
+		     << " (expected " << foundName(expected) << ")\n";
+	    }
+	}
+
+	filter.printFrameRate(cout, timer.secsElapsed());
+	if (cache.isOpen()) {
+	    cout << cache.getHits() << " results from " << opts.getCacheDir() << ", "
+		 << cache.getMisses() << " images filtered\n";
+	}
+	cout << "\nFound stanchion in " << found << " of the "
+	     << images << " images, "
+	     << (checked - mismatches.size()) << " of " << checked
+	     << " matched their expected result\n\n";
+
+	for (size_t i : mismatches) {
+	    cout << "  " << pack.path(i) << " [" << pack.label(i) << "] expected "
+		 << foundName(pack.expected(i)) << "\n";
+	}
+
+	return mismatches.size();
+    }
 }
 
 // ---------------------------------------------------------------------
@@ -573,6 +1792,11 @@ namespace {
 #if ENABLE_MAIN
 
 int main(int argc, char* argv[]) {
+    // Time to the first result is what counts after a reboot or crash
+    // (process start to here is spent loading libraries)
+    StartupPhases startup;
+    startup.add("load", startup.getStartNanos());
+
     signal(SIGINT, interrupted);
     signal(SIGTERM, interrupted);
 
@@ -582,14 +1806,66 @@ int main(int argc, char* argv[]) {
 	return 1;
     }
 
+    Metrics metrics;
+    if (!opts.getMetricsSocket().empty()) {
+	metrics.startServer(opts.getMetricsSocket());
+    }
+
+    bool streaming = !opts.isFileMode() && opts.getPackFile().empty();
+
+    // Binary log in place of the console output (-L LOG_FILE)
+    EventLog eventLog;
+    if (streaming && !opts.getEventLogFile().empty()) {
+	if (!eventLog.open(opts.getEventLogFile())) {
+	    return 1;
+	}
+	metrics.addGauge("avc_event_log_dropped_total",
+			 "Event log records dropped as a thread's buffer was full.",
+			 [&eventLog]() { return eventLog.getDropped(); }, true);
+    }
+
+    // Frames come from the camera unless told otherwise (-s SOURCE),
+    // opened while the filter loads its configuration if it can be
+    const string& sourceSpec = opts.getFrameSource();
+    int buffers = opts.isPipelined() ? PIPELINE_SLOTS : 2;
+    future<unique_ptr<FrameSource>> opening;
+    if (streaming && !sourceNeedsFilter(sourceSpec)) {
+	opening = async(launch::async, [&]() {
+	    return openSource(sourceSpec, 0, buffers, metrics, eventLog, startup);
+	});
+    }
+
+    int64_t filterStart = monotonicNanos();
     Filter filter;
     filter.setRedEnabled(opts.isRedEnabled());
     filter.setYellowEnabled(opts.isYellowEnabled());
+    filter.setDetector(opts.getDetector());
+    filter.setBlur(opts.isBlur());
+    filter.setImageFormat(opts.getImageFormat());
+    filter.setContactSheet(opts.isContactSheet());
+    startup.add("filter", filterStart);
+
+    // Counters are per thread, so only the sequential modes can profile
+    StageProfiler profiler(FILTER_STAGE_NAMES, FILTER_STAGE_COUNT);
+    if (opts.isProfiling()) {
+	if (opts.isPipelined()) {
+	    cerr << "Stage profiling (-P) is not available with -t, ignoring\n";
+	} else {
+	    profiler.open();
+	    filter.setProfiler(&profiler);
+	}
+    }
+
+    // Stage timeline (-T), SIGUSR1 writes what has been recorded so far
+    unique_ptr<Tracer> tracer;
+    if (!opts.getTraceFile().empty()) {
+	tracer.reset(new Tracer());
+	filter.setTracer(tracer.get());
+	signal(SIGUSR1, requestTrace);
+    }
 
     // If processing a single file (-f FILE)
     if (opts.isFileMode()) {
-        Mat orig = imread(opts.getImageFile());
-
         // Create base name for output files
         string baseName(opts.getImageFile());
         int pos = baseName.rfind('.');
@@ -597,79 +1873,236 @@ int main(int argc, char* argv[]) {
             baseName.erase(pos);
         }
 
+	// Same image filtered with the same settings before (-C CACHE_DIR)?
+	ResultCache cache;
+	vector<uchar> bytes;
+	uint64_t contentHash = 0;
+	if (!opts.getCacheDir().empty()) {
+	    if (!cache.open(opts.getCacheDir(), filter)) {
+		return 1;
+	    }
+	    CachedResult cached;
+	    if (readFile(opts.getImageFile(), bytes)) {
+		// Images are written next to the input, so only a run that
+		// wrote them for the same base name counts
+		contentHash = hashBytes(bytes.data(), bytes.size());
+		contentHash = hashBytes(baseName.data(), baseName.size(), contentHash);
+		if (cache.lookup(contentHash, cached)) {
+		    Filter::printFrameRate(cout, 0, cached.fileData);
+		    cout << "(cached result, images were written by an earlier run)\n";
+		    return (cached.fileData.found == Found::None ? 1 : 0);
+		}
+	    }
+	}
+
+        Mat orig = bytes.empty() ? imread(opts.getImageFile()) : imdecode(bytes, IMREAD_COLOR);
+
         avc::Timer timer;
-        Found found = filter.filter(orig);
+        Found found;
+	{
+	    TraceScope scope(tracer.get(), "filter", 1);
+	    found = filter.filter(orig);
+	}
+	writeTrace(opts, tracer.get());
 
 	filter.printFrameRate(cout, timer.secsElapsed());
+	if (opts.isProfiling()) {
+	    profiler.print(cout);
+	}
 
         // Write out individual image files
         filter.writeImages(baseName, orig, false);
+	if (!bytes.empty()) {
+	    cache.store(contentHash, filter.getFrame());
+	}
 
         // Return 0 to parent process if we found image (for scripting)
         return (found == Found::None ? 1 : 0);
     }
 
-    // Video processing
-    VideoCapture videoFeed(0);
-    {
-	int attempts = 0;
-	while (!videoFeed.isOpened()) {
-	    float waitSecs = 3;
-	    attempts++;
-	    cerr << "Failed to open camera on attempt " << attempts
-		 << ", trying again in "
-		 << waitSecs << " seconds.\n";
-	    avc::Timer::sleep(waitSecs);
-	    if (isInterrupted) {
-			return 1;
-	    }
-	    videoFeed.release();
-	    videoFeed.open(0);
+    // If evaluating a dataset pack (-D PACK_FILE)
+    if (!opts.getPackFile().empty()) {
+	int mismatches;
+	{
+	    TraceScope scope(tracer.get(), "pack");
+	    mismatches = evaluatePack(opts, filter);
+	}
+	writeTrace(opts, tracer.get());
+	if (opts.isProfiling()) {
+	    profiler.print(cout);
 	}
+	return (mismatches == 0) ? 0 : 1;
     }
 
-    videoFeed.set(CV_CAP_PROP_FRAME_WIDTH, 320);
-    videoFeed.set(CV_CAP_PROP_FRAME_HEIGHT, 240);
-
-    Mat origFrame;
+    unique_ptr<FrameSource> source = opening.valid() ? opening.get()
+	: openSource(sourceSpec, &filter, buffers, metrics, eventLog, startup);
+    if (!source) {
+	// Event log gauge reads a local destroyed before metrics
+	metrics.stopServer();
+	return 1;
+    }
+    metrics.addGauge("avc_startup_seconds",
+		     "Seconds from process start to the end of the last startup phase"
+		     " (the first published result once there is one).",
+		     [&startup]() { return startup.getSecs(); });
+    if (source->getConvertLatency() != 0) {
+	metrics.addStage("convert", source->getConvertLatency());
+    }
+    FrameRingSource* ring = dynamic_cast<FrameRingSource*>(source.get());
+    if (ring != 0) {
+	metrics.addGauge("avc_ring_skipped_total",
+			 "Shared frames replaced by newer ones before we took them.",
+			 [ring]() { return ring->getSkipped(); }, true);
+    }
 
     // Where to write out information about what we see
-    ofstream stanchionsFile(opts.getStanchionsFile());
+    Publisher publisher(opts.getStanchionsFile());
+    publisher.openNotifier();
+    if ((opts.getRingRecords() > 0) && publisher.openRing(opts.getRingRecords())) {
+	// Ring consumers want to see everything, not just the winner
+	filter.setSearchAllColors(true);
+    }
+
+    metrics.addStage("capture_to_publish", &publisher.getLatency());
+    metrics.addGauge("avc_dropped_frames_total", "Camera frames we never saw.",
+		     [&publisher]() { return publisher.getDroppedFrames(); }, true);
+
+    // Debug images for anyone watching (-V PORT[:FPS])
+    DebugViewer viewer;
+    if ((opts.getViewerPort() > 0) && viewer.start(opts.getViewerPort(), opts.getViewerFps())) {
+	metrics.addGauge("avc_viewer_snapshots_total", "Frames copied for debug viewers.",
+			 [&viewer]() { return viewer.getSnapshots(); }, true);
+	metrics.addGauge("avc_viewer_skipped_total",
+			 "Debug viewer snapshots skipped as the last was still being encoded.",
+			 [&viewer]() { return viewer.getSkipped(); }, true);
+    }
+
+    if (opts.isPipelined()) {
+	runPipelined(opts, filter, *source, publisher, metrics, tracer.get(), viewer, eventLog,
+		     startup);
+	writeTrace(opts, tracer.get());
+	return 0;
+    }
+
+    // Images ready before the first frame arrives
+    if (source->getFrameSize().area() > 0) {
+	int64_t prepareStart = monotonicNanos();
+	filter.prepare(source->getFrameSize());
+	startup.add("prepare", prepareStart);
+    }
 
-    // Get initial frame and toss (incase first one is bad)
-    videoFeed >> origFrame;
+    LatencyHistogram captureLatency, filterLatency, publishLatency;
+    metrics.addStage("capture", &captureLatency);
+    metrics.addStage("filter", &filterLatency);
+    metrics.addStage("publish", &publishLatency);
 
     avc::Timer timer;
+    metrics.markStart();
 
     int foundLast = -1;
 
+    Tracer* trace = tracer.get();
+
+    // Frame being processed and the one before (kept until the next
+    // arrives so there's always a frame to dump on exit)
+    Frame frame, previous;
+
     while (!isInterrupted) {
-        videoFeed >> origFrame;
+	int frameNumber = filter.getFileData().frameCount + 1;
+	TraceScope frameScope(trace, "frame", frameNumber);
+
+	int64_t captureStart = monotonicNanos();
+	bool captured;
+	{
+	    TraceScope scope(trace, "capture");
+	    captured = source->acquire(frame);
+	}
+	if (!captured) {
+	    // End of recorded input (or camera stopped delivering frames)
+	    break;
+	}
+	source->release(previous);
+	const Mat& origFrame = frame.image;
+	int64_t filterStart = monotonicNanos();
+	captureLatency.record(filterStart - captureStart);
+
+	int found;
+	{
+	    TraceScope scope(trace, "filter");
+	    found = filter.filter(origFrame);
+	}
+	int64_t publishStart = monotonicNanos();
+	filterLatency.record(publishStart - filterStart);
 
-        int found = filter.filter(origFrame);
 	if ((found != foundLast) || opts.verbose()) {
-	    opts.writeToChangeDir(origFrame, filter.getFileData().frameCount);
-	    filter.printFrameRate(cout, timer.secsElapsed());
+	    {
+		TraceScope scope(trace, "write_image");
+		opts.writeToChangeDir(origFrame, filter.getFileData().frameCount);
+	    }
+	    if (eventLog.isOpen()) {
+		if (found != foundLast) {
+		    int frameCount = filter.getFileData().frameCount;
+		    eventLog.stateChange(frameCount, foundLast, found,
+					 frameCount / timer.secsElapsed());
+		}
+	    } else {
+		filter.printFrameRate(cout, timer.secsElapsed());
+		publisher.printLatency(cout) << "\n";
+	    }
 	    foundLast = found;
 	} else {
 	    // No change in detection state, however, go write out image
 	    // if user enabled the periodic feature (-p PERIODIC) and we've
 	    // reached the periodic count
+	    TraceScope scope(trace, "write_image");
 	    opts.writePeriodic(origFrame, filter.getFileData().frameCount);
 	}
 
-	stanchionsFile.seekp(0);
-	stanchionsFile.write((const char*) &filter.getFileData(), sizeof(FileData));
-	stanchionsFile.flush();
+	{
+	    TraceScope scope(trace, "publish");
+	    FileData results = filter.getFileData();
+	    publisher.publish(results, frame.stamp, filter.getCandidates(), filter.getWinner());
+	    countResult(metrics, results.found);
+	    eventLog.frameResult(results, filter.getCandidates().size());
+	    if (results.frameCount == 1) {
+		startup.add("first_result", frame.stamp.captureNanos);
+		startup.print(cout) << "\n";
+	    }
+	}
+	int64_t publishNanos = monotonicNanos() - publishStart;
+	publishLatency.record(publishNanos);
+	if (eventLog.isOpen()) {
+	    eventLog.timing(frameNumber, "capture", filterStart - captureStart);
+	    eventLog.timing(frameNumber, "filter", publishStart - filterStart);
+	    eventLog.timing(frameNumber, "publish", publishNanos);
+	}
+	viewer.offer(origFrame, filter, filter.getFrame());
+
+	if (traceRequested) {
+	    writeTrace(opts, trace);
+	}
+
+	previous = frame;
+	frame = Frame();
     }
 
     if (filter.getFileData().frameCount > 0) {
 	filter.printFrameRate(cout, timer.secsElapsed());
+	publisher.printLatency(cout) << "\n";
+	if (opts.isProfiling()) {
+	    profiler.print(cout);
+	}
 
-	filter.writeImages(opts.getOutputDir() + "/avc-vision", origFrame, true);
+	filter.writeImages(opts.getOutputDir() + "/avc-vision", previous.image, true);
     } else {
 	cout << "***ERROR*** Failed to read/process any video frames from camera\n";
+	eventLog.error(0, "no video frames read");
     }
+    source->release(previous);
+
+    // Stop serving before the histograms and gauges it reads go away
+    metrics.stopServer();
+    writeTrace(opts, trace);
 
     return 0;
 }
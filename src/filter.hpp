@@ -1,14 +1,173 @@
 #pragma once
 
+#include "boxblur.hpp"
 #include "filedata.hpp"
+#include "filterkernels.hpp"
+#include "groundrange.hpp"
+#include "rowengine.hpp"
+#include "perfcounters.hpp"
+#include "trace.hpp"
 
 #include <opencv2/opencv.hpp>
 
+#include <algorithm>
 #include <string>
 #include <iostream>
 
 namespace vision {
 
+    /**
+     * Outcome of checking a shape, in the order the checks are made
+     * (cheap tests on the raw contour bounds first, polygon fit last).
+     */
+    enum Verdict {
+	// Passed isPossibleStanchion()
+	Accepted,
+	// Contour bounds too narrow or too short
+	TooSmall,
+	// Contour can't be at the right height in the image
+	BadPosition,
+	// Right edge can't be near the center of the image
+	OffCenter,
+	// Rejected by isPossibleStanchion() after fitting the polygon
+	BadShape
+    };
+
+    /**
+     * How stanchions are found in a color reduced image.
+     */
+    enum Detector {
+	// Threshold, erode, dilate, trace contours and fit polygons
+	ContourDetector,
+	// Column and row occupancy of the color mask (see profiledetector.hpp)
+	ProfileDetector,
+	// Same masks and contours as the ContourDetector, but made a few
+	// rows at a time (see rowengine.hpp) and only traced if a blob in
+	// the mask could pass checkBounds()
+	StreamDetector
+    };
+
+    /**
+     * How Filter::writeImages() encodes debug images (trading file size
+     * for time spent writing them).
+     */
+    enum ImageFormat {
+	// PNG at OpenCV's default compression
+	PngImages,
+	// PNG at the lowest compression level (much faster, a bit larger)
+	FastPngImages,
+	// PNG without compression (stored, just filtered and checksummed)
+	RawPngImages,
+	// Uncompressed BMP (fastest, largest)
+	BmpImages
+    };
+
+    /** Short name of a verdict (for debug output). */
+    const char* verdictName(Verdict verdict);
+
+    /**
+     * A shape found in a color reduced image (only Accepted ones are
+     * stanchion candidates).
+     */
+    struct Candidate {
+	// Bounding box (in cropped image coordinates) of the polygon if
+	// one was fitted, otherwise of the raw contour
+	cv::Rect bbox;
+	// Which color filter found it
+	Found color;
+	// How we rank candidates of the same color (box height in pixels,
+	// the tallest one wins)
+	int score;
+	// Approximated polygon (empty if rejected before fitting one)
+	std::vector<cv::Point> polygon;
+	// Why the shape was rejected (or Accepted)
+	Verdict verdict;
+    };
+
+    /**
+     * Working buffers for a single frame as it moves through the filter
+     * stages. The Filter keeps one of these for the normal sequential
+     * filter() call, the pipelined executor keeps one per frame slot so
+     * several frames can be in flight at once.
+     */
+    struct FilterFrame {
+	// Size of the original frame (cropped is the part searched)
+	cv::Size frameSize;
+	cv::Mat cropped;
+	cv::Mat colorTransformed;
+	// Column sums and strip used when blurring (see Filter::setBlur())
+	smooth::BlurScratch blurScratch;
+	// Color reduced images (indexed by Found::Yellow and Found::Red)
+	cv::Mat colorReduced[3];
+	cv::Mat redLower;
+	cv::Mat grayScale;
+	cv::Mat bw;
+	cv::Mat eroded;
+	cv::Mat dilated;
+	// Scratch copy handed to findContours (which modifies its input)
+	cv::Mat contourScratch;
+	// Pixels set in each column of the color reduced images (only
+	// filled in by the ProfileDetector)
+	std::vector<int> columnFill[3];
+	// Line buffers, dilated masks and blobs (only filled in by the
+	// StreamDetector)
+	RowEngine rowEngine;
+
+	// Contours found (if any) for lastSearched
+	std::vector<std::vector<cv::Point>> contours;
+	std::vector<cv::Vec4i> hierarchy;
+
+	// Color the bw, eroded, ... images, contours and shapes are for
+	// (the winner's when another color was searched after it was found)
+	Found lastSearched;
+
+	// Which colors were searched (indexed by Found::Yellow and Found::Red)
+	bool searched[3];
+
+	// Every shape checked for lastSearched (one per entry in
+	// contours, in the same order)
+	std::vector<Candidate> shapes;
+
+	// Masks, contours and shapes of a color searched after the winner
+	// was found (see Filter::setSearchAllColors()), kept apart so the
+	// ones above stay the winner's
+	cv::Mat otherBw;
+	cv::Mat otherEroded;
+	cv::Mat otherDilated;
+	std::vector<std::vector<cv::Point>> otherContours;
+	std::vector<cv::Vec4i> otherHierarchy;
+	std::vector<Candidate> otherShapes;
+	Found otherSearched;
+
+	// Every candidate found (for each color searched) in this frame
+	// and index of the one reported in fileData (-1 if none)
+	std::vector<Candidate> candidates;
+	int winner;
+
+	// Results of processing this frame
+	FileData fileData;
+
+	FilterFrame();
+    };
+
+    /**
+     * Stages of the filter timed when a StageProfiler is attached (see
+     * Filter::setProfiler()).
+     */
+    enum FilterStage {
+	StageConvert,
+	StageReduce,
+	StageThreshold,
+	StageErode,
+	StageDilate,
+	StageContours,
+	StageCandidates,
+	FILTER_STAGE_COUNT
+    };
+
+    /** Names of each FilterStage (for StageProfiler). */
+    extern const char* const FILTER_STAGE_NAMES[FILTER_STAGE_COUNT];
+
     /**
      * Filter which attempts to find a yellow or red stanchion in an image
      * (assumes only one will be found and prefers yellow over red).
@@ -33,6 +192,194 @@ namespace vision {
          */
         Found filter(const cv::Mat& mat);
 
+        /**
+         * First half of the filter split out so it can run on its own
+         * thread: crops, converts color space and builds the color
+         * reduced image for each enabled color.
+         *
+         * @param mat Matrix containing original image data in BGR form.
+         *
+         * @param frame Where to store the intermediate images (only
+         * the frame is modified, so different threads may classify
+         * different frames with the same Filter).
+         */
+        void classify(const cv::Mat& mat, FilterFrame& frame) const;
+
+        /**
+         * Second half of the filter: searches the color reduced images
+         * produced by classify() for a stanchion (yellow first, then red).
+         *
+         * @param frame Frame previously passed to classify(). The box
+         * information in frame.fileData is updated (frame counts are
+         * left alone for the caller to manage).
+         *
+         * @return Found::None, Found::Red or Found::Yellow.
+         */
+        Found locate(FilterFrame& frame) const;
+
+        /**
+         * Runs a blank frame through the filter so the images of a
+         * frame are allocated (and their memory touched) before the
+         * first real frame arrives. Nothing is profiled or traced and
+         * frame counts are left alone.
+         *
+         * @param frame Frame to prepare for classify() and locate().
+         * @param frameSize Size of the frames that will be filtered.
+         */
+        void prepare(FilterFrame& frame, cv::Size frameSize);
+
+        /** Prepare the frame used by filter() (see above). */
+        void prepare(cv::Size frameSize) { prepare(_frame, frameSize); }
+
+        /**
+         * Part of a frame the filter looks at (anything outside is
+         * cropped off before processing).
+         *
+         * @param frameSize Size of the original image.
+         */
+        static cv::Rect getCropWindow(cv::Size frameSize) {
+	    // Need to adjust this if we move/tilt camera
+	    return cv::Rect(50, 10, frameSize.width - 50, frameSize.height - 50);
+	}
+
+        /**
+         * Crops, blurs (if enabled, see setBlur()) and converts image to
+         * HSV color space (first step of classify()).
+         */
+        void convertColor(const cv::Mat& src, FilterFrame& frame) const;
+
+        /**
+         * Builds the color reduced image for a color from the frame's
+         * HSV image (second step of classify()).
+         */
+        void reduceColor(FilterFrame& frame, Found color) const;
+
+        /**
+         * Builds the color reduced image of every enabled color in a
+         * single pass over the HSV image (with the kernel compiled for
+         * the enabled colors, see filterkernels.hpp).
+         */
+        void reduceColors(FilterFrame& frame) const;
+
+        /**
+         * Thresholds, erodes and dilates a color reduced image into
+         * the frame's black and white mask (frame.dilated).
+         */
+        void buildMask(FilterFrame& frame, Found color) const;
+
+        /**
+         * Searches the mask built by buildMask() for shapes that could
+         * be stanchions, appending them to frame.candidates.
+         *
+         * @return Index of tallest candidate found (-1 if none).
+         */
+        int findCandidates(FilterFrame& frame, Found color) const;
+
+        /**
+         * ProfileDetector alternative to buildMask() and findCandidates():
+         * finds vertical objects from the column counts made by
+         * reduceColor() and applies the same box rules as
+         * isPossibleStanchion() (except the polygon point count).
+         *
+         * @return Index of tallest candidate found (-1 if none).
+         */
+        int findProfileCandidates(FilterFrame& frame, Found color) const;
+
+        /**
+         * StreamDetector alternative to buildMask() and findCandidates():
+         * takes the dilated mask the row engine built and only traces
+         * contours in it if one of its blobs passes checkBounds() (an
+         * outer contour's box lies within its blob's box, so none could
+         * pass otherwise).
+         *
+         * @return Index of tallest candidate found (-1 if none).
+         */
+        int findStreamCandidates(FilterFrame& frame, Found color) const;
+
+        /**
+         * Select how stanchions are found (ContourDetector by default).
+         */
+        void setDetector(Detector detector) {
+	    _detector = detector;
+	    selectKernels();
+	}
+
+        /** How stanchions are found. */
+        Detector getDetector() const { return _detector; }
+
+        /**
+         * Smooth the image with a 3x3 box blur before converting it to
+         * HSV (off by default). Gives cleaner masks in low light, the
+         * blur is done as part of the color conversion (see boxblur.hpp).
+         */
+        void setBlur(bool enable) {
+	    _blur = enable;
+	    selectKernels();
+	}
+
+        /** Whether images are blurred before converting them to HSV. */
+        bool isBlur() const { return _blur; }
+
+        /**
+         * Reads color ranges (red then yellow) from a configuration file.
+         *
+         * @param fileName Values file to read.
+         *
+         * @return true if all values were read.
+         */
+        bool loadConfig(const std::string& fileName = "/etc/avc.conf.d/values.txt");
+
+        /**
+         * Reads the camera model used to estimate range and bearing of
+         * what is found (see groundrange.hpp). Until one is read, the
+         * model fitted to the webcam-test images is used.
+         *
+         * @param fileName Range file to read.
+         *
+         * @return true if the model was read.
+         */
+        bool loadRange(const std::string& fileName = "/etc/avc.conf.d/range.txt") {
+	    return _range.load(fileName);
+	}
+
+        /** Range and bearing estimator. */
+        const GroundRange& getRange() const { return _range; }
+
+        /** Color reduction levels (min0, max0, min1, max1, min2, max2) for a color. */
+        const int* getColorRanges(Found color) const {
+	    return (color == Found::Red) ? _redRanges : _yelRanges;
+	}
+
+        /** Replace the color reduction levels for a color (6 values as above). */
+        void setColorRanges(Found color, const int* ranges) {
+	    int* dst = (color == Found::Red) ? _redRanges : _yelRanges;
+	    std::copy(ranges, ranges + 6, dst);
+	}
+
+        /** Structuring element used to erode black and white image. */
+        const cv::Mat& getErosionElement() const { return _erosionElem; }
+
+        /** Structuring element used to dilate eroded image. */
+        const cv::Mat& getDilationElement() const { return _dilationElem; }
+
+        /** How much we can straighten out contours when making polygons. */
+        int getPolyEpsilon() const { return _polyEpsilon; }
+
+	/**
+	 * Cheap checks of the bounds of a raw contour made before fitting
+	 * a polygon to it. The polygon approxPolyDP() fits uses a subset
+	 * of the contour points, so its bounding box lies within the
+	 * contour's: a contour rejected here could never pass
+	 * isPossibleStanchion().
+	 *
+	 * @param img Reference to image (to get dimensions from)
+	 *
+	 * @param bounds Bounding rectangle of the contour.
+	 *
+	 * @return Accepted if a polygon should be fitted, otherwise why not.
+	 */
+	static Verdict checkBounds(const cv::Mat& img, const cv::Rect& bounds);
+
 	/**
 	 * Checks a polygon bounding box to see if it could be a stanchion image.
 	 *
@@ -52,15 +399,71 @@ namespace vision {
         /**
          * Method allows you to enable or disable the search for the red target.
          */
-        void setRedEnabled(bool enable) { _redEnabled = enable; }
+        void setRedEnabled(bool enable) {
+	    _redEnabled = enable;
+	    selectKernels();
+	}
+
+        /** Whether red stanchions are searched for. */
+        bool isRedEnabled() const { return _redEnabled; }
 
         /**
          * Method allows you to enable or disable the search for the yellow target.
          */
-        void setYellowEnabled(bool enable) { _yellowEnabled = enable; }
+        void setYellowEnabled(bool enable) {
+	    _yellowEnabled = enable;
+	    selectKernels();
+	}
+
+        /** Whether yellow stanchions are searched for. */
+        bool isYellowEnabled() const { return _yellowEnabled; }
+
+        /**
+         * Normally we stop looking once a yellow stanchion is found,
+         * enable this to always search every enabled color so the
+         * candidates list has everything seen in the frame (results in
+         * the FileData are the same either way).
+         */
+        void setSearchAllColors(bool enable) { _searchAllColors = enable; }
+
+        /** Whether every enabled color is searched (see above). */
+        bool isSearchAllColors() const { return _searchAllColors; }
+
+        /**
+         * Attach a profiler to collect time and perf counters for each
+         * FilterStage (pass 0 to detach). Counters are per thread, so
+         * only use this when filtering on the thread that opened the
+         * profiler.
+         */
+        void setProfiler(StageProfiler* profiler) { _profiler = profiler; }
+
+        /**
+         * Record begin/end trace events for each FilterStage (pass 0 to
+         * stop). Events are tagged with the frame of the enclosing
+         * TraceScope on the calling thread.
+         */
+        void setTracer(Tracer* tracer) { _tracer = tracer; }
+
+        /** How writeImages() encodes images (PngImages by default). */
+        void setImageFormat(ImageFormat format) { _imageFormat = format; }
+
+        /** How writeImages() encodes images. */
+        ImageFormat getImageFormat() const { return _imageFormat; }
+
+        /**
+         * Have writeImages() tile every step (labelled) into a single
+         * "-steps" image rather than writing a file for each step.
+         */
+        void setContactSheet(bool enable) { _contactSheet = enable; }
+
+        /** Whether writeImages() writes a single contact sheet of the steps. */
+        bool isContactSheet() const { return _contactSheet; }
 
         /**
          * Writes out all image files (from each step of the process).
+         * Images are encoded in parallel in the format set with
+         * setImageFormat() (or tiled into one image, see
+         * setContactSheet()).
          *
          * @param baseName The base name to use for each file name (if
          * you don't include path information, files will be created
@@ -73,51 +476,81 @@ namespace vision {
 	 * well as all the parts.
          */
         void writeImages(const std::string& baseName, const cv::Mat& orig,
-			 bool writeOrig = true) const;
+			 bool writeOrig = true) const {
+	    writeImages(_frame, baseName, orig, writeOrig);
+	}
+
+        /**
+         * Writes out all image files for a specific frame (used when
+         * frames were processed with classify() and locate()).
+         */
+        void writeImages(const FilterFrame& frame, const std::string& baseName,
+			 const cv::Mat& orig, bool writeOrig = true) const;
 
         /** Get color transformed (XYZ, HSV, or whatever color space we switch to). */
-        const cv::Mat& getColorTransformed() const { return _colorTransformed; }
+        const cv::Mat& getColorTransformed() const { return _frame.colorTransformed; }
 
         /** Get color reduced matrix. */
-        const cv::Mat& getColorReduced() const { return _colorReduced; }
+        const cv::Mat& getColorReduced() const { return _frame.colorReduced[_frame.lastSearched]; }
 
         /** Get gray scale matrix. */
-        const cv::Mat& getGrayScale() const { return _grayScale; }
+        const cv::Mat& getGrayScale() const { return _frame.grayScale; }
 
         /** Get black and white matrix. */
-        const cv::Mat& getBW() const { return _bw; }
+        const cv::Mat& getBW() const { return _frame.bw; }
   
+        /** Get all candidates found by last filter. */
+        const std::vector<Candidate>& getCandidates() const { return _frame.candidates; }
+
+        /** Get index of candidate reported in file data (-1 if none). */
+        int getWinner() const { return _frame.winner; }
+
         /** Get file data information (results of last filter). */
-        const FileData& getFileData() const { return _fileData; }
+        const FileData& getFileData() const { return _frame.fileData; }
+
+        /** Get intermediate images and results of last filter. */
+        const FilterFrame& getFrame() const { return _frame; }
+
+        /**
+         * Get the final black and white mask of a frame (the one shapes
+         * were looked for in, for the last color searched).
+         */
+        const cv::Mat& getMask(const FilterFrame& frame) const {
+	    return (_detector == ProfileDetector)
+		? frame.colorReduced[frame.lastSearched] : frame.dilated;
+	}
 
         /** Dump information about results of last image processed. */
-        std::ostream& print(std::ostream& out) const;
+        std::ostream& print(std::ostream& out) const {
+	    return print(out, _frame.fileData);
+	}
+
+        /** Dump information about the results in a FileData structure. */
+        static std::ostream& print(std::ostream& out, const FileData& fileData);
 
 	/** Dump information about last image processes and total FPS.
 	 *
 	 * @param out Where to write the information.
 	 * @param secs How many total seconds have elapsed.
 	 */
-	std::ostream& printFrameRate(std::ostream& out, float secs) const;
+	std::ostream& printFrameRate(std::ostream& out, float secs) const {
+	    return printFrameRate(out, secs, _frame.fileData);
+	}
+
+	/** Dump information about a frame's results and total FPS. */
+	static std::ostream& printFrameRate(std::ostream& out, float secs,
+					    const FileData& fileData);
 
     private:
-        void loadConfig();
-        Found filterColorRange(const int* ranges, Found colorToFind);
-
-	cv::Mat _cropped;
-	cv::Mat _blurred;
-        cv::Mat _colorTransformed;
-        cv::Mat _colorReduced;
-	cv::Mat _redLower;
-        cv::Mat _grayScale;
-        cv::Mat _bw;
-	cv::Mat _dilated;
+        void selectKernels();
+        Found searchColors(FilterFrame& frame, bool reduce) const;
+        int filterColorRange(FilterFrame& frame, Found colorToFind) const;
+
 	cv::Mat _dilationElem;
-	cv::Mat _eroded;
 	cv::Mat _erosionElem;
 
-	// Contours found (if any)
-	std::vector<std::vector<cv::Point>> _contours;
+	// Intermediate images and results of last call to filter()
+	FilterFrame _frame;
 
 	// How much we can straighten out contours when making polygons
 	int _polyEpsilon;
@@ -126,14 +559,37 @@ namespace vision {
         int _yelRanges[6];
         int _redRanges[6];
 
-        FileData _fileData;
-
         // Whether or not the red filter is enabled (normally is
         // unless debugging yellow)
         bool _redEnabled;
         // Whether or not the yellow filter is enabled (normally is
         // unless debugging red)
         bool _yellowEnabled;
+        // Whether to keep searching for red after finding yellow
+        bool _searchAllColors;
+
+        // How stanchions are found in color reduced images
+        Detector _detector;
+
+        // Whether to blur before converting to HSV
+        bool _blur;
+
+        // Per pixel work compiled for the settings above (picked by
+        // selectKernels() whenever they change, the reduce kernel is 0
+        // if there is none for the settings)
+        kernels::ConvertKernel _convertKernel;
+        kernels::ReduceKernel _reduceKernel;
+
+        // Optional per stage instrumentation (not owned)
+        StageProfiler* _profiler;
+        Tracer* _tracer;
+
+        // How writeImages() writes out images
+        ImageFormat _imageFormat;
+        bool _contactSheet;
+
+        // Turns boxes into range and bearing
+        GroundRange _range;
     };
 
     // Helper method to dump information about Filter to output stream
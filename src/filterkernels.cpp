@@ -0,0 +1,168 @@
+#include "filterkernels.hpp"
+#include "boxblur.hpp"
+#include "filter.hpp"
+
+using namespace cv;
+using namespace vision;
+using namespace std;
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+namespace {
+
+    void crop(const Mat& src, FilterFrame& frame) {
+	frame.cropped = src(Filter::getCropWindow(src.size()));
+    }
+
+    template <bool Blur>
+    void convert(const Mat& src, FilterFrame& frame) {
+	frame.cropped = src(Filter::getCropWindow(src.size()));
+	if (Blur) {
+	    smooth::blurToHsv(frame.cropped, frame.colorTransformed, frame.blurScratch);
+	} else {
+	    cvtColor(frame.cropped, frame.colorTransformed, COLOR_BGR2HSV);
+	}
+    }
+
+    /**
+     * Reduces every compiled in color a row at a time (the HSV row is
+     * still in cache when the second color reads it).
+     */
+    template <bool Yellow, bool Red, bool CountColumns>
+    void reduce(FilterFrame& frame, const int* yelRanges, const int* redRanges) {
+	const Mat& hsv = frame.colorTransformed;
+	int rows = hsv.rows;
+	int cols = hsv.cols;
+	kernels::HsvRange<false> yellow(yelRanges);
+	kernels::HsvRange<true> red(redRanges);
+
+	Mat& yelMask = frame.colorReduced[Found::Yellow];
+	Mat& redMask = frame.colorReduced[Found::Red];
+	int* yelCounts = 0;
+	int* redCounts = 0;
+	if (Yellow) {
+	    yelMask.create(rows, cols, CV_8UC1);
+	    if (CountColumns) {
+		frame.columnFill[Found::Yellow].assign(cols, 0);
+		yelCounts = frame.columnFill[Found::Yellow].data();
+	    }
+	}
+	if (Red) {
+	    redMask.create(rows, cols, CV_8UC1);
+	    if (CountColumns) {
+		frame.columnFill[Found::Red].assign(cols, 0);
+		redCounts = frame.columnFill[Found::Red].data();
+	    }
+	}
+
+	for (int y = 0; y < rows; y++) {
+	    const uchar* src = hsv.ptr(y);
+	    if (Yellow) {
+		yellow.reduceRow<CountColumns>(src, cols, yelMask.ptr(y), yelCounts);
+	    }
+	    if (Red) {
+		red.reduceRow<CountColumns>(src, cols, redMask.ptr(y), redCounts);
+	    }
+	}
+    }
+
+    /**
+     * Streams the cropped frame through every stage up to the dilated
+     * mask a strip of rows at a time. A mask of 0 and 255 values is
+     * unchanged by the threshold at 32, so reduced rows go straight to
+     * erosion.
+     */
+    template <bool Yellow, bool Red, bool Blur>
+    void stream(FilterFrame& frame, const int* yelRanges, const int* redRanges) {
+	const Mat& bgr = frame.cropped;
+	int rows = bgr.rows;
+	int cols = bgr.cols;
+	kernels::HsvRange<false> yellow(yelRanges);
+	kernels::HsvRange<true> red(redRanges);
+
+	RowEngine& engine = frame.rowEngine;
+	MorphLane& yelLane = engine.lanes[Found::Yellow];
+	MorphLane& redLane = engine.lanes[Found::Red];
+	if (Yellow) {
+	    yelLane.start(rows, cols);
+	}
+	if (Red) {
+	    redLane.start(rows, cols);
+	}
+	if (Blur) {
+	    smooth::startBlur(bgr, frame.blurScratch);
+	}
+
+	engine.hsvStrip.create(RowEngine::STRIP_ROWS, cols, CV_8UC3);
+	for (int y0 = 0; y0 < rows; y0 += RowEngine::STRIP_ROWS) {
+	    int count = min((int) RowEngine::STRIP_ROWS, rows - y0);
+	    Mat hsv = engine.hsvStrip.rowRange(0, count);
+	    if (Blur) {
+		smooth::blurRows(bgr, count, frame.blurScratch, hsv);
+	    } else {
+		cvtColor(bgr.rowRange(y0, y0 + count), hsv, COLOR_BGR2HSV);
+	    }
+
+	    for (int s = 0; s < count; s++) {
+		const uchar* src = hsv.ptr(s);
+		if (Yellow) {
+		    yellow.reduceRow<false>(src, cols, yelLane.maskRow(), 0);
+		    yelLane.push(yelLane.maskRow());
+		}
+		if (Red) {
+		    red.reduceRow<false>(src, cols, redLane.maskRow(), 0);
+		    redLane.push(redLane.maskRow());
+		}
+	    }
+	}
+    }
+
+    // Indexed by [yellow][red][countColumns]
+    const kernels::ReduceKernel REDUCE_KERNELS[2][2][2] = {
+	{
+	    { 0, 0 },
+	    { &reduce<false, true, false>, &reduce<false, true, true> }
+	},
+	{
+	    { &reduce<true, false, false>, &reduce<true, false, true> },
+	    { &reduce<true, true, false>, &reduce<true, true, true> }
+	}
+    };
+
+    // Indexed by [yellow][red][blur]
+    const kernels::ReduceKernel STREAM_KERNELS[2][2][2] = {
+	{
+	    { 0, 0 },
+	    { &stream<false, true, false>, &stream<false, true, true> }
+	},
+	{
+	    { &stream<true, false, false>, &stream<true, false, true> },
+	    { &stream<true, true, false>, &stream<true, true, true> }
+	}
+    };
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+kernels::ConvertKernel kernels::selectConvert(bool blur, bool cropOnly) {
+    if (cropOnly) {
+	return &crop;
+    }
+    return blur ? &convert<true> : &convert<false>;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+kernels::ReduceKernel kernels::selectReduce(bool yellow, bool red, bool countColumns) {
+    return REDUCE_KERNELS[yellow][red][countColumns];
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+kernels::ReduceKernel kernels::selectStream(bool yellow, bool red, bool blur) {
+    return STREAM_KERNELS[yellow][red][blur];
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+
+#include <stdint.h>
+
+namespace vision {
+
+    struct FilterFrame;
+
+    /**
+     * Versions of the filter's per pixel work compiled for each
+     * configuration (colors searched, blur, column counts), so the hot
+     * loops test no settings. The Filter picks the ones to use when it
+     * is configured (see selectConvert() and selectReduce()) rather
+     * than checking settings on every frame.
+     */
+    namespace kernels {
+
+	// Highest hue of the red range that wraps around to 0
+	const unsigned WRAP_HUE_MAX = 10;
+
+	/**
+	 * Crops a frame and converts it to HSV (frame.cropped and
+	 * frame.colorTransformed).
+	 */
+	typedef void (*ConvertKernel)(const cv::Mat& src, FilterFrame& frame);
+
+	/**
+	 * Builds the color reduced masks (frame.colorReduced) from the
+	 * HSV image for the colors the kernel was compiled for, counting
+	 * the pixels set in each column (frame.columnFill) if compiled to.
+	 *
+	 * @param yelRanges Yellow reduction levels (min0, max0, ... max2).
+	 * @param redRanges Red reduction levels (hue wraps around).
+	 */
+	typedef void (*ReduceKernel)(FilterFrame& frame, const int* yelRanges,
+				     const int* redRanges);
+
+	/**
+	 * Convert kernel with or without the 3x3 box blur (or one that
+	 * only crops, for the stream kernels which convert as they go).
+	 */
+	ConvertKernel selectConvert(bool blur, bool cropOnly);
+
+	/**
+	 * Reduce kernel for a set of colors.
+	 *
+	 * @return Kernel to use or 0 if there is none for the
+	 * configuration (no colors), in which case use the generic
+	 * Filter::reduceColor().
+	 */
+	ReduceKernel selectReduce(bool yellow, bool red, bool countColumns);
+
+	/**
+	 * Kernel that pushes the cropped frame through HSV conversion
+	 * (blurred if compiled to), color reduction, thresholding, erosion
+	 * and dilation a few rows at a time (see RowEngine). Takes the
+	 * place of the convert, reduce and mask steps: the dilated masks
+	 * and blobs are left in frame.rowEngine.
+	 *
+	 * @return Kernel to use or 0 if there is none (no colors).
+	 */
+	ReduceKernel selectStream(bool yellow, bool red, bool blur);
+
+	/**
+	 * Tests HSV pixels against a color range (inclusive at both ends
+	 * like cv::inRange()), with the red hue wrap compiled in or out.
+	 */
+	template <bool WrapHue>
+	class HsvRange {
+	public:
+	    explicit HsvRange(const int* ranges) :
+		_hLo(ranges[0]), _hSpan(ranges[1] - ranges[0]),
+		_sLo(ranges[2]), _sSpan(ranges[3] - ranges[2]),
+		_vLo(ranges[4]), _vSpan(ranges[5] - ranges[4])
+	    {
+		// Inverted ranges match nothing (an inverted saturation or
+		// value range matches nothing even with the hue wrap)
+		if (ranges[1] < ranges[0]) {
+		    _hLo = NOTHING;
+		    _hSpan = 0;
+		}
+		if ((ranges[3] < ranges[2]) || (ranges[5] < ranges[4])) {
+		    _sLo = NOTHING;
+		    _sSpan = 0;
+		}
+	    }
+
+	    /** Whether an HSV pixel is in range (no branches). */
+	    bool contains(const uchar* hsv) const {
+		// Compare as unsigned so a single test checks both ends of a range
+		unsigned h = hsv[0];
+		bool hueOk = ((h - _hLo) <= _hSpan);
+		if (WrapHue) {
+		    hueOk |= (h <= WRAP_HUE_MAX);
+		}
+		return hueOk & ((hsv[1] - _sLo) <= _sSpan) & ((hsv[2] - _vLo) <= _vSpan);
+	    }
+
+	    /**
+	     * Mask one row (255 where in range) and add the pixels set to
+	     * the column counts if compiled to.
+	     */
+	    template <bool CountColumns>
+	    void reduceRow(const uchar* hsv, int cols, uchar* mask, int* counts) const {
+		for (int x = 0; x < cols; x++, hsv += 3) {
+		    bool set = contains(hsv);
+		    mask[x] = set ? 255 : 0;
+		    if (CountColumns) {
+			counts[x] += set;
+		    }
+		}
+	    }
+
+	private:
+	    // Lower bound no 8 bit value reaches
+	    static const unsigned NOTHING = 0x10000;
+
+	    unsigned _hLo, _hSpan;
+	    unsigned _sLo, _sSpan;
+	    unsigned _vLo, _vSpan;
+	};
+    }
+}
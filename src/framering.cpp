@@ -0,0 +1,301 @@
+#include "framering.hpp"
+#include "Timer.h"
+
+#include <iostream>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace cv;
+using namespace vision;
+using namespace std;
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+namespace {
+    const size_t PAGE = 4096;
+
+    // How long the reader waits for a new frame before giving up
+    const int64_t READ_TIMEOUT_NANOS = 2000000000;
+
+    size_t alignUp(size_t n, size_t alignment) {
+	return ((n + alignment - 1) / alignment) * alignment;
+    }
+
+    size_t dataOffset(uint32_t slots) {
+	return alignUp(sizeof(FrameRingHeader) + slots * sizeof(FrameRingSlot), PAGE);
+    }
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+FrameRingWriter::FrameRingWriter() :
+    _header(0),
+    _slots(0),
+    _data(0),
+    _mappedSize(0),
+    _next(0)
+{
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+FrameRingWriter::~FrameRingWriter() {
+    close();
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+bool FrameRingWriter::open(Size size, int type, int slots, const string& name) {
+    close();
+    if ((slots < 2) || (size.area() == 0)) {
+	return false;
+    }
+
+    size_t elemSize = CV_ELEM_SIZE(type);
+    uint32_t step = alignUp(size.width * elemSize, 64);
+    size_t slotBytes = alignUp((size_t) step * size.height, PAGE);
+    size_t total = dataOffset(slots) + slots * slotBytes;
+
+    int fd = shm_open(name.c_str(), O_CREAT | O_RDWR, 0666);
+    if (fd < 0) {
+	cerr << "Failed to create shared memory " << name << ": " << strerror(errno) << "\n";
+	return false;
+    }
+
+    // Readers claim slots, so one running as another user needs write
+    // access whatever our umask is (fails if the segment was left by
+    // another user, who set it already)
+    fchmod(fd, 0666);
+
+    void* addr = MAP_FAILED;
+    if (ftruncate(fd, total) == 0) {
+	addr = mmap(0, total, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    ::close(fd);
+
+    if (addr == MAP_FAILED) {
+	cerr << "Failed to map shared memory " << name << ": " << strerror(errno) << "\n";
+	return false;
+    }
+
+    _header = (FrameRingHeader*) addr;
+    _slots = (FrameRingSlot*) (_header + 1);
+    _data = ((uint8_t*) addr) + dataOffset(slots);
+    _mappedSize = total;
+    _next = 0;
+
+    // Clear magic first so readers don't attach to a half initialized ring
+    _header->magic = 0;
+    atomic_thread_fence(memory_order_release);
+    memset(addr, 0, dataOffset(slots));
+    _header->version = FRAME_RING_VERSION;
+    _header->slots = slots;
+    _header->rows = size.height;
+    _header->cols = size.width;
+    _header->type = type;
+    _header->step = step;
+    _header->slotSize = sizeof(FrameRingSlot);
+    _header->slotBytes = slotBytes;
+    _header->dataOffset = dataOffset(slots);
+    _header->published.store(0, memory_order_relaxed);
+    _header->latest.store(-1, memory_order_relaxed);
+    _header->closed.store(0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    _header->magic = FRAME_RING_MAGIC;
+    return true;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+bool FrameRingWriter::publish(const Mat& image, const FrameStamp& stamp) {
+    if ((_header == 0) || (image.rows != (int) _header->rows)
+	|| (image.cols != (int) _header->cols) || (image.type() != (int) _header->type)) {
+	return false;
+    }
+
+    int slots = _header->slots;
+    for (int i = 0; i < slots; i++) {
+	int index = (_next + i) % slots;
+	FrameRingSlot& slot = _slots[index];
+	uint32_t expected = FrameSlotFree;
+	if (!slot.state.compare_exchange_strong(expected, FrameSlotWriting, memory_order_acquire)) {
+	    // Reader has it
+	    continue;
+	}
+
+	uint8_t* dst = _data + index * _header->slotBytes;
+	size_t rowBytes = image.cols * image.elemSize();
+	for (int y = 0; y < image.rows; y++) {
+	    memcpy(dst + y * _header->step, image.ptr(y), rowBytes);
+	}
+
+	uint64_t frame = _header->published.load(memory_order_relaxed) + 1;
+	slot.captureNanos = stamp.captureNanos;
+	slot.cameraSeq = stamp.sequence;
+	slot.fromDriver = stamp.fromDriver;
+	slot.frame.store(frame, memory_order_relaxed);
+	slot.state.store(FrameSlotFree, memory_order_release);
+
+	_header->latest.store(index, memory_order_release);
+	_header->published.store(frame, memory_order_release);
+	_next = (index + 1) % slots;
+	return true;
+    }
+    return false;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+void FrameRingWriter::close() {
+    if (_header != 0) {
+	_header->closed.store(1, memory_order_release);
+	munmap(_header, _mappedSize);
+    }
+    _header = 0;
+    _slots = 0;
+    _data = 0;
+    _mappedSize = 0;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+FrameRingSource::FrameRingSource(const string& name) :
+    FrameSource(name),
+    _header(0),
+    _slots(0),
+    _data(0),
+    _mappedSize(0),
+    _lastFrame(0),
+    _skipped(0)
+{
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+FrameRingSource::~FrameRingSource() {
+    if (_header != 0) {
+	munmap(_header, _mappedSize);
+    }
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+bool FrameRingSource::open() {
+    // Read/write as taking a slot marks it held
+    int fd = shm_open(getName().c_str(), O_RDWR, 0);
+    if (fd < 0) {
+	cerr << "Unable to open shared memory " << getName() << ": " << strerror(errno) << "\n";
+	return false;
+    }
+
+    struct stat info;
+    void* addr = MAP_FAILED;
+    if ((fstat(fd, &info) == 0) && ((size_t) info.st_size >= sizeof(FrameRingHeader))) {
+	addr = mmap(0, info.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    ::close(fd);
+    if (addr == MAP_FAILED) {
+	cerr << "Unable to map shared memory " << getName() << "\n";
+	return false;
+    }
+
+    FrameRingHeader* header = (FrameRingHeader*) addr;
+    bool compatible = (header->magic == FRAME_RING_MAGIC)
+	&& (header->version == FRAME_RING_VERSION)
+	&& (header->slotSize == sizeof(FrameRingSlot))
+	&& (header->dataOffset == dataOffset(header->slots))
+	&& (header->dataOffset + header->slots * header->slotBytes <= (uint64_t) info.st_size)
+	&& ((uint64_t) header->step * header->rows <= header->slotBytes);
+    if (!compatible) {
+	cerr << getName() << " is not a frame ring (or the writer is still setting it up)\n";
+	munmap(addr, info.st_size);
+	return false;
+    }
+
+    _header = header;
+    _slots = (FrameRingSlot*) (_header + 1);
+    _data = ((uint8_t*) addr) + _header->dataOffset;
+    _mappedSize = info.st_size;
+    _lastFrame = 0;
+    return true;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+bool FrameRingSource::acquire(Frame& frame) {
+    if (_header == 0) {
+	return false;
+    }
+
+    int64_t start = monotonicNanos();
+    for (int attempt = 0; ; attempt++) {
+	int index = _header->latest.load(memory_order_acquire);
+	if (index >= 0) {
+	    FrameRingSlot& slot = _slots[index];
+	    uint32_t expected = FrameSlotFree;
+	    if ((slot.frame.load(memory_order_acquire) > _lastFrame)
+		&& slot.state.compare_exchange_strong(expected, FrameSlotHeld, memory_order_acquire)) {
+		// Writer may have refilled the slot since we looked (still newer)
+		uint64_t number = slot.frame.load(memory_order_relaxed);
+		if (number > _lastFrame) {
+		    if (_lastFrame != 0) {
+			_skipped.fetch_add(number - _lastFrame - 1, memory_order_relaxed);
+		    }
+		    _lastFrame = number;
+		    frame.image = Mat(_header->rows, _header->cols, _header->type,
+				      _data + index * _header->slotBytes, _header->step);
+		    frame.buffer = index;
+		    frame.stamp.captureNanos = slot.captureNanos;
+		    // Camera's numbering, so frames it dropped before the
+		    // writer saw them count as dropped here too
+		    frame.stamp.sequence = slot.cameraSeq;
+		    frame.stamp.fromDriver = slot.fromDriver;
+		    return true;
+		}
+		slot.state.store(FrameSlotFree, memory_order_release);
+	    }
+	}
+
+	if (_header->closed.load(memory_order_acquire)) {
+	    return false;
+	}
+	if (monotonicNanos() - start > READ_TIMEOUT_NANOS) {
+	    cerr << "No frames from " << getName() << " for "
+		 << (READ_TIMEOUT_NANOS / 1000000000) << " seconds\n";
+	    return false;
+	}
+
+	// Frames come at camera rates, so mostly sleep
+	if (attempt < 16) {
+	    sched_yield();
+	} else {
+	    avc::Timer::sleepNanos(200000);
+	}
+    }
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+void FrameRingSource::release(Frame& frame) {
+    if ((_header != 0) && (frame.buffer >= 0)) {
+	_slots[frame.buffer].state.store(FrameSlotFree, memory_order_release);
+    }
+    FrameSource::release(frame);
+}
@@ -0,0 +1,163 @@
+#pragma once
+
+#include "framesource.hpp"
+#include "latency.hpp"
+
+#include <opencv2/opencv.hpp>
+
+#include <atomic>
+#include <string>
+
+#include <stdint.h>
+
+namespace vision {
+
+    // Identifies a frame ring shared memory segment ("AVCF")
+    const uint32_t FRAME_RING_MAGIC = 0x46435641;
+    const uint32_t FRAME_RING_VERSION = 1;
+
+    // Default shared memory name (shows up as /dev/shm/avc-frames)
+    const char* const FRAME_RING_NAME = "/avc-frames";
+
+    // Default number of frame slots (enough for a pipelined reader to
+    // hold a frame in every pipeline slot and still leave the writer
+    // room)
+    const int FRAME_RING_SLOTS = 8;
+
+    /** FrameRingSlot::state values. */
+    enum FrameSlotState {
+	// Writer may fill it, reader may take it
+	FrameSlotFree = 0,
+	// Writer is filling it
+	FrameSlotWriting = 1,
+	// Reader has it (writer skips it)
+	FrameSlotHeld = 2
+    };
+
+    /**
+     * Header at the start of the shared memory segment, followed by
+     * slots FrameRingSlot entries and then (from dataOffset) the pixels
+     * of each slot, slotBytes apart.
+     */
+    struct FrameRingHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t slots;
+	uint32_t rows;
+	uint32_t cols;
+	// OpenCV type (CV_8UC3 for BGR frames) and bytes per row
+	uint32_t type;
+	uint32_t step;
+	uint32_t slotSize;
+	uint64_t slotBytes;
+	uint64_t dataOffset;
+	char pad0[16];
+
+	// Number of frames ever published (frame numbers start at 1)
+	std::atomic<uint64_t> published;
+	// Slot holding the newest frame (-1 until the first is published)
+	std::atomic<int32_t> latest;
+	// Non-zero once the writer has stopped publishing
+	std::atomic<uint32_t> closed;
+	char pad1[48];
+    };
+
+    /**
+     * State and time stamp of one frame slot.
+     */
+    struct FrameRingSlot {
+	// FrameSlotState, changed with compare and swap so the writer and
+	// reader never both have the slot
+	std::atomic<uint32_t> state;
+	uint32_t fromDriver;
+	// Number of the frame in the slot (0 if never filled)
+	std::atomic<uint64_t> frame;
+	// See FrameStamp
+	int64_t captureNanos;
+	uint32_t cameraSeq;
+	char pad[36];
+    };
+
+    /**
+     * Publishes frames into shared memory so another process can run
+     * the filter on them (avc-vision -s shm:NAME) while this process
+     * keeps the camera.
+     *
+     * <p>Frames go to the slot after the last one written that the
+     * reader isn't holding. The reader always takes the newest frame,
+     * so like a camera frames are dropped (not queued) when the reader
+     * falls behind.</p>
+     */
+    class FrameRingWriter {
+    public:
+	FrameRingWriter();
+
+	/** Marks the ring closed and unmaps it. */
+	~FrameRingWriter();
+
+	/**
+	 * Create (or reinitialize) the shared memory segment (mode 0666,
+	 * as the reader claims slots and may run as any user).
+	 *
+	 * @param size Size of every frame to be published.
+	 * @param type OpenCV type of every frame (like CV_8UC3).
+	 * @param slots Number of frame slots.
+	 * @param name Shared memory name.
+	 */
+	bool open(cv::Size size, int type, int slots = FRAME_RING_SLOTS,
+		  const std::string& name = FRAME_RING_NAME);
+
+	/**
+	 * Copy a frame into the ring.
+	 *
+	 * @return false if the frame doesn't match the ring or every slot
+	 * was held by the reader (frame dropped).
+	 */
+	bool publish(const cv::Mat& image, const FrameStamp& stamp);
+
+	/** Tell the reader no more frames are coming and unmap. */
+	void close();
+
+    private:
+	FrameRingHeader* _header;
+	FrameRingSlot* _slots;
+	uint8_t* _data;
+	size_t _mappedSize;
+	int _next;
+    };
+
+    /**
+     * Reads frames another process publishes with FrameRingWriter,
+     * lending them straight out of shared memory (a single reader per
+     * ring).
+     */
+    class FrameRingSource : public FrameSource {
+    public:
+	/** @param name Shared memory name. */
+	explicit FrameRingSource(const std::string& name = FRAME_RING_NAME);
+
+	~FrameRingSource();
+
+	/** Map the ring (false if the writer hasn't created it yet). */
+	bool open();
+
+	bool acquire(Frame& frame);
+	void release(Frame& frame);
+	bool isLive() const { return true; }
+
+	/**
+	 * Frames published to the ring that were replaced by newer ones
+	 * before we got to them (frame stamps carry the camera's sequence
+	 * numbers, so these also show up as dropped camera frames).
+	 */
+	uint64_t getSkipped() const { return _skipped.load(std::memory_order_relaxed); }
+
+    private:
+	FrameRingHeader* _header;
+	FrameRingSlot* _slots;
+	uint8_t* _data;
+	size_t _mappedSize;
+	uint64_t _lastFrame;
+	std::atomic<uint64_t> _skipped;
+    };
+}
@@ -0,0 +1,342 @@
+#include "framesource.hpp"
+#include "datasetpack.hpp"
+#include "filter.hpp"
+#include "framering.hpp"
+#include "imagefiles.hpp"
+#include "mjpegsource.hpp"
+#include "synthetic.hpp"
+#include "v4l2source.hpp"
+
+#include <iostream>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace cv;
+using namespace vision;
+using namespace std;
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+namespace {
+
+    /** OpenCV camera (or video file) read with VideoCapture. */
+    class CaptureSource : public PooledSource {
+    public:
+	CaptureSource(const string& name, int buffers, bool live) :
+	    PooledSource(name, buffers),
+	    _capture(),
+	    _clock(),
+	    _live(live) {
+	}
+
+	bool open(int camera) {
+	    _capture.open(camera);
+	    if (!_capture.isOpened()) {
+		return false;
+	    }
+	    _capture.set(CV_CAP_PROP_FRAME_WIDTH, 320);
+	    _capture.set(CV_CAP_PROP_FRAME_HEIGHT, 240);
+	    _clock.setFrameRate(_capture.get(CV_CAP_PROP_FPS));
+
+	    // Get initial frame and toss (incase first one is bad), it
+	    // tells us what size the rest will be
+	    Mat toss;
+	    _capture >> toss;
+	    if (!toss.empty()) {
+		prefault(toss.size(), toss.type());
+	    }
+	    return true;
+	}
+
+	bool open(const string& file) {
+	    _capture.open(file);
+	    if (!_capture.isOpened()) {
+		cerr << "Unable to open video " << file << "\n";
+		return false;
+	    }
+	    return true;
+	}
+
+	bool isLive() const { return _live; }
+
+    protected:
+	/**
+	 * Reads the next frame noting when it was captured (grab() returns
+	 * as soon as the driver hands over the buffer, the decode/copy
+	 * happens in retrieve()).
+	 */
+	bool fill(Mat& image, FrameStamp& stamp) {
+	    if (!_capture.grab()) {
+		return false;
+	    }
+	    // Video file positions aren't capture times
+	    _clock.stamp(_live ? _capture.get(CV_CAP_PROP_POS_MSEC) : 0, stamp);
+	    return _capture.retrieve(image);
+	}
+
+    private:
+	VideoCapture _capture;
+	CaptureClock _clock;
+	bool _live;
+    };
+
+    /** Images read from files one after another. */
+    class ImageFilesSource : public PooledSource {
+    public:
+	ImageFilesSource(const string& path, int buffers) :
+	    PooledSource(path, buffers),
+	    _files(),
+	    _next(0),
+	    _clock() {
+	}
+
+	bool open() {
+	    findImages(getName(), _files);
+	    if (_files.empty()) {
+		cerr << "No images found in " << getName() << "\n";
+		return false;
+	    }
+	    return true;
+	}
+
+    protected:
+	bool fill(Mat& image, FrameStamp& stamp) {
+	    while (_next < _files.size()) {
+		image = imread(_files[_next++]);
+		if (!image.empty()) {
+		    _clock.stamp(0, stamp);
+		    return true;
+		}
+		cerr << "Unable to load image: " << _files[_next - 1] << "\n";
+	    }
+	    return false;
+	}
+
+    private:
+	vector<string> _files;
+	size_t _next;
+	CaptureClock _clock;
+    };
+
+    /** Decoded MJPEG stream or JPEG images (see MjpegSource). */
+    class CompressedSource : public PooledSource {
+    public:
+	CompressedSource(const string& path, int buffers) :
+	    PooledSource(path, buffers),
+	    _mjpeg() {
+	}
+
+	bool open() {
+	    return _mjpeg.open(getName(), 320, &Filter::getCropWindow);
+	}
+
+	const LatencyHistogram* getConvertLatency() const { return &_mjpeg.getDecodeLatency(); }
+
+    protected:
+	bool fill(Mat& image, FrameStamp& stamp) {
+	    // Swaps buffers with the decode thread, nothing is copied
+	    return _mjpeg.read(image, stamp);
+	}
+
+    private:
+	MjpegSource _mjpeg;
+    };
+
+    /** Generated frames (see SyntheticFrames). */
+    class GeneratedSource : public PooledSource {
+    public:
+	GeneratedSource(const Filter& filter, const SyntheticSpec& spec, int buffers) :
+	    PooledSource("synthetic", buffers),
+	    _frames(filter, spec) {
+	}
+
+    protected:
+	bool fill(Mat& image, FrameStamp& stamp) {
+	    return _frames.read(image, stamp);
+	}
+
+    private:
+	SyntheticFrames _frames;
+    };
+
+    /** Images lent straight out of a memory mapped dataset pack. */
+    class PackSource : public FrameSource {
+    public:
+	explicit PackSource(const string& path) :
+	    FrameSource(path),
+	    _pack(),
+	    _next(0),
+	    _clock() {
+	}
+
+	bool open() {
+	    return _pack.open(getName());
+	}
+
+	bool acquire(Frame& frame) {
+	    if (_next >= _pack.size()) {
+		return false;
+	    }
+	    frame.image = _pack.image(_next++);
+	    frame.buffer = -1;
+	    _clock.stamp(0, frame.stamp);
+	    return true;
+	}
+
+    private:
+	DatasetPack _pack;
+	size_t _next;
+	CaptureClock _clock;
+    };
+
+    /** Splits "TYPE:ARG" (type is "camera" if there is no colon). */
+    void splitSpec(const string& spec, string& type, string& arg) {
+	size_t colon = spec.find(':');
+	type = spec.substr(0, colon);
+	arg = (colon == string::npos) ? "" : spec.substr(colon + 1);
+    }
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+PooledSource::PooledSource(const string& name, int buffers) :
+    FrameSource(name),
+    _buffers(max(1, buffers)),
+    _frameSize(),
+    _inUse(new atomic<bool>[max(1, buffers)])
+{
+    for (size_t i = 0; i < _buffers.size(); i++) {
+	_inUse[i].store(false);
+    }
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+bool PooledSource::acquire(Frame& frame) {
+    for (size_t i = 0; i < _buffers.size(); i++) {
+	if (_inUse[i].load(memory_order_acquire)) {
+	    continue;
+	}
+	if (!fill(_buffers[i], frame.stamp)) {
+	    return false;
+	}
+	_inUse[i].store(true, memory_order_relaxed);
+	frame.image = _buffers[i];
+	frame.buffer = i;
+	return true;
+    }
+
+    cerr << "All " << _buffers.size() << " frame buffers of " << getName() << " are in use\n";
+    return false;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+void PooledSource::release(Frame& frame) {
+    int buffer = frame.buffer;
+    FrameSource::release(frame);
+    if ((buffer >= 0) && (buffer < (int) _buffers.size())) {
+	_inUse[buffer].store(false, memory_order_release);
+    }
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+void PooledSource::prefault(Size size, int type) {
+    _frameSize = size;
+    for (Mat& buffer : _buffers) {
+	buffer.create(size, type);
+	buffer = Scalar::all(0);
+    }
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+bool vision::sourceNeedsFilter(const string& spec) {
+    string type, arg;
+    splitSpec(spec, type, arg);
+    return type == "synthetic";
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+unique_ptr<FrameSource> vision::openFrameSource(const string& spec, const Filter* filter,
+						int buffers) {
+    string type, arg;
+    splitSpec(spec, type, arg);
+
+    if (type == "camera") {
+	unique_ptr<CaptureSource> source(new CaptureSource(spec, buffers, true));
+	if (source->open(arg.empty() ? 0 : atoi(arg.c_str()))) {
+	    return move(source);
+	}
+	cerr << "Failed to open camera " << spec << "\n";
+    } else if (type == "v4l2") {
+	// DEVICE[,WxH][,mjpeg|yuyv]
+	string device = arg.substr(0, arg.find(','));
+	Size size(320, 240);
+	bool mjpeg = true;
+	size_t comma = arg.find(',');
+	while (comma != string::npos) {
+	    size_t end = arg.find(',', comma + 1);
+	    string option = arg.substr(comma + 1, end - comma - 1);
+	    int w, h;
+	    if (sscanf(option.c_str(), "%dx%d", &w, &h) == 2) {
+		size = Size(w, h);
+	    } else if ((option == "mjpeg") || (option == "yuyv")) {
+		mjpeg = (option == "mjpeg");
+	    } else {
+		cerr << "Unknown V4L2 option: " << option << "\n";
+		return nullptr;
+	    }
+	    comma = end;
+	}
+	unique_ptr<V4l2Source> source(new V4l2Source(device, buffers));
+	if (source->open(size, mjpeg, &Filter::getCropWindow)) {
+	    return move(source);
+	}
+    } else if ((type == "file") || (type == "dir")) {
+	unique_ptr<ImageFilesSource> source(new ImageFilesSource(arg, buffers));
+	if (source->open()) {
+	    return move(source);
+	}
+    } else if (type == "video") {
+	unique_ptr<CaptureSource> source(new CaptureSource(arg, buffers, false));
+	if (source->open(arg)) {
+	    return move(source);
+	}
+    } else if (type == "mjpeg") {
+	unique_ptr<CompressedSource> source(new CompressedSource(arg, buffers));
+	if (source->open()) {
+	    return move(source);
+	}
+    } else if (type == "pack") {
+	unique_ptr<PackSource> source(new PackSource(arg));
+	if (source->open()) {
+	    return move(source);
+	}
+    } else if (type == "synthetic") {
+	SyntheticSpec synthetic;
+	if (filter == 0) {
+	    cerr << "Synthetic frames can't be generated without the filter\n";
+	} else if (synthetic.parse((arg == "default") ? "" : arg)) {
+	    return unique_ptr<FrameSource>(new GeneratedSource(*filter, synthetic, buffers));
+	}
+    } else if (type == "shm") {
+	unique_ptr<FrameRingSource> source(new FrameRingSource(arg.empty() ? FRAME_RING_NAME : arg));
+	if (source->open()) {
+	    return move(source);
+	}
+    } else {
+	cerr << "Unknown frame source: " << spec << "\n";
+    }
+    return nullptr;
+}
@@ -0,0 +1,159 @@
+#pragma once
+
+#include "latency.hpp"
+
+#include <opencv2/opencv.hpp>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace vision {
+
+    class Filter;
+
+    /**
+     * A frame lent by a FrameSource. The image refers to the source's
+     * own buffer (nothing is copied to hand it over), so it must be
+     * given back with FrameSource::release() once processing is done
+     * and not used after that.
+     */
+    struct Frame {
+	cv::Mat image;
+	FrameStamp stamp;
+	// Which of the source's buffers holds the image (-1 if the
+	// source doesn't need it back)
+	int buffer;
+
+	Frame() : buffer(-1) { }
+    };
+
+    /**
+     * Somewhere frames come from (a camera, files, generated frames or
+     * another process sharing its camera). Sources are created with
+     * openFrameSource().
+     *
+     * <p>acquire() and release() may be called from different threads
+     * (one thread each).</p>
+     */
+    class FrameSource {
+    public:
+	virtual ~FrameSource() { }
+
+	/**
+	 * Borrow the next frame (waits for it to be available).
+	 *
+	 * @param frame Set to the frame (must not already hold one).
+	 *
+	 * @return false at the end of the input or if the source failed.
+	 */
+	virtual bool acquire(Frame& frame) = 0;
+
+	/** Give back a frame from acquire() (frame is cleared). */
+	virtual void release(Frame& frame) {
+	    frame.image.release();
+	    frame.buffer = -1;
+	}
+
+	/**
+	 * Whether frames arrive in real time (a camera) rather than from
+	 * something read at our own pace.
+	 */
+	virtual bool isLive() const { return false; }
+
+	/** Time spent decoding or converting each frame (0 if none). */
+	virtual const LatencyHistogram* getConvertLatency() const { return 0; }
+
+	/**
+	 * Size frames will be, if known before the first one arrives
+	 * (empty otherwise).
+	 */
+	virtual cv::Size getFrameSize() const { return cv::Size(); }
+
+	/** What the source reads from (for messages). */
+	const std::string& getName() const { return _name; }
+
+    protected:
+	explicit FrameSource(const std::string& name) : _name(name) { }
+
+    private:
+	std::string _name;
+    };
+
+    /**
+     * Base for sources that fill frames into a fixed pool of buffers
+     * they own and lend out. Buffers are reused once released, so after
+     * the first few frames nothing is allocated.
+     */
+    class PooledSource : public FrameSource {
+    public:
+	bool acquire(Frame& frame);
+	void release(Frame& frame);
+
+	cv::Size getFrameSize() const { return _frameSize; }
+
+    protected:
+	/**
+	 * @param name What the source reads from.
+	 * @param buffers Number of frames that may be held at once.
+	 */
+	PooledSource(const std::string& name, int buffers);
+
+	/**
+	 * Store the next frame in a buffer (reuse its memory if the size
+	 * is right).
+	 *
+	 * @return false at the end of the input.
+	 */
+	virtual bool fill(cv::Mat& image, FrameStamp& stamp) = 0;
+
+	/**
+	 * Allocate every buffer for frames of a size and write to it, so
+	 * the first frames don't wait on the allocator and page faults
+	 * (called by sources that know the size once opened).
+	 */
+	void prefault(cv::Size size, int type);
+
+    private:
+	std::vector<cv::Mat> _buffers;
+	cv::Size _frameSize;
+	std::unique_ptr<std::atomic<bool>[]> _inUse;
+    };
+
+    /**
+     * Opens a frame source.
+     *
+     * <pre>
+     *   camera[:N]                 OpenCV camera N (default 0) at 320x240
+     *   v4l2:DEVICE[,WxH][,FORMAT] Video4Linux2 device read directly
+     *                              (FORMAT mjpeg or yuyv, default mjpeg
+     *                              at 320x240)
+     *   file:PATH                  A single image
+     *   dir:PATH                   Every image in a directory (sorted)
+     *   video:PATH                 A video file (anything OpenCV plays)
+     *   mjpeg:PATH                 Recorded MJPEG stream or JPEG images
+     *                              (see MjpegSource)
+     *   pack:PATH                  Dataset pack (see DatasetPack)
+     *   synthetic:SPEC             Generated frames (see SyntheticSpec)
+     *   shm:NAME                   Frames shared by another process (see
+     *                              FrameRingWriter)
+     * </pre>
+     *
+     * @param spec Which source (see above).
+     * @param filter Filter the frames are for (only synthetic frames
+     * need it for their colors, see sourceNeedsFilter()).
+     * @param buffers Largest number of frames the caller holds at once.
+     *
+     * @return The source (null after reporting why if it couldn't be
+     * opened).
+     */
+    std::unique_ptr<FrameSource> openFrameSource(const std::string& spec,
+						 const Filter* filter, int buffers);
+
+    /**
+     * Whether a source needs the filter to be opened (otherwise it can
+     * be opened while the filter is still being set up).
+     */
+    bool sourceNeedsFilter(const std::string& spec);
+}
@@ -0,0 +1,289 @@
+#include "groundrange.hpp"
+
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+
+#include <math.h>
+#include <stdlib.h>
+
+using namespace cv;
+using namespace vision;
+using namespace std;
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+RangeModel::RangeModel() :
+    width(320),
+    height(240),
+    fx(277),
+    fy(277),
+    cx(160),
+    cy(120),
+    k1(0),
+    k2(0),
+    p1(0),
+    p2(0),
+    cameraHeight(0.595),
+    tilt(2.8),
+    offset(0.591),
+    stanchionHeight(0.68)
+{
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+namespace {
+    string trim(const string& s) {
+	size_t start = s.find_first_not_of(" \t\r");
+	if (start == string::npos) {
+	    return "";
+	}
+	return s.substr(start, s.find_last_not_of(" \t\r") - start + 1);
+    }
+
+    void setting(const map<string, double>& values, const char* name, double& value) {
+	map<string, double>::const_iterator it = values.find(name);
+	if (it != values.end()) {
+	    value = it->second;
+	}
+    }
+
+    void setting(const map<string, double>& values, const char* name, int& value) {
+	double d = value;
+	setting(values, name, d);
+	value = (int) d;
+    }
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+bool RangeModel::load(const string& fileName) {
+    ifstream in(fileName.c_str());
+    if (!in) {
+	return false;
+    }
+
+    // "section.name" -> value
+    map<string, double> values;
+    bool ok = true;
+    string section;
+    string line;
+    int lineNumber = 0;
+    while (getline(in, line)) {
+	lineNumber++;
+	line = trim(line.substr(0, line.find('#')));
+	if (line.empty()) {
+	    continue;
+	}
+	if ((line[0] == '[') && (line[line.size() - 1] == ']')) {
+	    section = trim(line.substr(1, line.size() - 2));
+	    continue;
+	}
+
+	size_t equals = line.find('=');
+	string value = (equals == string::npos) ? "" : trim(line.substr(equals + 1));
+	char* end = 0;
+	double parsed = strtod(value.c_str(), &end);
+	if (value.empty() || (*end != '\0')) {
+	    cerr << fileName << ":" << lineNumber << ": expected \"name = number\"\n";
+	    ok = false;
+	    continue;
+	}
+	values[section + "." + trim(line.substr(0, equals))] = parsed;
+    }
+
+    setting(values, "camera.width", width);
+    setting(values, "camera.height", height);
+    setting(values, "camera.fx", fx);
+    setting(values, "camera.fy", fy);
+    setting(values, "camera.cx", cx);
+    setting(values, "camera.cy", cy);
+    setting(values, "camera.k1", k1);
+    setting(values, "camera.k2", k2);
+    setting(values, "camera.p1", p1);
+    setting(values, "camera.p2", p2);
+    setting(values, "mount.height", cameraHeight);
+    setting(values, "mount.tilt", tilt);
+    setting(values, "mount.offset", offset);
+    setting(values, "stanchion.height", stanchionHeight);
+
+    if ((width <= 0) || (height <= 0) || (fx <= 0) || (fy <= 0)
+	|| (cameraHeight <= 0) || (stanchionHeight <= 0)) {
+	cerr << fileName << ": sizes, focal lengths and heights must be more than 0\n";
+	ok = false;
+    }
+    return ok;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+bool RangeModel::save(const string& fileName) const {
+    ofstream out(fileName.c_str());
+    out << setprecision(6)
+	<< "# Camera model for range and bearing estimates (see groundrange.hpp)\n"
+	<< "\n"
+	<< "# Intrinsics (pixels) at the image size they were measured at\n"
+	<< "[camera]\n"
+	<< "width = " << width << "\n"
+	<< "height = " << height << "\n"
+	<< "fx = " << fx << "\n"
+	<< "fy = " << fy << "\n"
+	<< "cx = " << cx << "\n"
+	<< "cy = " << cy << "\n"
+	<< "k1 = " << k1 << "\n"
+	<< "k2 = " << k2 << "\n"
+	<< "p1 = " << p1 << "\n"
+	<< "p2 = " << p2 << "\n"
+	<< "\n"
+	<< "# Camera height (feet), tilt down from horizontal (degrees) and\n"
+	<< "# distance behind where ranges are measured from (feet)\n"
+	<< "[mount]\n"
+	<< "height = " << cameraHeight << "\n"
+	<< "tilt = " << tilt << "\n"
+	<< "offset = " << offset << "\n"
+	<< "\n"
+	<< "# Stanchion height (feet)\n"
+	<< "[stanchion]\n"
+	<< "height = " << stanchionHeight << "\n";
+    out.close();
+    return !out.fail();
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+GroundRange::GroundRange() :
+    _model(),
+    _enabled(false),
+    _cameraMatrix(),
+    _distortion(),
+    _rowMargin(0),
+    _columnMargin(0),
+    _rowInverseAhead(),
+    _rowSidePerAhead(),
+    _columnX()
+{
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+void GroundRange::setModel(const RangeModel& model) {
+    _model = model;
+
+    _cameraMatrix = (Mat_<double>(3, 3) <<
+		     model.fx, 0, model.cx,
+		     0, model.fy, model.cy,
+		     0, 0, 1);
+    _distortion = (Mat_<double>(1, 4) << model.k1, model.k2, model.p1, model.p2);
+
+    // Ray through normalized (x, y) of a camera tilted down by t heads
+    // (cos(t) - y sin(t)) forward and (y cos(t) + sin(t)) down for
+    // every unit of depth, so it meets the ground cameraHeight down
+    double t = model.tilt * M_PI / 180;
+    double cosT = cos(t);
+    double sinT = sin(t);
+
+    _rowMargin = model.height / 2;
+    int rows = model.height + 2 * _rowMargin + 1;
+    _rowInverseAhead.resize(rows);
+    _rowSidePerAhead.resize(rows);
+    for (int i = 0; i < rows; i++) {
+	double y = (i - _rowMargin - model.cy) / model.fy;
+	double forward = cosT - y * sinT;
+	double down = y * cosT + sinT;
+	_rowInverseAhead[i] = down / (model.cameraHeight * forward);
+	_rowSidePerAhead[i] = 1 / forward;
+    }
+
+    _columnMargin = model.width / 2;
+    int columns = model.width + 2 * _columnMargin + 1;
+    _columnX.resize(columns);
+    for (int i = 0; i < columns; i++) {
+	_columnX[i] = (i - _columnMargin - model.cx) / model.fx;
+    }
+
+    _enabled = true;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+bool GroundRange::load(const string& fileName) {
+    RangeModel model;
+    if (!model.load(fileName)) {
+	return false;
+    }
+    setModel(model);
+    return true;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+double GroundRange::lookup(const vector<float>& table, double index) {
+    int last = table.size() - 1;
+    if (index <= 0) {
+	return table[0];
+    }
+    if (index >= last) {
+	return table[last];
+    }
+    int i = (int) index;
+    double frac = index - i;
+    return table[i] + frac * (table[i + 1] - table[i]);
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+Point2d GroundRange::undistort(const Point2d& pixel, Size frameSize) const {
+    Point2d scaled(pixel.x * _model.width / frameSize.width,
+		   pixel.y * _model.height / frameSize.height);
+    if ((_model.k1 == 0) && (_model.k2 == 0) && (_model.p1 == 0) && (_model.p2 == 0)) {
+	return scaled;
+    }
+
+    vector<Point2d> distorted(1, scaled);
+    vector<Point2d> undistorted;
+    undistortPoints(distorted, undistorted, _cameraMatrix, _distortion, noArray(), _cameraMatrix);
+    return undistorted[0];
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+bool GroundRange::estimate(const Rect& box, Size frameSize, bool bottomCut,
+			   float& range, float& bearing) const {
+    if (!_enabled || (box.height <= 0)) {
+	return false;
+    }
+
+    double xMid = box.x + box.width / 2.0;
+    Point2d bottom = undistort(Point2d(xMid, box.y + box.height), frameSize);
+    double x = lookup(_columnX, bottom.x + _columnMargin);
+    double inverseAhead = lookup(_rowInverseAhead, bottom.y + _rowMargin);
+
+    double ahead, side;
+    if (!bottomCut && (inverseAhead > 0)) {
+	ahead = 1 / inverseAhead;
+	side = x * ahead * lookup(_rowSidePerAhead, bottom.y + _rowMargin);
+    } else {
+	// Bottom isn't on the ground we can see, go by how tall it looks
+	Point2d top = undistort(Point2d(xMid, box.y), frameSize);
+	double height = max(bottom.y - top.y, 1.0);
+	ahead = _model.fy * _model.stanchionHeight / height;
+	side = x * ahead;
+    }
+
+    ahead -= _model.offset;
+    range = sqrt(ahead * ahead + side * side);
+    bearing = atan2(side, ahead) * 180 / M_PI;
+    return true;
+}
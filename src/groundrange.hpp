@@ -0,0 +1,140 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+
+#include <string>
+#include <vector>
+
+namespace vision {
+
+    // Boxes whose bottom is this close to the bottom of the crop window
+    // are cut off (so their bottom isn't where they meet the ground)
+    const int RANGE_EDGE_ROWS = 3;
+
+    /**
+     * Camera intrinsics and mounting the range tables are built from
+     * (read from range.txt, see avc-vision-calibrate for fitting the
+     * mounting to labelled images).
+     */
+    struct RangeModel {
+	// Size of the images the intrinsics are for (points in frames of
+	// other sizes are scaled to it)
+	int width, height;
+
+	// Focal lengths and principal point (pixels)
+	double fx, fy;
+	double cx, cy;
+
+	// Lens distortion (OpenCV's k1, k2, p1, p2)
+	double k1, k2, p1, p2;
+
+	// Height of the camera above the ground (feet), how far it is
+	// tilted down from horizontal (degrees) and how far behind the
+	// point ranges are measured from it sits (feet)
+	double cameraHeight;
+	double tilt;
+	double offset;
+
+	// Height of a stanchion (feet, used to estimate range from the
+	// box height when the bottom of the box is cut off)
+	double stanchionHeight;
+
+	/** Model fitted to the webcam-test images (same as range.txt). */
+	RangeModel();
+
+	/**
+	 * Read settings from a range file ([camera], [mount] and
+	 * [stanchion] sections of "name = value" lines). Settings not in
+	 * the file are left alone.
+	 *
+	 * @return true if the file was read and every value in it parsed.
+	 */
+	bool load(const std::string& fileName);
+
+	/** Write settings in the format load() reads. */
+	bool save(const std::string& fileName) const;
+    };
+
+    /**
+     * Estimates how far away (along the ground) and in what direction
+     * the bottom of a box is, assuming it sits on flat ground.
+     *
+     * <p>Everything that only depends on the row or column of a point
+     * is worked out once when the model is set: the distance ahead of
+     * the camera and how far to the side normalized x reaches for each
+     * undistorted row, and the normalized x of each undistorted column.
+     * Estimating a box then only undistorts its bottom and top points
+     * (never the whole frame) and looks them up.</p>
+     */
+    class GroundRange {
+    public:
+	GroundRange();
+
+	/** Build the tables for a model (enables estimates). */
+	void setModel(const RangeModel& model);
+
+	/**
+	 * Read a model from a range file and build its tables (estimates
+	 * stay disabled if the file can't be read).
+	 *
+	 * @return true if the file was read.
+	 */
+	bool load(const std::string& fileName);
+
+	/** Whether a model has been set. */
+	bool isEnabled() const { return _enabled; }
+
+	/** Model the tables were built from. */
+	const RangeModel& getModel() const { return _model; }
+
+	/**
+	 * Remove lens distortion from a point.
+	 *
+	 * @param pixel Point in a frame.
+	 * @param frameSize Size of the frame.
+	 *
+	 * @return Undistorted point in model pixels.
+	 */
+	cv::Point2d undistort(const cv::Point2d& pixel, cv::Size frameSize) const;
+
+	/**
+	 * Estimate range and bearing of the bottom of a box.
+	 *
+	 * @param box Box in frame coordinates.
+	 * @param frameSize Size of the frame.
+	 * @param bottomCut Whether the bottom of the box was cut off (the
+	 * range then comes from the box height, as it does when the bottom
+	 * is at or above the horizon).
+	 * @param range Feet from where ranges are measured.
+	 * @param bearing Degrees (positive is to the right).
+	 *
+	 * @return false if no model is set or the box is empty.
+	 */
+	bool estimate(const cv::Rect& box, cv::Size frameSize, bool bottomCut,
+		      float& range, float& bearing) const;
+
+    private:
+	static double lookup(const std::vector<float>& table, double index);
+
+	RangeModel _model;
+	bool _enabled;
+	cv::Mat _cameraMatrix;
+	cv::Mat _distortion;
+
+	// Tables cover a margin of half the image on each side as
+	// undistorted points can land outside it (index 0 of the row
+	// table is row -_rowMargin)
+	int _rowMargin;
+	int _columnMargin;
+
+	// Inverse of the feet ahead of the camera where each row meets the
+	// ground (smooth through the horizon, where it goes to 0 and then
+	// negative) and feet to the side per foot ahead per unit of
+	// normalized x
+	std::vector<float> _rowInverseAhead;
+	std::vector<float> _rowSidePerAhead;
+
+	// Normalized x ((u - cx) / fx) of each column
+	std::vector<float> _columnX;
+    };
+}
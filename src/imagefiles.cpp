@@ -0,0 +1,96 @@
+#include "imagefiles.hpp"
+
+#include <algorithm>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+using namespace vision;
+using namespace std;
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+namespace {
+    bool endsWith(const string& s, const string& suffix) {
+	return (s.size() >= suffix.size())
+	    && (s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0);
+    }
+
+    bool isImage(const string& fileName) {
+	string lower(fileName);
+	transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+	return endsWith(lower, ".png") || endsWith(lower, ".jpg") || endsWith(lower, ".jpeg");
+    }
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+bool vision::isOutputImage(const string& fileName) {
+    string base = fileName.substr(fileName.rfind('/') + 1);
+
+    // If no "-" in file name then OK
+    if (base.find('-') == string::npos) {
+	return false;
+    }
+
+    // If it has -step somewhere in the name, assume it is an output file
+    if (base.find("-step") != string::npos) {
+	return true;
+    }
+
+    // Specific name checks
+    const char* outputNames[] = {
+	"-blurred", "-bw", "-contours", "-cropped", "-dialate", "-erode",
+	"-hsv", "-orig.png", "-polygons", "-red.png", "-yellow.png"
+    };
+    for (const char* name : outputNames) {
+	if (base.find(name) != string::npos) {
+	    return true;
+	}
+    }
+
+    return false;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+bool vision::findImages(const string& path, vector<string>& files) {
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0) {
+	return false;
+    }
+
+    if (!S_ISDIR(info.st_mode)) {
+	files.push_back(path);
+	return true;
+    }
+
+    DIR* dir = opendir(path.c_str());
+    if (dir == 0) {
+	return false;
+    }
+
+    vector<string> entries;
+    while (dirent* entry = readdir(dir)) {
+	string name(entry->d_name);
+	if (name[0] != '.') {
+	    entries.push_back(name);
+	}
+    }
+    closedir(dir);
+    sort(entries.begin(), entries.end());
+
+    for (const string& name : entries) {
+	string child = path + "/" + name;
+	if ((stat(child.c_str(), &info) == 0) && S_ISDIR(info.st_mode)) {
+	    findImages(child, files);
+	} else if (isImage(name) && !isOutputImage(name)) {
+	    files.push_back(child);
+	}
+    }
+
+    return true;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace vision {
+
+    /**
+     * Determines if a file name looks like one of the images we write
+     * out (see Filter::writeImages() and process-all.bash) rather than
+     * an original image.
+     */
+    bool isOutputImage(const std::string& fileName);
+
+    /**
+     * Collects image files to process.
+     *
+     * @param path Image file or directory to search (recursively) for
+     * PNG and JPEG files. Files we wrote out ourselves are skipped.
+     *
+     * @param files Where to append the file names found (directory
+     * contents are added in sorted order).
+     *
+     * @return false if path could not be read.
+     */
+    bool findImages(const std::string& path, std::vector<std::string>& files);
+}
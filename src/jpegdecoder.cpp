@@ -0,0 +1,130 @@
+#include "jpegdecoder.hpp"
+
+#include <setjmp.h>
+#include <stdio.h>
+
+#include <jpeglib.h>
+
+using namespace cv;
+using namespace vision;
+using namespace std;
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+/**
+ * libjpeg decompressor (kept between frames so its buffers are reused)
+ * with an error handler that jumps back to decode() rather than exiting.
+ */
+struct JpegDecoder::State {
+    jpeg_decompress_struct cinfo;
+    jpeg_error_mgr errors;
+    jmp_buf onError;
+    char message[JMSG_LENGTH_MAX];
+
+    static void errorExit(j_common_ptr cinfo) {
+	State* state = (State*) cinfo->client_data;
+	(*cinfo->err->format_message)(cinfo, state->message);
+	longjmp(state->onError, 1);
+    }
+
+    static void emitMessage(j_common_ptr cinfo, int level) {
+	// Ignore warnings about corrupt data (common in MJPEG streams)
+    }
+};
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+JpegDecoder::JpegDecoder(int targetWidth) :
+    _targetWidth(targetWidth),
+    _scaleDenom(1),
+    _crop(),
+    _error(),
+    _state(new State())
+{
+    _state->cinfo.err = jpeg_std_error(&_state->errors);
+    _state->errors.error_exit = &State::errorExit;
+    _state->errors.emit_message = &State::emitMessage;
+    _state->cinfo.client_data = _state;
+    jpeg_create_decompress(&_state->cinfo);
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+JpegDecoder::~JpegDecoder() {
+    jpeg_destroy_decompress(&_state->cinfo);
+    delete _state;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+bool JpegDecoder::decode(const uint8_t* data, size_t size, Mat& out) {
+    jpeg_decompress_struct& cinfo = _state->cinfo;
+
+    if (setjmp(_state->onError)) {
+	_error = _state->message;
+	jpeg_abort_decompress(&cinfo);
+	return false;
+    }
+
+    jpeg_mem_src(&cinfo, (unsigned char*) data, size);
+    jpeg_read_header(&cinfo, TRUE);
+
+    // Largest reduction that still gives us at least the target width
+    _scaleDenom = 1;
+    while ((_scaleDenom < 8) && (_targetWidth > 0)
+	   && (((int) cinfo.image_width / (_scaleDenom * 2)) >= _targetWidth)) {
+	_scaleDenom *= 2;
+    }
+    cinfo.scale_num = 1;
+    cinfo.scale_denom = _scaleDenom;
+    cinfo.out_color_space = JCS_EXT_BGR;
+
+    jpeg_start_decompress(&cinfo);
+
+    int width = cinfo.output_width;
+    int height = cinfo.output_height;
+    const uchar* before = out.data;
+    out.create(height, width, CV_8UC3);
+    if (out.data != before) {
+	out = Scalar::all(0);
+    }
+
+    Rect window(0, 0, width, height);
+    if (_crop) {
+	Rect crop = _crop(Size(width, height));
+	if (crop.area() > 0) {
+	    crop = Rect(crop.x - 1, crop.y - 1, crop.width + 2, crop.height + 2);
+	}
+	window &= crop;
+    }
+    if (window.area() == 0) {
+	jpeg_abort_decompress(&cinfo);
+	return true;
+    }
+
+    // Skip columns left of the window (libjpeg widens the window to
+    // whole iMCU columns and tells us where it actually starts)
+    JDIMENSION xOffset = window.x;
+    JDIMENSION cropWidth = window.width;
+    if ((xOffset > 0) || ((int) cropWidth < width)) {
+	jpeg_crop_scanline(&cinfo, &xOffset, &cropWidth);
+    }
+
+    if (window.y > 0) {
+	jpeg_skip_scanlines(&cinfo, window.y);
+    }
+
+    int lastRow = window.y + window.height;
+    while ((int) cinfo.output_scanline < lastRow) {
+	JSAMPROW row = out.ptr(cinfo.output_scanline) + (xOffset * 3);
+	jpeg_read_scanlines(&cinfo, &row, 1);
+    }
+
+    // Don't bother decoding rows below the window
+    jpeg_abort_decompress(&cinfo);
+    return true;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+
+#include <functional>
+#include <string>
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace vision {
+
+    /**
+     * Decodes JPEG (MJPEG frame) data with libjpeg-turbo straight to the
+     * resolution we process at, only decoding the part of the image the
+     * filter will look at.
+     *
+     * <p>The DCT scaling built into libjpeg (1/2, 1/4 or 1/8) reduces the
+     * image while decoding, which costs a fraction of a full resolution
+     * decode followed by a resize. Rows above the crop window are skipped
+     * without color conversion or upsampling, decoding stops after the
+     * last row of the window and columns outside it are not color
+     * converted.</p>
+     */
+    class JpegDecoder {
+    public:
+	/** Returns the part of a frame of the given size that is used. */
+	typedef std::function<cv::Rect(cv::Size)> CropFunc;
+
+	/**
+	 * @param targetWidth Smallest width we want frames decoded at
+	 * (the largest scale reduction that still gives at least this
+	 * width is used, 0 to always decode at full size).
+	 */
+	explicit JpegDecoder(int targetWidth = 320);
+
+	~JpegDecoder();
+
+	/**
+	 * Only decode the part of the image this function returns for
+	 * the decoded size (by default the whole image is decoded). A one
+	 * pixel margin around it is decoded too, as the 3x3 blur reads the
+	 * pixels just outside the window (see boxblur.hpp).
+	 */
+	void setCrop(CropFunc crop) { _crop = crop; }
+
+	/**
+	 * Decode a JPEG image to BGR.
+	 *
+	 * @param data Compressed image.
+	 * @param size Number of bytes of data.
+	 * @param out Where to store the image (reused if already the right
+	 * size). Pixels outside the crop window and its margin are left
+	 * alone (zero if out had to be allocated).
+	 *
+	 * @return false if data could not be decoded.
+	 */
+	bool decode(const uint8_t* data, size_t size, cv::Mat& out);
+
+	/** Scale denominator used for the last image decoded (1, 2, 4 or 8). */
+	int getScaleDenom() const { return _scaleDenom; }
+
+	/** Error message from the last failed decode. */
+	const std::string& getError() const { return _error; }
+
+    private:
+	struct State;
+
+	int _targetWidth;
+	int _scaleDenom;
+	CropFunc _crop;
+	std::string _error;
+	State* _state;
+    };
+}
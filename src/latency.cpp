@@ -0,0 +1,189 @@
+#include "latency.hpp"
+#include "Timer.h"
+
+#include <cmath>
+
+using namespace vision;
+using namespace std;
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+int64_t vision::monotonicNanos() {
+    timespec now;
+    avc::Timer::getTime(now);
+    return toNanos(now);
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+CaptureClock::CaptureClock() :
+    _periodNanos(0),
+    _lastDriverNanos(0),
+    _sequence(0)
+{
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+void CaptureClock::setFrameRate(double fps) {
+    _periodNanos = (fps > 0) ? (int64_t) (1e9 / fps) : 0;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+int64_t CaptureClock::monotonicToRaw(int64_t monotonicNanos) const {
+    // The two clocks only drift apart slowly (NTP slewing), so sampling
+    // the offset now is accurate enough for a frame or two ago
+    timespec mono;
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+    int64_t raw = vision::monotonicNanos();
+    return monotonicNanos + (raw - toNanos(mono));
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+void CaptureClock::stamp(double driverMsecs, FrameStamp& stamp) {
+    if (driverMsecs <= 0) {
+	stamp.captureNanos = monotonicNanos();
+	stamp.sequence = ++_sequence;
+	stamp.fromDriver = false;
+	return;
+    }
+
+    int64_t driverNanos = (int64_t) (driverMsecs * 1e6);
+
+    // Estimate how many sensor periods went by since last frame
+    uint32_t advance = 1;
+    if ((_periodNanos > 0) && (_lastDriverNanos > 0)) {
+	int64_t periods = llround(((double) (driverNanos - _lastDriverNanos)) / _periodNanos);
+	if (periods > 1) {
+	    advance = periods;
+	}
+    }
+    _lastDriverNanos = driverNanos;
+    _sequence += advance;
+
+    stamp.captureNanos = monotonicToRaw(driverNanos);
+    stamp.sequence = _sequence;
+    stamp.fromDriver = true;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+void CaptureClock::stamp(const timespec& driverTime, uint32_t sequence, FrameStamp& stamp) {
+    _lastDriverNanos = toNanos(driverTime);
+    _sequence = sequence;
+
+    stamp.captureNanos = monotonicToRaw(_lastDriverNanos);
+    stamp.sequence = sequence;
+    stamp.fromDriver = true;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+LatencyHistogram::LatencyHistogram() {
+    reset();
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+int LatencyHistogram::bucketOf(uint64_t micros) {
+    // First 8 buckets are exact
+    if (micros < 8) {
+	return micros;
+    }
+
+    // Then 8 buckets between each power of two
+    int msb = 63 - __builtin_clzll(micros);
+    int sub = (micros >> (msb - 3)) & 7;
+    int bucket = (msb - 2) * 8 + sub;
+    return (bucket < BUCKETS) ? bucket : (BUCKETS - 1);
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+uint64_t LatencyHistogram::bucketMid(int bucket) {
+    if (bucket < 8) {
+	return bucket;
+    }
+    int shift = (bucket / 8) - 1;
+    uint64_t low = ((uint64_t) (8 + (bucket % 8))) << shift;
+    return low + ((1ULL << shift) / 2);
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+void LatencyHistogram::record(int64_t nanos) {
+    if (nanos < 0) {
+	nanos = 0;
+    }
+
+    // Only one thread records, so no need for read-modify-write atomics
+    atomic<uint64_t>& bucket = _buckets[bucketOf(nanos / 1000)];
+    bucket.store(bucket.load(memory_order_relaxed) + 1, memory_order_relaxed);
+    _count.store(_count.load(memory_order_relaxed) + 1, memory_order_relaxed);
+    _sum.store(_sum.load(memory_order_relaxed) + nanos, memory_order_relaxed);
+    if (nanos > _max.load(memory_order_relaxed)) {
+	_max.store(nanos, memory_order_relaxed);
+    }
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+int64_t LatencyHistogram::percentile(double fraction) const {
+    uint64_t count = getCount();
+    if (count == 0) {
+	return 0;
+    }
+
+    uint64_t target = (uint64_t) ceil(fraction * count);
+    if (target < 1) {
+	target = 1;
+    }
+
+    uint64_t seen = 0;
+    for (int i = 0; i < BUCKETS; i++) {
+	seen += _buckets[i].load(memory_order_relaxed);
+	if (seen >= target) {
+	    int64_t nanos = bucketMid(i) * 1000;
+	    // Never report more than we've actually seen
+	    return (nanos < getMax()) ? nanos : getMax();
+	}
+    }
+    return getMax();
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+void LatencyHistogram::reset() {
+    for (int i = 0; i < BUCKETS; i++) {
+	_buckets[i].store(0, memory_order_relaxed);
+    }
+    _count.store(0, memory_order_relaxed);
+    _sum.store(0, memory_order_relaxed);
+    _max.store(0, memory_order_relaxed);
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+ostream& LatencyHistogram::print(ostream& out) const {
+    out << "n: " << getCount()
+	<< "  p50: " << (percentile(0.50) * 1e-6)
+	<< "  p90: " << (percentile(0.90) * 1e-6)
+	<< "  p99: " << (percentile(0.99) * 1e-6)
+	<< "  max: " << (getMax() * 1e-6) << " ms";
+    return out;
+}
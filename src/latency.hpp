@@ -0,0 +1,167 @@
+#pragma once
+
+#include <atomic>
+#include <iostream>
+
+#include <stdint.h>
+#include <time.h>
+
+namespace vision {
+
+    /** Converts a time stamp to nanoseconds. */
+    inline int64_t toNanos(const timespec& ts) {
+	return ((int64_t) ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+    }
+
+    /** Current CLOCK_MONOTONIC_RAW time (see avc::Timer::getTime) in nanoseconds. */
+    int64_t monotonicNanos();
+
+    /**
+     * When and in what order a frame was captured.
+     */
+    struct FrameStamp {
+	// CLOCK_MONOTONIC_RAW nanoseconds when the sensor delivered the frame
+	int64_t captureNanos;
+	// Camera sequence number (gaps indicate frames dropped)
+	uint32_t sequence;
+	// true if captureNanos came from the driver's buffer time stamp
+	bool fromDriver;
+
+	FrameStamp() : captureNanos(0), sequence(0), fromDriver(false) { }
+    };
+
+    /**
+     * Produces FrameStamp values for frames read from a camera.
+     *
+     * <p>If the driver reports buffer time stamps (V4L2 uses
+     * CLOCK_MONOTONIC) they are converted to the CLOCK_MONOTONIC_RAW time
+     * base used everywhere else, otherwise the time the frame was grabbed
+     * is used. The driver time stamps also let us estimate the camera
+     * sequence number (and detect dropped frames) when the capture API
+     * doesn't provide one.</p>
+     */
+    class CaptureClock {
+    public:
+	CaptureClock();
+
+	/** Nominal frames per second of the camera (0 if unknown). */
+	void setFrameRate(double fps);
+
+	/**
+	 * Stamp a frame that was just grabbed.
+	 *
+	 * @param driverMsecs Driver buffer time stamp in milliseconds
+	 * (CLOCK_MONOTONIC), 0 or less if not available.
+	 *
+	 * @param stamp Where to store the results.
+	 */
+	void stamp(double driverMsecs, FrameStamp& stamp);
+
+	/**
+	 * Stamp a frame where the capture API provides the driver sequence
+	 * number and time stamp directly (like V4L2).
+	 *
+	 * @param driverTime Buffer time stamp (CLOCK_MONOTONIC).
+	 * @param sequence Sequence number reported by the driver.
+	 * @param stamp Where to store the results.
+	 */
+	void stamp(const timespec& driverTime, uint32_t sequence, FrameStamp& stamp);
+
+    private:
+	int64_t monotonicToRaw(int64_t monotonicNanos) const;
+
+	int64_t _periodNanos;
+	int64_t _lastDriverNanos;
+	uint32_t _sequence;
+    };
+
+    /**
+     * Counts frames dropped based on gaps in camera sequence numbers.
+     */
+    class SequenceTracker {
+    public:
+	SequenceTracker() : _started(false), _last(0), _dropped(0) { }
+
+	/**
+	 * Record the sequence number of the next frame received.
+	 *
+	 * @return Number of frames dropped since previous frame.
+	 */
+	uint32_t observe(uint32_t sequence) {
+	    uint32_t gap = 0;
+	    if (_started && (sequence > _last + 1)) {
+		gap = sequence - _last - 1;
+		_dropped += gap;
+	    }
+	    _started = true;
+	    _last = sequence;
+	    return gap;
+	}
+
+	/** Total number of frames dropped. */
+	uint32_t getDropped() const { return _dropped; }
+
+    private:
+	bool _started;
+	uint32_t _last;
+	uint32_t _dropped;
+    };
+
+    /**
+     * Fixed memory histogram of latencies that can report running
+     * percentiles.
+     *
+     * <p>Values are kept in microsecond buckets with 8 buckets per power
+     * of two (about 12% resolution) up to about 16 seconds. A single
+     * thread records values, other threads may read percentiles at any
+     * time (results may be a sample or two stale).</p>
+     */
+    class LatencyHistogram {
+    public:
+	LatencyHistogram();
+
+	/** Record a latency (negative values are recorded as 0). */
+	void record(int64_t nanos);
+
+	/** Number of values recorded. */
+	uint64_t getCount() const { return _count.load(std::memory_order_relaxed); }
+
+	/** Largest value recorded (in nanoseconds). */
+	int64_t getMax() const { return _max.load(std::memory_order_relaxed); }
+
+	/** Sum of all values recorded (in nanoseconds). */
+	int64_t getSum() const { return _sum.load(std::memory_order_relaxed); }
+
+	/**
+	 * Get the approximate value that a fraction of the recorded values
+	 * were at or below.
+	 *
+	 * @param fraction Value in the range [0, 1] (0.99 for 99th percentile).
+	 *
+	 * @return Latency in nanoseconds (0 if nothing recorded).
+	 */
+	int64_t percentile(double fraction) const;
+
+	/** Forget all values recorded. */
+	void reset();
+
+	/** Dump count, p50, p90, p99 and max values in milliseconds. */
+	std::ostream& print(std::ostream& out) const;
+
+    private:
+	static const int BUCKETS = 184;
+
+	static int bucketOf(uint64_t micros);
+	static uint64_t bucketMid(int bucket);
+
+	std::atomic<uint64_t> _buckets[BUCKETS];
+	std::atomic<uint64_t> _count;
+	std::atomic<int64_t> _sum;
+	std::atomic<int64_t> _max;
+    };
+
+    // Helper method to dump information about LatencyHistogram to output stream
+    inline std::ostream& operator <<(std::ostream& out, const LatencyHistogram& h) {
+	return h.print(out);
+    }
+}
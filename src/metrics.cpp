@@ -0,0 +1,303 @@
+#include "metrics.hpp"
+
+#include <sstream>
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace vision;
+using namespace std;
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+namespace {
+    const char* const COUNTER_NAMES[COUNTER_COUNT] = {
+	"avc_frames_processed_total",
+	"avc_detections_total{color=\"none\"}",
+	"avc_detections_total{color=\"red\"}",
+	"avc_detections_total{color=\"yellow\"}",
+	"avc_camera_reopens_total",
+    };
+
+    const double QUANTILES[] = { 0.5, 0.9, 0.99 };
+
+    void header(ostream& out, const string& name, const string& help, const char* type) {
+	out << "# HELP " << name << " " << help << "\n"
+	    << "# TYPE " << name << " " << type << "\n";
+    }
+
+    void writeAll(int fd, const string& data) {
+	const char* buf = data.data();
+	size_t left = data.size();
+	while (left > 0) {
+	    ssize_t n = send(fd, buf, left, MSG_NOSIGNAL);
+	    if (n <= 0) {
+		if ((n < 0) && (errno == EINTR)) {
+		    continue;
+		}
+		return;
+	    }
+	    buf += n;
+	    left -= n;
+	}
+    }
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+Metrics::Metrics() :
+    _slotsUsed(0),
+    _lock(),
+    _stages(),
+    _gauges(),
+    _startNanos(monotonicNanos()),
+    _lastPrintNanos(_startNanos),
+    _lastPrintFrames(0),
+    _socketPath(),
+    _listenFd(-1),
+    _serving(false),
+    _server()
+{
+    for (int i = 0; i < MAX_THREADS; i++) {
+	for (int j = 0; j < COUNTER_COUNT; j++) {
+	    _slots[i].values[j].store(0, memory_order_relaxed);
+	}
+    }
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+Metrics::~Metrics() {
+    stopServer();
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+Metrics::Slot& Metrics::threadSlot() {
+    static thread_local int index = -1;
+    if (index < 0) {
+	index = _slotsUsed.fetch_add(1);
+	if (index > SHARED_SLOT) {
+	    index = SHARED_SLOT;
+	}
+    }
+    return _slots[index];
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+uint64_t Metrics::get(Counter counter) const {
+    uint64_t total = 0;
+    for (int i = 0; i < MAX_THREADS; i++) {
+	total += _slots[i].values[counter].load(memory_order_relaxed);
+    }
+    return total;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+void Metrics::addStage(const string& stage, const LatencyHistogram* histogram) {
+    lock_guard<mutex> guard(_lock);
+    Stage entry;
+    entry.name = stage;
+    entry.histogram = histogram;
+    _stages.push_back(entry);
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+void Metrics::addGauge(const string& name, const string& help, GaugeFunc func, bool counter) {
+    lock_guard<mutex> guard(_lock);
+    Gauge gauge;
+    gauge.name = name;
+    gauge.help = help;
+    gauge.func = func;
+    gauge.counter = counter;
+    _gauges.push_back(gauge);
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+void Metrics::markStart() {
+    lock_guard<mutex> guard(_lock);
+    _startNanos = _lastPrintNanos = monotonicNanos();
+    _lastPrintFrames = get(FramesProcessed);
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+ostream& Metrics::print(ostream& out) {
+    lock_guard<mutex> guard(_lock);
+
+    int64_t now = monotonicNanos();
+    uint64_t frames = get(FramesProcessed);
+
+    header(out, "avc_frames_processed_total", "Frames run through the filter.", "counter");
+    out << COUNTER_NAMES[FramesProcessed] << " " << frames << "\n";
+
+    header(out, "avc_detections_total", "Frames by what was found.", "counter");
+    for (int c = FoundNone; c <= FoundYellow; c++) {
+	out << COUNTER_NAMES[c] << " " << get((Counter) c) << "\n";
+    }
+
+    header(out, "avc_detection_rate", "Fraction of frames where color was found.", "gauge");
+    out << "avc_detection_rate{color=\"red\"} "
+	<< (frames ? ((double) get(FoundRed)) / frames : 0) << "\n"
+	<< "avc_detection_rate{color=\"yellow\"} "
+	<< (frames ? ((double) get(FoundYellow)) / frames : 0) << "\n";
+
+    // Rate since start and since previous time metrics were read
+    double secs = (now - _startNanos) * 1e-9;
+    double recentSecs = (now - _lastPrintNanos) * 1e-9;
+    header(out, "avc_fps", "Frames per second processed.", "gauge");
+    out << "avc_fps{window=\"total\"} " << ((secs > 0) ? (frames / secs) : 0) << "\n"
+	<< "avc_fps{window=\"since_last_read\"} "
+	<< ((recentSecs > 0) ? ((frames - _lastPrintFrames) / recentSecs) : 0) << "\n";
+    _lastPrintNanos = now;
+    _lastPrintFrames = frames;
+
+    header(out, "avc_camera_reopens_total", "Times camera was closed and opened again.", "counter");
+    out << COUNTER_NAMES[CameraReopens] << " " << get(CameraReopens) << "\n";
+
+    if (!_stages.empty()) {
+	header(out, "avc_stage_latency_seconds", "Time spent in each processing stage.", "summary");
+	for (const Stage& stage : _stages) {
+	    const LatencyHistogram& h = *stage.histogram;
+	    string label = "avc_stage_latency_seconds{stage=\"" + stage.name + "\"";
+	    for (double q : QUANTILES) {
+		out << label << ",quantile=\"" << q << "\"} " << (h.percentile(q) * 1e-9) << "\n";
+	    }
+	    out << "avc_stage_latency_seconds_sum{stage=\"" << stage.name << "\"} "
+		<< (h.getSum() * 1e-9) << "\n"
+		<< "avc_stage_latency_seconds_count{stage=\"" << stage.name << "\"} "
+		<< h.getCount() << "\n";
+	}
+    }
+
+    // Gauges with the same base name (different labels) share a header
+    string lastBase;
+    for (const Gauge& gauge : _gauges) {
+	string base = gauge.name.substr(0, gauge.name.find('{'));
+	if (base != lastBase) {
+	    header(out, base, gauge.help, gauge.counter ? "counter" : "gauge");
+	    lastBase = base;
+	}
+	out << gauge.name << " " << gauge.func() << "\n";
+    }
+
+    return out;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+bool Metrics::startServer(const string& socketPath) {
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(addr.sun_path)) {
+	cerr << "Metrics socket path too long: " << socketPath << "\n";
+	return false;
+    }
+    strcpy(addr.sun_path, socketPath.c_str());
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+	cerr << "Failed to create metrics socket: " << strerror(errno) << "\n";
+	return false;
+    }
+
+    // Remove stale socket from a previous run
+    unlink(socketPath.c_str());
+
+    if ((bind(fd, (sockaddr*) &addr, sizeof(addr)) != 0) || (listen(fd, 4) != 0)) {
+	cerr << "Failed to listen on " << socketPath << ": " << strerror(errno) << "\n";
+	close(fd);
+	return false;
+    }
+
+    _socketPath = socketPath;
+    _listenFd = fd;
+    _serving.store(true);
+    _server = thread(&Metrics::serve, this);
+    return true;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+void Metrics::stopServer() {
+    if (!_serving.exchange(false)) {
+	return;
+    }
+    if (_server.joinable()) {
+	_server.join();
+    }
+    close(_listenFd);
+    _listenFd = -1;
+    unlink(_socketPath.c_str());
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+void Metrics::serve() {
+    while (_serving.load()) {
+	// Wake up periodically to see if we've been asked to stop
+	pollfd pfd;
+	pfd.fd = _listenFd;
+	pfd.events = POLLIN;
+	if (poll(&pfd, 1, 250) <= 0) {
+	    continue;
+	}
+
+	int client = accept4(_listenFd, 0, 0, SOCK_CLOEXEC);
+	if (client >= 0) {
+	    respond(client);
+	    close(client);
+	}
+    }
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+void Metrics::respond(int client) {
+    // Clients may send an HTTP request (curl --unix-socket) or nothing at
+    // all (socat), so only wait briefly for a request
+    char request[1024];
+    ssize_t n = 0;
+    pollfd pfd;
+    pfd.fd = client;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, 100) > 0) {
+	n = read(client, request, sizeof(request));
+    }
+    bool http = (n >= 4) && (strncmp(request, "GET ", 4) == 0);
+
+    ostringstream body;
+    print(body);
+
+    if (http) {
+	ostringstream head;
+	head << "HTTP/1.0 200 OK\r\n"
+	     << "Content-Type: text/plain; version=0.0.4\r\n"
+	     << "Content-Length: " << body.str().size() << "\r\n"
+	     << "\r\n";
+	writeAll(client, head.str());
+    }
+    writeAll(client, body.str());
+}
@@ -0,0 +1,154 @@
+#pragma once
+
+#include "latency.hpp"
+
+#include <atomic>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <stdint.h>
+
+namespace vision {
+
+    /**
+     * Counters updated from the processing loop.
+     */
+    enum Counter {
+	FramesProcessed,
+	FoundNone,
+	FoundRed,
+	FoundYellow,
+	CameraReopens,
+	COUNTER_COUNT
+    };
+
+    /**
+     * Runtime statistics served in Prometheus text format over a local
+     * Unix socket.
+     *
+     * <p>Counters are kept in per-thread slots padded out to their own
+     * cache lines, so updating one is a plain load and store on memory
+     * nobody else writes (no locks or contended atomics in the hot loop).
+     * The slots are only summed when someone reads the metrics. Latency
+     * histograms and gauges are registered up front and read at that
+     * time as well.</p>
+     *
+     * <p>Only one instance should be created per process.</p>
+     *
+     * <p>To view: curl --unix-socket PATH http://localhost/metrics</p>
+     */
+    class Metrics {
+    public:
+	/** Function returning current value of a gauge. */
+	typedef std::function<double()> GaugeFunc;
+
+	Metrics();
+
+	/** Stops the server (if running). */
+	~Metrics();
+
+	/**
+	 * Add to a counter (safe from any thread, the first MAX_THREADS - 1
+	 * threads get their own slots, any more share the last one).
+	 */
+	void add(Counter counter, uint64_t amount = 1) {
+	    Slot& slot = threadSlot();
+	    std::atomic<uint64_t>& value = slot.values[counter];
+	    if (&slot != &_slots[SHARED_SLOT]) {
+		value.store(value.load(std::memory_order_relaxed) + amount,
+			    std::memory_order_relaxed);
+	    } else {
+		value.fetch_add(amount, std::memory_order_relaxed);
+	    }
+	}
+
+	/** Current total of a counter across all threads. */
+	uint64_t get(Counter counter) const;
+
+	/**
+	 * Report latency quantiles of a processing stage.
+	 *
+	 * @param stage Name of stage (used as label value).
+	 * @param histogram Histogram the stage records into (must
+	 * outlive this object).
+	 */
+	void addStage(const std::string& stage, const LatencyHistogram* histogram);
+
+	/**
+	 * Report a value computed when the metrics are read.
+	 *
+	 * @param name Metric name (like "avc_log_queue_depth"), may
+	 * include labels (like "avc_queue_depth{stage=\"locate\"}").
+	 * @param help Description of metric.
+	 * @param func Function that returns the current value.
+	 * @param counter Pass true if the value only goes up.
+	 */
+	void addGauge(const std::string& name, const std::string& help,
+		      GaugeFunc func, bool counter = false);
+
+	/** Start time of frame processing (used to compute FPS). */
+	void markStart();
+
+	/**
+	 * Starts background thread serving metrics.
+	 *
+	 * @param socketPath Path of Unix socket to create.
+	 *
+	 * @return true if listening.
+	 */
+	bool startServer(const std::string& socketPath);
+
+	/** Stops background thread and removes socket. */
+	void stopServer();
+
+	/** Write all metrics in Prometheus text exposition format. */
+	std::ostream& print(std::ostream& out);
+
+    private:
+	static const int MAX_THREADS = 16;
+	static const int SHARED_SLOT = MAX_THREADS - 1;
+
+	// Counter values for one thread (padded to whole cache lines)
+	struct Slot {
+	    std::atomic<uint64_t> values[COUNTER_COUNT];
+	    char pad[64 - ((COUNTER_COUNT * sizeof(uint64_t)) % 64)];
+	};
+
+	struct Stage {
+	    std::string name;
+	    const LatencyHistogram* histogram;
+	};
+
+	struct Gauge {
+	    std::string name;
+	    std::string help;
+	    GaugeFunc func;
+	    bool counter;
+	};
+
+	Slot& threadSlot();
+	void serve();
+	void respond(int client);
+
+	alignas(64) Slot _slots[MAX_THREADS];
+	std::atomic<int> _slotsUsed;
+
+	// Registration and printing happen off the hot path
+	std::mutex _lock;
+	std::vector<Stage> _stages;
+	std::vector<Gauge> _gauges;
+
+	int64_t _startNanos;
+	int64_t _lastPrintNanos;
+	uint64_t _lastPrintFrames;
+
+	std::string _socketPath;
+	int _listenFd;
+	std::atomic<bool> _serving;
+	std::thread _server;
+    };
+}
@@ -0,0 +1,298 @@
+#include "mjpegsource.hpp"
+#include "imagefiles.hpp"
+#include "Timer.h"
+
+#include <fstream>
+#include <iostream>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace cv;
+using namespace vision;
+using namespace std;
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+namespace {
+    bool isJpegFile(const string& name) {
+	size_t dot = name.rfind('.');
+	if (dot == string::npos) {
+	    return false;
+	}
+	string ext = name.substr(dot + 1);
+	for (char& c : ext) {
+	    c = tolower(c);
+	}
+	return (ext == "jpg") || (ext == "jpeg");
+    }
+
+    /** Wait a little longer each time we find nothing to do. */
+    void idle(int attempt) {
+	if (attempt < 64) {
+	    sched_yield();
+	} else {
+	    avc::Timer::sleepNanos(100000);
+	}
+    }
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+bool vision::findJpeg(const uint8_t* data, size_t size, size_t& pos,
+		      size_t& start, size_t& length) {
+    while (pos + 1 < size) {
+	// Start of image marker
+	while ((pos + 1 < size) && !((data[pos] == 0xFF) && (data[pos + 1] == 0xD8))) {
+	    pos++;
+	}
+	if (pos + 1 >= size) {
+	    return false;
+	}
+	start = pos;
+
+	// Walk marker segments (skipping their contents so thumbnails in
+	// EXIF data don't confuse us) and scan entropy coded data for the
+	// end of image marker
+	size_t p = pos + 2;
+	while (p + 1 < size) {
+	    if (data[p] != 0xFF) {
+		p++;
+		continue;
+	    }
+	    uint8_t marker = data[p + 1];
+	    if (marker == 0xFF) {
+		// Fill byte
+		p++;
+	    } else if ((marker == 0x00) || (marker == 0x01) || ((marker >= 0xD0) && (marker <= 0xD7))) {
+		// Stuffed zero, TEM or restart marker (no length)
+		p += 2;
+	    } else if (marker == 0xD9) {
+		length = p + 2 - start;
+		pos = p + 2;
+		return true;
+	    } else if (marker == 0xD8) {
+		// New image before end of last one (truncated frame)
+		break;
+	    } else {
+		if (p + 3 >= size) {
+		    return false;
+		}
+		p += 2 + ((data[p + 2] << 8) | data[p + 3]);
+	    }
+	}
+
+	if (p + 1 >= size) {
+	    return false;
+	}
+	pos = p;
+    }
+    return false;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+MjpegSource::MjpegSource() :
+    _slots(SLOTS),
+    _free(SLOTS),
+    _ready(SLOTS),
+    _thread(),
+    _stopping(false),
+    _done(true),
+    _errors(0),
+    _decodeLatency(),
+    _map(0),
+    _mapSize(0),
+    _pos(0),
+    _files(),
+    _nextFile(0),
+    _fileData()
+{
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+MjpegSource::~MjpegSource() {
+    close();
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+bool MjpegSource::open(const string& path, int targetWidth, JpegDecoder::CropFunc crop) {
+    close();
+
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0) {
+	cerr << "Unable to open " << path << ": " << strerror(errno) << "\n";
+	return false;
+    }
+
+    if (S_ISDIR(info.st_mode) || isJpegFile(path)) {
+	vector<string> images;
+	findImages(path, images);
+	for (const string& image : images) {
+	    if (isJpegFile(image)) {
+		_files.push_back(image);
+	    }
+	}
+	if (_files.empty()) {
+	    cerr << "No JPEG images found in " << path << "\n";
+	    return false;
+	}
+    } else {
+	int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	void* map = (fd >= 0) ? mmap(0, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+	if (map == MAP_FAILED) {
+	    cerr << "Unable to map " << path << ": " << strerror(errno) << "\n";
+	    if (fd >= 0) {
+		::close(fd);
+	    }
+	    return false;
+	}
+	::close(fd);
+	madvise(map, info.st_size, MADV_SEQUENTIAL);
+	_map = (const uint8_t*) map;
+	_mapSize = info.st_size;
+    }
+
+    for (int i = 0; i < SLOTS; i++) {
+	_free.push(i);
+    }
+    _stopping.store(false);
+    _done.store(false);
+    _thread = thread(&MjpegSource::decodeLoop, this, targetWidth, crop);
+    return true;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+void MjpegSource::close() {
+    _stopping.store(true);
+    if (_thread.joinable()) {
+	_thread.join();
+    }
+
+    int slot;
+    while (_free.pop(slot)) {
+    }
+    while (_ready.pop(slot)) {
+    }
+
+    if (_map != 0) {
+	munmap((void*) _map, _mapSize);
+	_map = 0;
+	_mapSize = 0;
+	_pos = 0;
+    }
+    _files.clear();
+    _nextFile = 0;
+    _done.store(true);
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+bool MjpegSource::nextCompressed(const uint8_t*& data, size_t& size) {
+    if (_map != 0) {
+	size_t start;
+	if (!findJpeg(_map, _mapSize, _pos, start, size)) {
+	    return false;
+	}
+	data = _map + start;
+	return true;
+    }
+
+    if (_nextFile >= _files.size()) {
+	return false;
+    }
+    ifstream in(_files[_nextFile++].c_str(), ios::binary);
+    _fileData.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+    data = _fileData.data();
+    size = _fileData.size();
+    return true;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+void MjpegSource::decodeLoop(int targetWidth, JpegDecoder::CropFunc crop) {
+    JpegDecoder decoder(targetWidth);
+    decoder.setCrop(crop);
+    uint32_t sequence = 0;
+
+    while (!_stopping.load()) {
+	int slot;
+	int attempt = 0;
+	while (!_free.pop(slot)) {
+	    if (_stopping.load()) {
+		return;
+	    }
+	    idle(attempt++);
+	}
+
+	const uint8_t* data;
+	size_t size;
+	bool decoded = false;
+	Slot& frame = _slots[slot];
+
+	while (!decoded && nextCompressed(data, size)) {
+	    int64_t start = monotonicNanos();
+	    frame.stamp.captureNanos = start;
+	    frame.stamp.sequence = ++sequence;
+	    frame.stamp.fromDriver = false;
+
+	    decoded = decoder.decode(data, size, frame.image);
+	    if (decoded) {
+		_decodeLatency.record(monotonicNanos() - start);
+	    } else {
+		_errors.fetch_add(1);
+		cerr << "Failed to decode frame " << sequence << ": " << decoder.getError() << "\n";
+	    }
+	}
+
+	if (!decoded) {
+	    // End of input
+	    break;
+	}
+	_ready.push(slot);
+    }
+
+    _done.store(true);
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+bool MjpegSource::read(Mat& frame, FrameStamp& stamp) {
+    int slot;
+    int attempt = 0;
+    while (!_ready.pop(slot)) {
+	if (_done.load()) {
+	    // Decoder may have pushed a frame just before finishing
+	    if (_ready.pop(slot)) {
+		break;
+	    }
+	    frame.release();
+	    return false;
+	}
+	idle(attempt++);
+    }
+
+    // Hand our old buffer to the decoder rather than copying
+    Slot& decoded = _slots[slot];
+    swap(frame, decoded.image);
+    stamp = decoded.stamp;
+    _free.push(slot);
+    return true;
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include "jpegdecoder.hpp"
+#include "latency.hpp"
+#include "spscqueue.hpp"
+
+#include <opencv2/opencv.hpp>
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace vision {
+
+    /**
+     * Finds the next complete JPEG image in a buffer (like a recorded
+     * MJPEG stream of back to back JPEG frames, possibly with multipart
+     * HTTP headers in between).
+     *
+     * @param data Buffer to search.
+     * @param size Number of bytes in buffer.
+     * @param pos Where to start searching (updated to just past the
+     * image found).
+     * @param start Set to offset of the image's start of image marker.
+     * @param length Set to number of bytes in the image.
+     *
+     * @return false if there are no more complete images.
+     */
+    bool findJpeg(const uint8_t* data, size_t size, size_t& pos,
+		  size_t& start, size_t& length);
+
+    /**
+     * Supplies decoded frames from compressed (MJPEG) data in place of a
+     * camera, decoding on a background thread with JpegDecoder so the
+     * decode of frame N+1 overlaps processing of frame N.
+     *
+     * <p>The source may be a recorded MJPEG stream (frames are found
+     * with findJpeg()), a single JPEG image or a directory of them.</p>
+     */
+    class MjpegSource {
+    public:
+	MjpegSource();
+
+	/** Stops the decode thread and releases the input. */
+	~MjpegSource();
+
+	/**
+	 * Open the compressed input and start decoding.
+	 *
+	 * @param path MJPEG stream file, JPEG file or directory of JPEG files.
+	 * @param targetWidth Width to scale frames down to (see JpegDecoder).
+	 * @param crop Part of each frame that needs to be decoded.
+	 *
+	 * @return true if input was opened.
+	 */
+	bool open(const std::string& path, int targetWidth,
+		  JpegDecoder::CropFunc crop = JpegDecoder::CropFunc());
+
+	/**
+	 * Get the next decoded frame (waits for the decode thread).
+	 *
+	 * @param frame Set to the next frame. The buffer frame previously
+	 * held is handed to the decoder for reuse, so don't keep other
+	 * references to it.
+	 * @param stamp Set to when the compressed frame was read and its
+	 * position in the stream.
+	 *
+	 * @return false at the end of the input (frame is left alone).
+	 */
+	bool read(cv::Mat& frame, FrameStamp& stamp);
+
+	/** Stops decoding and releases the input. */
+	void close();
+
+	/** Time taken to decode each frame. */
+	const LatencyHistogram& getDecodeLatency() const { return _decodeLatency; }
+
+	/** Number of compressed frames that failed to decode. */
+	uint64_t getDecodeErrors() const { return _errors.load(); }
+
+    private:
+	static const int SLOTS = 3;
+
+	struct Slot {
+	    cv::Mat image;
+	    FrameStamp stamp;
+	};
+
+	bool nextCompressed(const uint8_t*& data, size_t& size);
+	void decodeLoop(int targetWidth, JpegDecoder::CropFunc crop);
+
+	std::vector<Slot> _slots;
+	SpscQueue<int> _free;
+	SpscQueue<int> _ready;
+	std::thread _thread;
+	std::atomic<bool> _stopping;
+	std::atomic<bool> _done;
+	std::atomic<uint64_t> _errors;
+	LatencyHistogram _decodeLatency;
+
+	// Memory mapped MJPEG stream
+	const uint8_t* _map;
+	size_t _mapSize;
+	size_t _pos;
+
+	// Individual JPEG files
+	std::vector<std::string> _files;
+	size_t _nextFile;
+	std::vector<uint8_t> _fileData;
+    };
+}
@@ -0,0 +1,261 @@
+#include "perfcounters.hpp"
+#include "latency.hpp"
+
+#include <iomanip>
+
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using namespace vision;
+using namespace std;
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+namespace {
+    struct CounterSpec {
+	uint32_t type;
+	uint64_t config;
+	const char* name;
+    };
+
+    const CounterSpec HARDWARE[PerfCounters::COUNT] = {
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "cycles" },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "instructions" },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, "cache-misses" },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, "branch-misses" },
+    };
+
+    const CounterSpec SOFTWARE[PerfCounters::COUNT] = {
+	{ PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK, "task-clock-ns" },
+	{ PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS, "page-faults" },
+	{ PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, "context-switches" },
+	{ PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS, "cpu-migrations" },
+    };
+
+    int perfEventOpen(perf_event_attr& attr, int groupFd) {
+	// Calling thread, any CPU
+	return syscall(__NR_perf_event_open, &attr, 0, -1, groupFd, PERF_FLAG_FD_CLOEXEC);
+    }
+
+    // Layout of read() with PERF_FORMAT_GROUP and both time fields
+    struct GroupRead {
+	uint64_t nr;
+	uint64_t timeEnabled;
+	uint64_t timeRunning;
+	uint64_t values[PerfCounters::COUNT];
+    };
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+PerfCounters::PerfCounters() :
+    _hardware(false)
+{
+    for (int i = 0; i < COUNT; i++) {
+	_fds[i] = -1;
+    }
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+PerfCounters::~PerfCounters() {
+    close();
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+void PerfCounters::close() {
+    for (int i = 0; i < COUNT; i++) {
+	if (_fds[i] >= 0) {
+	    ::close(_fds[i]);
+	    _fds[i] = -1;
+	}
+    }
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+bool PerfCounters::open() {
+    close();
+
+    if (openGroup(true)) {
+	return true;
+    }
+    int hwErrno = errno;
+
+    if (openGroup(false)) {
+	cerr << "Hardware performance counters unavailable ("
+	     << strerror(hwErrno) << "), using software counters\n";
+	return true;
+    }
+
+    cerr << "Failed to open performance counters: " << strerror(errno)
+	 << " (check /proc/sys/kernel/perf_event_paranoid)\n";
+    return false;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+bool PerfCounters::openGroup(bool hardware) {
+    const CounterSpec* specs = hardware ? HARDWARE : SOFTWARE;
+
+    for (int i = 0; i < COUNT; i++) {
+	perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = specs[i].type;
+	attr.config = specs[i].config;
+	attr.read_format = PERF_FORMAT_GROUP
+	    | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+	// Group starts disabled and is enabled as a whole below
+	attr.disabled = (i == 0) ? 1 : 0;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	_fds[i] = perfEventOpen(attr, (i == 0) ? -1 : _fds[0]);
+	if (_fds[i] < 0) {
+	    int err = errno;
+	    close();
+	    errno = err;
+	    return false;
+	}
+    }
+
+    ioctl(_fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(_fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    _hardware = hardware;
+    return true;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+const char* PerfCounters::getName(int counter) const {
+    return (_hardware ? HARDWARE : SOFTWARE)[counter].name;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+bool PerfCounters::read(Sample& sample) const {
+    GroupRead data;
+    if ((_fds[0] < 0) || (::read(_fds[0], &data, sizeof(data)) != sizeof(data))) {
+	return false;
+    }
+
+    // Counters only ran part of the time if the PMU was shared out
+    double scale = 1.0;
+    if ((data.timeRunning > 0) && (data.timeRunning < data.timeEnabled)) {
+	scale = ((double) data.timeEnabled) / data.timeRunning;
+    }
+    for (int i = 0; i < COUNT; i++) {
+	sample.values[i] = (uint64_t) (data.values[i] * scale);
+    }
+    return true;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+StageProfiler::StageProfiler(const char* const* names, int count) :
+    _counters(),
+    _stages(count)
+{
+    for (int i = 0; i < count; i++) {
+	_stages[i].name = names[i];
+    }
+    reset();
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+void StageProfiler::reset() {
+    for (Totals& stage : _stages) {
+	stage.calls = 0;
+	stage.nanos = 0;
+	stage.startNanos = 0;
+	memset(stage.counts, 0, sizeof(stage.counts));
+	memset(&stage.start, 0, sizeof(stage.start));
+    }
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+void StageProfiler::begin(int stage) {
+    Totals& t = _stages[stage];
+    _counters.read(t.start);
+    t.startNanos = monotonicNanos();
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+void StageProfiler::end(int stage) {
+    int64_t now = monotonicNanos();
+    PerfCounters::Sample sample;
+    Totals& t = _stages[stage];
+
+    t.calls++;
+    t.nanos += now - t.startNanos;
+    if (_counters.read(sample)) {
+	for (int i = 0; i < PerfCounters::COUNT; i++) {
+	    t.counts[i] += sample.values[i] - t.start.values[i];
+	}
+    }
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+ostream& StageProfiler::print(ostream& out) const {
+    bool hw = _counters.isHardware();
+    bool counted = _counters.isOpen();
+
+    out << "Stage profile (" << (counted ? (hw ? "hardware" : "software") : "no")
+	<< " counters):\n"
+	<< setw(12) << "stage" << setw(10) << "calls" << setw(12) << "avg us";
+    if (counted && hw) {
+	out << setw(8) << "IPC" << setw(16) << "cache miss/ki" << setw(16) << "branch miss/ki";
+    } else if (counted) {
+	for (int i = 0; i < PerfCounters::COUNT; i++) {
+	    out << setw(18) << _counters.getName(i);
+	}
+    }
+    out << "\n";
+
+    for (const Totals& t : _stages) {
+	if (t.calls == 0) {
+	    continue;
+	}
+	out << setw(12) << t.name << setw(10) << t.calls
+	    << setw(12) << fixed << setprecision(1) << (t.nanos * 1e-3 / t.calls);
+
+	if (counted && hw) {
+	    double cycles = t.counts[0];
+	    double kinst = t.counts[1] * 1e-3;
+	    out << setw(8) << setprecision(2) << ((cycles > 0) ? (t.counts[1] / cycles) : 0)
+		<< setw(16) << ((kinst > 0) ? (t.counts[2] / kinst) : 0)
+		<< setw(16) << ((kinst > 0) ? (t.counts[3] / kinst) : 0);
+	} else if (counted) {
+	    // Per call averages
+	    for (int i = 0; i < PerfCounters::COUNT; i++) {
+		out << setw(18) << setprecision(2) << (((double) t.counts[i]) / t.calls);
+	    }
+	}
+	out << "\n";
+    }
+    out.unsetf(ios::floatfield);
+    return out;
+}
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+namespace vision {
+
+    /**
+     * A group of perf_event counters for the calling thread.
+     *
+     * <p>Tries the hardware PMU counters (cycles, instructions, cache
+     * misses and branch misses) first. Where those aren't available
+     * (virtual machines, no PMU driver, perf_event_paranoid too strict
+     * for hardware events) software counters are used instead (task
+     * clock, page faults, context switches and CPU migrations).</p>
+     */
+    class PerfCounters {
+    public:
+	static const int COUNT = 4;
+
+	/** Counter values (indexed the same as getName()). */
+	struct Sample {
+	    uint64_t values[COUNT];
+	};
+
+	PerfCounters();
+
+	/** Closes counters. */
+	~PerfCounters();
+
+	/**
+	 * Opens and starts counters for the calling thread (only read
+	 * them from that thread).
+	 *
+	 * @return true if either hardware or software counters are running.
+	 */
+	bool open();
+
+	/** Whether open() succeeded. */
+	bool isOpen() const { return _fds[0] >= 0; }
+
+	/** Whether the hardware counters are the ones being used. */
+	bool isHardware() const { return _hardware; }
+
+	/** Name of a counter (like "cycles" or "page-faults"). */
+	const char* getName(int counter) const;
+
+	/**
+	 * Reads current counter values (scaled up if the kernel had to
+	 * multiplex the counters).
+	 *
+	 * @return false if counters could not be read.
+	 */
+	bool read(Sample& sample) const;
+
+    private:
+	bool openGroup(bool hardware);
+	void close();
+
+	int _fds[COUNT];
+	bool _hardware;
+    };
+
+    /**
+     * Accumulates wall clock time and perf counter deltas for each of a
+     * fixed set of named stages (not thread safe, use from the thread
+     * that called open()).
+     */
+    class StageProfiler {
+    public:
+	/**
+	 * @param names Name of each stage.
+	 * @param count Number of stages.
+	 */
+	StageProfiler(const char* const* names, int count);
+
+	/** Opens the perf counters (see PerfCounters::open()). */
+	bool open() { return _counters.open(); }
+
+	/** Marks start of a stage. */
+	void begin(int stage);
+
+	/** Marks end of a stage (adds time and counts since begin()). */
+	void end(int stage);
+
+	/** Clear all totals. */
+	void reset();
+
+	/**
+	 * Dump per stage averages with IPC and miss rates (or software
+	 * counts per call if no hardware counters were available).
+	 */
+	std::ostream& print(std::ostream& out) const;
+
+	/**
+	 * Times a stage for the life of the object (does nothing if
+	 * profiler is null).
+	 */
+	class Scope {
+	public:
+	    Scope(StageProfiler* profiler, int stage) :
+		_profiler(profiler), _stage(stage) {
+		if (_profiler != 0) {
+		    _profiler->begin(_stage);
+		}
+	    }
+
+	    ~Scope() {
+		if (_profiler != 0) {
+		    _profiler->end(_stage);
+		}
+	    }
+
+	private:
+	    StageProfiler* _profiler;
+	    int _stage;
+	};
+
+    private:
+	struct Totals {
+	    std::string name;
+	    uint64_t calls;
+	    int64_t nanos;
+	    uint64_t counts[PerfCounters::COUNT];
+	    // Values at begin()
+	    int64_t startNanos;
+	    PerfCounters::Sample start;
+	};
+
+	PerfCounters _counters;
+	std::vector<Totals> _stages;
+    };
+}
@@ -0,0 +1,245 @@
+#include "pipeline.hpp"
+#include "Timer.h"
+
+#include <iomanip>
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+
+using namespace vision;
+using namespace std;
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+namespace {
+    uint64_t nanosNow() {
+	timespec now;
+	avc::Timer::getTime(now);
+	return ((uint64_t) now.tv_sec) * 1000000000ULL + now.tv_nsec;
+    }
+
+    /**
+     * Back off a little more each time we find our input queue empty
+     * (spin first as the next frame is usually only microseconds away).
+     */
+    void idle(int attempt) {
+	if (attempt < 64) {
+	    return;
+	} else if (attempt < 128) {
+	    sched_yield();
+	} else {
+	    avc::Timer::sleepNanos(50000);
+	}
+    }
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+StageStats::StageStats() :
+    frames(0),
+    stalls(0),
+    stallNanos(0),
+    busyNanos(0),
+    depthSum(0),
+    maxDepth(0),
+    latency()
+{
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+Pipeline::Pipeline(int slots) :
+    _slots(slots),
+    _stages(),
+    _stopping(true),
+    _ended(-1),
+    _active(0)
+{
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+Pipeline::~Pipeline() {
+    stop();
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+void Pipeline::addStage(const StageConfig& config, StageFunc func) {
+    _stages.push_back(unique_ptr<Stage>(new Stage(config, func, _slots)));
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+void Pipeline::start() {
+    if (_stages.empty()) {
+	return;
+    }
+
+    for (int slot = 0; slot < _slots; slot++) {
+	_stages[0]->input.push(slot);
+    }
+
+    int n = _stages.size();
+    _ended.store(-1);
+    _active.store(n);
+    _stopping.store(false, memory_order_release);
+
+    for (int i = 0; i < n; i++) {
+	_stages[i]->thread = thread(&Pipeline::run, this, i);
+    }
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+void Pipeline::stop() {
+    _stopping.store(true, memory_order_release);
+
+    for (auto& stage : _stages) {
+	if (stage->thread.joinable()) {
+	    stage->thread.join();
+	}
+    }
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+void Pipeline::applySchedule(const StageConfig& config) {
+    pthread_t self = pthread_self();
+
+    // Name thread after stage (shows up in top, gdb and traces)
+    pthread_setname_np(self, config.name.substr(0, 15).c_str());
+
+    if (config.cpu >= 0) {
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+	CPU_SET(config.cpu, &cpus);
+	int rc = pthread_setaffinity_np(self, sizeof(cpus), &cpus);
+	if (rc != 0) {
+	    cerr << "Failed to pin " << config.name << " stage to CPU "
+		 << config.cpu << ": " << strerror(rc) << "\n";
+	}
+    }
+
+    if (config.fifoPriority > 0) {
+	sched_param param;
+	memset(&param, 0, sizeof(param));
+	param.sched_priority = config.fifoPriority;
+	int rc = pthread_setschedparam(self, SCHED_FIFO, &param);
+	if (rc != 0) {
+	    cerr << "Failed to set SCHED_FIFO priority " << config.fifoPriority
+		 << " for " << config.name << " stage: " << strerror(rc) << "\n";
+	}
+    }
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+bool Pipeline::isStopped(int index) const {
+    // Stages up to the one that ended have nothing more coming
+    int ended = _ended.load(memory_order_acquire);
+    return _stopping.load(memory_order_acquire) || ((ended >= 0) && (index <= ended));
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+void Pipeline::run(int index) {
+    applySchedule(_stages[index]->config);
+    runStage(index);
+    _stages[index]->finished.store(true, memory_order_release);
+    _active.fetch_sub(1, memory_order_acq_rel);
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+void Pipeline::runStage(int index) {
+    Stage& stage = *_stages[index];
+    SpscQueue<int>& output = _stages[(index + 1) % _stages.size()]->input;
+    StageStats& stats = stage.stats;
+
+    while (!isStopped(index)) {
+	int slot;
+
+	if (!stage.input.pop(slot)) {
+	    uint64_t waitStart = nanosNow();
+	    int attempt = 0;
+	    while (true) {
+		// Checked before popping so a slot pushed just before the
+		// stage feeding us finished isn't missed
+		bool drained = (index > 0) && _stages[index - 1]->finished.load(memory_order_acquire);
+		if (stage.input.pop(slot)) {
+		    break;
+		}
+		if (drained || isStopped(index)) {
+		    return;
+		}
+		idle(attempt++);
+	    }
+	    stats.stalls.fetch_add(1, memory_order_relaxed);
+	    stats.stallNanos.fetch_add(nanosNow() - waitStart, memory_order_relaxed);
+	}
+
+	// Depth includes the slot we just took
+	uint32_t depth = stage.input.size() + 1;
+	stats.depthSum.fetch_add(depth, memory_order_relaxed);
+	if (depth > stats.maxDepth.load(memory_order_relaxed)) {
+	    stats.maxDepth.store(depth, memory_order_relaxed);
+	}
+
+	uint64_t busyStart = nanosNow();
+	bool keepGoing = stage.func(slot);
+	uint64_t busy = nanosNow() - busyStart;
+	stats.busyNanos.fetch_add(busy, memory_order_relaxed);
+	stats.latency.record(busy);
+	stats.frames.fetch_add(1, memory_order_relaxed);
+
+	if (!keepGoing) {
+	    // Don't hand a slot the stage failed to fill to the next stage,
+	    // the ones after drain what they already have
+	    int none = -1;
+	    _ended.compare_exchange_strong(none, index, memory_order_acq_rel);
+	    return;
+	}
+
+	// Every queue can hold all slots, so this never fails
+	output.push(slot);
+    }
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+ostream& Pipeline::printStats(ostream& out, float secs) const {
+    out << "Pipeline stages (" << _slots << " frame slots, "
+	<< secs << " secs):\n";
+
+    for (auto& stage : _stages) {
+	const StageStats& stats = stage->stats;
+	uint64_t frames = stats.frames.load();
+	double perFrame = frames ? (1e-6 * stats.busyNanos.load() / frames) : 0;
+	double avgDepth = frames ? (((double) stats.depthSum.load()) / frames) : 0;
+
+	out << "  " << setw(10) << left << stage->config.name << right
+	    << "  frames: " << frames
+	    << "  ms/frame: " << perFrame
+	    << "  stalls: " << stats.stalls.load()
+	    << " (" << (1e-9 * stats.stallNanos.load()) << " secs)"
+	    << "  depth avg/max: " << avgDepth << "/" << stats.maxDepth.load()
+	    << "\n";
+    }
+
+    return out;
+}
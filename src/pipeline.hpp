@@ -0,0 +1,161 @@
+#pragma once
+
+#include "latency.hpp"
+#include "spscqueue.hpp"
+
+#include <atomic>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <stdint.h>
+
+namespace vision {
+
+    /**
+     * How a pipeline stage thread should be scheduled.
+     */
+    struct StageConfig {
+	// Name used when reporting statistics
+	std::string name;
+	// CPU core to pin the thread to (-1 to let the OS decide)
+	int cpu;
+	// SCHED_FIFO priority [1, 99] (0 to leave normal scheduling)
+	int fifoPriority;
+
+	StageConfig(const std::string& n, int c = -1, int prio = 0) :
+	    name(n), cpu(c), fifoPriority(prio) {
+	}
+    };
+
+    /**
+     * Counters maintained by a stage thread (only the stage thread
+     * writes them, anyone may read them while the pipeline runs).
+     */
+    struct StageStats {
+	// Number of frame slots processed
+	std::atomic<uint64_t> frames;
+	// Number of times the stage had to wait for its input queue
+	std::atomic<uint64_t> stalls;
+	// Total time spent waiting for input
+	std::atomic<uint64_t> stallNanos;
+	// Total time spent in the stage function
+	std::atomic<uint64_t> busyNanos;
+	// Sum of input queue depths seen (divide by frames for average)
+	std::atomic<uint64_t> depthSum;
+	// Deepest input queue seen
+	std::atomic<uint32_t> maxDepth;
+	// Distribution of time spent in the stage function
+	LatencyHistogram latency;
+
+	StageStats();
+    };
+
+    /**
+     * Runs a fixed set of stages, each on its own thread, passing frame
+     * slots from one stage to the next through lock free single
+     * producer/single consumer queues.
+     *
+     * <p>The caller owns the frame buffers (typically a vector indexed
+     * by slot). The pipeline only moves slot numbers around: all slots
+     * start in the input queue of the first stage, each stage passes the
+     * slot to the next when done and the last stage hands it back to the
+     * first. Since every slot is in exactly one queue (or stage) at a
+     * time, throughput is limited by the slowest stage rather than the
+     * sum of all of them, and the first stage stalls when all buffers are
+     * in use downstream.</p>
+     */
+    class Pipeline {
+    public:
+	/**
+	 * Function invoked by a stage for each slot.
+	 *
+	 * @return false at the end of the input (or if the stage failed):
+	 * the stages before it stop and the ones after it finish the slots
+	 * already passed to them, then stop.
+	 */
+	typedef std::function<bool(int slot)> StageFunc;
+
+	/**
+	 * Construct a new pipeline.
+	 *
+	 * @param slots Number of frame buffers the caller has allocated.
+	 */
+	explicit Pipeline(int slots);
+
+	/** Stops threads (if still running). */
+	~Pipeline();
+
+	/** Adds the next stage (must be done before start()). */
+	void addStage(const StageConfig& config, StageFunc func);
+
+	/** Fills the first queue with all slots and starts stage threads. */
+	void start();
+
+	/**
+	 * Requests all stages to stop right away (slots still queued are
+	 * dropped) and waits for the threads to exit.
+	 */
+	void stop();
+
+	/**
+	 * Returns true until stop() is called or every stage has exited
+	 * (after a stage returned false and the rest were drained).
+	 */
+	bool isRunning() const {
+	    return !_stopping.load(std::memory_order_acquire)
+		&& (_active.load(std::memory_order_acquire) > 0);
+	}
+
+	/** Number of stages added. */
+	int getStageCount() const { return _stages.size(); }
+
+	/** Configuration of a stage. */
+	const StageConfig& getConfig(int stage) const { return _stages[stage]->config; }
+
+	/** Counters for a stage. */
+	const StageStats& getStats(int stage) const { return _stages[stage]->stats; }
+
+	/** Number of slots currently waiting to be processed by a stage. */
+	size_t getQueueDepth(int stage) const { return _stages[stage]->input.size(); }
+
+	/**
+	 * Dump per stage counters.
+	 *
+	 * @param out Where to write the information.
+	 * @param secs How many total seconds the pipeline has been running.
+	 */
+	std::ostream& printStats(std::ostream& out, float secs) const;
+
+    private:
+	struct Stage {
+	    StageConfig config;
+	    StageFunc func;
+	    SpscQueue<int> input;
+	    StageStats stats;
+	    std::thread thread;
+	    // Set once the thread won't pass on any more slots
+	    std::atomic<bool> finished;
+
+	    Stage(const StageConfig& c, StageFunc f, int slots) :
+		config(c), func(f), input(slots), finished(false) {
+	    }
+	};
+
+	void run(int stage);
+	void runStage(int stage);
+	bool isStopped(int stage) const;
+	void applySchedule(const StageConfig& config);
+
+	int _slots;
+	std::vector<std::unique_ptr<Stage>> _stages;
+	std::atomic<bool> _stopping;
+	// First stage that returned false (-1 if none has)
+	std::atomic<int> _ended;
+	// Stage threads that haven't exited yet
+	std::atomic<int> _active;
+    };
+}
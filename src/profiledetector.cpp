@@ -0,0 +1,99 @@
+#include "profiledetector.hpp"
+#include "filterkernels.hpp"
+
+using namespace cv;
+using namespace vision;
+using namespace std;
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+void profile::reduce(const Mat& hsv, const int* ranges, bool wrapHue,
+		     Mat& mask, vector<int>& columns) {
+    int rows = hsv.rows;
+    int cols = hsv.cols;
+    mask.create(rows, cols, CV_8UC1);
+    columns.assign(cols, 0);
+    int* counts = columns.data();
+
+    // Pick the hue wrap once rather than testing it for every pixel
+    kernels::HsvRange<true> wrapped(ranges);
+    kernels::HsvRange<false> plain(ranges);
+    for (int y = 0; y < rows; y++) {
+	if (wrapHue) {
+	    wrapped.reduceRow<true>(hsv.ptr(y), cols, mask.ptr(y), counts);
+	} else {
+	    plain.reduceRow<true>(hsv.ptr(y), cols, mask.ptr(y), counts);
+	}
+    }
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+void profile::findBoxes(const Mat& mask, const vector<int>& columns,
+			vector<Rect>& boxes) {
+    int cols = columns.size();
+    vector<int> rowFill(mask.rows);
+
+    int x = 0;
+    while (x < cols) {
+	if (columns[x] < MIN_COLUMN_FILL) {
+	    x++;
+	    continue;
+	}
+
+	// Extend run of filled columns (tolerating small gaps)
+	int x0 = x;
+	int x1 = x;
+	int gap = 0;
+	for (x++; (x < cols) && (gap <= MAX_COLUMN_GAP); x++) {
+	    if (columns[x] >= MIN_COLUMN_FILL) {
+		x1 = x;
+		gap = 0;
+	    } else {
+		gap++;
+	    }
+	}
+	x = x1 + 1;
+	int width = x1 - x0 + 1;
+
+	// Row profile of just the columns in the run
+	for (int y = 0; y < mask.rows; y++) {
+	    const uchar* row = mask.ptr(y) + x0;
+	    int n = 0;
+	    for (int i = 0; i < width; i++) {
+		n += (row[i] != 0);
+	    }
+	    rowFill[y] = n;
+	}
+
+	// Tallest stretch of rows where at least a third of the run is
+	// filled (tolerating small gaps)
+	int minFill = max(1, width / 3);
+	int bestY0 = -1, bestY1 = -1;
+	int y0 = -1, y1 = -1;
+	gap = 0;
+	for (int y = 0; y <= mask.rows; y++) {
+	    bool filled = (y < mask.rows) && (rowFill[y] >= minFill);
+	    if (filled) {
+		if (y0 < 0) {
+		    y0 = y;
+		}
+		y1 = y;
+		gap = 0;
+	    } else if ((y0 >= 0) && ((++gap > MAX_ROW_GAP) || (y == mask.rows))) {
+		if ((y1 - y0) > (bestY1 - bestY0)) {
+		    bestY0 = y0;
+		    bestY1 = y1;
+		}
+		y0 = -1;
+		gap = 0;
+	    }
+	}
+
+	if (bestY0 >= 0) {
+	    boxes.push_back(Rect(x0, bestY0, width, bestY1 - bestY0 + 1));
+	}
+    }
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+
+#include <vector>
+
+namespace vision {
+
+    /**
+     * Fast stanchion detection from projection profiles of the color
+     * mask (an alternative to morphology and contour tracing).
+     *
+     * <p>A stanchion is a tall vertical object, so the columns it covers
+     * have many mask pixels set. The column counts are accumulated while
+     * the mask is built, runs of well filled columns give the horizontal
+     * extent of each object and a row profile of just those columns
+     * gives its vertical extent.</p>
+     */
+    namespace profile {
+
+	// Minimum pixels set for a column to be part of an object (half
+	// the height of the shortest stanchion we accept)
+	const int MIN_COLUMN_FILL = 20;
+
+	// Poorly filled columns allowed inside an object
+	const int MAX_COLUMN_GAP = 2;
+
+	// Poorly filled rows allowed inside an object
+	const int MAX_ROW_GAP = 3;
+
+	/**
+	 * Builds the color reduced mask (like cv::inRange) and counts the
+	 * pixels set in each column in the same pass.
+	 *
+	 * @param hsv 8 bit 3 channel HSV image.
+	 * @param ranges Color reduction levels (min0, max0, min1, max1,
+	 * min2, max2).
+	 * @param wrapHue Also accept hue values 0-10 (red wraps around).
+	 * @param mask Where to store mask (255 where pixel is in range).
+	 * @param columns Where to store count of pixels set in each column.
+	 */
+	void reduce(const cv::Mat& hsv, const int* ranges, bool wrapHue,
+		    cv::Mat& mask, std::vector<int>& columns);
+
+	/**
+	 * Finds bounding boxes of vertical objects in a mask.
+	 *
+	 * @param mask Mask built by reduce().
+	 * @param columns Column counts built by reduce().
+	 * @param boxes Where to append a box for each object found.
+	 */
+	void findBoxes(const cv::Mat& mask, const std::vector<int>& columns,
+		       std::vector<cv::Rect>& boxes);
+    }
+}
@@ -0,0 +1,89 @@
+#include "publisher.hpp"
+
+#include <algorithm>
+
+using namespace vision;
+using namespace std;
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+Publisher::Publisher(const string& stanchionsFile) :
+    _file(stanchionsFile),
+    _latency(),
+    _sequence(),
+    _ring(),
+    _notifier()
+{
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+bool Publisher::openRing(int capacity) {
+    return _ring.open(capacity);
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+void Publisher::publish(FileData& fileData, const FrameStamp& stamp,
+			const vector<Candidate>& candidates, int winner) {
+    _sequence.observe(stamp.sequence);
+
+    fileData.stampLayout();
+    fileData.cameraSeq = stamp.sequence;
+    fileData.droppedFrames = _sequence.getDropped();
+    fileData.captureNanos = stamp.captureNanos;
+    fileData.publishNanos = monotonicNanos();
+    fileData.tailFrameCount = fileData.frameCount;
+    fileData.rangeFrameCount = fileData.frameCount;
+
+    _latency.record(fileData.publishNanos - fileData.captureNanos);
+
+    _file.seekp(0);
+    _file.write((const char*) &fileData, sizeof(FileData));
+    _file.flush();
+
+    if (_ring.isOpen()) {
+	DetectionRecord record;
+	record.frameCount = fileData.frameCount;
+	record.cameraSeq = fileData.cameraSeq;
+	record.captureNanos = fileData.captureNanos;
+	record.publishNanos = fileData.publishNanos;
+	record.found = fileData.found;
+	record.candidatesSeen = candidates.size();
+	record.candidateCount = min(record.candidatesSeen, DETECTION_RING_MAX_CANDIDATES);
+	record.winner = winner;
+
+	for (int i = 0; i < record.candidateCount; i++) {
+	    // Make sure winner is kept if there are too many to fit
+	    int src = i;
+	    if ((i == record.candidateCount - 1) && (winner > i)) {
+		src = winner;
+		record.winner = i;
+	    }
+	    const Candidate& candidate = candidates[src];
+	    RingCandidate& dest = record.candidates[i];
+	    dest.x = candidate.bbox.x;
+	    dest.y = candidate.bbox.y;
+	    dest.width = candidate.bbox.width;
+	    dest.height = candidate.bbox.height;
+	    dest.color = candidate.color;
+	    dest.score = candidate.score;
+	}
+
+	_ring.publish(record);
+    }
+
+    _notifier.notify(fileData.frameCount);
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+ostream& Publisher::printLatency(ostream& out) const {
+    out << "Capture to publish latency " << _latency
+	<< "  dropped frames: " << getDroppedFrames();
+    return out;
+}
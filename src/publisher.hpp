@@ -0,0 +1,81 @@
+#pragma once
+
+#include "detectionring.hpp"
+#include "filedata.hpp"
+#include "filter.hpp"
+#include "latency.hpp"
+#include "resultnotify.hpp"
+
+#include <fstream>
+#include <iostream>
+#include <string>
+
+namespace vision {
+
+    /**
+     * Writes filter results to the stanchions file for the navigation
+     * code to pick up, stamping each with capture/publish times and
+     * keeping track of how old results are when we publish them.
+     */
+    class Publisher {
+    public:
+	/**
+	 * Construct a new instance.
+	 *
+	 * @param stanchionsFile Where to write results (typically:
+	 * "/dev/shm/stanchions").
+	 */
+	explicit Publisher(const std::string& stanchionsFile);
+
+	/**
+	 * Also publish every candidate to a shared memory ring holding
+	 * the history of the last few frames.
+	 *
+	 * @param capacity Number of frames to keep in the ring.
+	 *
+	 * @return true if ring was created.
+	 */
+	bool openRing(int capacity);
+
+	/**
+	 * Wake up consumers blocked in ResultWaiter::wait() each time
+	 * results are published (so they don't have to poll).
+	 *
+	 * @return true if notification segment was created.
+	 */
+	bool openNotifier() { return _notifier.open(); }
+
+	/**
+	 * Stamps results with frame information and publish time then
+	 * writes them out.
+	 *
+	 * @param fileData Results to publish (time stamp, sequence and
+	 * layout fields are filled in).
+	 *
+	 * @param stamp When the frame the results came from was captured.
+	 *
+	 * @param candidates All candidates found in the frame (only used
+	 * if the ring is open).
+	 *
+	 * @param winner Index of candidate reported in fileData (-1 if none).
+	 */
+	void publish(FileData& fileData, const FrameStamp& stamp,
+		     const std::vector<Candidate>& candidates, int winner);
+
+	/** Capture to publish latency of frames published so far. */
+	const LatencyHistogram& getLatency() const { return _latency; }
+
+	/** Number of camera frames we never saw (gaps in sequence numbers). */
+	uint32_t getDroppedFrames() const { return _sequence.getDropped(); }
+
+	/** Dump latency percentiles and dropped frame count. */
+	std::ostream& printLatency(std::ostream& out) const;
+
+    private:
+	std::ofstream _file;
+	LatencyHistogram _latency;
+	SequenceTracker _sequence;
+	DetectionRingWriter _ring;
+	ResultNotifier _notifier;
+    };
+}
@@ -0,0 +1,237 @@
+#include "resultcache.hpp"
+#include "filter.hpp"
+
+#include <fstream>
+#include <iostream>
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace cv;
+using namespace vision;
+using namespace std;
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+namespace {
+    const uint64_t HASH_PRIME = 0x100000001b3ULL;
+
+    template<typename T> uint64_t hashValue(const T& value, uint64_t hash) {
+	return hashBytes(&value, sizeof(value), hash);
+    }
+
+    /** Hash of the running program (0 if it couldn't be read). */
+    uint64_t hashProgram() {
+	ifstream in("/proc/self/exe", ios::binary);
+	if (!in) {
+	    return 0;
+	}
+	uint64_t hash = HASH_SEED;
+	vector<char> block(1 << 16);
+	while (in.read(block.data(), block.size()) || (in.gcount() > 0)) {
+	    hash = hashBytes(block.data(), in.gcount(), hash);
+	}
+	return hash;
+    }
+
+    bool makeDir(const string& dir) {
+	if ((mkdir(dir.c_str(), 0755) != 0) && (errno != EEXIST)) {
+	    cerr << "Unable to create " << dir << ": " << strerror(errno) << "\n";
+	    return false;
+	}
+	return true;
+    }
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+uint64_t vision::hashBytes(const void* data, size_t size, uint64_t hash) {
+    const uint8_t* bytes = (const uint8_t*) data;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+	uint64_t word;
+	memcpy(&word, bytes + i, sizeof(word));
+	hash = (hash ^ word) * HASH_PRIME;
+    }
+    for (; i < size; i++) {
+	hash = (hash ^ bytes[i]) * HASH_PRIME;
+    }
+    return hash;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+uint64_t vision::hashImage(const Mat& image) {
+    uint64_t hash = hashValue(image.rows, HASH_SEED);
+    hash = hashValue(image.cols, hash);
+    hash = hashValue(image.type(), hash);
+    size_t rowBytes = image.cols * image.elemSize();
+    for (int y = 0; y < image.rows; y++) {
+	hash = hashBytes(image.ptr(y), rowBytes, hash);
+    }
+    return hash;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+ResultCache::ResultCache() :
+    _dir(),
+    _filter(0),
+    _codeHash(0),
+    _hits(0),
+    _misses(0)
+{
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+bool ResultCache::open(const string& dir, const Filter& filter) {
+    if (!makeDir(dir)) {
+	return false;
+    }
+    _dir = dir;
+    _filter = &filter;
+    _codeHash = hashProgram();
+    return true;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+string ResultCache::path(uint64_t contentHash) const {
+    // Spread over 256 directories like DIR/3f/3fa4...
+    char name[20];
+    snprintf(name, sizeof(name), "%016llx", (unsigned long long) contentHash);
+    return _dir + "/" + string(name, 2) + "/" + name;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+uint64_t ResultCache::commonHash() const {
+    uint64_t hash = hashValue(RESULT_CACHE_VERSION, HASH_SEED);
+    hash = hashValue(_filter->getDetector(), hash);
+    hash = hashValue(_filter->isBlur(), hash);
+    hash = hashValue(_filter->getPolyEpsilon(), hash);
+    hash = hashValue(_filter->isSearchAllColors(), hash);
+
+    const RangeModel& model = _filter->getRange().getModel();
+    double camera[] = {
+	(double) model.width, (double) model.height, model.fx, model.fy, model.cx, model.cy,
+	model.k1, model.k2, model.p1, model.p2, model.cameraHeight, model.tilt,
+	model.offset, model.stanchionHeight
+    };
+    hash = hashBytes(camera, sizeof(camera), hash);
+
+    // Cached results in -f mode skip writing images, so how they are
+    // written counts too
+    hash = hashValue(_filter->getImageFormat(), hash);
+    return hashValue(_filter->isContactSheet(), hash);
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+uint64_t ResultCache::colorHash(Found color) const {
+    bool enabled = (color == Found::Red) ? _filter->isRedEnabled() : _filter->isYellowEnabled();
+    uint64_t hash = hashValue(color, HASH_SEED);
+    hash = hashValue(enabled, hash);
+    return hashBytes(_filter->getColorRanges(color), 6 * sizeof(int), hash);
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+bool ResultCache::lookup(uint64_t contentHash, CachedResult& result) {
+    if (!isOpen()) {
+	return false;
+    }
+
+    ifstream in(path(contentHash).c_str(), ios::binary);
+    bool valid = in.read((char*) &result, sizeof(result))
+	&& (result.magic == RESULT_CACHE_MAGIC) && (result.version == RESULT_CACHE_VERSION)
+	&& (result.contentHash == contentHash) && (result.codeHash == _codeHash)
+	&& (result.commonHash == commonHash());
+
+    // Colors that couldn't have affected the result are stored as 0
+    Found colors[] = { Found::Yellow, Found::Red };
+    for (Found color : colors) {
+	valid = valid && ((result.colorHash[color] == 0)
+			  || (result.colorHash[color] == colorHash(color)));
+    }
+
+    if (valid) {
+	_hits++;
+    } else {
+	_misses++;
+    }
+    return valid;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+bool ResultCache::store(uint64_t contentHash, const FilterFrame& frame) {
+    if (!isOpen()) {
+	return false;
+    }
+
+    CachedResult result;
+    memset(&result, 0, sizeof(result));
+    result.magic = RESULT_CACHE_MAGIC;
+    result.version = RESULT_CACHE_VERSION;
+    result.contentHash = contentHash;
+    result.codeHash = _codeHash;
+    result.commonHash = commonHash();
+    result.fileData = frame.fileData;
+
+    // Yellow is searched first (when enabled), red only matters when
+    // it was searched (every color is with setSearchAllColors(), which
+    // keeps its candidates) or yellow didn't win
+    result.colorHash[Found::Yellow] = colorHash(Found::Yellow);
+    if (frame.searched[Found::Red] || (frame.fileData.found != Found::Yellow)) {
+	result.colorHash[Found::Red] = colorHash(Found::Red);
+    }
+
+    Found colors[] = { Found::Yellow, Found::Red };
+    for (Found color : colors) {
+	if (!frame.searched[color]) {
+	    continue;
+	}
+	ColorSummary& summary = result.colors[color];
+	summary.searched = 1;
+	const Mat& reduced = frame.colorReduced[color];
+	summary.maskPixels = reduced.empty() ? 0 : countNonZero(reduced);
+	for (const Candidate& candidate : frame.candidates) {
+	    if (candidate.color == color) {
+		summary.candidates++;
+		summary.bestScore = max(summary.bestScore, candidate.score);
+	    }
+	}
+    }
+
+    // Write to a temporary file then rename so readers never see part
+    // of an entry
+    string file = path(contentHash);
+    if (!makeDir(file.substr(0, file.rfind('/')))) {
+	return false;
+    }
+    string temp = file + "." + to_string(getpid());
+    ofstream out(temp.c_str(), ios::binary);
+    out.write((const char*) &result, sizeof(result));
+    out.close();
+    if (out.fail() || (rename(temp.c_str(), file.c_str()) != 0)) {
+	cerr << "Unable to write " << file << ": " << strerror(errno) << "\n";
+	unlink(temp.c_str());
+	return false;
+    }
+    return true;
+}
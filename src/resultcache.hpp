@@ -0,0 +1,138 @@
+#pragma once
+
+#include "filedata.hpp"
+
+#include <opencv2/opencv.hpp>
+
+#include <string>
+
+#include <stdint.h>
+
+namespace vision {
+
+    class Filter;
+    struct FilterFrame;
+
+    const uint32_t RESULT_CACHE_MAGIC = 0x52435641;  // "AVCR"
+    const uint32_t RESULT_CACHE_VERSION = 1;
+
+    // Starting value of hashBytes()
+    const uint64_t HASH_SEED = 0xcbf29ce484222325ULL;
+
+    /**
+     * Fast 64 bit hash of some bytes (FNV-1a taken eight bytes at a
+     * time, not for anything that needs to resist tampering).
+     *
+     * @param data Bytes to hash.
+     * @param size Number of bytes.
+     * @param hash Hash of what came before (to hash in pieces).
+     */
+    uint64_t hashBytes(const void* data, size_t size, uint64_t hash = HASH_SEED);
+
+    /** Hash of an image's size, type and pixels (padding ignored). */
+    uint64_t hashImage(const cv::Mat& image);
+
+    /** What the search for one color found (all 0 if not searched). */
+    struct ColorSummary {
+	int32_t searched;
+	// Pixels set in the color reduced image
+	int32_t maskPixels;
+	// Candidates accepted and score of the best (0 if none)
+	int32_t candidates;
+	int32_t bestScore;
+    };
+
+    /**
+     * Results of filtering an image as stored in a ResultCache (written
+     * to the file as is).
+     */
+    struct CachedResult {
+	uint32_t magic;
+	uint32_t version;
+	// Hash of the image
+	uint64_t contentHash;
+	// Hashes of what the result depended on: the program, settings
+	// every search uses and the settings of each color (0 for red when
+	// yellow won without red being searched)
+	uint64_t codeHash;
+	uint64_t commonHash;
+	uint64_t colorHash[3];
+	FileData fileData;
+	// Indexed by Found::Yellow and Found::Red
+	ColorSummary colors[3];
+    };
+
+    /**
+     * Results of filtering images kept in a directory (one small file
+     * per image, named for the hash of its content), so offline runs
+     * after a settings change only filter the images whose results
+     * could have changed.
+     *
+     * <p>A result stays valid while the image, the program (hash of
+     * the running executable, shared libraries aren't included) and the
+     * settings it depended on stay the same. Yellow is searched first,
+     * so a result where yellow won (and red wasn't searched too, see
+     * Filter::setSearchAllColors()) doesn't depend on the red ranges and
+     * is reused when only those change. Entries are replaced with
+     * rename() so several processes can share a directory.</p>
+     */
+    class ResultCache {
+    public:
+	ResultCache();
+
+	/**
+	 * Use a directory (created if it doesn't exist).
+	 *
+	 * @param dir Where to keep results.
+	 * @param filter Filter the results come from (its settings are
+	 * hashed again by each lookup() and store(), so they may be
+	 * changed, and it must outlive the cache).
+	 *
+	 * @return false if the directory couldn't be created.
+	 */
+	bool open(const std::string& dir, const Filter& filter);
+
+	/** Whether open() succeeded (lookups always miss otherwise). */
+	bool isOpen() const { return _filter != 0; }
+
+	/**
+	 * Find the results of an image filtered with the current settings.
+	 *
+	 * @param contentHash Hash of the image (hashBytes() of the file or
+	 * hashImage() of the pixels, as long as it is the same each time)
+	 * and of anything else outside the settings a result depends on,
+	 * like the base name images are written to.
+	 * @param result Set to what was stored.
+	 *
+	 * @return true if there is a result still valid.
+	 */
+	bool lookup(uint64_t contentHash, CachedResult& result);
+
+	/**
+	 * Remember what the filter found in an image.
+	 *
+	 * @param contentHash Hash of the image (see lookup()).
+	 * @param frame Frame the image was filtered into.
+	 *
+	 * @return false if it couldn't be written (reported on cerr).
+	 */
+	bool store(uint64_t contentHash, const FilterFrame& frame);
+
+	/** Lookups answered from the cache. */
+	int getHits() const { return _hits; }
+
+	/** Lookups that weren't (nothing stored or settings changed). */
+	int getMisses() const { return _misses; }
+
+    private:
+	std::string path(uint64_t contentHash) const;
+	uint64_t commonHash() const;
+	uint64_t colorHash(Found color) const;
+
+	std::string _dir;
+	const Filter* _filter;
+	uint64_t _codeHash;
+	int _hits;
+	int _misses;
+    };
+}
@@ -0,0 +1,187 @@
+#include "resultnotify.hpp"
+#include "latency.hpp"
+
+#include <iostream>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using namespace vision;
+using namespace std;
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+namespace {
+    // NOTE: Not using FUTEX_PRIVATE_FLAG as waiters live in other processes
+    long futex(atomic<uint32_t>* addr, int op, uint32_t val, const timespec* timeout) {
+	return syscall(SYS_futex, (uint32_t*) addr, op, val, timeout, 0, 0);
+    }
+
+    NotifyHeader* mapHeader(const string& name, int flags, int prot) {
+	int fd = shm_open(name.c_str(), flags, 0666);
+	if (fd < 0) {
+	    return 0;
+	}
+
+	bool sized = true;
+	if (flags & O_CREAT) {
+	    // Waiters write the waiters count, so consumers running as
+	    // other users need write access whatever our umask is (fails
+	    // if the segment was left by another user, who set it already)
+	    fchmod(fd, 0666);
+	    sized = (ftruncate(fd, sizeof(NotifyHeader)) == 0);
+	} else {
+	    struct stat info;
+	    sized = (fstat(fd, &info) == 0) && ((size_t) info.st_size >= sizeof(NotifyHeader));
+	}
+
+	void* addr = MAP_FAILED;
+	if (sized) {
+	    addr = mmap(0, sizeof(NotifyHeader), prot, MAP_SHARED, fd, 0);
+	}
+	close(fd);
+
+	return (addr == MAP_FAILED) ? 0 : (NotifyHeader*) addr;
+    }
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+ResultNotifier::ResultNotifier() :
+    _header(0)
+{
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+ResultNotifier::~ResultNotifier() {
+    if (_header != 0) {
+	munmap(_header, sizeof(NotifyHeader));
+    }
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+bool ResultNotifier::open(const string& name) {
+    _header = mapHeader(name, O_CREAT | O_RDWR, PROT_READ | PROT_WRITE);
+    if (_header == 0) {
+	cerr << "Failed to create shared memory " << name << ": " << strerror(errno) << "\n";
+	return false;
+    }
+
+    // Leave sequence alone (waiters from a previous run may be blocked on it)
+    _header->version = RESULT_NOTIFY_VERSION;
+    atomic_thread_fence(memory_order_release);
+    _header->magic = RESULT_NOTIFY_MAGIC;
+    return true;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+void ResultNotifier::notify(int frameCount) {
+    if (_header == 0) {
+	return;
+    }
+
+    _header->frameCount.store(frameCount, memory_order_relaxed);
+    _header->sequence.fetch_add(1, memory_order_seq_cst);
+
+    // Only pay for the system call when someone is blocked
+    if (_header->waiters.load(memory_order_seq_cst) != 0) {
+	futex(&_header->sequence, FUTEX_WAKE, INT_MAX, 0);
+    }
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+ResultWaiter::ResultWaiter() :
+    _header(0),
+    _lastSeen(0)
+{
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+ResultWaiter::~ResultWaiter() {
+    if (_header != 0) {
+	munmap(_header, sizeof(NotifyHeader));
+    }
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+bool ResultWaiter::open(const string& name) {
+    // Needs write access to maintain the waiters count
+    NotifyHeader* header = mapHeader(name, O_RDWR, PROT_READ | PROT_WRITE);
+    if (header == 0) {
+	return false;
+    }
+
+    if ((header->magic != RESULT_NOTIFY_MAGIC) || (header->version != RESULT_NOTIFY_VERSION)) {
+	munmap(header, sizeof(NotifyHeader));
+	return false;
+    }
+
+    _header = header;
+    _lastSeen = _header->sequence.load(memory_order_acquire);
+    return true;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+bool ResultWaiter::wait(int timeoutMs) {
+    if (_header == 0) {
+	return false;
+    }
+
+    int64_t deadline = monotonicNanos() + ((int64_t) timeoutMs) * 1000000;
+
+    for (;;) {
+	uint32_t current = _header->sequence.load(memory_order_acquire);
+	if (current != _lastSeen) {
+	    _lastSeen = current;
+	    return true;
+	}
+
+	timespec remaining;
+	const timespec* timeout = 0;
+	if (timeoutMs >= 0) {
+	    int64_t left = deadline - monotonicNanos();
+	    if (left <= 0) {
+		return false;
+	    }
+	    remaining.tv_sec = left / 1000000000;
+	    remaining.tv_nsec = left % 1000000000;
+	    timeout = &remaining;
+	}
+
+	// Kernel only puts us to sleep if sequence is still what we saw,
+	// so a publish between the check above and here isn't missed
+	_header->waiters.fetch_add(1, memory_order_seq_cst);
+	futex(&_header->sequence, FUTEX_WAIT, current, timeout);
+	_header->waiters.fetch_sub(1, memory_order_seq_cst);
+    }
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+int ResultWaiter::getFrameCount() const {
+    return (_header != 0) ? _header->frameCount.load(memory_order_relaxed) : 0;
+}
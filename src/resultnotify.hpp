@@ -0,0 +1,110 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+
+#include <stdint.h>
+
+namespace vision {
+
+    // Identifies a result notification shared memory segment ("AVCN")
+    const uint32_t RESULT_NOTIFY_MAGIC = 0x4e435641;
+    const uint32_t RESULT_NOTIFY_VERSION = 1;
+
+    // Default shared memory name (shows up as /dev/shm/stanchions-notify)
+    const char* const RESULT_NOTIFY_NAME = "/stanchions-notify";
+
+    /**
+     * Layout of the notification shared memory segment.
+     */
+    struct NotifyHeader {
+	uint32_t magic;
+	uint32_t version;
+	// Frame count of the most recently published results
+	std::atomic<int32_t> frameCount;
+	// Futex word bumped each time results are published
+	std::atomic<uint32_t> sequence;
+	// Number of consumers currently blocked (so the publisher can
+	// skip the wake system call when nobody is waiting)
+	std::atomic<uint32_t> waiters;
+    };
+
+    /**
+     * Publisher side: wakes up consumers each time new results have been
+     * written to the stanchions file (and detection ring).
+     */
+    class ResultNotifier {
+    public:
+	ResultNotifier();
+	~ResultNotifier();
+
+	/**
+	 * Creates the shared memory segment consumers wait on (mode 0666,
+	 * as waiters running as any user write to it).
+	 *
+	 * @param name Shared memory name (see "man shm_open").
+	 *
+	 * @return true if ready to use.
+	 */
+	bool open(const std::string& name = RESULT_NOTIFY_NAME);
+
+	/** Whether open() succeeded. */
+	bool isOpen() const { return _header != 0; }
+
+	/**
+	 * Signal that results for a frame are available (call after they
+	 * have been written).
+	 */
+	void notify(int frameCount);
+
+    private:
+	NotifyHeader* _header;
+    };
+
+    /**
+     * Consumer side: blocks until the vision process publishes new results
+     * instead of polling the stanchions file.
+     *
+     * <pre>
+     * ResultWaiter waiter;
+     * waiter.open();
+     * while (running) {
+     *   if (waiter.wait(100)) {
+     *     // read /dev/shm/stanchions (or detection ring)
+     *   }
+     * }
+     * </pre>
+     */
+    class ResultWaiter {
+    public:
+	ResultWaiter();
+	~ResultWaiter();
+
+	/**
+	 * Maps the notification segment created by the publisher.
+	 *
+	 * @return true if segment was found and is compatible.
+	 */
+	bool open(const std::string& name = RESULT_NOTIFY_NAME);
+
+	/** Whether open() succeeded. */
+	bool isOpen() const { return _header != 0; }
+
+	/**
+	 * Wait for results newer than the last ones this waiter saw.
+	 *
+	 * @param timeoutMs Maximum time to wait in milliseconds (0 to just
+	 * check, negative to wait forever).
+	 *
+	 * @return true if new results were published, false on timeout.
+	 */
+	bool wait(int timeoutMs);
+
+	/** Frame count of the most recently published results. */
+	int getFrameCount() const;
+
+    private:
+	NotifyHeader* _header;
+	uint32_t _lastSeen;
+    };
+}
@@ -0,0 +1,232 @@
+#include "rowengine.hpp"
+
+#include <algorithm>
+
+#include <string.h>
+
+using namespace cv;
+using namespace vision;
+using namespace std;
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+namespace {
+    // Half the size of the filter's erosion (5x5) and dilation (7x7)
+    // structuring elements (see Filter::Filter())
+    const int ERODE_RADIUS = 2;
+    const int DILATE_RADIUS = 3;
+
+    const int MIN_RING = 2 * ERODE_RADIUS + 1;
+    const int MAX_RING = 2 * DILATE_RADIUS + 1;
+
+    /**
+     * Minimum (or maximum) of src over x - radius .. x + radius. Pixels
+     * past the ends are left out, like erode() and dilate() treat their
+     * default border.
+     */
+    template <bool Max>
+    void horizontal(const uchar* src, uchar* dst, int cols, int radius) {
+	for (int x = 0; x < cols; x++) {
+	    int x0 = max(0, x - radius);
+	    int x1 = min(cols - 1, x + radius);
+	    uchar v = src[x0];
+	    for (int i = x0 + 1; i <= x1; i++) {
+		v = Max ? max(v, src[i]) : min(v, src[i]);
+	    }
+	    dst[x] = v;
+	}
+    }
+
+    /** Minimum (or maximum) of rows y0 .. y1 of a ring of rows. */
+    template <bool Max>
+    void vertical(const Mat& ring, int y0, int y1, uchar* dst, int cols) {
+	memcpy(dst, ring.ptr(y0 % ring.rows), cols);
+	for (int y = y0 + 1; y <= y1; y++) {
+	    const uchar* src = ring.ptr(y % ring.rows);
+	    for (int x = 0; x < cols; x++) {
+		dst[x] = Max ? max(dst[x], src[x]) : min(dst[x], src[x]);
+	    }
+	}
+    }
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+MorphLane::MorphLane() :
+    _rows(0),
+    _cols(0),
+    _maskRow(),
+    _minRows(),
+    _pushed(0),
+    _eroded(),
+    _maxRows(),
+    _erodedRows(0),
+    _dilated(),
+    _dilatedRows(0),
+    _runs(),
+    _previousRuns(),
+    _parent(),
+    _extents(),
+    _seenRow(),
+    _blobs()
+{
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+void MorphLane::start(int rows, int cols) {
+    _rows = rows;
+    _cols = cols;
+    _maskRow.resize(cols);
+    _minRows.create(MIN_RING, cols, CV_8UC1);
+    _eroded.resize(cols);
+    _maxRows.create(MAX_RING, cols, CV_8UC1);
+    _dilated.create(rows, cols, CV_8UC1);
+    _pushed = 0;
+    _erodedRows = 0;
+    _dilatedRows = 0;
+
+    _runs.clear();
+    _previousRuns.clear();
+    _parent.clear();
+    _extents.clear();
+    _seenRow.clear();
+    _blobs.clear();
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+void MorphLane::push(const uchar* maskRow) {
+    if (_pushed >= _rows) {
+	return;
+    }
+    horizontal<false>(maskRow, _minRows.ptr(_pushed % MIN_RING), _cols, ERODE_RADIUS);
+    _pushed++;
+
+    // Eroded row y needs the mask rows down to y + 2 (or the last row)
+    while ((_erodedRows < _rows) && (min(_rows - 1, _erodedRows + ERODE_RADIUS) < _pushed)) {
+	int y = _erodedRows++;
+	vertical<false>(_minRows, max(0, y - ERODE_RADIUS), min(_rows - 1, y + ERODE_RADIUS),
+			_eroded.data(), _cols);
+	horizontal<true>(_eroded.data(), _maxRows.ptr(y % MAX_RING), _cols, DILATE_RADIUS);
+
+	// Dilated row d needs the eroded rows down to d + 3
+	while ((_dilatedRows < _rows)
+	       && (min(_rows - 1, _dilatedRows + DILATE_RADIUS) < _erodedRows)) {
+	    int d = _dilatedRows++;
+	    vertical<true>(_maxRows, max(0, d - DILATE_RADIUS), min(_rows - 1, d + DILATE_RADIUS),
+			   _dilated.ptr(d), _cols);
+	    dilatedRowDone(d);
+	}
+    }
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+void MorphLane::dilatedRowDone(int y) {
+    const uchar* row = _dilated.ptr(y);
+
+    _runs.clear();
+    for (int x = 0; x < _cols; ) {
+	if (row[x] == 0) {
+	    x++;
+	    continue;
+	}
+	Run run = { x, x, -1 };
+	while ((x < _cols) && (row[x] != 0)) {
+	    run.x1 = x++;
+	}
+	_runs.push_back(run);
+    }
+
+    // Join each run to the runs above it (touching diagonally counts)
+    size_t first = 0;
+    for (Run& run : _runs) {
+	while ((first < _previousRuns.size()) && (_previousRuns[first].x1 < run.x0 - 1)) {
+	    first++;
+	}
+
+	int label = -1;
+	for (size_t i = first; (i < _previousRuns.size()) && (_previousRuns[i].x0 <= run.x1 + 1); i++) {
+	    int root = find(_previousRuns[i].label);
+	    if (label < 0) {
+		label = root;
+	    } else if (root != label) {
+		// Run joins two blobs
+		_parent[root] = label;
+		Extent& to = _extents[label];
+		const Extent& from = _extents[root];
+		to.x0 = min(to.x0, from.x0);
+		to.y0 = min(to.y0, from.y0);
+		to.x1 = max(to.x1, from.x1);
+		to.pixels += from.pixels;
+	    }
+	}
+
+	if (label < 0) {
+	    label = _parent.size();
+	    _parent.push_back(label);
+	    Extent extent = { run.x0, y, run.x1, y, 0 };
+	    _extents.push_back(extent);
+	    _seenRow.push_back(y);
+	}
+
+	Extent& extent = _extents[label];
+	extent.x0 = min(extent.x0, run.x0);
+	extent.x1 = max(extent.x1, run.x1);
+	extent.y1 = y;
+	extent.pixels += run.x1 - run.x0 + 1;
+	run.label = label;
+    }
+
+    for (const Run& run : _runs) {
+	_seenRow[find(run.label)] = y;
+    }
+
+    // Blobs above with no run in this row can't grow any more
+    for (const Run& run : _previousRuns) {
+	emitBlob(find(run.label), y);
+    }
+
+    swap(_runs, _previousRuns);
+
+    if (y == _rows - 1) {
+	for (const Run& run : _previousRuns) {
+	    emitBlob(find(run.label), y + 1);
+	}
+    }
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+int MorphLane::find(int label) {
+    while (_parent[label] != label) {
+	_parent[label] = _parent[_parent[label]];
+	label = _parent[label];
+    }
+    return label;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+void MorphLane::emitBlob(int root, int y) {
+    // Already reported (or still growing in row y)
+    if (_seenRow[root] >= y) {
+	return;
+    }
+    _seenRow[root] = y;
+
+    const Extent& extent = _extents[root];
+    RowBlob blob = {
+	Rect(extent.x0, extent.y0, extent.x1 - extent.x0 + 1, extent.y1 - extent.y0 + 1),
+	extent.pixels
+    };
+    _blobs.push_back(blob);
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+
+#include <vector>
+
+#include <stdint.h>
+
+namespace vision {
+
+    /**
+     * A connected group of pixels set in a mask (8 way connected, like
+     * the shapes findContours() traces).
+     */
+    struct RowBlob {
+	// Bounding box (the same box boundingRect() gives its outer contour)
+	cv::Rect bounds;
+	// Pixels set
+	int pixels;
+    };
+
+    /**
+     * Streams one color's black and white mask through erosion (5x5
+     * rectangle) and dilation (7x7 rectangle) a row at a time, producing
+     * the same result as cv::erode() followed by cv::dilate() with the
+     * filter's structuring elements.
+     *
+     * <p>Both are separable: each row's horizontal minimum (or maximum)
+     * goes into a small ring of rows sized to the element, and an output
+     * row is made as soon as the rows below it have arrived. Only the
+     * final mask is kept as a whole image (contours are traced from it).
+     * Blobs in the final mask are labelled as its rows complete and each
+     * blob is reported once no row below can add to it.</p>
+     */
+    class MorphLane {
+    public:
+	MorphLane();
+
+	/** Prepare for a mask of the given size. */
+	void start(int rows, int cols);
+
+	/**
+	 * Add the next mask row (0 or 255 values), producing any eroded,
+	 * dilated and labelled rows it completes.
+	 */
+	void push(const uchar* maskRow);
+
+	/** Scratch row of the lane's width for building the next mask row. */
+	uchar* maskRow() { return _maskRow.data(); }
+
+	/** Eroded and dilated mask (complete once every row is pushed). */
+	const cv::Mat& getDilated() const { return _dilated; }
+
+	/** Blobs in the dilated mask (complete once every row is pushed). */
+	const std::vector<RowBlob>& getBlobs() const { return _blobs; }
+
+    private:
+	// Horizontal run of set pixels in a row of the dilated mask
+	struct Run {
+	    int x0, x1;
+	    int label;
+	};
+
+	void dilatedRowDone(int y);
+	int find(int label);
+	void emitBlob(int root, int y);
+
+	int _rows;
+	int _cols;
+	std::vector<uchar> _maskRow;
+
+	// Horizontal minimums of the last 5 mask rows (row y at y % 5)
+	cv::Mat _minRows;
+	int _pushed;
+	// Eroded row being built and horizontal maximums of the last 7
+	// eroded rows (row y at y % 7)
+	std::vector<uchar> _eroded;
+	cv::Mat _maxRows;
+	int _erodedRows;
+	cv::Mat _dilated;
+	int _dilatedRows;
+
+	// Blob labelling of the dilated rows (union find over runs)
+	std::vector<Run> _runs;
+	std::vector<Run> _previousRuns;
+	std::vector<int> _parent;
+	// Extent of each label (only kept up to date for roots) and the
+	// last row with a run of it
+	struct Extent {
+	    int x0, y0, x1, y1;
+	    int pixels;
+	};
+	std::vector<Extent> _extents;
+	std::vector<int> _seenRow;
+	std::vector<RowBlob> _blobs;
+    };
+
+    /**
+     * Working storage for pushing a frame through color conversion,
+     * color reduction, thresholding, erosion and dilation a few rows at
+     * a time (see Filter's StreamDetector), so intermediate images
+     * never leave the cache.
+     */
+    struct RowEngine {
+	// Rows converted to HSV at a time
+	static const int STRIP_ROWS = 8;
+
+	// HSV rows being reduced
+	cv::Mat hsvStrip;
+	// Lanes (indexed by Found::Yellow and Found::Red)
+	MorphLane lanes[3];
+    };
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+namespace vision {
+
+    /**
+     * Lock free, fixed capacity queue safe for exactly one producer
+     * thread and one consumer thread.
+     *
+     * <p>All storage is allocated up front (capacity is rounded up to a
+     * power of two) so pushing and popping never allocate. The producer
+     * and consumer positions are kept on separate cache lines so the two
+     * threads don't fight over the same line.</p>
+     */
+    template <typename T>
+    class SpscQueue {
+    public:
+	/**
+	 * Construct a new queue.
+	 *
+	 * @param capacity Minimum number of items the queue must hold.
+	 */
+	explicit SpscQueue(size_t capacity) :
+	    _items(roundUp(capacity)),
+	    _mask(_items.size() - 1),
+	    _head(0),
+	    _tail(0)
+	{
+	}
+
+	/**
+	 * Adds an item (producer thread only).
+	 *
+	 * @return false if the queue was full (item not added).
+	 */
+	bool push(const T& item) {
+	    size_t tail = _tail.load(std::memory_order_relaxed);
+	    if ((tail - _head.load(std::memory_order_acquire)) > _mask) {
+		return false;
+	    }
+	    _items[tail & _mask] = item;
+	    _tail.store(tail + 1, std::memory_order_release);
+	    return true;
+	}
+
+	/**
+	 * Removes the oldest item (consumer thread only).
+	 *
+	 * @return false if the queue was empty (item not modified).
+	 */
+	bool pop(T& item) {
+	    size_t head = _head.load(std::memory_order_relaxed);
+	    if (head == _tail.load(std::memory_order_acquire)) {
+		return false;
+	    }
+	    item = _items[head & _mask];
+	    _head.store(head + 1, std::memory_order_release);
+	    return true;
+	}
+
+	/** Number of items waiting (approximate if other thread is active). */
+	size_t size() const {
+	    return _tail.load(std::memory_order_acquire)
+		- _head.load(std::memory_order_acquire);
+	}
+
+	/** Maximum number of items the queue can hold. */
+	size_t capacity() const { return _items.size(); }
+
+    private:
+	static size_t roundUp(size_t n) {
+	    size_t cap = 1;
+	    while (cap < n) {
+		cap <<= 1;
+	    }
+	    return cap;
+	}
+
+	std::vector<T> _items;
+	size_t _mask;
+
+	char _pad0[64];
+	// Next position to read (only modified by consumer)
+	std::atomic<size_t> _head;
+	char _pad1[64];
+	// Next position to write (only modified by producer)
+	std::atomic<size_t> _tail;
+	char _pad2[64];
+    };
+}
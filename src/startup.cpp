@@ -0,0 +1,99 @@
+#include "startup.hpp"
+#include "latency.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+#include <time.h>
+#include <unistd.h>
+
+using namespace vision;
+using namespace std;
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+int64_t vision::processStartNanos() {
+    int64_t now = monotonicNanos();
+
+    // Field 22 of /proc/self/stat is the start time in clock ticks since
+    // boot (the name in field 2 may hold spaces, so count from the ')')
+    ifstream in("/proc/self/stat");
+    string stat;
+    getline(in, stat);
+    size_t paren = stat.rfind(')');
+    if (paren == string::npos) {
+	return now;
+    }
+    istringstream fields(stat.substr(paren + 1));
+    string field;
+    for (int i = 3; (i < 22) && (fields >> field); i++) {
+    }
+    long long ticks;
+    long hz = sysconf(_SC_CLK_TCK);
+    timespec boot;
+    if (!(fields >> ticks) || (hz <= 0) || (clock_gettime(CLOCK_BOOTTIME, &boot) != 0)) {
+	return now;
+    }
+
+    int64_t runningNanos = toNanos(boot) - ticks * (1000000000LL / hz);
+    return now - max(runningNanos, (int64_t) 0);
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+StartupPhases::StartupPhases() :
+    _start(processStartNanos()),
+    _lock(),
+    _phases()
+{
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+void StartupPhases::add(const string& name, int64_t startNanos) {
+    Phase phase;
+    phase.name = name;
+    phase.start = startNanos - _start;
+    phase.end = monotonicNanos() - _start;
+
+    lock_guard<mutex> guard(_lock);
+    _phases.push_back(phase);
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+double StartupPhases::getSecs() const {
+    lock_guard<mutex> guard(_lock);
+    int64_t end = 0;
+    for (const Phase& phase : _phases) {
+	end = max(end, phase.end);
+    }
+    return end / 1e9;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+ostream& StartupPhases::print(ostream& out) const {
+    vector<Phase> phases;
+    {
+	lock_guard<mutex> guard(_lock);
+	phases = _phases;
+    }
+    stable_sort(phases.begin(), phases.end(),
+		[](const Phase& a, const Phase& b) { return a.start < b.start; });
+
+    out << "Startup (ms after process start):";
+    for (const Phase& phase : phases) {
+	out << fixed << setprecision(1) << "  " << phase.name << " "
+	    << (phase.start / 1e6) << "-" << (phase.end / 1e6);
+    }
+    out.unsetf(ios::floatfield);
+    return out << setprecision(6);
+}
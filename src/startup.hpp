@@ -0,0 +1,67 @@
+#pragma once
+
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+namespace vision {
+
+    /**
+     * When the process was started as a CLOCK_MONOTONIC_RAW time in
+     * nanoseconds (see monotonicNanos()), so the time spent loading
+     * shared libraries before main() is counted too. Only as precise as
+     * the kernel's clock ticks (usually 10 ms).
+     *
+     * @return The start time (or the current time if it couldn't be
+     * read from /proc/self/stat).
+     */
+    int64_t processStartNanos();
+
+    /**
+     * How long each phase of starting up took, to see where the time
+     * from process start to the first published result goes.
+     *
+     * <p>Phases can overlap (the camera is opened while the filter
+     * loads) so each is kept as a start and end relative to when the
+     * process started rather than as a duration. Phases may be added
+     * from any thread.</p>
+     */
+    class StartupPhases {
+    public:
+	StartupPhases();
+
+	/**
+	 * Note a phase that has just finished.
+	 *
+	 * @param name What was done.
+	 * @param startNanos When it started (see monotonicNanos()).
+	 */
+	void add(const std::string& name, int64_t startNanos);
+
+	/** When the process started (see processStartNanos()). */
+	int64_t getStartNanos() const { return _start; }
+
+	/** Seconds from process start until the last phase ended. */
+	double getSecs() const;
+
+	/**
+	 * Print each phase (start and end in milliseconds after the
+	 * process started) on one line.
+	 */
+	std::ostream& print(std::ostream& out) const;
+
+    private:
+	struct Phase {
+	    std::string name;
+	    int64_t start;
+	    int64_t end;
+	};
+
+	int64_t _start;
+	mutable std::mutex _lock;
+	std::vector<Phase> _phases;
+    };
+}
@@ -0,0 +1,332 @@
+#include "synthetic.hpp"
+#include "filter.hpp"
+#include "Timer.h"
+
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace cv;
+using namespace vision;
+using namespace std;
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+namespace {
+    /** Small, fast pseudo random numbers (xorshift32). */
+    class Random {
+    public:
+	/** Independent sequence for each frame of a seed. */
+	Random(uint32_t seed, int index) :
+	    _state((seed * 0x9e3779b9u) ^ ((index + 1) * 0x85ebca6bu))
+	{
+	    if (_state == 0) {
+		_state = 1;
+	    }
+	    for (int i = 0; i < 4; i++) {
+		next();
+	    }
+	}
+
+	uint32_t next() {
+	    _state ^= _state << 13;
+	    _state ^= _state >> 17;
+	    _state ^= _state << 5;
+	    return _state;
+	}
+
+	/** Value in [lo, hi]. */
+	int uniform(int lo, int hi) {
+	    return (hi <= lo) ? lo : lo + (int) (next() % (uint32_t) (hi - lo + 1));
+	}
+
+    private:
+	uint32_t _state;
+    };
+
+    Scalar hsvToBgr(int h, int s, int v) {
+	Mat hsv(1, 1, CV_8UC3, Scalar(h, s, v));
+	Mat bgr;
+	cvtColor(hsv, bgr, COLOR_HSV2BGR);
+	const uchar* c = bgr.ptr(0);
+	return Scalar(c[0], c[1], c[2]);
+    }
+
+    bool overlapsAny(const Rect& r, const vector<Rect>& placed) {
+	for (const Rect& p : placed) {
+	    if ((r & p).area() > 0) {
+		return true;
+	    }
+	}
+	return false;
+    }
+
+    Rect inflate(const Rect& r, int margin) {
+	return Rect(r.x - margin, r.y - margin, r.width + 2 * margin, r.height + 2 * margin);
+    }
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+SyntheticSpec::SyntheticSpec() :
+    size(320, 240),
+    color(SYNTHETIC_MIXED),
+    x(0),
+    y(0),
+    width(0),
+    height(0),
+    jitter(0),
+    blobs(0),
+    noise(0),
+    lighting(0),
+    seed(1),
+    frames(0),
+    fps(0)
+{
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+bool SyntheticSpec::parse(const string& spec) {
+    istringstream in(spec);
+    string item;
+    while (getline(in, item, ',')) {
+	if (item.empty()) {
+	    continue;
+	}
+	size_t eq = item.find('=');
+	string key = item.substr(0, eq);
+	string value = (eq == string::npos) ? "" : item.substr(eq + 1);
+	int n = atoi(value.c_str());
+	bool ok = !value.empty();
+
+	if (key == "size") {
+	    int w = 0, h = 0;
+	    ok = (sscanf(value.c_str(), "%dx%d", &w, &h) == 2) && (w >= 100) && (h >= 100);
+	    size = Size(w, h);
+	} else if (key == "color") {
+	    if (value == "yellow") {
+		color = Found::Yellow;
+	    } else if (value == "red") {
+		color = Found::Red;
+	    } else if (value == "none") {
+		color = Found::None;
+	    } else if (value == "mixed") {
+		color = SYNTHETIC_MIXED;
+	    } else {
+		ok = false;
+	    }
+	} else if (key == "x") {
+	    x = n;
+	} else if (key == "y") {
+	    y = n;
+	} else if (key == "w") {
+	    width = n;
+	    ok = ok && (n >= 0);
+	} else if (key == "h") {
+	    height = n;
+	    ok = ok && (n >= 0);
+	} else if (key == "jitter") {
+	    jitter = n;
+	    ok = ok && (n >= 0);
+	} else if (key == "blobs") {
+	    blobs = n;
+	    ok = ok && (n >= 0);
+	} else if (key == "noise") {
+	    noise = n;
+	    ok = ok && (n >= 0);
+	} else if (key == "light") {
+	    lighting = n;
+	    ok = ok && (n >= 0);
+	} else if (key == "seed") {
+	    seed = strtoul(value.c_str(), 0, 0);
+	} else if (key == "frames") {
+	    frames = n;
+	    ok = ok && (n >= 0);
+	} else if (key == "fps") {
+	    fps = atof(value.c_str());
+	    ok = ok && (fps >= 0);
+	} else {
+	    ok = false;
+	}
+
+	if (!ok) {
+	    cerr << "Invalid synthetic frame setting: " << item << "\n";
+	    return false;
+	}
+    }
+    return true;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+SyntheticFrames::SyntheticFrames(const Filter& filter, const SyntheticSpec& spec) :
+    _spec(spec),
+    _next(0),
+    _startNanos(0)
+{
+    memset(_hueRanges, 0, sizeof(_hueRanges));
+    memset(&_truth, 0, sizeof(_truth));
+
+    // Stanchions are colored from the middle of each range
+    const Found colors[] = { Found::Yellow, Found::Red };
+    for (Found color : colors) {
+	const int* r = filter.getColorRanges(color);
+	_fill[color] = hsvToBgr((r[0] + r[1]) / 2, (r[2] + r[3]) / 2, (r[4] + r[5]) / 2);
+	_hueRanges[color][0] = r[0];
+	_hueRanges[color][1] = r[1];
+    }
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+void SyntheticFrames::render(int index, Mat& frame, FileData& truth) const {
+    Random rnd(_spec.seed, index);
+    Size size = _spec.size;
+    Rect crop = Filter::getCropWindow(size);
+    double scale = size.width / 320.0;
+
+    // Slightly tinted gray background
+    frame.create(size, CV_8UC3);
+    frame = Scalar(100 + rnd.uniform(-20, 20), 100 + rnd.uniform(-20, 20),
+		   100 + rnd.uniform(-20, 20));
+
+    memset(&truth, 0, sizeof(truth));
+    truth.frameCount = index + 1;
+    vector<Rect> placed;
+
+    int color = (_spec.color == SYNTHETIC_MIXED)
+	? ((index % 2) ? Found::Red : Found::Yellow) : _spec.color;
+
+    if (color != Found::None) {
+	int j = _spec.jitter;
+	int w = ((_spec.width > 0) ? _spec.width : (int) (22 * scale + 0.5)) + rnd.uniform(-j, j);
+	int h = ((_spec.height > 0) ? _spec.height : (int) (80 * scale + 0.5)) + rnd.uniform(-j, j);
+	w = max(1, min(w, crop.width));
+	h = max(1, min(h, crop.height));
+
+	// Position within cropped image
+	int right = (crop.width / 2) + _spec.x + rnd.uniform(-j, j);
+	int top = (crop.height / 2) - (h / 2) + _spec.y + rnd.uniform(-j, j);
+	int left = max(0, min(right - w, crop.width - w));
+	top = max(0, min(top, crop.height - h));
+
+	Rect box(left, top, w, h);
+	rectangle(frame, box + crop.tl(), _fill[color], -1);
+	placed.push_back(inflate(box + crop.tl(), 8));
+
+	truth.found = (Found) color;
+	truth.boxWidth = w;
+	truth.boxHeight = h;
+	truth.xMid = left + (w / 2);
+	truth.yBot = top + h;
+    }
+
+    // Distractors
+    for (int i = 0; i < _spec.blobs; i++) {
+	int kind = rnd.uniform(0, 2);
+	Scalar fill;
+	int w, h;
+
+	if (kind == 0) {
+	    // Some other color (any shape)
+	    int hue = 0;
+	    for (int attempt = 0; attempt < 8; attempt++) {
+		hue = rnd.uniform(20, 179);
+		bool near = false;
+		for (int c = Found::Red; c <= Found::Yellow; c++) {
+		    near = near || ((hue >= _hueRanges[c][0] - 10) && (hue <= _hueRanges[c][1] + 10));
+		}
+		if (!near) {
+		    break;
+		}
+	    }
+	    fill = hsvToBgr(hue, rnd.uniform(80, 255), rnd.uniform(80, 255));
+	    w = rnd.uniform(4, (int) (40 * scale));
+	    h = rnd.uniform(4, (int) (40 * scale));
+	} else if (kind == 1) {
+	    // Stanchion color but too narrow
+	    fill = _fill[rnd.uniform(Found::Red, Found::Yellow)];
+	    w = rnd.uniform(4, 14);
+	    h = rnd.uniform(4, 14);
+	} else {
+	    // Stanchion color but too wide for its height
+	    fill = _fill[rnd.uniform(Found::Red, Found::Yellow)];
+	    w = rnd.uniform(20, max(20, (int) (60 * scale)));
+	    h = max(4, w / 3);
+	}
+
+	for (int attempt = 0; attempt < 8; attempt++) {
+	    Rect blob(rnd.uniform(0, size.width - w), rnd.uniform(0, size.height - h), w, h);
+	    if (!overlapsAny(blob, placed)) {
+		if (kind == 0) {
+		    ellipse(frame, RotatedRect(Point2f(blob.x + w / 2.0f, blob.y + h / 2.0f),
+					       Size2f(w, h), 0), fill, -1);
+		} else {
+		    rectangle(frame, blob, fill, -1);
+		    placed.push_back(inflate(blob, 8));
+		}
+		break;
+	    }
+	}
+    }
+
+    // Uneven lighting and sensor noise
+    int light = _spec.lighting;
+    int noise = _spec.noise;
+    if ((light == 0) && (noise == 0)) {
+	return;
+    }
+
+    int offset = rnd.uniform(-light, light);
+    int gradient = rnd.uniform(-light / 2, light / 2);
+    vector<int> shift(size.width);
+    for (int x = 0; x < size.width; x++) {
+	shift[x] = offset + (gradient * (2 * x - size.width)) / size.width;
+    }
+
+    for (int y = 0; y < size.height; y++) {
+	uchar* row = frame.ptr(y);
+	for (int x = 0; x < size.width; x++, row += 3) {
+	    for (int c = 0; c < 3; c++) {
+		int n = (noise > 0) ? rnd.uniform(-noise, noise) : 0;
+		row[c] = saturate_cast<uchar>(row[c] + shift[x] + n);
+	    }
+	}
+    }
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+bool SyntheticFrames::read(Mat& frame, FrameStamp& stamp) {
+    if ((_spec.frames > 0) && (_next >= _spec.frames)) {
+	return false;
+    }
+
+    if (_next == 0) {
+	_startNanos = monotonicNanos();
+    }
+    if (_spec.fps > 0) {
+	int64_t due = _startNanos + (int64_t) (_next * 1e9 / _spec.fps);
+	for (int64_t now = monotonicNanos(); now < due; now = monotonicNanos()) {
+	    avc::Timer::sleepNanos((int) min<int64_t>(due - now, 999999999));
+	}
+    }
+
+    stamp.captureNanos = monotonicNanos();
+    stamp.sequence = _next + 1;
+    stamp.fromDriver = false;
+    render(_next++, frame, _truth);
+    return true;
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include "filedata.hpp"
+#include "latency.hpp"
+
+#include <opencv2/opencv.hpp>
+
+#include <string>
+
+#include <stdint.h>
+
+namespace vision {
+
+    class Filter;
+
+    // SyntheticSpec::color value that alternates yellow and red frames
+    const int SYNTHETIC_MIXED = -1;
+
+    /**
+     * What SyntheticFrames renders. Parsed from a comma separated list
+     * of key=value pairs (like "size=1280x720,blobs=200,noise=20"):
+     *
+     * <pre>
+     *   size=WxH   Frame resolution (default 320x240)
+     *   color=C    Stanchion color: yellow, red, none or mixed (default)
+     *   x=N        Right edge of stanchion relative to middle of the
+     *              cropped frame in pixels (default 0)
+     *   y=N        Middle of stanchion relative to middle of the cropped
+     *              frame in pixels (default 0)
+     *   w=N, h=N   Stanchion size in pixels (default 22x80 scaled to
+     *              the frame width)
+     *   jitter=N   Random variation of position and size in pixels
+     *   blobs=N    Number of distractor blobs
+     *   noise=N    Per pixel noise amplitude (+/- N)
+     *   light=N    Largest brightness shift (+/- N, with a gradient
+     *              across the frame)
+     *   seed=N     Random seed (same seed and index, same frame)
+     *   frames=N   Frames read() supplies (0 for no limit)
+     *   fps=N      Frames per second read() supplies (0 for no pacing)
+     * </pre>
+     */
+    struct SyntheticSpec {
+	cv::Size size;
+	int color;
+	int x, y;
+	int width, height;
+	int jitter;
+	int blobs;
+	int noise;
+	int lighting;
+	uint32_t seed;
+	int frames;
+	double fps;
+
+	SyntheticSpec();
+
+	/**
+	 * Update from a list of key=value pairs (see above).
+	 *
+	 * @return false (after reporting the problem) if spec is bad.
+	 */
+	bool parse(const std::string& spec);
+    };
+
+    /**
+     * Deterministic generator of stanchion frames with known results.
+     *
+     * <p>Each frame is a noisy, unevenly lit background with one
+     * stanchion colored from the middle of the filter's color range
+     * and distractor blobs that must not be reported: blobs of other
+     * colors plus blobs of the stanchion colors that are too small or
+     * too wide to pass Filter::isPossibleStanchion(). Distractors are
+     * kept apart from the stanchion and each other so they can't merge
+     * into something that looks like one. Frame N is the same every
+     * time for a given spec, whatever order frames are rendered in.</p>
+     *
+     * <p>The ground truth FileData has the box that was drawn (in
+     * cropped image coordinates like the filter's results). The filter
+     * reports a box a pixel or so larger as its dilation is larger than
+     * its erosion.</p>
+     */
+    class SyntheticFrames {
+    public:
+	/**
+	 * @param filter Where to get the color ranges from.
+	 * @param spec What to render.
+	 */
+	SyntheticFrames(const Filter& filter, const SyntheticSpec& spec);
+
+	/**
+	 * Render a frame.
+	 *
+	 * @param index Which frame (frameCount in truth is index + 1).
+	 * @param frame Where to render the BGR image (reused if already
+	 * the right size).
+	 * @param truth Set to what the filter should find.
+	 */
+	void render(int index, cv::Mat& frame, FileData& truth) const;
+
+	/**
+	 * Render the next frame in place of reading one from a camera
+	 * (paced to the spec's fps).
+	 *
+	 * @return false once the spec's number of frames have been read.
+	 */
+	bool read(cv::Mat& frame, FrameStamp& stamp);
+
+	/** Ground truth for the last frame read(). */
+	const FileData& getTruth() const { return _truth; }
+
+	const SyntheticSpec& getSpec() const { return _spec; }
+
+    private:
+	SyntheticSpec _spec;
+	cv::Scalar _fill[3];
+	int _hueRanges[3][2];
+	int _next;
+	int64_t _startNanos;
+	FileData _truth;
+    };
+}
@@ -0,0 +1,175 @@
+#include "trace.hpp"
+#include "latency.hpp"
+
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using namespace vision;
+using namespace std;
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+namespace {
+    thread_local int currentTraceFrame = -1;
+    thread_local int cachedTid = 0;
+
+    /** Escape a string for use in JSON. */
+    string quote(const string& s) {
+	string out = "\"";
+	for (char c : s) {
+	    if ((c == '"') || (c == '\\')) {
+		out += '\\';
+		out += c;
+	    } else if ((unsigned char) c >= 0x20) {
+		out += c;
+	    }
+	}
+	return out + "\"";
+    }
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+Tracer::Tracer(size_t capacity) :
+    _events(),
+    _mask(0),
+    _next(0),
+    _lock(),
+    _threadNames()
+{
+    size_t size = 1;
+    while (size < capacity) {
+	size *= 2;
+    }
+    _events.reset(new Event[size]);
+    _mask = size - 1;
+    for (size_t i = 0; i < size; i++) {
+	_events[i].seq.store(0, memory_order_relaxed);
+    }
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+int Tracer::currentFrame() {
+    return currentTraceFrame;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+void Tracer::setCurrentFrame(int frame) {
+    currentTraceFrame = frame;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+int Tracer::threadId() {
+    if (cachedTid == 0) {
+	cachedTid = syscall(SYS_gettid);
+
+	// First event from this thread, remember its name (set by
+	// pthread_setname_np) for the trace viewer
+	char name[17];
+	memset(name, 0, sizeof(name));
+	prctl(PR_GET_NAME, name, 0, 0, 0);
+	lock_guard<mutex> guard(_lock);
+	_threadNames[cachedTid] = name;
+    }
+    return cachedTid;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+void Tracer::record(char phase, const char* name, int frame) {
+    int tid = threadId();
+    uint64_t index = _next.fetch_add(1, memory_order_relaxed);
+    Event& e = _events[index & _mask];
+
+    // Odd while being written
+    e.seq.store(2 * index + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    e.nanos = monotonicNanos();
+    e.name = name;
+    e.frame = frame;
+    e.tid = tid;
+    e.phase = phase;
+    e.seq.store(2 * (index + 1), memory_order_release);
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+bool Tracer::write(const string& fileName) {
+    ofstream out(fileName.c_str());
+    if (!out) {
+	cerr << "Unable to write trace file: " << fileName << "\n";
+	return false;
+    }
+
+    int pid = getpid();
+    uint64_t end = _next.load(memory_order_acquire);
+    uint64_t start = (end > _mask) ? (end - _mask - 1) : 0;
+    bool first = true;
+    int written = 0;
+
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+
+    {
+	lock_guard<mutex> guard(_lock);
+	for (auto& thread : _threadNames) {
+	    out << (first ? "" : ",\n")
+		<< "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid
+		<< ",\"tid\":" << thread.first
+		<< ",\"args\":{\"name\":" << quote(thread.second) << "}}";
+	    first = false;
+	}
+    }
+
+    out << fixed << setprecision(3);
+    for (uint64_t i = start; i < end; i++) {
+	Event& e = _events[i & _mask];
+	uint64_t expected = 2 * (i + 1);
+	if (e.seq.load(memory_order_acquire) != expected) {
+	    // Not finished yet or already overwritten
+	    continue;
+	}
+	int64_t nanos = e.nanos;
+	const char* name = e.name;
+	int frame = e.frame;
+	int tid = e.tid;
+	char phase = e.phase;
+	atomic_thread_fence(memory_order_acquire);
+	if (e.seq.load(memory_order_relaxed) != expected) {
+	    continue;
+	}
+
+	out << (first ? "" : ",\n")
+	    << "{\"name\":" << quote(name) << ",\"ph\":\"" << phase
+	    << "\",\"ts\":" << (nanos * 1e-3)
+	    << ",\"pid\":" << pid << ",\"tid\":" << tid;
+	if (frame >= 0) {
+	    out << ",\"args\":{\"frame\":" << frame << "}";
+	}
+	out << "}";
+	first = false;
+	written++;
+    }
+
+    out << "\n]}\n";
+    out.close();
+
+    cerr << "Wrote " << written << " trace events to " << fileName << "\n";
+    return !out.fail();
+}
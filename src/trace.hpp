@@ -0,0 +1,115 @@
+#pragma once
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include <stdint.h>
+
+namespace vision {
+
+    /**
+     * In memory timeline of begin/end events from any number of threads,
+     * written out in the Chrome trace event JSON format (load the file in
+     * chrome://tracing or https://ui.perfetto.dev).
+     *
+     * <p>Events go into a fixed size ring (the oldest are overwritten
+     * once it fills) claimed with a single atomic increment, so recording
+     * never blocks or allocates. Each entry carries a sequence number so
+     * write() can run while other threads are still recording and skip
+     * entries that are being overwritten.</p>
+     */
+    class Tracer {
+    public:
+	/**
+	 * @param capacity Number of events to keep (rounded up to a
+	 * power of 2).
+	 */
+	explicit Tracer(size_t capacity = 1 << 17);
+
+	/**
+	 * Record an event.
+	 *
+	 * @param phase 'B' for begin, 'E' for end.
+	 * @param name Name of what happened (must be a string that
+	 * outlives the tracer, like a literal).
+	 * @param frame Frame number event belongs to (-1 if none).
+	 */
+	void record(char phase, const char* name, int frame);
+
+	/**
+	 * Writes all events still in the ring to a JSON file.
+	 *
+	 * @return true if file was written.
+	 */
+	bool write(const std::string& fileName);
+
+	/**
+	 * Frame number used by scopes that don't specify one (set by
+	 * the enclosing scope on this thread).
+	 */
+	static int currentFrame();
+	static void setCurrentFrame(int frame);
+
+    private:
+	struct Event {
+	    // 2 * (index + 1) once the event at ring index is complete
+	    std::atomic<uint64_t> seq;
+	    int64_t nanos;
+	    const char* name;
+	    int32_t frame;
+	    int32_t tid;
+	    char phase;
+	};
+
+	int threadId();
+
+	std::unique_ptr<Event[]> _events;
+	uint64_t _mask;
+	std::atomic<uint64_t> _next;
+
+	// Names of threads that recorded events (by kernel thread id)
+	std::mutex _lock;
+	std::map<int, std::string> _threadNames;
+    };
+
+    /**
+     * Records begin and end events for the life of the object (does
+     * nothing if tracer is null).
+     */
+    class TraceScope {
+    public:
+	/**
+	 * @param tracer Where to record (may be 0).
+	 * @param name Static name of the stage.
+	 * @param frame Frame number (-1 to use the frame of the enclosing
+	 * scope on this thread).
+	 */
+	TraceScope(Tracer* tracer, const char* name, int frame = -1) :
+	    _tracer(tracer), _name(name), _frame(frame), _prevFrame(-1) {
+	    if (_tracer != 0) {
+		_prevFrame = Tracer::currentFrame();
+		if (_frame < 0) {
+		    _frame = _prevFrame;
+		}
+		Tracer::setCurrentFrame(_frame);
+		_tracer->record('B', _name, _frame);
+	    }
+	}
+
+	~TraceScope() {
+	    if (_tracer != 0) {
+		_tracer->record('E', _name, _frame);
+		Tracer::setCurrentFrame(_prevFrame);
+	    }
+	}
+
+    private:
+	Tracer* _tracer;
+	const char* _name;
+	int _frame;
+	int _prevFrame;
+    };
+}
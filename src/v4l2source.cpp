@@ -0,0 +1,228 @@
+#include "v4l2source.hpp"
+
+#include <iostream>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <linux/videodev2.h>
+
+using namespace cv;
+using namespace vision;
+using namespace std;
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+namespace {
+    // Driver buffers (we only hold one while converting it)
+    const int DRIVER_BUFFERS = 4;
+
+    // How long to wait for the driver to fill a buffer
+    const int FRAME_TIMEOUT_MSECS = 2000;
+
+    /** ioctl() retried when interrupted by a signal. */
+    int xioctl(int fd, unsigned long request, void* arg) {
+	int rc;
+	do {
+	    rc = ioctl(fd, request, arg);
+	} while ((rc == -1) && (errno == EINTR));
+	return rc;
+    }
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+V4l2Source::V4l2Source(const string& device, int buffers) :
+    PooledSource(device, buffers),
+    _fd(-1),
+    _mapped(),
+    _size(0, 0),
+    _pixelFormat(0),
+    _stride(0),
+    _streaming(false),
+    // Driver already delivers the resolution we want
+    _decoder(0),
+    _clock(),
+    _convertLatency()
+{
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+V4l2Source::~V4l2Source() {
+    close();
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+bool V4l2Source::open(Size size, bool mjpeg, JpegDecoder::CropFunc crop) {
+    const string& device = getName();
+    _fd = ::open(device.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (_fd < 0) {
+	cerr << "Unable to open " << device << ": " << strerror(errno) << "\n";
+	return false;
+    }
+
+    v4l2_format format;
+    memset(&format, 0, sizeof(format));
+    format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    format.fmt.pix.width = size.width;
+    format.fmt.pix.height = size.height;
+    format.fmt.pix.pixelformat = mjpeg ? V4L2_PIX_FMT_MJPEG : V4L2_PIX_FMT_YUYV;
+    format.fmt.pix.field = V4L2_FIELD_NONE;
+    if (xioctl(_fd, VIDIOC_S_FMT, &format) != 0) {
+	cerr << "Unable to set format of " << device << ": " << strerror(errno) << "\n";
+	close();
+	return false;
+    }
+
+    _pixelFormat = format.fmt.pix.pixelformat;
+    if ((_pixelFormat != V4L2_PIX_FMT_MJPEG) && (_pixelFormat != V4L2_PIX_FMT_YUYV)) {
+	cerr << device << " supports neither MJPEG nor YUYV\n";
+	close();
+	return false;
+    }
+    _size = Size(format.fmt.pix.width, format.fmt.pix.height);
+    _stride = format.fmt.pix.bytesperline;
+    _decoder.setCrop(crop);
+
+    // Decoded MJPEG frames are scaled and cropped (size isn't known
+    // until the first one), YUYV frames are converted at full size
+    if (_pixelFormat == V4L2_PIX_FMT_YUYV) {
+	prefault(_size, CV_8UC3);
+    }
+
+    v4l2_streamparm parm;
+    memset(&parm, 0, sizeof(parm));
+    parm.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    if ((xioctl(_fd, VIDIOC_G_PARM, &parm) == 0)
+	&& (parm.parm.capture.timeperframe.numerator > 0)) {
+	const v4l2_fract& tpf = parm.parm.capture.timeperframe;
+	_clock.setFrameRate((double) tpf.denominator / tpf.numerator);
+    }
+
+    v4l2_requestbuffers request;
+    memset(&request, 0, sizeof(request));
+    request.count = DRIVER_BUFFERS;
+    request.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    request.memory = V4L2_MEMORY_MMAP;
+    if ((xioctl(_fd, VIDIOC_REQBUFS, &request) != 0) || (request.count < 2)) {
+	cerr << "Unable to get capture buffers from " << device << ": " << strerror(errno) << "\n";
+	close();
+	return false;
+    }
+
+    for (uint32_t i = 0; i < request.count; i++) {
+	v4l2_buffer buf;
+	memset(&buf, 0, sizeof(buf));
+	buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	buf.memory = V4L2_MEMORY_MMAP;
+	buf.index = i;
+
+	Buffer mapped = { MAP_FAILED, 0 };
+	if (xioctl(_fd, VIDIOC_QUERYBUF, &buf) == 0) {
+	    mapped.length = buf.length;
+	    mapped.start = mmap(0, buf.length, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, buf.m.offset);
+	}
+	if ((mapped.start == MAP_FAILED) || (xioctl(_fd, VIDIOC_QBUF, &buf) != 0)) {
+	    cerr << "Unable to map capture buffer of " << device << ": " << strerror(errno) << "\n";
+	    close();
+	    return false;
+	}
+	_mapped.push_back(mapped);
+    }
+
+    v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    if (xioctl(_fd, VIDIOC_STREAMON, &type) != 0) {
+	cerr << "Unable to start streaming from " << device << ": " << strerror(errno) << "\n";
+	close();
+	return false;
+    }
+    _streaming = true;
+    return true;
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+void V4l2Source::close() {
+    if (_streaming) {
+	v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	xioctl(_fd, VIDIOC_STREAMOFF, &type);
+	_streaming = false;
+    }
+    for (const Buffer& buffer : _mapped) {
+	munmap(buffer.start, buffer.length);
+    }
+    _mapped.clear();
+    if (_fd >= 0) {
+	::close(_fd);
+	_fd = -1;
+    }
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+bool V4l2Source::fill(Mat& image, FrameStamp& stamp) {
+    // Corrupt MJPEG frames happen now and then, skip a few of them
+    for (int attempt = 0; _streaming && (attempt < 2 * DRIVER_BUFFERS); attempt++) {
+	v4l2_buffer buf;
+	memset(&buf, 0, sizeof(buf));
+	buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	buf.memory = V4L2_MEMORY_MMAP;
+
+	while (xioctl(_fd, VIDIOC_DQBUF, &buf) != 0) {
+	    if (errno != EAGAIN) {
+		cerr << "Capture from " << getName() << " failed: " << strerror(errno) << "\n";
+		return false;
+	    }
+	    pollfd ready = { _fd, POLLIN, 0 };
+	    int rc = poll(&ready, 1, FRAME_TIMEOUT_MSECS);
+	    if (rc == 0) {
+		cerr << "No frames from " << getName() << "\n";
+		return false;
+	    }
+	    if ((rc < 0) && (errno != EINTR)) {
+		return false;
+	    }
+	}
+
+	timespec driverTime;
+	driverTime.tv_sec = buf.timestamp.tv_sec;
+	driverTime.tv_nsec = buf.timestamp.tv_usec * 1000;
+	_clock.stamp(driverTime, buf.sequence, stamp);
+
+	int64_t start = monotonicNanos();
+	const uint8_t* data = (const uint8_t*) _mapped[buf.index].start;
+	bool ok = true;
+	if (_pixelFormat == V4L2_PIX_FMT_MJPEG) {
+	    ok = _decoder.decode(data, buf.bytesused, image);
+	    if (!ok) {
+		cerr << "Failed to decode frame " << buf.sequence << ": "
+		     << _decoder.getError() << "\n";
+	    }
+	} else {
+	    Mat yuyv(_size, CV_8UC2, (void*) data, _stride);
+	    cvtColor(yuyv, image, COLOR_YUV2BGR_YUYV);
+	}
+	_convertLatency.record(monotonicNanos() - start);
+
+	// Driver can have the buffer back now the frame is ours
+	xioctl(_fd, VIDIOC_QBUF, &buf);
+
+	if (ok) {
+	    return true;
+	}
+    }
+    return false;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "framesource.hpp"
+#include "jpegdecoder.hpp"
+#include "latency.hpp"
+
+#include <opencv2/opencv.hpp>
+
+#include <string>
+#include <vector>
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace vision {
+
+    /**
+     * Reads a camera through Video4Linux2 directly (memory mapped driver
+     * buffers) rather than through OpenCV's VideoCapture.
+     *
+     * <p>Each frame is converted to BGR straight from the driver's
+     * buffer into one of our pooled buffers and the driver buffer is
+     * queued again right away. MJPEG frames are decoded at reduced
+     * scale, only decoding the filter's crop window (see JpegDecoder),
+     * and the driver's own sequence numbers and time stamps are used
+     * (see CaptureClock).</p>
+     */
+    class V4l2Source : public PooledSource {
+    public:
+	/**
+	 * @param device Device to open (like /dev/video0).
+	 * @param buffers Number of frames that may be held at once.
+	 */
+	V4l2Source(const std::string& device, int buffers);
+
+	/** Stops streaming and closes the device. */
+	~V4l2Source();
+
+	/**
+	 * Open the device and start streaming.
+	 *
+	 * @param size Resolution to ask for (the driver may pick another).
+	 * @param mjpeg Ask for MJPEG (otherwise YUYV).
+	 * @param crop Part of each frame the filter uses (MJPEG only).
+	 */
+	bool open(cv::Size size, bool mjpeg,
+		  JpegDecoder::CropFunc crop = JpegDecoder::CropFunc());
+
+	bool isLive() const { return true; }
+
+	const LatencyHistogram* getConvertLatency() const { return &_convertLatency; }
+
+    protected:
+	bool fill(cv::Mat& image, FrameStamp& stamp);
+
+    private:
+	void close();
+
+	struct Buffer {
+	    void* start;
+	    size_t length;
+	};
+
+	int _fd;
+	std::vector<Buffer> _mapped;
+	cv::Size _size;
+	uint32_t _pixelFormat;
+	uint32_t _stride;
+	bool _streaming;
+	JpegDecoder _decoder;
+	CaptureClock _clock;
+	LatencyHistogram _convertLatency;
+    };
+}
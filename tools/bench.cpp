@@ -0,0 +1,596 @@
+/**
+ * Micro benchmarks for the vision filter.
+ *
+ * Times Filter::filter() as a whole and each of its stages on their own
+ * (color conversion, color range reduction, threshold, erode, dilate,
+ * contour search, candidate selection with its rejection cascade,
+ * polygon approximation of every contour and isPossibleStanchion) over
+ * a set of images at several resolutions. Each measurement is warmed
+ * up, repeated and summarized (min, median, mean, p90, max and standard
+ * deviation). Results are written as CSV so runs from different builds
+ * can be diffed or compared with the -b option.
+ *
+ * The projection profile detector is timed as well and its results are
+ * compared with the contour detector's for each image.
+ *
+ * Generated frames (-g) can be benchmarked alongside (or instead of)
+ * images for resolutions, clutter and noise the webcam test images
+ * don't cover, and the contour detector's results on them are checked
+ * against their ground truth.
+ */
+
+#include "filter.hpp"
+#include "imagefiles.hpp"
+#include "latency.hpp"
+#include "synthetic.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+
+#include <stdlib.h>
+#include <unistd.h>
+
+using namespace cv;
+using namespace vision;
+using namespace std;
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+namespace {
+
+    /** Summary of repeated timings of one stage (in microseconds). */
+    struct Stats {
+	double min, median, mean, p90, max, stddev;
+    };
+
+    /** Key identifying a measurement (used to compare runs). */
+    string makeKey(const string& image, int width, int height,
+		   const string& stage, const string& color) {
+	ostringstream key;
+	key << image << "," << width << "," << height << "," << stage << "," << color;
+	return key.str();
+    }
+
+    /**
+     * Runs a function warmup times (ignored) and then runs times,
+     * timing each run.
+     */
+    template <typename Func>
+    Stats measure(int warmup, int runs, Func func) {
+	for (int i = 0; i < warmup; i++) {
+	    func();
+	}
+
+	vector<double> micros(runs);
+	for (int i = 0; i < runs; i++) {
+	    int64_t start = monotonicNanos();
+	    func();
+	    micros[i] = (monotonicNanos() - start) * 1e-3;
+	}
+	sort(micros.begin(), micros.end());
+
+	Stats stats;
+	double sum = 0;
+	for (double m : micros) {
+	    sum += m;
+	}
+	stats.mean = sum / runs;
+
+	double var = 0;
+	for (double m : micros) {
+	    var += (m - stats.mean) * (m - stats.mean);
+	}
+	stats.stddev = sqrt(var / runs);
+	stats.min = micros.front();
+	stats.max = micros.back();
+	stats.median = micros[runs / 2];
+	stats.p90 = micros[min(runs - 1, (int) ceil(0.9 * runs) - 1)];
+	return stats;
+    }
+
+    /** Intersection over union of two result boxes. */
+    double overlap(const FileData& a, const FileData& b) {
+	Rect ra(a.getX(), a.getY(), a.getWidth(), a.getHeight());
+	Rect rb(b.getX(), b.getY(), b.getWidth(), b.getHeight());
+	double both = (ra & rb).area();
+	double total = ra.area() + rb.area() - both;
+	return (total > 0) ? (both / total) : 1.0;
+    }
+
+    /**
+     * How often the profile detector agrees with the contour detector.
+     */
+    struct Agreement {
+	int frames;
+	int sameFound;
+	int bothFound;
+	double overlapSum;
+
+	Agreement() : frames(0), sameFound(0), bothFound(0), overlapSum(0) { }
+
+	void add(const FileData& contour, const FileData& profile) {
+	    frames++;
+	    if (contour.found != profile.found) {
+		return;
+	    }
+	    sameFound++;
+	    if (contour.found != Found::None) {
+		bothFound++;
+		overlapSum += overlap(contour, profile);
+	    }
+	}
+
+	void print(ostream& out) const {
+	    out << "\nProfile vs contour detector: same result on " << sameFound
+		<< " of " << frames << " frames";
+	    if (bothFound > 0) {
+		out << ", mean box overlap (IoU) " << setprecision(3)
+		    << (overlapSum / bothFound) << " over " << bothFound << " detections";
+	    }
+	    out << "\n";
+	}
+    };
+
+    /**
+     * How often the contour detector gets generated frames right.
+     */
+    struct Accuracy {
+	int frames;
+	int correct;
+	int boxes;
+	double overlapSum;
+
+	Accuracy() : frames(0), correct(0), boxes(0), overlapSum(0) { }
+
+	void add(const FileData& truth, const FileData& found) {
+	    frames++;
+	    if (truth.found != found.found) {
+		return;
+	    }
+	    correct++;
+	    if (truth.found != Found::None) {
+		boxes++;
+		overlapSum += overlap(truth, found);
+	    }
+	}
+
+	void print(ostream& out) const {
+	    if (frames == 0) {
+		return;
+	    }
+	    out << "\nContour detector vs ground truth: right color on " << correct
+		<< " of " << frames << " generated frames";
+	    if (boxes > 0) {
+		out << ", mean box overlap (IoU) " << setprecision(3)
+		    << (overlapSum / boxes) << " over " << boxes << " stanchions";
+	    }
+	    out << "\n";
+	}
+    };
+
+    /**
+     * Command line options.
+     */
+    class Options {
+    public:
+	Options(int argc, char** argv) :
+	    ok(true),
+	    warmup(5),
+	    runs(25),
+	    configFile("values.txt"),
+	    outputFile(""),
+	    baselineFile(""),
+	    synthetic(false),
+	    syntheticSpec(),
+	    sizes(),
+	    inputs()
+	{
+	    int opt;
+	    while ((opt = getopt(argc, argv, "b:c:g:hn:o:s:w:")) != -1) {
+		switch (opt) {
+
+		case 'b':
+		    baselineFile = optarg;
+		    break;
+
+		case 'c':
+		    configFile = optarg;
+		    break;
+
+		case 'g':
+		    synthetic = true;
+		    ok = ok && syntheticSpec.parse(optarg);
+		    break;
+
+		case 'n':
+		    runs = atoi(optarg);
+		    ok = ok && (runs > 0);
+		    break;
+
+		case 'o':
+		    outputFile = optarg;
+		    break;
+
+		case 's':
+		    ok = ok && parseSizes(optarg);
+		    break;
+
+		case 'w':
+		    warmup = atoi(optarg);
+		    ok = ok && (warmup >= 0);
+		    break;
+
+		case 'h':
+		default:
+		    ok = false;
+		}
+	    }
+
+	    for (int i = optind; i < argc; i++) {
+		inputs.push_back(argv[i]);
+	    }
+
+	    if (sizes.empty()) {
+		// Native resolution then the common capture resolutions
+		sizes.push_back(Size(0, 0));
+		sizes.push_back(Size(640, 480));
+		sizes.push_back(Size(1280, 720));
+	    }
+
+	    if (synthetic && (syntheticSpec.frames == 0)) {
+		syntheticSpec.frames = 8;
+	    }
+
+	    if (!ok || (inputs.empty() && !synthetic)) {
+		ok = false;
+		cerr << "\n"
+"Usage:\n"
+"\n"
+"  avc-vision-bench [-w WARMUP] [-n RUNS] [-s SIZES] [-c VALUES_FILE]\n"
+"                   [-o CSV_FILE] [-b BASELINE_CSV] [-g SYNTHETIC]\n"
+"                   [IMAGE_OR_DIR...]\n"
+"\n"
+"Where:\n"
+"\n"
+"  -w WARMUP\n"
+"    Number of untimed runs before timing each stage (default 5).\n"
+"\n"
+"  -n RUNS\n"
+"    Number of timed runs of each stage (default 25).\n"
+"\n"
+"  -s SIZES\n"
+"    Comma separated list of resolutions to scale images to (like\n"
+"    \"native,640x480,1280x720\", which is the default).\n"
+"\n"
+"  -c VALUES_FILE\n"
+"    Color ranges to use (default values.txt).\n"
+"\n"
+"  -o CSV_FILE\n"
+"    Where to write results (default is standard output).\n"
+"\n"
+"  -b BASELINE_CSV\n"
+"    Results of a previous run to compare median times against.\n"
+"\n"
+"  -g SYNTHETIC\n"
+"    Also benchmark generated frames (see synthetic.hpp), like\n"
+"    \"size=1920x1080,blobs=300,noise=25,frames=4\" (8 frames unless\n"
+"    frames is set). These are generated at their own size (-s is\n"
+"    not applied).\n"
+"\n";
+	    }
+	}
+
+	bool ok;
+	int warmup;
+	int runs;
+	string configFile;
+	string outputFile;
+	string baselineFile;
+	bool synthetic;
+	SyntheticSpec syntheticSpec;
+	vector<Size> sizes;
+	vector<string> inputs;
+
+    private:
+	bool parseSizes(const string& list) {
+	    istringstream in(list);
+	    string size;
+	    while (getline(in, size, ',')) {
+		int w = 0, h = 0;
+		if (size == "native") {
+		    sizes.push_back(Size(0, 0));
+		} else if ((sscanf(size.c_str(), "%dx%d", &w, &h) == 2) && (w > 50) && (h > 50)) {
+		    sizes.push_back(Size(w, h));
+		} else {
+		    cerr << "Invalid size: " << size << "\n";
+		    return false;
+		}
+	    }
+	    return true;
+	}
+    };
+
+    /**
+     * Times everything for one image at one resolution.
+     */
+    class ImageBench {
+    public:
+	ImageBench(const Options& opts, Filter& filter, ostream& csv,
+		   const string& name, const Mat& img) :
+	    _opts(opts), _filter(filter), _csv(csv), _name(name), _img(img) {
+	}
+
+	/** Returns what the contour detector found. */
+	FileData run(Agreement& agreement) {
+	    FilterFrame frame;
+
+	    time("filter", "all", 0, [&]() { _filter.filter(_img); });
+	    FileData contour = _filter.getFileData();
+
+	    _filter.setDetector(ProfileDetector);
+	    time("filter_profile", "all", 0, [&]() { _filter.filter(_img); });
+	    agreement.add(contour, _filter.getFileData());
+	    _filter.setDetector(ContourDetector);
+
+	    // Stream detector must find exactly what the contour detector does
+	    _filter.setDetector(StreamDetector);
+	    time("filter_stream", "all", 0, [&]() { _filter.filter(_img); });
+	    const FileData& stream = _filter.getFileData();
+	    if ((stream.found != contour.found) || (stream.xMid != contour.xMid)
+		|| (stream.yBot != contour.yBot) || (stream.boxWidth != contour.boxWidth)
+		|| (stream.boxHeight != contour.boxHeight)) {
+		cerr << _name << " " << _img.cols << "x" << _img.rows
+		     << ": stream detector result differs from contour detector\n";
+	    }
+	    _filter.setDetector(ContourDetector);
+
+	    // Fused blur against a separate blur pass (then plain, which the
+	    // stages below work from)
+	    _filter.setBlur(true);
+	    time("convert_blur", "all", 0, [&]() { _filter.convertColor(_img, frame); });
+	    _filter.setBlur(false);
+	    Mat blurred;
+	    time("convert_blur_separate", "all", 0, [&]() {
+		blur(frame.cropped, blurred, Size(3, 3));
+		cvtColor(blurred, frame.colorTransformed, COLOR_BGR2HSV);
+	    });
+	    time("convert", "all", 0, [&]() { _filter.convertColor(_img, frame); });
+
+	    // Both colors in one pass (compare with the range rows below)
+	    time("reduce_fused", "all", 0, [&]() { _filter.reduceColors(frame); });
+
+	    runColor(frame, Found::Yellow, "yellow");
+	    runColor(frame, Found::Red, "red");
+	    return contour;
+	}
+
+	/** Medians of each measurement (keyed by makeKey()). */
+	const map<string, double>& getMedians() const { return _medians; }
+
+    private:
+	void runColor(FilterFrame& frame, Found color, const string& colorName) {
+	    Mat& reduced = frame.colorReduced[color];
+	    const Mat& erosionElem = _filter.getErosionElement();
+	    const Mat& dilationElem = _filter.getDilationElement();
+	    int epsilon = _filter.getPolyEpsilon();
+
+	    time("range", colorName, 0, [&]() { _filter.reduceColor(frame, color); });
+	    time("threshold", colorName, 0, [&]() {
+		threshold(reduced, frame.bw, 32, 255, THRESH_BINARY);
+	    });
+	    time("erode", colorName, 0, [&]() { erode(frame.bw, frame.eroded, erosionElem); });
+	    time("dilate", colorName, 0, [&]() { dilate(frame.eroded, frame.dilated, dilationElem); });
+
+	    vector<vector<Point>>& contours = frame.contours;
+	    time("contours", colorName, 0, [&]() {
+		frame.dilated.copyTo(frame.contourScratch);
+		findContours(frame.contourScratch, contours, frame.hierarchy,
+			     CV_RETR_EXTERNAL, CV_CHAIN_APPROX_SIMPLE);
+	    });
+
+	    // Rejection cascade plus polygon fits of the survivors
+	    time("candidates", colorName, contours.size(), [&]() {
+		frame.candidates.clear();
+		_filter.findCandidates(frame, color);
+	    });
+
+	    vector<vector<Point>> polygons(contours.size());
+	    time("polygons", colorName, contours.size(), [&]() {
+		for (size_t i = 0; i < contours.size(); i++) {
+		    approxPolyDP(Mat(contours[i]), polygons[i], epsilon, true);
+		}
+	    });
+
+	    time("possible", colorName, polygons.size(), [&]() {
+		Rect br;
+		for (const vector<Point>& polygon : polygons) {
+		    Filter::isPossibleStanchion(frame.cropped, polygon, br);
+		}
+	    });
+
+	    // Profile detector replaces everything after the HSV conversion
+	    _filter.setDetector(ProfileDetector);
+	    time("range_profile", colorName, 0, [&]() { _filter.reduceColor(frame, color); });
+	    time("profile", colorName, 0, [&]() {
+		frame.candidates.clear();
+		_filter.findProfileCandidates(frame, color);
+	    });
+	    _filter.setDetector(ContourDetector);
+	}
+
+	template <typename Func>
+	void time(const string& stage, const string& color, int items, Func func) {
+	    Stats s = measure(_opts.warmup, _opts.runs, func);
+
+	    _csv << _name << "," << _img.cols << "," << _img.rows << ","
+		 << stage << "," << color << "," << _opts.runs << "," << items << ","
+		 << fixed << setprecision(2)
+		 << s.min << "," << s.median << "," << s.mean << ","
+		 << s.p90 << "," << s.max << "," << s.stddev << "\n";
+	    _csv.unsetf(ios::floatfield);
+
+	    _medians[makeKey(_name, _img.cols, _img.rows, stage, color)] = s.median;
+	}
+
+	const Options& _opts;
+	Filter& _filter;
+	ostream& _csv;
+	const string& _name;
+	const Mat& _img;
+	map<string, double> _medians;
+    };
+
+    /**
+     * Loads median times from a previous CSV file.
+     */
+    bool loadMedians(const string& fileName, map<string, double>& medians) {
+	ifstream in(fileName.c_str());
+	string line;
+	if (!getline(in, line)) {
+	    return false;
+	}
+
+	while (getline(in, line)) {
+	    vector<string> fields;
+	    istringstream row(line);
+	    string field;
+	    while (getline(row, field, ',')) {
+		fields.push_back(field);
+	    }
+	    if (fields.size() >= 9) {
+		string key = makeKey(fields[0], atoi(fields[1].c_str()), atoi(fields[2].c_str()),
+				     fields[3], fields[4]);
+		medians[key] = atof(fields[8].c_str());
+	    }
+	}
+	return true;
+    }
+
+    /**
+     * Prints ratio of current to baseline median times (geometric mean
+     * over all images and sizes) for each stage.
+     */
+    void compare(ostream& out, const map<string, double>& baseline,
+		 const map<string, double>& current) {
+	map<string, double> logSum;
+	map<string, int> count;
+
+	for (auto& entry : current) {
+	    auto base = baseline.find(entry.first);
+	    if ((base == baseline.end()) || (base->second <= 0) || (entry.second <= 0)) {
+		continue;
+	    }
+	    // Key ends with stage,color
+	    const string& key = entry.first;
+	    size_t colorPos = key.rfind(',');
+	    size_t stagePos = key.rfind(',', colorPos - 1);
+	    string stage = key.substr(stagePos + 1);
+	    logSum[stage] += log(entry.second / base->second);
+	    count[stage]++;
+	}
+
+	out << "\nCurrent / baseline median time (below 1.0 is faster):\n";
+	for (auto& entry : logSum) {
+	    out << "  " << setw(20) << left << entry.first << right
+		 << setprecision(3) << exp(entry.second / count[entry.first])
+		 << "  (" << count[entry.first] << " measurements)\n";
+	}
+    }
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+int main(int argc, char* argv[]) {
+    Options opts(argc, argv);
+    if (!opts.ok) {
+	return 1;
+    }
+
+    vector<string> files;
+    for (const string& input : opts.inputs) {
+	if (!findImages(input, files)) {
+	    cerr << "Unable to read: " << input << "\n";
+	}
+    }
+
+    Filter filter;
+    if (!filter.loadConfig(opts.configFile)) {
+	cerr << "Unable to read color ranges from " << opts.configFile << "\n";
+	return 1;
+    }
+
+    ofstream outFile;
+    if (!opts.outputFile.empty()) {
+	outFile.open(opts.outputFile.c_str());
+    }
+    ostream& csv = opts.outputFile.empty() ? cout : outFile;
+    // Keep summaries out of the CSV
+    ostream& report = opts.outputFile.empty() ? cerr : cout;
+
+    csv << "image,width,height,stage,color,runs,items,"
+	<< "min_us,median_us,mean_us,p90_us,max_us,stddev_us\n";
+
+    map<string, double> medians;
+    Agreement agreement;
+
+    for (const string& file : files) {
+	Mat orig = imread(file);
+	if (orig.empty()) {
+	    cerr << "Unable to load image: " << file << "\n";
+	    continue;
+	}
+
+	for (const Size& size : opts.sizes) {
+	    Mat img;
+	    if ((size.width == 0) || (size == orig.size())) {
+		img = orig;
+	    } else {
+		resize(orig, img, size, 0, 0, INTER_AREA);
+	    }
+
+	    cerr << "Benchmarking " << file << " at " << img.cols << "x" << img.rows << "\n";
+	    ImageBench bench(opts, filter, csv, file, img);
+	    bench.run(agreement);
+	    medians.insert(bench.getMedians().begin(), bench.getMedians().end());
+	}
+    }
+
+    Accuracy accuracy;
+    if (opts.synthetic) {
+	SyntheticFrames generator(filter, opts.syntheticSpec);
+	for (int i = 0; i < opts.syntheticSpec.frames; i++) {
+	    Mat img;
+	    FileData truth;
+	    generator.render(i, img, truth);
+
+	    ostringstream buf;
+	    buf << "synthetic-" << i;
+	    string name = buf.str();
+	    cerr << "Benchmarking " << name << " at " << img.cols << "x" << img.rows << "\n";
+	    ImageBench bench(opts, filter, csv, name, img);
+	    accuracy.add(truth, bench.run(agreement));
+	    medians.insert(bench.getMedians().begin(), bench.getMedians().end());
+	}
+    }
+
+    agreement.print(report);
+    accuracy.print(report);
+
+    if (!opts.baselineFile.empty()) {
+	map<string, double> baseline;
+	if (loadMedians(opts.baselineFile, baseline)) {
+	    compare(report, baseline, medians);
+	} else {
+	    cerr << "Unable to read baseline: " << opts.baselineFile << "\n";
+	}
+    }
+
+    return 0;
+}
@@ -0,0 +1,352 @@
+/**
+ * Fits the camera mounting in a range file to labelled images.
+ *
+ * Each image is named for how far the stanchion in it is (like
+ * "3.5ftred.png" in webcam-test/red) and run through the filter. Boxes
+ * look shorter in proportion to their distance from the camera, so a
+ * straight line fit of 1 / box height against the labelled distance
+ * gives the offset (how far behind where distances are measured the
+ * camera sits) and the stanchion height. The camera height and tilt are
+ * then searched for the pair that best predicts the row the bottom of
+ * each box lands on. Boxes cut off by the crop window are left out of
+ * both fits.
+ *
+ * The camera intrinsics are taken from the input range file as they
+ * are. Estimates for every image are printed with the model before and
+ * after fitting.
+ */
+
+#include "filter.hpp"
+#include "groundrange.hpp"
+#include "imagefiles.hpp"
+
+#include <iomanip>
+#include <iostream>
+
+#include <math.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+using namespace cv;
+using namespace vision;
+using namespace std;
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+namespace {
+
+    /**
+     * Command line options.
+     */
+    class Options {
+    public:
+	Options(int argc, char** argv) :
+	    ok(true),
+	    configFile("values.txt"),
+	    rangeFile("range.txt"),
+	    outputFile(""),
+	    inputs()
+	{
+	    int opt;
+	    while ((opt = getopt(argc, argv, "c:ho:r:")) != -1) {
+		switch (opt) {
+
+		case 'c':
+		    configFile = optarg;
+		    break;
+
+		case 'o':
+		    outputFile = optarg;
+		    break;
+
+		case 'r':
+		    rangeFile = optarg;
+		    break;
+
+		case 'h':
+		default:
+		    ok = false;
+		}
+	    }
+
+	    for (int i = optind; i < argc; i++) {
+		inputs.push_back(argv[i]);
+	    }
+
+	    if (!ok || inputs.empty()) {
+		ok = false;
+		cerr << "\n"
+"Usage:\n"
+"\n"
+"  avc-vision-calibrate [-c VALUES_FILE] [-r RANGE_FILE] [-o OUTPUT_FILE]\n"
+"                       IMAGE_OR_DIR...\n"
+"\n"
+"Where:\n"
+"\n"
+"  IMAGE_OR_DIR\n"
+"    Images named for the distance to the stanchion in feet (like\n"
+"    \"2ftred.png\" or \"3.5ftred.png\"), others are skipped.\n"
+"\n"
+"  -c VALUES_FILE\n"
+"    Color ranges to use (default values.txt).\n"
+"\n"
+"  -r RANGE_FILE\n"
+"    Camera model to start from (default range.txt), only the mount\n"
+"    and stanchion height are fitted.\n"
+"\n"
+"  -o OUTPUT_FILE\n"
+"    Where to write the fitted model (default is to only print it).\n"
+"\n";
+	    }
+	}
+
+	bool ok;
+	string configFile;
+	string rangeFile;
+	string outputFile;
+	vector<string> inputs;
+    };
+
+    /** What the filter found in a labelled image. */
+    struct Sample {
+	string file;
+	// Labelled distance (feet)
+	double feet;
+	// Winning box (frame coordinates) and frame size
+	Rect box;
+	Size frameSize;
+	// Whether the bottom of the box was cut off by the crop window
+	bool bottomCut;
+	// Undistorted bottom row and height of the box (model pixels)
+	double bottomRow;
+	double height;
+    };
+
+    /** Distance in an image's name (0 if it doesn't have one). */
+    double feetFromName(const string& file) {
+	size_t slash = file.rfind('/');
+	string name = (slash == string::npos) ? file : file.substr(slash + 1);
+	char* end = 0;
+	double feet = strtod(name.c_str(), &end);
+	return ((end != name.c_str()) && (string(end).compare(0, 2, "ft") == 0)) ? feet : 0;
+    }
+
+    /** Row the ground this far away lands on with a mount. */
+    double predictRow(const RangeModel& model, double cameraHeight, double tilt, double feet) {
+	double below = atan2(cameraHeight, feet + model.offset) - tilt * M_PI / 180;
+	return model.cy + model.fy * tan(below);
+    }
+
+    /**
+     * Fits the offset and stanchion height to the box heights.
+     *
+     * @return false if there weren't enough different distances.
+     */
+    bool fitHeights(const vector<Sample>& samples, RangeModel& model) {
+	// 1 / height = (feet + offset) / (fy * stanchionHeight)
+	double n = 0;
+	double sumX = 0, sumY = 0, sumXX = 0, sumXY = 0;
+	for (const Sample& sample : samples) {
+	    if (sample.bottomCut) {
+		// Box is shorter than the stanchion
+		continue;
+	    }
+	    double y = 1 / sample.height;
+	    n++;
+	    sumX += sample.feet;
+	    sumY += y;
+	    sumXX += sample.feet * sample.feet;
+	    sumXY += sample.feet * y;
+	}
+	double spread = n * sumXX - sumX * sumX;
+	if ((n < 2) || (spread <= 0)) {
+	    return false;
+	}
+	double slope = (n * sumXY - sumX * sumY) / spread;
+	double intercept = (sumY - slope * sumX) / n;
+	if (slope <= 0) {
+	    return false;
+	}
+	model.offset = intercept / slope;
+	model.stanchionHeight = 1 / (slope * model.fy);
+	return true;
+    }
+
+    /** Sum of squared row errors of a mount. */
+    double rowError(const vector<Sample>& samples, const RangeModel& model,
+		    double cameraHeight, double tilt) {
+	double sum = 0;
+	for (const Sample& sample : samples) {
+	    if (!sample.bottomCut) {
+		double error = predictRow(model, cameraHeight, tilt, sample.feet) - sample.bottomRow;
+		sum += error * error;
+	    }
+	}
+	return sum;
+    }
+
+    /**
+     * Searches for the camera height and tilt that best predict the
+     * rows the bottoms of the boxes land on (coarse grid, then a finer
+     * one around the best point).
+     *
+     * @return false if there weren't enough boxes on the ground.
+     */
+    bool fitMount(const vector<Sample>& samples, RangeModel& model) {
+	int onGround = 0;
+	for (const Sample& sample : samples) {
+	    onGround += !sample.bottomCut;
+	}
+	if (onGround < 2) {
+	    return false;
+	}
+
+	double bestHeight = 0.5, bestTilt = 0;
+	double best = rowError(samples, model, bestHeight, bestTilt);
+	double heightStep = 0.01, tiltStep = 0.5;
+	double heightLow = heightStep, heightHigh = 3;
+	double tiltLow = -30, tiltHigh = 60;
+	for (int pass = 0; pass < 3; pass++) {
+	    for (double h = heightLow; h <= heightHigh; h += heightStep) {
+		for (double t = tiltLow; t <= tiltHigh; t += tiltStep) {
+		    double error = rowError(samples, model, h, t);
+		    if (error < best) {
+			best = error;
+			bestHeight = h;
+			bestTilt = t;
+		    }
+		}
+	    }
+	    heightLow = max(bestHeight - heightStep, heightStep / 10);
+	    heightHigh = bestHeight + heightStep;
+	    tiltLow = bestTilt - tiltStep;
+	    tiltHigh = bestTilt + tiltStep;
+	    heightStep /= 10;
+	    tiltStep /= 10;
+	}
+
+	model.cameraHeight = bestHeight;
+	model.tilt = bestTilt;
+	cout << "Row error: " << sqrt(best / onGround) << " pixels RMS\n";
+	return true;
+    }
+
+    /** Dump estimates of every sample with a model. */
+    void printEstimates(const char* title, const vector<Sample>& samples, const RangeModel& model) {
+	GroundRange range;
+	range.setModel(model);
+
+	cout << "\n" << title << ":\n\n";
+	double sum = 0;
+	for (const Sample& sample : samples) {
+	    float feet = -1, bearing = 0;
+	    range.estimate(sample.box, sample.frameSize, sample.bottomCut, feet, bearing);
+	    sum += (feet - sample.feet) * (feet - sample.feet);
+	    cout << "  " << setw(5) << sample.feet << " ft  estimated "
+		 << setw(6) << feet << " ft " << setw(6) << bearing << " deg"
+		 << (sample.bottomCut ? " (from height) " : "  ") << sample.file << "\n";
+	}
+	cout << "\nRange error: " << sqrt(sum / samples.size()) << " ft RMS\n";
+    }
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+int main(int argc, char* argv[]) {
+    Options opts(argc, argv);
+    if (!opts.ok) {
+	return 1;
+    }
+
+    Filter filter;
+    if (!filter.loadConfig(opts.configFile)) {
+	cerr << "Unable to read color ranges from " << opts.configFile << "\n";
+	return 1;
+    }
+
+    RangeModel model;
+    if (!model.load(opts.rangeFile)) {
+	cerr << "Unable to read camera model from " << opts.rangeFile << "\n";
+	return 1;
+    }
+    GroundRange range;
+    range.setModel(model);
+
+    vector<Sample> samples;
+    int missed = 0;
+    for (const string& input : opts.inputs) {
+	vector<string> files;
+	if (!findImages(input, files)) {
+	    cerr << "Unable to read: " << input << "\n";
+	    return 1;
+	}
+
+	for (const string& file : files) {
+	    double feet = feetFromName(file);
+	    if (feet <= 0) {
+		continue;
+	    }
+	    Mat image = imread(file);
+	    if (image.empty()) {
+		cerr << "Unable to load image: " << file << "\n";
+		return 1;
+	    }
+
+	    if (filter.filter(image) == Found::None) {
+		cout << "Nothing found in " << file << ", skipped\n";
+		missed++;
+		continue;
+	    }
+
+	    Rect crop = Filter::getCropWindow(image.size());
+	    Sample sample;
+	    sample.file = file;
+	    sample.feet = feet;
+	    sample.box = filter.getCandidates()[filter.getWinner()].bbox + crop.tl();
+	    sample.frameSize = image.size();
+	    sample.bottomCut = (filter.getFileData().yBot >= crop.height - RANGE_EDGE_ROWS);
+
+	    double xMid = sample.box.x + sample.box.width / 2.0;
+	    Point2d bottom = range.undistort(Point2d(xMid, sample.box.y + sample.box.height),
+					     sample.frameSize);
+	    Point2d top = range.undistort(Point2d(xMid, sample.box.y), sample.frameSize);
+	    sample.bottomRow = bottom.y;
+	    sample.height = max(bottom.y - top.y, 1.0);
+	    samples.push_back(sample);
+	}
+    }
+
+    if (samples.empty()) {
+	cerr << "No labelled images with a stanchion found\n";
+	return 1;
+    }
+    printEstimates("Current model", samples, model);
+    cout << "\n";
+
+    RangeModel fitted = model;
+    if (!fitHeights(samples, fitted)) {
+	cerr << "Need boxes (not cut off by the crop window) at two or more distances\n";
+	return 1;
+    }
+    if (!fitMount(samples, fitted)) {
+	cerr << "Need two or more boxes not cut off by the crop window to fit the mount\n";
+	return 1;
+    }
+    printEstimates("Fitted model", samples, fitted);
+
+    cout << "\nCamera height: " << fitted.cameraHeight << " ft  tilt: " << fitted.tilt
+	 << " deg  offset: " << fitted.offset << " ft  stanchion height: "
+	 << fitted.stanchionHeight << " ft (" << samples.size() << " images used, "
+	 << missed << " without a stanchion)\n";
+
+    if (!opts.outputFile.empty()) {
+	if (!fitted.save(opts.outputFile)) {
+	    cerr << "Unable to write " << opts.outputFile << "\n";
+	    return 1;
+	}
+	cout << "Wrote " << opts.outputFile << "\n";
+    }
+    return 0;
+}
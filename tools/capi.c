@@ -0,0 +1,118 @@
+/*
+ * Runs the detector on JPEG images through the C interface only
+ * (avcvision.h), linked against libavcvision.a like an embedding
+ * program would be. make check runs it on test.jpg so the library and
+ * its header are built, linked and exercised from C.
+ *
+ * Usage: avc-vision-capi VALUES_FILE IMAGE.jpg...
+ */
+
+#include "avcvision.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <jpeglib.h>
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+
+/**
+ * Decode a JPEG file to BGR pixels (NULL if it couldn't be read, the
+ * caller frees the pixels).
+ */
+static uint8_t* readJpeg(const char* fileName, int* width, int* height) {
+    struct jpeg_decompress_struct cinfo;
+    struct jpeg_error_mgr errors;
+    FILE* in = fopen(fileName, "rb");
+    uint8_t* pixels;
+    size_t stride;
+
+    if (in == NULL) {
+	return NULL;
+    }
+
+    /* libjpeg exits on errors, fine for a check */
+    cinfo.err = jpeg_std_error(&errors);
+    jpeg_create_decompress(&cinfo);
+    jpeg_stdio_src(&cinfo, in);
+    jpeg_read_header(&cinfo, TRUE);
+    cinfo.out_color_space = JCS_EXT_BGR;
+    jpeg_start_decompress(&cinfo);
+
+    *width = cinfo.output_width;
+    *height = cinfo.output_height;
+    stride = (size_t) *width * 3;
+    pixels = malloc(stride * *height);
+    while ((pixels != NULL) && (cinfo.output_scanline < cinfo.output_height)) {
+	JSAMPROW row = pixels + cinfo.output_scanline * stride;
+	jpeg_read_scanlines(&cinfo, &row, 1);
+    }
+
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    fclose(in);
+    return pixels;
+}
+
+/* -------------------------------------------------------------------- */
+/* -------------------------------------------------------------------- */
+
+int main(int argc, char* argv[]) {
+    avc_config config;
+    avc_detector* detector;
+    int failed = 0;
+    int i;
+
+    if (argc < 3) {
+	fprintf(stderr, "Usage: avc-vision-capi VALUES_FILE IMAGE.jpg...\n");
+	return 1;
+    }
+
+    if (avc_version() != AVC_VISION_API_VERSION) {
+	printf("FAIL capi: library is version %d, header is %d\n",
+	       avc_version(), AVC_VISION_API_VERSION);
+	return 1;
+    }
+
+    avc_config_init(&config);
+    config.values_file = argv[1];
+    detector = avc_detector_create(&config);
+    if (detector == NULL) {
+	printf("FAIL capi: unable to create a detector\n");
+	return 1;
+    }
+
+    for (i = 2; i < argc; i++) {
+	avc_result result = AVC_RESULT_INIT;
+	int width, height;
+	int found;
+	uint8_t* pixels = readJpeg(argv[i], &width, &height);
+
+	if (pixels == NULL) {
+	    printf("FAIL capi: unable to read %s\n", argv[i]);
+	    failed++;
+	    continue;
+	}
+
+	found = avc_detector_process(detector, pixels, width, height, (size_t) width * 3,
+				     AVC_PIXELS_BGR24, &result);
+	free(pixels);
+	if ((found < 0) || (result.frame_count != i - 1) || (result.found != found)) {
+	    printf("FAIL capi: %s: %s\n", argv[i], (found < 0) ? avc_detector_error(detector)
+		   : "result doesn't match the return value");
+	    failed++;
+	    continue;
+	}
+
+	printf("%s: found %d, %dx%d box at x %d bottom %d, %d candidates, %.2f ft at %.1f deg\n",
+	       argv[i], result.found, result.box_width, result.box_height, result.x_mid,
+	       result.y_bot, result.candidates_seen, result.range_feet, result.bearing_degrees);
+    }
+
+    avc_detector_destroy(detector);
+    if (failed == 0) {
+	printf("PASS capi (libavcvision version %d, %d images)\n", avc_version(), argc - 2);
+    }
+    return (failed == 0) ? 0 : 1;
+}
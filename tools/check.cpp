@@ -0,0 +1,642 @@
+/**
+ * Golden output equivalence check for the vision filter.
+ *
+ * Runs a frozen reference copy of the original OpenCV filter pipeline
+ * and the current Filter implementation (in each of its registered
+ * variants) side by side over a set of images plus synthetic frames.
+ * The HSV image and every mask (color reduced, black and white, eroded
+ * and dilated) are compared bit for bit for each color, followed by the
+ * candidate boxes and the final FileData results.
+ *
+ * The first divergence found for each variant is reported along with
+ * reference, candidate and difference images for the stage that went
+ * wrong. The exit status is non-zero if anything differs.
+ */
+
+#include "filter.hpp"
+#include "imagefiles.hpp"
+#include "jpegdecoder.hpp"
+#include "synthetic.hpp"
+
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace cv;
+using namespace vision;
+using namespace std;
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+namespace {
+
+    const Found COLORS[] = { Found::Yellow, Found::Red };
+
+    const char* colorName(Found color) {
+	return (color == Found::Red) ? "red" : ((color == Found::Yellow) ? "yellow" : "none");
+    }
+
+    /**
+     * Everything the pipeline produces for one image (masks for both
+     * colors are always built so all stages get compared).
+     */
+    struct Outputs {
+	Mat hsv;
+	Mat reduced[3];
+	Mat bw[3];
+	Mat eroded[3];
+	Mat dilated[3];
+	vector<Rect> boxes[3];
+	FileData fileData;
+
+	Outputs() {
+	    memset(&fileData, 0, sizeof(fileData));
+	}
+    };
+
+    /**
+     * Frozen copy of the filter as originally written with stock OpenCV
+     * calls. Do NOT optimize anything in here, it is what every faster
+     * implementation gets compared against. Only the configuration
+     * (color ranges, structuring elements, polygon epsilon and whether
+     * to blur) comes from the Filter.
+     */
+    namespace reference {
+
+	bool isPossibleStanchion(const Mat& img, const vector<Point>& polygon, Rect& br) {
+	    br = boundingRect(polygon);
+	    int w = br.width;
+	    int h = br.height;
+	    int hw = ((h * 100) / w);
+	    int pts = polygon.size();
+	    int imgMid = img.rows / 2;
+	    int distFromTop = br.y;
+	    int distFromMid = (img.rows / 2) - (br.y + h);
+	    int distFromCenter = abs((img.cols / 2) - (br.x + w));
+
+	    return (w > 15) && (h > 40) && (hw > 50) && (hw < 800)
+		&& (pts >= 4) && (pts < 20)
+		&& (distFromTop > distFromMid) && (distFromTop < imgMid)
+		&& (distFromCenter < 50);
+	}
+
+	void run(const Filter& config, const Mat& src, Outputs& out) {
+	    Mat cropped = src(Rect(50, 10, src.cols - 50, src.rows - 50));
+	    if (config.isBlur()) {
+		Mat blurred;
+		blur(cropped, blurred, Size(3, 3));
+		cvtColor(blurred, out.hsv, COLOR_BGR2HSV);
+	    } else {
+		cvtColor(cropped, out.hsv, COLOR_BGR2HSV);
+	    }
+
+	    int best[3] = { -1, -1, -1 };
+	    int bestH[3] = { 0, 0, 0 };
+
+	    for (Found color : COLORS) {
+		const int* ranges = config.getColorRanges(color);
+		Mat& reduced = out.reduced[color];
+		inRange(out.hsv, Scalar(ranges[0], ranges[2], ranges[4]),
+			Scalar(ranges[1], ranges[3], ranges[5]), reduced);
+		if (color == Found::Red) {
+		    Mat lower;
+		    inRange(out.hsv, Scalar(0, ranges[2], ranges[4]),
+			    Scalar(10, ranges[3], ranges[5]), lower);
+		    bitwise_or(lower, reduced, reduced);
+		}
+
+		threshold(reduced, out.bw[color], 32, 255, THRESH_BINARY);
+		erode(out.bw[color], out.eroded[color], config.getErosionElement());
+		dilate(out.eroded[color], out.dilated[color], config.getDilationElement());
+
+		Mat scratch = out.dilated[color].clone();
+		vector<vector<Point>> contours;
+		vector<Vec4i> hierarchy;
+		findContours(scratch, contours, hierarchy, CV_RETR_EXTERNAL, CV_CHAIN_APPROX_SIMPLE);
+
+		for (const vector<Point>& contour : contours) {
+		    vector<Point> polygon;
+		    Rect br;
+		    approxPolyDP(Mat(contour), polygon, config.getPolyEpsilon(), true);
+		    if (isPossibleStanchion(cropped, polygon, br)) {
+			out.boxes[color].push_back(br);
+			if (br.height > bestH[color]) {
+			    bestH[color] = br.height;
+			    best[color] = out.boxes[color].size() - 1;
+			}
+		    }
+		}
+	    }
+
+	    // Yellow wins over red (colors not enabled find nothing)
+	    bool yellow = config.isYellowEnabled() && (best[Found::Yellow] >= 0);
+	    bool red = config.isRedEnabled() && (best[Found::Red] >= 0);
+	    Found found = yellow ? Found::Yellow : (red ? Found::Red : Found::None);
+	    FileData& fd = out.fileData;
+	    fd.found = found;
+	    if (found != Found::None) {
+		const Rect& br = out.boxes[found][best[found]];
+		fd.boxWidth = br.width;
+		fd.boxHeight = br.height;
+		fd.xMid = br.x + (br.width / 2);
+		fd.yBot = br.y + br.height;
+	    }
+	}
+    }
+
+    /**
+     * Runs the current Filter implementation one stage at a time so the
+     * same intermediate results can be compared. Stages a variant
+     * doesn't materialize are left empty (and skipped in the compare).
+     */
+    void runCandidate(Filter& filter, const Mat& src, Outputs& out) {
+	FilterFrame frame;
+	filter.convertColor(src, frame);
+	out.hsv = frame.colorTransformed;
+
+	if (filter.getDetector() == StreamDetector) {
+	    // Row engine goes straight from the cropped frame to the
+	    // dilated masks (only those and the boxes can be compared, so
+	    // stream variants keep both colors enabled)
+	    filter.reduceColors(frame);
+	    for (Found color : COLORS) {
+		size_t first = frame.candidates.size();
+		filter.findStreamCandidates(frame, color);
+		out.dilated[color] = frame.dilated.clone();
+		for (size_t i = first; i < frame.candidates.size(); i++) {
+		    out.boxes[color].push_back(frame.candidates[i].bbox);
+		}
+	    }
+	    filter.filter(src);
+	    out.fileData = filter.getFileData();
+	    return;
+	}
+
+	// Enabled colors are reduced the way filter() does it (by the
+	// kernel compiled for the enabled colors when there is one), the
+	// rest by the generic reduceColor() so every stage still gets
+	// compared
+	filter.reduceColors(frame);
+
+	for (Found color : COLORS) {
+	    bool enabled = (color == Found::Red) ? filter.isRedEnabled() : filter.isYellowEnabled();
+	    if (!enabled) {
+		filter.reduceColor(frame, color);
+	    }
+	    out.reduced[color] = frame.colorReduced[color];
+
+	    filter.buildMask(frame, color);
+	    out.bw[color] = frame.bw.clone();
+	    out.eroded[color] = frame.eroded.clone();
+	    out.dilated[color] = frame.dilated.clone();
+
+	    size_t first = frame.candidates.size();
+	    filter.findCandidates(frame, color);
+	    for (size_t i = first; i < frame.candidates.size(); i++) {
+		out.boxes[color].push_back(frame.candidates[i].bbox);
+	    }
+	}
+
+	// Final answer comes from the normal entry point
+	filter.filter(src);
+	out.fileData = filter.getFileData();
+    }
+
+    /**
+     * A configuration of the Filter to compare against the reference.
+     * Add an entry here for each optimized code path.
+     */
+    struct Variant {
+	const char* name;
+	const char* description;
+	void (*configure)(Filter& filter);
+	// Whether the candidate gets frames decoded like MJPEG input
+	// (only the crop window, see CropDecoder), false if left out
+	bool decodeCrop;
+    };
+
+    const Variant VARIANTS[] = {
+	{ "default", "Filter as configured out of the box (yellow and red reduce kernel)",
+	  [](Filter&) { } },
+	{ "yellow", "Yellow only reduce kernel",
+	  [](Filter& filter) { filter.setRedEnabled(false); } },
+	{ "red", "Red only reduce kernel",
+	  [](Filter& filter) { filter.setYellowEnabled(false); } },
+	{ "none", "No colors enabled (generic reduceColor())",
+	  [](Filter& filter) {
+	      filter.setYellowEnabled(false);
+	      filter.setRedEnabled(false);
+	  } },
+	{ "blur", "3x3 box blur fused with the HSV conversion",
+	  [](Filter& filter) { filter.setBlur(true); } },
+	{ "stream", "Row engine masks (StreamDetector)",
+	  [](Filter& filter) { filter.setDetector(StreamDetector); } },
+	{ "stream-blur", "Row engine masks from blurred rows",
+	  [](Filter& filter) {
+	      filter.setDetector(StreamDetector);
+	      filter.setBlur(true);
+	  } },
+	{ "blur-decoded", "3x3 box blur of frames only decoded in the crop window",
+	  [](Filter& filter) { filter.setBlur(true); }, true },
+    };
+
+    /**
+     * Round trips frames through JPEG the way MJPEG input decodes them:
+     * the whole frame for the reference, and only the crop window (plus
+     * the margin the decoder keeps around it) for the candidate, decoded
+     * over a buffer still holding other pixels like a reused one would.
+     */
+    class CropDecoder {
+    public:
+	CropDecoder() : _whole(0), _cropped(0) {
+	    _cropped.setCrop(&Filter::getCropWindow);
+	}
+
+	/**
+	 * @return false if the frame couldn't be encoded or decoded.
+	 */
+	bool decode(const Mat& frame, Mat& whole, Mat& cropped) {
+	    vector<uchar> jpeg;
+	    if (!imencode(".jpg", frame, jpeg)) {
+		return false;
+	    }
+	    // Anything read outside what was decoded shows up as magenta
+	    cropped.create(frame.size(), CV_8UC3);
+	    cropped = Scalar(255, 0, 255);
+	    return _whole.decode(&jpeg[0], jpeg.size(), whole)
+		&& _cropped.decode(&jpeg[0], jpeg.size(), cropped);
+	}
+
+    private:
+	JpegDecoder _whole;
+	JpegDecoder _cropped;
+    };
+
+    // Synthetic frames checked: stanchions of both colors with
+    // distractors, noise and uneven lighting (see SyntheticSpec)
+    const char* const SYNTHETIC_SPEC = "jitter=20,blobs=6,noise=30,light=20";
+
+    /**
+     * Command line options.
+     */
+    class Options {
+    public:
+	Options(int argc, char** argv) :
+	    ok(true),
+	    all(false),
+	    verbose(false),
+	    synthetic(16),
+	    configFile("values.txt"),
+	    outputDir("check-output"),
+	    inputs()
+	{
+	    int opt;
+	    while ((opt = getopt(argc, argv, "ac:hn:o:v")) != -1) {
+		switch (opt) {
+
+		case 'a':
+		    all = true;
+		    break;
+
+		case 'c':
+		    configFile = optarg;
+		    break;
+
+		case 'n':
+		    synthetic = atoi(optarg);
+		    ok = ok && (synthetic >= 0);
+		    break;
+
+		case 'o':
+		    outputDir = optarg;
+		    break;
+
+		case 'v':
+		    verbose = true;
+		    break;
+
+		case 'h':
+		default:
+		    ok = false;
+		}
+	    }
+
+	    for (int i = optind; i < argc; i++) {
+		inputs.push_back(argv[i]);
+	    }
+
+	    if (!ok) {
+		cerr << "\n"
+"Usage:\n"
+"\n"
+"  avc-vision-check [-a] [-v] [-n SYNTHETIC] [-c VALUES_FILE] [-o OUTPUT_DIR]\n"
+"                   [IMAGE_OR_DIR...]\n"
+"\n"
+"Where:\n"
+"\n"
+"  -a\n"
+"    Report every divergence (not just the first one for each variant).\n"
+"\n"
+"  -v\n"
+"    List each image as it is checked.\n"
+"\n"
+"  -n SYNTHETIC\n"
+"    Number of synthetic frames to check in addition to images (default 16).\n"
+"\n"
+"  -c VALUES_FILE\n"
+"    Color ranges to use (default values.txt).\n"
+"\n"
+"  -o OUTPUT_DIR\n"
+"    Where to write images of diverging stages (default check-output).\n"
+"\n";
+	    }
+	}
+
+	bool ok;
+	bool all;
+	bool verbose;
+	int synthetic;
+	string configFile;
+	string outputDir;
+	vector<string> inputs;
+    };
+
+    /**
+     * Compares outputs of one image and writes images of divergences.
+     */
+    class Checker {
+    public:
+	Checker(const Options& opts) : _opts(opts), _failures(0) {
+	}
+
+	int getFailures() const { return _failures; }
+
+	/**
+	 * @return true if candidate matched reference exactly.
+	 */
+	bool check(const string& variant, const string& image,
+		   const Outputs& ref, const Outputs& cand) {
+	    _variant = variant;
+	    _image = image;
+	    bool same = compareMat("hsv", "all", ref.hsv, cand.hsv);
+
+	    for (Found color : COLORS) {
+		const char* name = colorName(color);
+		same = (same || _opts.all) && compareMat("reduced", name, ref.reduced[color], cand.reduced[color]);
+		same = (same || _opts.all) && compareMat("bw", name, ref.bw[color], cand.bw[color]);
+		same = (same || _opts.all) && compareMat("eroded", name, ref.eroded[color], cand.eroded[color]);
+		same = (same || _opts.all) && compareMat("dilated", name, ref.dilated[color], cand.dilated[color]);
+		same = (same || _opts.all) && compareBoxes(name, ref.boxes[color], cand.boxes[color]);
+	    }
+
+	    return (same || _opts.all) && compareResults(ref.fileData, cand.fileData);
+	}
+
+    private:
+	string prefix() const {
+	    return "[" + _variant + "] " + _image + ": ";
+	}
+
+	bool compareMat(const char* stage, const char* color, const Mat& ref, const Mat& cand) {
+	    if (cand.empty()) {
+		// Stage not materialized by this variant
+		return true;
+	    }
+
+	    if ((ref.size() != cand.size()) || (ref.type() != cand.type())) {
+		_failures++;
+		cout << prefix() << stage << " (" << color << ") is "
+		     << cand.cols << "x" << cand.rows << " type " << cand.type()
+		     << ", expected " << ref.cols << "x" << ref.rows << " type " << ref.type() << "\n";
+		return false;
+	    }
+
+	    // Per pixel mismatch mask (any channel differs)
+	    Mat diff, mismatch;
+	    absdiff(ref, cand, diff);
+	    if (diff.channels() > 1) {
+		Mat planes[4];
+		split(diff, planes);
+		mismatch = planes[0];
+		for (int i = 1; i < diff.channels(); i++) {
+		    bitwise_or(mismatch, planes[i], mismatch);
+		}
+	    } else {
+		mismatch = diff;
+	    }
+
+	    int count = countNonZero(mismatch);
+	    if (count == 0) {
+		return true;
+	    }
+	    _failures++;
+
+	    Point first(-1, -1);
+	    for (int y = 0; (y < mismatch.rows) && (first.x < 0); y++) {
+		const uchar* row = mismatch.ptr(y);
+		for (int x = 0; x < mismatch.cols; x++) {
+		    if (row[x] != 0) {
+			first = Point(x, y);
+			break;
+		    }
+		}
+	    }
+
+	    int ch = ref.channels();
+	    cout << prefix() << stage << " (" << color << ") differs in " << count
+		 << " pixels, first at (" << first.x << "," << first.y << ") expected";
+	    for (int c = 0; c < ch; c++) {
+		cout << " " << (int) ref.ptr(first.y)[first.x * ch + c];
+	    }
+	    cout << " got";
+	    for (int c = 0; c < ch; c++) {
+		cout << " " << (int) cand.ptr(first.y)[first.x * ch + c];
+	    }
+	    cout << "\n";
+
+	    writeDiff(stage, color, ref, cand, mismatch);
+	    return false;
+	}
+
+	bool compareBoxes(const char* color, const vector<Rect>& ref, const vector<Rect>& cand) {
+	    bool same = (ref.size() == cand.size());
+	    for (size_t i = 0; same && (i < ref.size()); i++) {
+		same = (ref[i] == cand[i]);
+	    }
+	    if (!same) {
+		_failures++;
+		cout << prefix() << "candidates (" << color << ") expected";
+		printBoxes(ref);
+		cout << " got";
+		printBoxes(cand);
+		cout << "\n";
+	    }
+	    return same;
+	}
+
+	bool compareResults(const FileData& ref, const FileData& cand) {
+	    bool same = (ref.found == cand.found)
+		&& (ref.boxWidth == cand.boxWidth) && (ref.boxHeight == cand.boxHeight)
+		&& (ref.xMid == cand.xMid) && (ref.yBot == cand.yBot);
+	    if (!same) {
+		_failures++;
+		cout << prefix() << "results differ\n  expected: ";
+		Filter::print(cout, ref);
+		cout << "\n  got:      ";
+		Filter::print(cout, cand);
+		cout << "\n";
+	    }
+	    return same;
+	}
+
+	void printBoxes(const vector<Rect>& boxes) {
+	    cout << " [";
+	    for (const Rect& r : boxes) {
+		cout << " " << r.width << "x" << r.height << "+" << r.x << "+" << r.y;
+	    }
+	    cout << " ]";
+	}
+
+	void writeDiff(const char* stage, const char* color,
+		       const Mat& ref, const Mat& cand, const Mat& mismatch) {
+	    mkdir(_opts.outputDir.c_str(), 0755);
+
+	    // Flatten image path into a file name
+	    string name = _image;
+	    for (char& c : name) {
+		if ((c == '/') || (c == '.')) {
+		    c = '_';
+		}
+	    }
+
+	    ostringstream base;
+	    base << _opts.outputDir << "/" << _variant << "-" << name << "-" << stage << "-" << color;
+
+	    // Difference image: reference in gray with mismatches in red
+	    Mat gray, overlay;
+	    if (ref.channels() == 1) {
+		gray = ref;
+	    } else {
+		Mat planes[4];
+		split(ref, planes);
+		gray = planes[ref.channels() - 1];
+	    }
+	    cvtColor(gray, overlay, COLOR_GRAY2BGR);
+	    overlay.setTo(Scalar(0, 0, 255), mismatch);
+
+	    imwrite(base.str() + "-ref.png", ref);
+	    imwrite(base.str() + "-cand.png", cand);
+	    imwrite(base.str() + "-diff.png", overlay);
+	    cout << "  wrote " << base.str() << "-{ref,cand,diff}.png\n";
+	}
+
+	const Options& _opts;
+	int _failures;
+	string _variant;
+	string _image;
+    };
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+int main(int argc, char* argv[]) {
+    Options opts(argc, argv);
+    if (!opts.ok) {
+	return 1;
+    }
+
+    vector<string> files;
+    for (const string& input : opts.inputs) {
+	if (!findImages(input, files)) {
+	    cerr << "Unable to read: " << input << "\n";
+	}
+    }
+
+    Filter config;
+    if (!config.loadConfig(opts.configFile)) {
+	cerr << "Unable to read color ranges from " << opts.configFile << "\n";
+	return 1;
+    }
+
+    // Load (or generate) each frame once up front
+    vector<pair<string, Mat>> frames;
+    for (const string& file : files) {
+	Mat img = imread(file);
+	if (img.empty()) {
+	    cerr << "Unable to load image: " << file << "\n";
+	    continue;
+	}
+	frames.push_back(make_pair(file, img));
+    }
+    // Every fourth synthetic frame is at 640x480
+    SyntheticSpec small, large;
+    small.parse(SYNTHETIC_SPEC);
+    large.parse(SYNTHETIC_SPEC);
+    large.size = Size(640, 480);
+    SyntheticFrames smallFrames(config, small);
+    SyntheticFrames largeFrames(config, large);
+    for (int i = 0; i < opts.synthetic; i++) {
+	ostringstream name;
+	name << "synthetic-" << i;
+	Mat img;
+	FileData truth;
+	((i % 4 == 3) ? largeFrames : smallFrames).render(i, img, truth);
+	frames.push_back(make_pair(name.str(), img));
+    }
+
+    Checker checker(opts);
+    int variantsFailed = 0;
+
+    CropDecoder decoder;
+
+    for (const Variant& variant : VARIANTS) {
+	Filter filter;
+	filter.loadConfig(opts.configFile);
+	variant.configure(filter);
+
+	bool ok = true;
+	for (size_t i = 0; i < frames.size(); i++) {
+	    if (opts.verbose) {
+		cout << "[" << variant.name << "] " << frames[i].first << "\n";
+	    }
+	    Mat refInput = frames[i].second;
+	    Mat candInput = refInput;
+	    if (variant.decodeCrop) {
+		Mat whole, cropped;
+		if (!decoder.decode(frames[i].second, whole, cropped)) {
+		    cout << "[" << variant.name << "] " << frames[i].first
+			 << ": unable to round trip through JPEG\n";
+		    ok = false;
+		    break;
+		}
+		refInput = whole;
+		candInput = cropped;
+	    }
+
+	    // Reference gets the variant's settings (blurring changes
+	    // everything after the HSV image)
+	    Outputs ref;
+	    reference::run(filter, refInput, ref);
+	    Outputs cand;
+	    runCandidate(filter, candInput, cand);
+	    if (!checker.check(variant.name, frames[i].first, ref, cand)) {
+		ok = false;
+		if (!opts.all) {
+		    break;
+		}
+	    }
+	}
+
+	cout << (ok ? "PASS " : "FAIL ") << variant.name << " (" << variant.description << ") "
+	     << frames.size() << " frames\n";
+	variantsFailed += ok ? 0 : 1;
+    }
+
+    return (variantsFailed == 0) ? 0 : 1;
+}
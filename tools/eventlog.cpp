@@ -0,0 +1,277 @@
+/**
+ * Prints binary event logs (avc-vision -L LOG_FILE) as text or CSV.
+ *
+ * Records are written in the order each thread's queue was drained, so
+ * they are sorted by time within each file before printing. Pass
+ * rotated files oldest first (LOG.2 LOG.1 LOG) to print them in order.
+ */
+
+#include "eventlog.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+using namespace vision;
+using namespace std;
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+namespace {
+
+    /**
+     * Command line options.
+     */
+    class Options {
+    public:
+	Options(int argc, char** argv) :
+	    ok(true),
+	    csv(false),
+	    inputs()
+	{
+	    int opt;
+	    while ((opt = getopt(argc, argv, "ch")) != -1) {
+		switch (opt) {
+
+		case 'c':
+		    csv = true;
+		    break;
+
+		case 'h':
+		default:
+		    ok = false;
+		}
+	    }
+
+	    for (int i = optind; i < argc; i++) {
+		inputs.push_back(argv[i]);
+	    }
+
+	    if (!ok || inputs.empty()) {
+		ok = false;
+		cerr << "\n"
+"Usage:\n"
+"\n"
+"  avc-vision-eventlog [-c] LOG_FILE...\n"
+"\n"
+"Where:\n"
+"\n"
+"  LOG_FILE\n"
+"    Event log written by avc-vision -L (rotated files oldest first).\n"
+"\n"
+"  -c\n"
+"    Print CSV (one row per record, unused columns empty) instead of\n"
+"    text.\n"
+"\n";
+	    }
+	}
+
+	bool ok;
+	bool csv;
+	vector<string> inputs;
+    };
+
+    const char* foundName(int found) {
+	return (found == Found::Red) ? "red"
+	    : ((found == Found::Yellow) ? "yellow"
+	       : ((found == Found::None) ? "none" : "unknown"));
+    }
+
+    /** Fixed size text field as a string (may not be terminated). */
+    string text(const char* field, size_t size) {
+	return string(field, strnlen(field, size));
+    }
+
+    /** Wall clock time of a record ("YYYY-MM-DD HH:MM:SS.uuuuuu"). */
+    string wallTime(const EventLogHeader& header, int64_t nanos) {
+	int64_t real = header.realtimeNanos + (nanos - header.monotonicNanos);
+	time_t secs = real / 1000000000LL;
+	tm local;
+	localtime_r(&secs, &local);
+	char buf[32];
+	strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &local);
+
+	ostringstream out;
+	out << buf << "." << setw(6) << setfill('0') << ((real % 1000000000LL) / 1000);
+	return out.str();
+    }
+
+    void printText(const EventLogHeader& header, const EventRecord& record) {
+	cout << wallTime(header, record.nanos) << " [" << record.tid << "] ";
+	if (record.frame != 0) {
+	    cout << "frame " << record.frame << " ";
+	}
+
+	switch (record.type) {
+
+	case FrameEvent: {
+	    const auto& r = record.result;
+	    cout << "found " << foundName(r.found);
+	    if (r.found != Found::None) {
+		cout << " " << r.boxWidth << "x" << r.boxHeight
+		     << " x-mid " << r.xMid << " y-bot " << r.yBot;
+		if (r.rangeFeet >= 0) {
+		    cout << " range " << r.rangeFeet << " ft bearing "
+			 << r.bearingDegrees << " deg";
+		}
+	    }
+	    cout << " (" << r.candidates << " candidates) seq " << r.cameraSeq
+		 << " dropped " << r.droppedFrames << " latency "
+		 << r.latencyMicros << " us\n";
+	    break;
+	}
+
+	case TimingEvent:
+	    cout << text(record.timing.stage, sizeof(record.timing.stage)) << " took "
+		 << (record.timing.nanos / 1000.0) << " us\n";
+	    break;
+
+	case StateEvent:
+	    cout << "now " << foundName(record.state.to) << " (was "
+		 << ((record.state.from < 0) ? "starting" : foundName(record.state.from))
+		 << ") at " << record.state.fps << " FPS\n";
+	    break;
+
+	case ErrorEvent:
+	    cout << "ERROR " << text(record.message, sizeof(record.message)) << "\n";
+	    break;
+
+	case DroppedEvent:
+	    cout << record.dropped.count << " records dropped (queue full)\n";
+	    break;
+
+	default:
+	    cout << "unknown record type " << record.type << "\n";
+	}
+    }
+
+    const char* CSV_HEADER =
+	"time,nanos,tid,frame,type,found,box_width,box_height,x_mid,y_bot,"
+	"range_feet,bearing_degrees,camera_seq,dropped_frames,latency_us,"
+	"candidates,stage,stage_nanos,from,to,fps,message,dropped_records\n";
+
+    /** CSV field (quoted if needed). */
+    string csvText(const string& s) {
+	if (s.find_first_of(",\"\n") == string::npos) {
+	    return s;
+	}
+	string quoted = "\"";
+	for (char c : s) {
+	    quoted += c;
+	    if (c == '"') {
+		quoted += c;
+	    }
+	}
+	return quoted + "\"";
+    }
+
+    void printCsv(const EventLogHeader& header, const EventRecord& record) {
+	cout << wallTime(header, record.nanos) << "," << record.nanos << ","
+	     << record.tid << "," << record.frame << ",";
+
+	switch (record.type) {
+
+	case FrameEvent: {
+	    const auto& r = record.result;
+	    cout << "frame," << foundName(r.found) << "," << r.boxWidth << ","
+		 << r.boxHeight << "," << r.xMid << "," << r.yBot << ","
+		 << r.rangeFeet << "," << r.bearingDegrees << "," << r.cameraSeq << ","
+		 << r.droppedFrames << "," << r.latencyMicros << "," << r.candidates
+		 << ",,,,,,,\n";
+	    break;
+	}
+
+	case TimingEvent:
+	    cout << "timing,,,,,,,,,,,,"
+		 << csvText(text(record.timing.stage, sizeof(record.timing.stage))) << ","
+		 << record.timing.nanos << ",,,,,\n";
+	    break;
+
+	case StateEvent:
+	    cout << "state,,,,,,,,,,,,,,"
+		 << ((record.state.from < 0) ? "" : foundName(record.state.from)) << ","
+		 << foundName(record.state.to) << "," << record.state.fps << ",,\n";
+	    break;
+
+	case ErrorEvent:
+	    cout << "error,,,,,,,,,,,,,,,,,"
+		 << csvText(text(record.message, sizeof(record.message))) << ",\n";
+	    break;
+
+	case DroppedEvent:
+	    cout << "dropped,,,,,,,,,,,,,,,,,," << record.dropped.count << "\n";
+	    break;
+
+	default:
+	    cout << "unknown,,,,,,,,,,,,,,,,,,\n";
+	}
+    }
+
+    /**
+     * Print every record in a log file.
+     *
+     * @return false if the file couldn't be read.
+     */
+    bool printFile(const string& fileName, bool csv) {
+	ifstream in(fileName.c_str(), ios::binary);
+	EventLogHeader header;
+	if (!in.read((char*) &header, sizeof(header))
+	    || (header.magic != EVENT_LOG_MAGIC) || (header.version != EVENT_LOG_VERSION)) {
+	    cerr << fileName << ": not an event log (or written by another version)\n";
+	    return false;
+	}
+	if ((header.headerSize != sizeof(header)) || (header.recordSize != sizeof(EventRecord))) {
+	    cerr << fileName << ": unexpected header or record size\n";
+	    return false;
+	}
+
+	vector<EventRecord> records;
+	EventRecord record;
+	while (in.read((char*) &record, sizeof(record))) {
+	    records.push_back(record);
+	}
+	if (in.gcount() != 0) {
+	    cerr << fileName << ": ignoring partial record at end\n";
+	}
+
+	stable_sort(records.begin(), records.end(),
+		    [](const EventRecord& a, const EventRecord& b) { return a.nanos < b.nanos; });
+	for (const EventRecord& r : records) {
+	    if (csv) {
+		printCsv(header, r);
+	    } else {
+		printText(header, r);
+	    }
+	}
+	return true;
+    }
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+int main(int argc, char* argv[]) {
+    Options opts(argc, argv);
+    if (!opts.ok) {
+	return 1;
+    }
+
+    if (opts.csv) {
+	cout << CSV_HEADER;
+    }
+
+    int failed = 0;
+    for (const string& input : opts.inputs) {
+	failed += !printFile(input, opts.csv);
+    }
+    return (failed == 0) ? 0 : 1;
+}
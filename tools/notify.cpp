@@ -0,0 +1,184 @@
+/**
+ * Smallest consumer of the result notification segment: waits for
+ * avc-vision to publish results (see ResultWaiter) and prints the frame
+ * count of each.
+ *
+ * With -t it instead checks the notifier and waiter against each other
+ * on a segment of its own (make check runs this): new results wake a
+ * blocked waiter, waits time out when nothing is published and the
+ * segment can be attached by consumers running as other users.
+ */
+
+#include "resultnotify.hpp"
+#include "latency.hpp"
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace vision;
+using namespace std;
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+namespace {
+
+    /**
+     * Command line options.
+     */
+    class Options {
+    public:
+	Options(int argc, char** argv) :
+	    ok(true),
+	    test(false),
+	    timeoutMs(1000),
+	    name(RESULT_NOTIFY_NAME)
+	{
+	    int opt;
+	    while ((opt = getopt(argc, argv, "hn:tw:")) != -1) {
+		switch (opt) {
+
+		case 'n':
+		    name = optarg;
+		    break;
+
+		case 't':
+		    test = true;
+		    break;
+
+		case 'w':
+		    timeoutMs = atoi(optarg);
+		    ok = ok && (timeoutMs > 0);
+		    break;
+
+		case 'h':
+		default:
+		    ok = false;
+		}
+	    }
+
+	    if (!ok) {
+		cerr << "\n"
+"Usage:\n"
+"\n"
+"  avc-vision-notify [-t] [-n NAME] [-w TIMEOUT_MS]\n"
+"\n"
+"Where:\n"
+"\n"
+"  -t\n"
+"    Check notify and wait against each other on a private segment\n"
+"    and exit (non-zero status if anything is wrong).\n"
+"\n"
+"  -n NAME\n"
+"    Shared memory name to wait on (default " << RESULT_NOTIFY_NAME << ").\n"
+"\n"
+"  -w TIMEOUT_MS\n"
+"    Report when nothing is published for this long (default 1000).\n"
+"\n";
+	    }
+	}
+
+	bool ok;
+	bool test;
+	int timeoutMs;
+	string name;
+    };
+
+    /** Print what failed and count it. */
+    void expect(bool ok, const char* what, int& failures) {
+	if (!ok) {
+	    cout << "FAIL notify: " << what << "\n";
+	    failures++;
+	}
+    }
+
+    /**
+     * Publishes and waits on a segment only this process knows about.
+     *
+     * @return Number of checks that failed.
+     */
+    int selfTest() {
+	ostringstream name;
+	name << RESULT_NOTIFY_NAME << "-check-" << getpid();
+	int failures = 0;
+
+	{
+	    ResultNotifier notifier;
+	    ResultWaiter waiter;
+	    expect(notifier.open(name.str()), "publisher can't create the segment", failures);
+	    expect(waiter.open(name.str()), "consumer can't attach", failures);
+
+	    int fd = shm_open(name.str().c_str(), O_RDONLY, 0);
+	    struct stat info;
+	    expect((fd >= 0) && (fstat(fd, &info) == 0) && ((info.st_mode & 0777) == 0666),
+		   "segment can't be attached by other users (mode isn't 0666)", failures);
+	    if (fd >= 0) {
+		close(fd);
+	    }
+
+	    if (failures == 0) {
+		expect(!waiter.wait(0), "nothing published yet but wait() returned true", failures);
+
+		notifier.notify(1);
+		expect(waiter.wait(0) && (waiter.getFrameCount() == 1),
+		       "results published before waiting were missed", failures);
+
+		int64_t start = monotonicNanos();
+		expect(!waiter.wait(20), "wait() didn't time out", failures);
+		expect(monotonicNanos() - start >= 20000000, "wait() timed out early", failures);
+
+		// Publish while the waiter is blocked in the kernel
+		thread publisher([&notifier]() {
+		    usleep(50000);
+		    notifier.notify(2);
+		});
+		bool woken = waiter.wait(5000);
+		publisher.join();
+		expect(woken && (waiter.getFrameCount() == 2), "blocked waiter wasn't woken", failures);
+	    }
+	}
+
+	shm_unlink(name.str().c_str());
+	if (failures == 0) {
+	    cout << "PASS notify (publish and wait on " << name.str() << ")\n";
+	}
+	return failures;
+    }
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+int main(int argc, char* argv[]) {
+    Options opts(argc, argv);
+    if (!opts.ok) {
+	return 1;
+    }
+
+    if (opts.test) {
+	return (selfTest() == 0) ? 0 : 1;
+    }
+
+    ResultWaiter waiter;
+    if (!waiter.open(opts.name)) {
+	cerr << "Unable to attach to " << opts.name << " (is avc-vision running?)\n";
+	return 1;
+    }
+
+    for (;;) {
+	if (waiter.wait(opts.timeoutMs)) {
+	    cout << "Results for frame " << waiter.getFrameCount() << "\n";
+	} else {
+	    cout << "Nothing published for " << opts.timeoutMs << " ms\n";
+	}
+	cout.flush();
+    }
+}
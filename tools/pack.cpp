@@ -0,0 +1,165 @@
+/**
+ * Packs a set of images into a single dataset pack file.
+ *
+ * Every image is decoded once and stored as raw, aligned BGR pixels
+ * along with an index of where it came from, a label (the directory it
+ * was found in relative to the input, like "red/north") and the result
+ * the filter is expected to report. The pack can then be run through
+ * the filter any number of times (avc-vision -D PACK) without decoding
+ * PNG files again.
+ *
+ * The expected result comes from a "red" or "yellow" directory in the
+ * image's path, or with -e from what the filter currently finds (for
+ * regression runs against today's behavior).
+ */
+
+#include "datasetpack.hpp"
+#include "filter.hpp"
+#include "imagefiles.hpp"
+
+#include <iostream>
+
+#include <unistd.h>
+
+using namespace cv;
+using namespace vision;
+using namespace std;
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+namespace {
+
+    /**
+     * Command line options.
+     */
+    class Options {
+    public:
+	Options(int argc, char** argv) :
+	    ok(true),
+	    snapshot(false),
+	    configFile("values.txt"),
+	    outputFile(""),
+	    inputs()
+	{
+	    int opt;
+	    while ((opt = getopt(argc, argv, "c:eho:")) != -1) {
+		switch (opt) {
+
+		case 'c':
+		    configFile = optarg;
+		    break;
+
+		case 'e':
+		    snapshot = true;
+		    break;
+
+		case 'o':
+		    outputFile = optarg;
+		    break;
+
+		case 'h':
+		default:
+		    ok = false;
+		}
+	    }
+
+	    for (int i = optind; i < argc; i++) {
+		inputs.push_back(argv[i]);
+	    }
+
+	    if (!ok || inputs.empty() || outputFile.empty()) {
+		ok = false;
+		cerr << "\n"
+"Usage:\n"
+"\n"
+"  avc-vision-pack [-e] [-c VALUES_FILE] -o PACK_FILE IMAGE_OR_DIR...\n"
+"\n"
+"Where:\n"
+"\n"
+"  -o PACK_FILE\n"
+"    Pack file to create.\n"
+"\n"
+"  -e\n"
+"    Record what the filter finds in each image now as its expected\n"
+"    result (default is to go by a \"red\" or \"yellow\" directory in\n"
+"    the image's path).\n"
+"\n"
+"  -c VALUES_FILE\n"
+"    Color ranges to use with -e (default values.txt).\n"
+"\n";
+	    }
+	}
+
+	bool ok;
+	bool snapshot;
+	string configFile;
+	string outputFile;
+	vector<string> inputs;
+    };
+
+    /** Directory of file relative to the input it was found under. */
+    string labelFor(const string& input, const string& file) {
+	size_t slash = file.rfind('/');
+	string dir = (slash == string::npos) ? "" : file.substr(0, slash);
+	if ((dir.size() > input.size()) && (dir.compare(0, input.size(), input) == 0)) {
+	    dir.erase(0, input.size());
+	}
+	while (!dir.empty() && (dir[0] == '/')) {
+	    dir.erase(0, 1);
+	}
+	return dir;
+    }
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+int main(int argc, char* argv[]) {
+    Options opts(argc, argv);
+    if (!opts.ok) {
+	return 1;
+    }
+
+    Filter filter;
+    if (opts.snapshot && !filter.loadConfig(opts.configFile)) {
+	cerr << "Unable to read color ranges from " << opts.configFile << "\n";
+	return 1;
+    }
+
+    PackWriter pack;
+    if (!pack.open(opts.outputFile)) {
+	return 1;
+    }
+
+    int failed = 0;
+    for (const string& input : opts.inputs) {
+	vector<string> files;
+	if (!findImages(input, files)) {
+	    cerr << "Unable to read: " << input << "\n";
+	    failed++;
+	    continue;
+	}
+
+	for (const string& file : files) {
+	    Mat image = imread(file);
+	    if (image.empty()) {
+		cerr << "Unable to load image: " << file << "\n";
+		failed++;
+		continue;
+	    }
+
+	    int32_t expected = opts.snapshot ? filter.filter(image) : expectedFromPath(file);
+	    if (!pack.add(image, file, labelFor(input, file), expected)) {
+		return 1;
+	    }
+	}
+    }
+
+    size_t count = pack.size();
+    if (!pack.close()) {
+	return 1;
+    }
+    cout << "Packed " << count << " images into " << opts.outputFile << "\n";
+    return (failed == 0) ? 0 : 1;
+}
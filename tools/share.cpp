@@ -0,0 +1,159 @@
+/**
+ * Shares frames from any frame source with other processes.
+ *
+ * Reads frames (from the camera by default) and publishes each one into
+ * a shared memory frame ring, so avc-vision (-s shm:NAME) can run on the
+ * frames of a camera another program already owns. Frames the reader
+ * is too slow to take are dropped, like a camera does.
+ */
+
+#include "filter.hpp"
+#include "framering.hpp"
+#include "framesource.hpp"
+#include "Timer.h"
+
+#include <iostream>
+
+#include <signal.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+using namespace cv;
+using namespace vision;
+using namespace std;
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+namespace {
+
+    volatile sig_atomic_t isInterrupted = 0;
+
+    void interrupted(int) {
+	isInterrupted = 1;
+    }
+
+    /**
+     * Command line options.
+     */
+    class Options {
+    public:
+	Options(int argc, char** argv) :
+	    ok(true),
+	    verbose(false),
+	    slots(FRAME_RING_SLOTS),
+	    ringName(FRAME_RING_NAME),
+	    source("camera")
+	{
+	    int opt;
+	    while ((opt = getopt(argc, argv, "hk:n:v")) != -1) {
+		switch (opt) {
+
+		case 'k':
+		    slots = atoi(optarg);
+		    ok = ok && (slots >= 2);
+		    break;
+
+		case 'n':
+		    ringName = optarg;
+		    break;
+
+		case 'v':
+		    verbose = true;
+		    break;
+
+		case 'h':
+		default:
+		    ok = false;
+		}
+	    }
+
+	    if (optind < argc) {
+		source = argv[optind];
+	    }
+
+	    if (!ok || (optind + 1 < argc)) {
+		ok = false;
+		cerr << "\n"
+"Usage:\n"
+"\n"
+"  avc-vision-share [-v] [-n NAME] [-k SLOTS] [SOURCE]\n"
+"\n"
+"Where:\n"
+"\n"
+"  SOURCE\n"
+"    Where to read frames from (default \"camera\", see -s in\n"
+"    avc-vision -h).\n"
+"\n"
+"  -n NAME\n"
+"    Shared memory name of the frame ring (default /avc-frames).\n"
+"\n"
+"  -k SLOTS\n"
+"    Number of frames the ring holds (default 8, the reader can hold\n"
+"    all but one of them at once).\n"
+"\n"
+"  -v\n"
+"    Report how many frames were shared each second.\n"
+"\n";
+	    }
+	}
+
+	bool ok;
+	bool verbose;
+	int slots;
+	string ringName;
+	string source;
+    };
+}
+
+// ---------------------------------------------------------------------
+// ---------------------------------------------------------------------
+
+int main(int argc, char* argv[]) {
+    Options opts(argc, argv);
+    if (!opts.ok) {
+	return 1;
+    }
+
+    signal(SIGINT, interrupted);
+    signal(SIGTERM, interrupted);
+
+    Filter filter;
+    unique_ptr<FrameSource> source = openFrameSource(opts.source, &filter, 1);
+    if (!source) {
+	return 1;
+    }
+
+    FrameRingWriter ring;
+    Frame frame;
+    uint64_t shared = 0;
+    uint64_t dropped = 0;
+    avc::Timer timer;
+
+    while (!isInterrupted && source->acquire(frame)) {
+	if ((shared + dropped) == 0) {
+	    // Ring is sized for the frames the source delivers
+	    if (!ring.open(frame.image.size(), frame.image.type(), opts.slots, opts.ringName)) {
+		return 1;
+	    }
+	    cout << "Sharing " << frame.image.cols << "x" << frame.image.rows
+		 << " frames from " << opts.source << " as " << opts.ringName << "\n";
+	}
+
+	if (ring.publish(frame.image, frame.stamp)) {
+	    shared++;
+	} else {
+	    dropped++;
+	}
+	source->release(frame);
+
+	if (opts.verbose && (timer.secsElapsed() >= 1)) {
+	    cout << shared << " frames shared, " << dropped << " dropped\n";
+	    timer.start();
+	}
+    }
+
+    ring.close();
+    cout << shared << " frames shared, " << dropped << " dropped\n";
+    return 0;
+}